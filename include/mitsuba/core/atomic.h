@@ -117,15 +117,18 @@ inline float atomicAdd(volatile float *dst, float delta) {
 	/* Atomic FP addition from PBRT */
 	union bits { float f; int32_t i; };
 	bits oldVal, newVal;
-	do {
+	while (true) {
+		oldVal.f = *dst;
+		newVal.f = oldVal.f + delta;
+		if (atomicCompareAndExchange((volatile int32_t *) dst, newVal.i, oldVal.i))
+			break;
         // On IA32/x64, adding a PAUSE instruction in compare/exchange loops
-        // is recommended to improve performance.  (And it does!)
+        // is recommended to improve performance.  (And it does!) It is only
+        // needed when the exchange failed due to contention, though.
 #if (defined(__i386__) || defined(__amd64__))
         __asm__ __volatile__ ("pause\n");
 #endif
-		oldVal.f = *dst;
-		newVal.f = oldVal.f + delta;
-	} while (!atomicCompareAndExchange((volatile int32_t *) dst, newVal.i, oldVal.i));
+	}
 	return newVal.f;
 }
 
@@ -138,15 +141,18 @@ inline double atomicAdd(volatile double *dst, double delta) {
 	/* Atomic FP addition from PBRT */
 	union bits { double f; int64_t i; };
 	bits oldVal, newVal;
-	do {
-        // On IA64/x64, adding a PAUSE instruction in compare/exchange loops
-        // is recommended to improve performance.  (And it does!)
+	while (true) {
+		oldVal.f = *dst;
+		newVal.f = oldVal.f + delta;
+		if (atomicCompareAndExchange((volatile int64_t *) dst, newVal.i, oldVal.i))
+			break;
+        // On IA32/x64, adding a PAUSE instruction in compare/exchange loops
+        // is recommended to improve performance.  (And it does!) It is only
+        // needed when the exchange failed due to contention, though.
 #if (defined(__i386__) || defined(__amd64__))
         __asm__ __volatile__ ("pause\n");
 #endif
-		oldVal.f = *dst;
-		newVal.f = oldVal.f + delta;
-	} while (!atomicCompareAndExchange((volatile int64_t *) dst, newVal.i, oldVal.i));
+	}
 	return newVal.f;
 }
 
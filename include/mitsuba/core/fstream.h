@@ -118,6 +118,42 @@ protected:
 	fs::path m_path;
 };
 
+/** \brief File stream, which atomically replaces a file once it 
+ * has been written completely.
+ *
+ * The data is written to a temporary file next to the target, whose
+ * name contains the host name and process ID. \ref commit() moves it
+ * into place using \ref replaceFile(), hence concurrent processes (even
+ * on other machines sharing the directory) never observe a partially
+ * written file. When the stream is destroyed without being committed 
+ * (e.g. because an exception was thrown while writing), the temporary
+ * file is removed.
+ *
+ * \ingroup libcore
+ */
+class MTS_EXPORT_CORE AtomicFileStream : public FileStream {
+public:
+	/// Create a temporary file, which will replace \c path
+	explicit AtomicFileStream(const fs::path &path, EFileMode mode = ETruncWrite);
+
+	/// Return the path of the file that is replaced
+	inline const fs::path &getTargetPath() const { return m_targetPath; }
+
+	/// Close the temporary file and move it into place
+	void commit();
+
+	/// Return a string representation
+	std::string toString() const;
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Virtual destructor (removes the temporary file if necessary)
+	virtual ~AtomicFileStream();
+protected:
+	fs::path m_targetPath;
+	bool m_committed;
+};
+
 MTS_NAMESPACE_END
 
 #endif /* __FSTREAM_H */
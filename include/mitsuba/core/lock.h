@@ -39,6 +39,15 @@ public:
 		pthread_mutex_lock(&m_mutex);
 	}
 
+	/**
+	 * \brief Try to lock the mutex without blocking
+	 *
+	 * \return \c true if the lock was acquired
+	 */
+	inline bool tryLock() {
+		return pthread_mutex_trylock(&m_mutex) == 0;
+	}
+
 	/// Unlock the mutex
 	inline void unlock() {
 		pthread_mutex_unlock(&m_mutex);
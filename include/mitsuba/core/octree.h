@@ -57,11 +57,46 @@ public:
 		return m_head;
 	}
 
-	void append(const T &value) {
+	/**
+	 * \brief Append an item to the end of the list
+	 *
+	 * The list is traversed using ordinary loads, and only the
+	 * final link is set using an atomic operation.
+	 *
+	 * \return The number of atomic operations, which failed due
+	 *         to concurrent insertions (i.e. a measure of contention)
+	 */
+	int append(const T &value) {
 		ListItem *item = new ListItem(value);
 		ListItem **cur = &m_head;
-		while (!atomicCompareAndExchangePtr<ListItem>(cur, item, NULL))
-			cur = &((*cur)->next);
+		int retries = 0;
+		while (true) {
+			while (*cur)
+				cur = &((*cur)->next);
+			if (atomicCompareAndExchangePtr<ListItem>(cur, item, NULL))
+				return retries;
+			++retries;
+		}
+	}
+
+	/**
+	 * \brief Insert an item at the beginning of the list
+	 *
+	 * In contrast to \ref append(), this takes constant time.
+	 *
+	 * \return The number of atomic operations, which failed due
+	 *         to concurrent insertions (i.e. a measure of contention)
+	 */
+	int push(const T &value) {
+		ListItem *item = new ListItem(value);
+		int retries = 0;
+		while (true) {
+			ListItem *head = m_head;
+			item->next = head;
+			if (atomicCompareAndExchangePtr<ListItem>(&m_head, item, head))
+				return retries;
+			++retries;
+		}
 	}
 private:
 	ListItem *m_head;
@@ -87,9 +122,16 @@ public:
 	 : m_aabb(aabb), m_maxDepth(maxDepth) {
 	}
 
-	/// Insert an item with the specified cell coverage
-	inline void insert(const T &value, const AABB &coverage) {
-		insert(&m_root, m_aabb, value, coverage,
+	/**
+	 * \brief Insert an item with the specified cell coverage
+	 *
+	 * This function can safely be called from multiple threads.
+	 *
+	 * \return The number of atomic operations, which failed due
+	 *         to concurrent insertions (i.e. a measure of contention)
+	 */
+	inline int insert(const T &value, const AABB &coverage) {
+		return insert(&m_root, m_aabb, value, coverage,
 			coverage.getExtents().lengthSquared(), 0);
 	}
 
@@ -100,6 +142,29 @@ public:
 		lookup(&m_root, m_aabb, p, functor);
 	}
 
+	/**
+	 * \brief Batched version of \ref lookup()
+	 *
+	 * Traverses the octree once for a whole set of points. The records
+	 * of every node are visited once and passed to all points below the
+	 * node, which improves the memory locality compared to separate
+	 * lookups. For every record, which potentially overlaps the point 
+	 * with index \c i, <tt>functor(i, record)</tt> is executed.
+	 *
+	 * \param indices
+	 *    Scratch space for \c count indices
+	 */
+	template <typename Functor> inline void lookup(const Point *points, size_t count,
+			uint32_t *indices, Functor &functor) const {
+		size_t inside = 0;
+		for (size_t i=0; i<count; ++i) {
+			if (m_aabb.contains(points[i]))
+				indices[inside++] = (uint32_t) i;
+		}
+		if (inside > 0)
+			lookup(&m_root, m_aabb, points, indices, indices + inside, functor);
+	}
+
 	/// Execute operator() of <tt>functor</tt> on all records, which potentially overlap <tt>bsphere</tt>
 	template <typename Functor> inline void searchSphere(const BSphere &sphere, Functor &functor) {
 		if (!m_aabb.overlaps(sphere))
@@ -140,16 +205,28 @@ private:
 	}
 
 
-	void insert(OctreeNode *node, const AABB &nodeAABB, const T &value, 
+	/// Selects the points, which do not lie above a split plane
+	struct BelowPredicate {
+		inline BelowPredicate(const Point *points, int axis, Float value)
+			: points(points), axis(axis), value(value) { }
+
+		inline bool operator()(uint32_t index) const {
+			return points[index][axis] <= value;
+		}
+
+		const Point *points;
+		int axis;
+		Float value;
+	};
+
+	int insert(OctreeNode *node, const AABB &nodeAABB, const T &value, 
 			const AABB &coverage, Float diag2, int depth) {
 		/* Add the data item to the current octree node if the max. tree
 		   depth is reached or the data item's coverage area is smaller
 		   than the current node size */
 		if (depth == m_maxDepth || 
-			(nodeAABB.getExtents().lengthSquared() < diag2)) {
-			node->data.append(value);
-			return;
-		}
+			(nodeAABB.getExtents().lengthSquared() < diag2))
+			return node->data.append(value);
 
 		/* Otherwise: test for overlap */
 		const Point center = nodeAABB.getCenter();
@@ -164,18 +241,22 @@ private:
 						 x[1] & y[1] & z[0], x[1] & y[1] & z[1] };
 
 		/* Recurse */
+		int retries = 0;
 		for (int child=0; child<8; ++child) {
 			if (!over[child])
 				continue;
 			if (!node->children[child]) {
 				OctreeNode *newNode = new OctreeNode();
-				if (!atomicCompareAndExchangePtr<OctreeNode>(&node->children[child], newNode, NULL))
+				if (!atomicCompareAndExchangePtr<OctreeNode>(&node->children[child], newNode, NULL)) {
 					delete newNode;
+					++retries;
+				}
 			}
 			const AABB childAABB(childBounds(child, nodeAABB, center));
-			insert(node->children[child], childAABB,
+			retries += insert(node->children[child], childAABB,
 				value, coverage, diag2, depth+1);
 		}
+		return retries;
 	}
 
 	/// Internal lookup procedure - const version
@@ -201,6 +282,41 @@ private:
 		}
 	}
 
+	/// Internal batched lookup procedure
+	template <typename Functor> void lookup(const OctreeNode *node, 
+			const AABB &nodeAABB, const Point *points, uint32_t *start, 
+			uint32_t *end, Functor &functor) const {
+		const Point center = nodeAABB.getCenter();
+
+		const typename LockFreeList<T>::ListItem *item = node->data.head();
+		while (item) {
+			for (uint32_t *index = start; index != end; ++index)
+				functor(*index, item->value);
+			item = item->next;
+		}
+
+		/* Sort the points by child index (i.e. by the x, y and z bits) */
+		uint32_t *ranges[9];
+		ranges[0] = start; ranges[8] = end;
+		ranges[4] = std::partition(ranges[0], ranges[8], 
+			BelowPredicate(points, 0, center.x));
+		for (int i=0; i<8; i += 4)
+			ranges[i+2] = std::partition(ranges[i], ranges[i+4], 
+				BelowPredicate(points, 1, center.y));
+		for (int i=0; i<8; i += 2)
+			ranges[i+1] = std::partition(ranges[i], ranges[i+2], 
+				BelowPredicate(points, 2, center.z));
+
+		for (int child=0; child<8; ++child) {
+			const OctreeNode *childNode = node->children[child];
+			if (childNode && ranges[child] != ranges[child+1]) {
+				const AABB childAABB(childBounds(child, nodeAABB, center));
+				lookup(childNode, childAABB, points, ranges[child],
+					ranges[child+1], functor);
+			}
+		}
+	}
+
 	template <typename Functor> inline void searchSphere(OctreeNode *node, 
 			const AABB &nodeAABB, const BSphere &sphere, 
 			Functor &functor) {
@@ -168,6 +168,276 @@ private:
 	bool m_ready;
 };
 
+/**
+ * \brief Stores a discrete probability distribution over the pixels
+ * of a two-dimensional image and warps samples hierarchically
+ *
+ * The distribution is represented by a pyramid of partial sums, which
+ * is traversed from the top when sampling. On each level, one of the
+ * (up to four) children is chosen using one decision along each 
+ * axis, and the two sample dimensions are rescaled so that they can 
+ * be reused. Compared to a \ref DiscretePDF over all pixels, this 
+ * keeps neighboring texels close in memory, uses both dimensions of 
+ * the sample evenly, and evaluates the PDF of a pixel in constant time.
+ *
+ * Below a certain tile size, the pyramid is only stored for tiles that
+ * are worth it: tiles with a constant weight (e.g. black regions) and 
+ * optionally tiles, whose average weight is below a given fraction
+ * of the global average are pruned. The pixels of such a tile are
+ * sampled uniformly, which keeps the distribution unbiased (every 
+ * pixel with a nonzero weight retains a nonzero probability).
+ *
+ * The resolution must be a power of two along each axis.
+ * 
+ * \ingroup libcore
+ */
+class HierarchicalPDF2D {
+public:
+	/// Create an empty distribution
+	inline HierarchicalPDF2D() : m_width(0), m_height(0) { }
+
+	/**
+	 * \brief Build the hierarchy from an array of non-negative weights
+	 *
+	 * \param weights
+	 *    Weights of the pixels in scanline order
+	 * \param pruneThreshold
+	 *    Tiles, whose average weight is less than this fraction of the
+	 *    global average are sampled uniformly. Set to zero to only
+	 *    prune tiles with a constant weight.
+	 * \param tileSize
+	 *    Resolution of the tiles, which are considered for pruning
+	 * \return Sum of all unnormalized weights
+	 */
+	Float build(const Float *weights, int width, int height,
+			Float pruneThreshold = 0, int tileSize = 16) {
+		SAssert(isPow2(width) && isPow2(height));
+		m_width = width; m_height = height;
+		m_tileSize = std::min(tileSize, std::min(width, height));
+		m_tileLevels = log2i((uint32_t) m_tileSize);
+		m_tilesX = width / m_tileSize; m_tilesY = height / m_tileSize;
+
+		double sum = 0;
+		for (int i=0; i<width*height; ++i)
+			sum += weights[i];
+		m_originalSum = (Float) sum;
+		Float normalization = sum > 0 ? (Float) (1.0 / sum) : 0;
+		bool uniform = !(sum > 0);
+		if (uniform)
+			SLog(EWarn, "HierarchicalPDF2D: the weights are zero "
+				"everywhere -- using a uniform distribution instead.");
+
+		/* Per-level offsets of the pyramid stored for each unpruned tile */
+		m_levelOffset.resize(m_tileLevels + 1);
+		m_levelOffset[0] = 0;
+		for (int l=0; l<m_tileLevels; ++l)
+			m_levelOffset[l+1] = m_levelOffset[l] + (m_tileSize >> l) * (m_tileSize >> l);
+		const uint32_t fineSize = m_levelOffset[m_tileLevels];
+
+		/* Normalized tile sums, which form the lowest coarse level */
+		m_coarse.clear(); m_coarseWidth.clear(); m_coarseHeight.clear();
+		m_coarse.push_back(std::vector<Float>(m_tilesX * m_tilesY));
+		m_coarseWidth.push_back(m_tilesX);
+		m_coarseHeight.push_back(m_tilesY);
+		m_tileOffset.resize(m_tilesX * m_tilesY);
+		m_fine.clear();
+
+		Float meanTileWeight = 1.0f / (m_tilesX * m_tilesY);
+		const Float pixelWeight = 1.0f / (width * height);
+		for (int ty=0; ty<m_tilesY; ++ty) {
+			for (int tx=0; tx<m_tilesX; ++tx) {
+				int tile = tx + ty * m_tilesX;
+				Float tileSum = 0, minWeight = std::numeric_limits<Float>::infinity(), maxWeight = 0;
+				for (int y=0; y<m_tileSize; ++y) {
+					for (int x=0; x<m_tileSize; ++x) {
+						Float weight = uniform ? pixelWeight : normalization
+							* weights[tx*m_tileSize + x + (ty*m_tileSize + y) * width];
+						tileSum += weight;
+						minWeight = std::min(minWeight, weight);
+						maxWeight = std::max(maxWeight, weight);
+					}
+				}
+				m_coarse[0][tile] = tileSum;
+
+				if (m_tileLevels == 0 || minWeight == maxWeight
+						|| tileSum < pruneThreshold * meanTileWeight) {
+					m_tileOffset[tile] = EPruned;
+					continue;
+				}
+
+				/* Store the pyramid of the tile (without its root) */
+				uint32_t offset = (uint32_t) m_fine.size();
+				m_tileOffset[tile] = offset;
+				m_fine.resize(offset + fineSize);
+				Float *fine = &m_fine[offset];
+				for (int y=0; y<m_tileSize; ++y)
+					for (int x=0; x<m_tileSize; ++x)
+						fine[x + y * m_tileSize] = normalization
+							* weights[tx*m_tileSize + x + (ty*m_tileSize + y) * width];
+				for (int l=1; l<m_tileLevels; ++l) {
+					int res = m_tileSize >> l;
+					const Float *src = fine + m_levelOffset[l-1];
+					Float *dest = fine + m_levelOffset[l];
+					for (int y=0; y<res; ++y)
+						for (int x=0; x<res; ++x)
+							dest[x + y*res] = src[2*x + 4*y*res] + src[2*x+1 + 4*y*res]
+								+ src[2*x + (2*y+1)*2*res] + src[2*x+1 + (2*y+1)*2*res];
+				}
+			}
+		}
+
+		/* Build the coarse levels up to a single entry */
+		while (m_coarseWidth.back() > 1 || m_coarseHeight.back() > 1) {
+			const std::vector<Float> &src = m_coarse.back();
+			int srcWidth = m_coarseWidth.back(), srcHeight = m_coarseHeight.back();
+			int width = std::max(1, srcWidth / 2), height = std::max(1, srcHeight / 2);
+			std::vector<Float> dest(width * height, (Float) 0);
+			for (int y=0; y<srcHeight; ++y)
+				for (int x=0; x<srcWidth; ++x)
+					dest[x * width / srcWidth + (y * height / srcHeight) * width] 
+						+= src[x + y * srcWidth];
+			m_coarse.push_back(dest);
+			m_coarseWidth.push_back(width);
+			m_coarseHeight.push_back(height);
+		}
+
+		return m_originalSum;
+	}
+
+	/**
+	 * \brief %Transform a uniformly distributed 2D sample
+	 * \param[in] sampleValue Uniform sample
+	 * \param[out] prob Probability of the chosen pixel
+	 * \return Continuous position in <tt>[0, width] x [0, height]</tt>,
+	 *    which is uniformly distributed within the chosen pixel
+	 */
+	inline Point2 sample(Point2 sampleValue, Float &prob) const {
+		int x = 0, y = 0;
+		for (int l=(int) m_coarse.size()-1; l>0; --l)
+			descend(&m_coarse[l-1][0], m_coarseWidth[l-1], m_coarseHeight[l-1],
+				m_coarseWidth[l], m_coarseHeight[l], x, y, sampleValue);
+
+		int tileX = x, tileY = y, tile = x + y * m_tilesX;
+		uint32_t offset = m_tileOffset[tile];
+		if (offset == EPruned) {
+			prob = m_coarse[0][tile] / (m_tileSize * m_tileSize);
+			return clamp(Point2((tileX + sampleValue.x) * m_tileSize,
+				(tileY + sampleValue.y) * m_tileSize));
+		}
+
+		const Float *fine = &m_fine[offset];
+		x = y = 0;
+		for (int l=m_tileLevels; l>0; --l) {
+			int res = m_tileSize >> (l-1);
+			descend(fine + m_levelOffset[l-1], res, res, res/2, res/2, x, y, sampleValue);
+		}
+		prob = fine[x + y * m_tileSize];
+		return clamp(Point2(tileX * m_tileSize + x + sampleValue.x,
+			tileY * m_tileSize + y + sampleValue.y));
+	}
+
+	/// Return the probability of the pixel at the given position
+	inline Float pdf(int x, int y) const {
+		int tile = x / m_tileSize + (y / m_tileSize) * m_tilesX;
+		uint32_t offset = m_tileOffset[tile];
+		if (offset == EPruned)
+			return m_coarse[0][tile] / (m_tileSize * m_tileSize);
+		return m_fine[offset + x % m_tileSize + (y % m_tileSize) * m_tileSize];
+	}
+
+	/// Return the original (unnormalized) sum of all weights
+	inline Float getOriginalSum() const {
+		return m_originalSum;
+	}
+
+	/// Return the fraction of tiles, which are sampled uniformly
+	inline Float getPrunedFraction() const {
+		size_t pruned = 0;
+		for (size_t i=0; i<m_tileOffset.size(); ++i)
+			pruned += m_tileOffset[i] == EPruned ? 1 : 0;
+		return pruned / (Float) std::max((size_t) 1, m_tileOffset.size());
+	}
+
+	/// Return the memory used by the hierarchy in bytes
+	inline size_t getMemoryUsage() const {
+		size_t size = m_fine.size() * sizeof(Float) 
+			+ m_tileOffset.size() * sizeof(uint32_t);
+		for (size_t i=0; i<m_coarse.size(); ++i)
+			size += m_coarse[i].size() * sizeof(Float);
+		return size;
+	}
+
+	/// Return a human-readable representation
+	std::string toString() const {
+		std::ostringstream oss;
+		oss << "HierarchicalPDF2D[resolution=" << m_width << "x" << m_height 
+			<< ", tileSize=" << m_tileSize << ", prunedTiles=" 
+			<< getPrunedFraction() * 100 << "%, originalSum=" << m_originalSum << "]";
+		return oss.str();
+	}
+protected:
+	/// Marks tiles that are sampled uniformly
+	enum { EPruned = 0xFFFFFFFF };
+
+	/**
+	 * \brief Choose a child of the entry (x, y) on the next-finer level 
+	 * and rescale the sample. Dimensions with a resolution of one are 
+	 * not subdivided.
+	 */
+	static inline void descend(const Float *child, int childWidth, int childHeight,
+			int parentWidth, int parentHeight, int &x, int &y, Point2 &sample) {
+		bool splitX = childWidth > parentWidth, splitY = childHeight > parentHeight;
+		int x0 = splitX ? 2*x : x, y0 = splitY ? 2*y : y;
+		const Float *row0 = child + y0 * childWidth,
+			  *row1 = splitY ? row0 + childWidth : NULL;
+		x = x0; y = y0;
+
+		if (splitX) {
+			Float left = row0[x0], right = row0[x0+1];
+			if (splitY) {
+				left += row1[x0];
+				right += row1[x0+1];
+			}
+			x += reuse(left, right, sample.x);
+		}
+		if (splitY)
+			y += reuse(row0[x], row1[x], sample.y);
+	}
+
+	/**
+	 * \brief Clamp a sampled position to the interior of the domain,
+	 * since adding the pixel offset may round up
+	 */
+	inline Point2 clamp(const Point2 &p) const {
+		const Float oneMinusEpsilon = 0.99999994f;
+		return Point2(std::min(p.x, m_width * oneMinusEpsilon),
+			std::min(p.y, m_height * oneMinusEpsilon));
+	}
+
+	/// Choose between two weights and rescale the sample value
+	static inline int reuse(Float weight0, Float weight1, Float &value) {
+		Float scaled = value * (weight0 + weight1);
+		int index = scaled < weight0 ? 0 : 1;
+		Float weight = index ? weight1 : weight0,
+			  offset = index ? weight0 : 0;
+		/* Guard against round-off, which would push the sample to 1
+		   and amplify the error on the following levels */
+		if (weight > 0)
+			value = std::min((scaled - offset) / weight, (Float) 0.99999994f);
+		return index;
+	}
+
+private:
+	int m_width, m_height;
+	int m_tileSize, m_tileLevels, m_tilesX, m_tilesY;
+	std::vector<std::vector<Float> > m_coarse;
+	std::vector<int> m_coarseWidth, m_coarseHeight;
+	std::vector<uint32_t> m_tileOffset;
+	std::vector<uint32_t> m_levelOffset;
+	std::vector<Float> m_fine;
+	Float m_originalSum;
+};
+
 MTS_NAMESPACE_END
 
 #endif /* __PDF_H */
@@ -216,7 +216,14 @@ struct RayPacket4 {
 	inline RayPacket4() {
 	}
 
+	/**
+	 * \brief Load four rays into the packet
+	 *
+	 * \return \c true if the direction signs of all rays agree, i.e.
+	 * the packet is coherent enough for a joint kd-tree traversal
+	 */
 	inline bool load(const Ray *rays) {
+		bool coherent = true;
 		for (int i=0; i<4; i++) {
 			for (int axis=0; axis<3; axis++) {
 				o[axis].f[i] = rays[i].o[axis];
@@ -224,10 +231,10 @@ struct RayPacket4 {
 				dRcp[axis].f[i] = rays[i].dRcp[axis];
 				signs[axis][i] = rays[i].d[axis] < 0 ? 1 : 0;
 				if (signs[axis][i] != signs[axis][0])
-					return false;
+					coherent = false;
 			}
 		}
-		return true;
+		return coherent;
 	}
 };
 
@@ -438,6 +438,20 @@ public:
 	/// Does the scheduler have one or more remote workers?
 	bool hasRemoteWorkers() const;
 
+	/**
+	 * \brief Set the number of work units that a local worker generates 
+	 * ahead of time whenever it acquires the central scheduler lock.
+	 *
+	 * Pre-generated work units are kept in a per-worker queue, from which
+	 * idle workers are allowed to steal. Larger values reduce contention
+	 * on the scheduler lock when work units are very small. The default
+	 * is 4, and a value of 1 disables pre-generation.
+	 */
+	void setWorkPrefetch(int count);
+
+	/// Return the number of work units that local workers generate ahead of time
+	inline int getWorkPrefetch() const { return m_workPrefetch; }
+
 	/// Return a pointer to the scheduler of this process
 	inline static Scheduler *getInstance() { return m_scheduler; }
 
@@ -523,6 +537,20 @@ public:
 		}
 	};
 
+	/**
+	 * Queue of work units that were generated ahead of time by a 
+	 * local worker. The owner takes units from the front, while
+	 * other (idle) local workers steal from the back.
+	 */
+	struct LocalQueue {
+		ref<Mutex> mutex;
+		std::deque<std::pair<int, ref<WorkUnit> > > units;
+
+		inline LocalQueue() {
+			mutex = new Mutex();
+		}
+	};
+
 	/// A list of status codes returned by acquireWork()
 	enum EStatus {
 		/// Sucessfully acquired a work unit
@@ -558,6 +586,23 @@ protected:
 	 */
 	EStatus acquireWork(Item &item, bool local, bool onlyTry, bool keepLock);
 
+	/**
+	 * Acquire a piece of work on behalf of a local worker. The work unit
+	 * is taken from the worker's own queue, stolen from another local 
+	 * worker, or generated (along with a few more) while the main 
+	 * scheduler lock is held.
+	 */
+	EStatus acquireLocalWork(Item &item);
+
+	/// Take a pre-generated work unit from the front of the given queue
+	bool popLocalWork(LocalQueue *queue, std::pair<int, ref<WorkUnit> > &unit);
+
+	/// Try to steal a pre-generated work unit from another local worker
+	bool stealLocalWork(int workerIndex, std::pair<int, ref<WorkUnit> > &unit);
+
+	/// Acquire the main scheduler lock and keep track of contention
+	void acquireLock();
+
 	/// Release the main scheduler lock -- internally used by the remote worker
 	inline void releaseLock() { m_mutex->unlock(); }
 
@@ -571,7 +616,7 @@ protected:
 			cancel(item.proc, true);
 			return;
 		}
-		m_mutex->lock();
+		acquireLock();
 		--rec->inflight;
 		rec->cond->signal();
 		if (rec->inflight == 0 && !rec->morework && !item.stop)
@@ -636,7 +681,12 @@ private:
 	std::map<int, ResourceRecord *> m_resources;
 	/// List of all active workers
 	std::vector<Worker *> m_workers;
+	/// Work units generated ahead of time (one queue per worker)
+	std::vector<LocalQueue *> m_workQueues;
+	/// Total number of units currently stored in \c m_workQueues
+	volatile int32_t m_queuedUnits;
 	int m_resourceCounter, m_processCounter;
+	int m_workPrefetch;
 	bool m_running;
 };
 
@@ -693,6 +743,11 @@ protected:
 		return m_scheduler->acquireWork(m_schedItem, local, onlyTry, keepLock);
 	}
 
+	/// Acquire work using the per-worker queues (local workers only)
+	inline Scheduler::EStatus acquireLocalWork() {
+		return m_scheduler->acquireLocalWork(m_schedItem);
+	}
+
 	void releaseSchedulerLock() {
 		return m_scheduler->releaseLock();
 	}
@@ -125,8 +125,29 @@ struct MTS_EXPORT_CORE Triangle {
 			positions[idx[0]], positions[idx[1]],
 			positions[idx[2]], ray, u, v, t);
 	}
+
+#if defined(MTS_SSE)
+	/**
+	 * \brief Moeller-Trumbore intersection test against a packet of
+	 * four rays (requires SSE)
+	 *
+	 * Only rays, whose lane is not set in \a inactive are considered.
+	 * The distance and barycentric coordinates in \a its are updated for
+	 * all lanes with an intersection inside <tt>(mint, maxt)</tt>. The
+	 * primitive and shape indices are left to the caller.
+	 *
+	 * \return A mask of the lanes that have an intersection
+	 */
+	FINLINE __m128 rayIntersectPacket(const Point *positions, 
+		const RayPacket4 &packet, __m128 mint, __m128 maxt, 
+		__m128 inactive, Intersection4 &its) const;
+#endif
 };
 
 MTS_NAMESPACE_END
 
+#ifdef MTS_SSE
+#include <mitsuba/core/triangle_sse.h>
+#endif
+
 #endif /* __TRIANGLE_H */
@@ -0,0 +1,104 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__TRIANGLE_SSE_H)
+#define __TRIANGLE_SSE_H
+
+MTS_NAMESPACE_BEGIN
+
+FINLINE __m128 Triangle::rayIntersectPacket(const Point *positions, 
+		const RayPacket4 &packet, __m128 mint, __m128 maxt, 
+		__m128 inactive, Intersection4 &its) const {
+	const Point &p0 = positions[idx[0]];
+	const Point &p1 = positions[idx[1]];
+	const Point &p2 = positions[idx[2]];
+
+	/* Find vectors for two edges sharing p0 */
+	const __m128
+		e1x = _mm_set1_ps(p1.x - p0.x),
+		e1y = _mm_set1_ps(p1.y - p0.y),
+		e1z = _mm_set1_ps(p1.z - p0.z),
+		e2x = _mm_set1_ps(p2.x - p0.x),
+		e2y = _mm_set1_ps(p2.y - p0.y),
+		e2z = _mm_set1_ps(p2.z - p0.z);
+
+	const __m128
+		dx = packet.d[0].ps, dy = packet.d[1].ps, dz = packet.d[2].ps;
+
+	/* Begin calculating determinant - also used to calculate U parameter */
+	const __m128
+		px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y)),
+		py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z)),
+		pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+
+	const __m128 det = _mm_add_ps(_mm_add_ps(
+		_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+
+	/* Discard lanes, where the ray lies in the plane of the triangle */
+	const __m128 
+		detEps = _mm_set1_ps(1e-8f),
+		absDet = _mm_andnot_ps(_mm_set1_ps(-0.0f), det);
+	__m128 hasIts = _mm_andnot_ps(inactive, _mm_cmpge_ps(absDet, detEps));
+
+	if (_mm_movemask_ps(hasIts) == 0)
+		return hasIts;
+
+	const __m128 invDet = _mm_div_ps(SSEConstants::one.ps, det);
+
+	/* Calculate the distance from p0 to the ray origin */
+	const __m128
+		tx = _mm_sub_ps(packet.o[0].ps, _mm_set1_ps(p0.x)),
+		ty = _mm_sub_ps(packet.o[1].ps, _mm_set1_ps(p0.y)),
+		tz = _mm_sub_ps(packet.o[2].ps, _mm_set1_ps(p0.z));
+
+	/* Calculate the U parameter */
+	const __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(
+		_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), invDet);
+
+	/* Prepare to test the V parameter */
+	const __m128
+		qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y)),
+		qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z)),
+		qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+
+	const __m128 
+		v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet),
+		t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+	const __m128 zero = _mm_setzero_ps();
+	hasIts = _mm_and_ps(hasIts, _mm_and_ps(
+		_mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero)),
+		_mm_cmpge_ps(SSEConstants::one.ps, _mm_add_ps(u, v))));
+	hasIts = _mm_and_ps(hasIts, _mm_and_ps(
+		_mm_cmpgt_ps(t, mint), _mm_cmpgt_ps(maxt, t)));
+
+	if (_mm_movemask_ps(hasIts) == 0) 
+		return hasIts;
+
+	its.t.ps  = mux_ps(hasIts, t, its.t.ps);
+	its.u.ps  = mux_ps(hasIts, u, its.u.ps);
+	its.v.ps  = mux_ps(hasIts, v, its.v.ps);
+
+	return hasIts;
+}
+
+MTS_NAMESPACE_END
+
+#endif /* __TRIANGLE_SSE_H */
@@ -100,6 +100,24 @@ extern MTS_EXPORT_CORE int getProcessorCount();
 /// Return the host name of this machine
 extern MTS_EXPORT_CORE std::string getHostName();
 
+/**
+ * Return the ID of the current process. Together with the host
+ * name, this can be used to create file names, which do not clash
+ * with those of concurrent processes sharing a directory.
+ */
+extern MTS_EXPORT_CORE int getProcessId();
+
+/**
+ * \brief Atomically replace the file \c target by \c source
+ *
+ * An existing target file is overwritten. Concurrent readers observe
+ * either the previous or the new version, but never a missing file.
+ * Both files must reside on the same file system. Throws an exception
+ * on failure.
+ */
+extern MTS_EXPORT_CORE void replaceFile(const std::string &source,
+	const std::string &target);
+
 /// Return the fully qualified domain name of this machine 
 extern MTS_EXPORT_CORE std::string getFQDN();
 
@@ -124,6 +142,17 @@ extern MTS_EXPORT_CORE bool disableFPExceptions();
 /// Restore floating point exceptions to the specified state
 extern MTS_EXPORT_CORE void restoreFPExceptions(bool state);
 
+/**
+ * \brief Compute a 64-bit hash of a region of memory
+ *
+ * Uses the 64-bit variant of MurmurHash2 by Austin Appleby. This is a
+ * fast non-cryptographic hash function, which is suitable for generating
+ * cache keys. Several regions can be hashed in succession by passing 
+ * the previous result as the \c seed parameter.
+ */
+extern MTS_EXPORT_CORE uint64_t hashBuffer(const void *data, size_t size,
+	uint64_t seed = 0);
+
 /// Cast between types that have an identical binary representation.
 template<typename T, typename U> inline T union_cast(const U &val) {
 	BOOST_STATIC_ASSERT(sizeof(T) == sizeof(U));
@@ -25,6 +25,12 @@
 
 namespace fs = boost::filesystem;
 
+/**
+ * Side length (in pixels) of the square film tiles, which are
+ * locked independently when merging image blocks
+ */
+#define MTS_FILM_TILE_SIZE 16
+
 MTS_NAMESPACE_BEGIN
 
 /** \brief Abstract Film base class - used to store samples
@@ -32,7 +38,12 @@ MTS_NAMESPACE_BEGIN
  */
 class MTS_EXPORT_RENDER Film : public ConfigurableObject {
 public:
-	/// Add an image block to the film
+	/**
+	 * \brief Add an image block to the film
+	 *
+	 * Implementations must be thread-safe -- this function
+	 * is called by several workers at the same time.
+	 */
 	virtual void putImageBlock(const ImageBlock *block) = 0;
 
 	/**
@@ -105,6 +116,65 @@ protected:
 
 	/// Virtual destructor
 	virtual ~Film();
+
+	/**
+	 * \brief Merge an image block into row-major film storage
+	 * using per-tile locks
+	 *
+	 * The crop window is split into square tiles of \ref MTS_FILM_TILE_SIZE
+	 * pixels, each of which has its own lock. The region covered by the
+	 * block is processed one tile at a time, and every row span is merged
+	 * by calling
+	 * \code
+	 * target->accumulate(block, entry, index, count);
+	 * \endcode
+	 * which must add \c count consecutive block entries starting at
+	 * \c entry to the film pixels starting at the crop window index 
+	 * \c index. Non-overlapping image blocks can thus be merged 
+	 * concurrently, and blocks that share a border only contend
+	 * for the shared tiles.
+	 */
+	template <typename T> void putImageBlockTiled(T *target, const ImageBlock *block) {
+		const int 
+			x0 = block->getOffset().x - block->getBorder() - m_cropOffset.x,
+			y0 = block->getOffset().y - block->getBorder() - m_cropOffset.y,
+			xStart = std::max(0, x0), xEnd = std::min(m_cropSize.x, x0 + block->getFullSize().x),
+			yStart = std::max(0, y0), yEnd = std::min(m_cropSize.y, y0 + block->getFullSize().y);
+
+		if (xStart >= xEnd || yStart >= yEnd)
+			return;
+
+		for (int ty = yStart / MTS_FILM_TILE_SIZE; ty <= (yEnd-1) / MTS_FILM_TILE_SIZE; ++ty) {
+			const int rowStart = std::max(yStart, ty * MTS_FILM_TILE_SIZE),
+				rowEnd = std::min(yEnd, (ty+1) * MTS_FILM_TILE_SIZE);
+
+			for (int tx = xStart / MTS_FILM_TILE_SIZE; tx <= (xEnd-1) / MTS_FILM_TILE_SIZE; ++tx) {
+				const int colStart = std::max(xStart, tx * MTS_FILM_TILE_SIZE),
+					colEnd = std::min(xEnd, (tx+1) * MTS_FILM_TILE_SIZE);
+
+				Mutex *mutex = m_tileLocks[ty * m_tileCount.x + tx];
+				mutex->lock();
+				for (int y = rowStart; y < rowEnd; ++y)
+					target->accumulate(block,
+						(size_t) (y - y0) * block->getFullSize().x + (colStart - x0),
+						(size_t) y * m_cropSize.x + colStart, colEnd - colStart);
+				mutex->unlock();
+			}
+		}
+	}
+
+	/// Allocate the per-tile locks used by \ref putImageBlockTiled()
+	void initializeTileLocks();
+
+	/**
+	 * \brief Add a span of \c count image block entries (starting at 
+	 * \c entry) to consecutive film pixels with the layout 
+	 * <tt>(spectrum, alpha, weight)</tt>.
+	 *
+	 * Uses SSE when compiled with single precision and RGB spectra.
+	 */
+	static void accumulateSpan(Float *target, const ImageBlock *block,
+		size_t entry, int count);
 protected:
 	Point2i m_cropOffset;
 	Vector2i m_size, m_cropSize;
@@ -112,6 +182,8 @@ protected:
 	ref<ReconstructionFilter> m_filter;
 	ref<TabulatedFilter> m_tabulatedFilter;
 	Properties m_properties;
+	std::vector<ref<Mutex> > m_tileLocks;
+	Vector2i m_tileCount;
 };
 
 MTS_NAMESPACE_END
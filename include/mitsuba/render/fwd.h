@@ -49,8 +49,10 @@ template <typename AABBType> class KDTreeBase;
 template <typename AABBType, typename TreeConstructionHeuristic, typename Derived> class GenericKDTree;
 template <typename Derived> class SAHKDTree3D;
 class ShapeKDTree;
+class LightTree;
 class LocalWorker;
 class Luminaire;
+struct LuminaireBounds;
 struct LuminaireSamplingRecord;
 class Medium;
 struct MediumSamplingRecord;
@@ -83,6 +85,7 @@ class Spiral;
 class Subsurface;
 class TabulatedFilter;
 class Texture;
+class TextureCache;
 struct TriAccel;
 struct TriAccel4;
 class TriMesh;
@@ -21,6 +21,7 @@
 
 #include <mitsuba/render/particleproc.h>
 #include <mitsuba/render/photonmap.h>
+#include <mitsuba/render/hashgrid.h>
 
 MTS_NAMESPACE_BEGIN
 
@@ -58,14 +59,21 @@ public:
 	 *     are not enough photons generated
 	 * \param progressReporterPayload
 	 *    Custom pointer payload to be delivered with progress messages
+	 * \param grid
+	 *    Optional hash grid over gather points. When specified, the
+	 *    photons are splatted into it as soon as a worker delivers them 
+	 *    (without holding any locks), and no photon map is created.
+	 *    Requires a local process.
 	 */
 	GatherPhotonProcess(EGatherType type, size_t photonCount, 
 		size_t granularity, int maxDepth, int rrDepth, bool isLocal,
-		bool autoCancel, const void *progressReporterPayload);
+		bool autoCancel, const void *progressReporterPayload,
+		GatherPointHashGrid *grid = NULL);
 
 	/**
 	 * Once the process has finished, this returns a reference 
-	 * to the (still unbalanced) photon map
+	 * to the (still unbalanced) photon map. Returns \c NULL when 
+	 * the photons were splatted into a hash grid instead.
 	 */
 	inline PhotonMap *getPhotonMap() { return m_photonMap; }
 
@@ -113,6 +121,8 @@ protected:
 protected:
 	EGatherType m_type;
 	ref<PhotonMap> m_photonMap;
+	ref<GatherPointHashGrid> m_grid;
+	size_t m_splatCount;
 	size_t m_photonCount;
 	int m_maxDepth;
 	int m_rrDepth;
@@ -25,6 +25,7 @@
 #include <boost/static_assert.hpp>
 #include <boost/tuple/tuple.hpp>
 #include <stack>
+#include <deque>
 
 /// Activate lots of extra checks
 // #define MTS_KD_DEBUG 1
@@ -40,6 +41,13 @@
 #define MTS_KD_BLOCKSIZE_KD  (512*1024/sizeof(KDNode))
 #define MTS_KD_BLOCKSIZE_IDX (512*1024/sizeof(uint32_t))
 
+/** Nodes with at least this many primitives are binned and
+    partitioned using all available build threads */
+#define MTS_KD_MIN_PARALLEL_PRIMS 131072
+
+/// Chunk size used by the data-parallel binning and partitioning code
+#define MTS_KD_PARALLEL_CHUNK 16384
+
 #if defined(MTS_KD_DEBUG)
 #define KDAssert(expr) SAssert(expr)
 #define KDAssertEx(expr, text) SAssertEx(expr, text)
@@ -708,7 +716,7 @@ public:
 	 * \brief Create a new kd-tree instance initialized with 
 	 * the default parameters.
 	 */
-	GenericKDTree() : m_indices(NULL) {
+	GenericKDTree() : m_indices(NULL), m_externalStorage(false) {
 		m_nodes = NULL;
 		m_traversalCost = 15;
 		m_queryCost = 20;
@@ -721,12 +729,16 @@ public:
 		m_retract = true;
 		m_parallelBuild = true;
 		m_minMaxBins = 128;
+		m_buildThreadCount = 0;
+		m_threadCount = 1;
 	}
 
 	/**
 	 * \brief Release all memory
 	 */
 	virtual ~GenericKDTree() {
+		if (m_externalStorage)
+			return;
 		if (m_indices)
 			delete[] m_indices;
 		if (m_nodes)
@@ -887,6 +899,22 @@ public:
 		return m_parallelBuild;
 	}
 
+	/**
+	 * \brief Set the number of threads used by a parallel tree 
+	 * construction (0 = one per processor core)
+	 */
+	inline void setBuildThreadCount(size_type buildThreadCount) {
+		m_buildThreadCount = buildThreadCount;
+	}
+
+	/**
+	 * \brief Return the number of threads used by a parallel tree 
+	 * construction (0 = one per processor core)
+	 */
+	inline size_type getBuildThreadCount() const {
+		return m_buildThreadCount;
+	}
+
 	/**
 	 * \brief Specify the number of primitives, at which the builder will 
 	 * switch from (approximate) Min-Max binning to the accurate 
@@ -939,6 +967,12 @@ protected:
 		if (primCount <= m_exactPrimThreshold)
 			m_parallelBuild = false;
 
+		size_type procCount = m_buildThreadCount > 0 
+			? m_buildThreadCount : (size_type) getProcessorCount();
+		if (procCount == 1)
+			m_parallelBuild = false;
+		m_threadCount = m_parallelBuild ? procCount : 1;
+
 		BuildContext ctx(primCount, m_minMaxBins);
 
 		/* Establish an ad-hoc depth cutoff value (Formula from PBRT) */
@@ -955,9 +989,29 @@ protected:
 		ref<Timer> timer = new Timer();
 		AABBType &aabb = m_aabb;
 		aabb.reset();
-		for (index_type i=0; i<primCount; ++i) {
-			aabb.expandBy(cast()->getAABB(i));
-			indices[i] = i;
+		if (m_threadCount > 1 && primCount >= MTS_KD_MIN_PARALLEL_PRIMS) {
+			const int chunkCount = (int) ((primCount + MTS_KD_PARALLEL_CHUNK - 1)
+				/ MTS_KD_PARALLEL_CHUNK);
+			std::vector<AABBType> chunkAABBs(chunkCount);
+
+			#pragma omp parallel for num_threads((int) m_threadCount) schedule(dynamic)
+			for (int chunk=0; chunk<chunkCount; ++chunk) {
+				const index_type start = (index_type) chunk * MTS_KD_PARALLEL_CHUNK,
+					end = (index_type) std::min((size_type) (start + MTS_KD_PARALLEL_CHUNK), primCount);
+				AABBType &chunkAABB = chunkAABBs[chunk];
+				chunkAABB.reset();
+				for (index_type i=start; i<end; ++i) {
+					chunkAABB.expandBy(cast()->getAABB(i));
+					indices[i] = i;
+				}
+			}
+			for (int chunk=0; chunk<chunkCount; ++chunk)
+				aabb.expandBy(chunkAABBs[chunk]);
+		} else {
+			for (index_type i=0; i<primCount; ++i) {
+				aabb.expandBy(cast()->getAABB(i));
+				indices[i] = i;
+			}
 		}
 
 		KDLog(EDebug, "Computed scene bounds in %i ms", 
@@ -982,15 +1036,15 @@ protected:
 		KDLog(EDebug, "   Stopping primitive count : %i", m_stopPrims);
 		KDLog(EDebug, "   Build tree in parallel   : %s", 
 				m_parallelBuild ? "yes" : "no");
+		if (m_parallelBuild)
+			KDLog(EDebug, "   Build threads            : %i", m_threadCount);
 		KDLog(EDebug, "");
 
-		size_type procCount = getProcessorCount();
-		if (procCount == 1)
-			m_parallelBuild = false;
-
 		if (m_parallelBuild) {
-			m_builders.resize(procCount);
-			for (size_type i=0; i<procCount; ++i) {
+			/* The main thread takes part in the subtree construction
+			   once it is done with the upper levels of the tree */
+			m_builders.resize(procCount-1);
+			for (size_type i=0; i<procCount-1; ++i) {
 				m_builders[i] = new TreeBuilder(i, this);
 				m_builders[i]->incRef();
 				m_builders[i]->start();
@@ -1003,10 +1057,12 @@ protected:
 				indices, primCount, true, 0);
 		ctx.leftAlloc.release(indices);
 
-		KDAssert(ctx.leftAlloc.used() == 0);
-		KDAssert(ctx.rightAlloc.used() == 0);
-
 		if (m_parallelBuild) {
+			/* Help with the remaining subtree jobs */
+			BuildJob job;
+			while (m_interface.takeJob(job, &ctx))
+				runJob(ctx, job);
+
 			m_interface.mutex->lock();
 			m_interface.done = true;
 			m_interface.cond->broadcast();
@@ -1015,12 +1071,15 @@ protected:
 				m_builders[i]->join();
 		}
 
+		KDAssert(ctx.leftAlloc.used() == 0);
+		KDAssert(ctx.rightAlloc.used() == 0);
+
 		KDLog(EInfo, "Finished -- took %i ms.", timer->getMilliseconds());
 		KDLog(EDebug, "");
 
 		KDLog(EDebug, "Temporary memory statistics:");
 		KDLog(EDebug, "   Classification storage : %s", 
-				memString((ctx.classStorage.size() * (1+procCount))).c_str());
+				memString((ctx.classStorage.size() * (1+m_builders.size()))).c_str());
 		KDLog(EDebug, "   Indirection entries    : " SIZE_T_FMT " (%s)", 
 				m_indirections.size(), memString(m_indirections.capacity()
 				* sizeof(KDNode *)).c_str());
@@ -1080,11 +1139,11 @@ protected:
 			const BuildContext *context = boost::get<2>(stack.top());
 			AABBType aabb = boost::get<3>(stack.top());
 			stack.pop();
-			typename std::map<const KDNode *, index_type>::const_iterator it 
+			typename std::map<const KDNode *, const BuildContext *>::const_iterator it 
 				= m_interface.threadMap.find(node);
 			// Check if we're switching to a subtree built by a worker thread
 			if (it != m_interface.threadMap.end()) 
-				context = &m_builders[(*it).second]->getContext();
+				context = (*it).second;
 
 			if (node->isLeaf()) {
 				size_type primStart = node->getPrimStart(),
@@ -1382,31 +1441,79 @@ protected:
 	};
 
 	/**
-	 * \brief Communication data structure used to pass jobs to
+	 * \brief Job description for building a subtree using the 
+	 * O(n log n) optimization
+	 */
+	struct BuildJob {
+		unsigned int depth;
+		KDNode *node;
+		AABBType nodeAABB;
+		index_type *indices;
+		size_type primCount;
+		size_type badRefines;
+	};
+
+	/**
+	 * \brief Task queue used to pass subtree construction jobs to
 	 * kd-tree builder threads
 	 */
 	struct BuildInterface {
 		/* Communcation */
 		ref<Mutex> mutex;
-		ref<ConditionVariable> cond, condJobTaken;
-		std::map<const KDNode *, index_type> threadMap;
+		ref<ConditionVariable> cond;
+		std::map<const KDNode *, const BuildContext *> threadMap;
+		std::deque<BuildJob> jobs;
 		bool done;
 
-		/* Job description for building a subtree */
-		int depth;
-		KDNode *node;
-		AABBType nodeAABB;
-		EdgeEvent *eventStart, *eventEnd;
-		size_type primCount;
-		int badRefines;
-
 		inline BuildInterface() {
 			mutex = new Mutex();
 			cond = new ConditionVariable(mutex);
-			condJobTaken = new ConditionVariable(mutex);
-			node = NULL;
 			done = false;
 		}
+
+		/// Append a job to the queue and wake up a builder thread
+		inline void addJob(const BuildJob &job) {
+			mutex->lock();
+			jobs.push_back(job);
+			cond->signal();
+			mutex->unlock();
+		}
+
+		/**
+		 * \brief Take the oldest job from the queue without blocking and
+		 * record which context will hold the resulting subtree
+		 */
+		inline bool takeJob(BuildJob &job, const BuildContext *ctx) {
+			mutex->lock();
+			if (jobs.empty()) {
+				mutex->unlock();
+				return false;
+			}
+			job = jobs.front();
+			jobs.pop_front();
+			threadMap[job.node] = ctx;
+			mutex->unlock();
+			return true;
+		}
+
+		/**
+		 * \brief Wait until a job is available. Returns \c false when the 
+		 * tree construction has finished and the queue is empty.
+		 */
+		inline bool waitJob(BuildJob &job, const BuildContext *ctx) {
+			mutex->lock();
+			while (!done && jobs.empty())
+				cond->wait();
+			if (jobs.empty()) {
+				mutex->unlock();
+				return false;
+			}
+			job = jobs.front();
+			jobs.pop_front();
+			threadMap[job.node] = ctx;
+			mutex->unlock();
+			return true;
+		}
 	};
 
 	/**
@@ -1430,35 +1537,9 @@ protected:
 		}
 
 		void run() {
-			OrderedChunkAllocator &leftAlloc = m_context.leftAlloc;
-			while (true) {
-				m_interface.mutex->lock();
-				while (!m_interface.done && !m_interface.node)
-					m_interface.cond->wait();
-				if (m_interface.done) {
-					m_interface.mutex->unlock();
-					break;
-				}
-				int depth = m_interface.depth;
-				KDNode *node = m_interface.node;
-				AABBType nodeAABB = m_interface.nodeAABB;
-				size_t eventCount = m_interface.eventEnd - m_interface.eventStart;
-				size_type primCount = m_interface.primCount;
-				int badRefines = m_interface.badRefines;
-				EdgeEvent *eventStart = leftAlloc.allocate<EdgeEvent>(eventCount),
-						  *eventEnd = eventStart + eventCount;
-				memcpy(eventStart, m_interface.eventStart, 
-						eventCount * sizeof(EdgeEvent));
-				m_interface.threadMap[node] = m_id;
-				m_interface.node = NULL;
-				m_interface.condJobTaken->signal();
-				m_interface.mutex->unlock();
-
-				std::sort(eventStart, eventEnd, EdgeEventOrdering());
-				m_parent->buildTree(m_context, depth, node,
-					nodeAABB, eventStart, eventEnd, primCount, true, badRefines);
-				leftAlloc.release(eventStart);
-			}
+			BuildJob job;
+			while (m_interface.waitJob(job, &m_context))
+				m_parent->runJob(m_context, job);
 		}
 
 		inline BuildContext &getContext() {
@@ -1482,6 +1563,26 @@ protected:
 		return static_cast<const Derived *>(this);
 	}
 
+	/**
+	 * \brief Build the subtree described by a job from the task queue.
+	 *
+	 * The edge event list is created here rather than when the job 
+	 * is queued, so that this step also runs in parallel.
+	 */
+	void runJob(BuildContext &ctx, BuildJob &job) {
+		OrderedChunkAllocator &leftAlloc = ctx.leftAlloc;
+		boost::tuple<EdgeEvent *, EdgeEvent *, size_type> events  
+				= createEventList(leftAlloc, job.nodeAABB, job.indices, job.primCount);
+		delete[] job.indices;
+
+		std::sort(boost::get<0>(events), boost::get<1>(events), 
+				EdgeEventOrdering());
+		buildTree(ctx, job.depth, job.node, job.nodeAABB, 
+			boost::get<0>(events), boost::get<1>(events),
+			boost::get<2>(events), true, job.badRefines);
+		leftAlloc.release(boost::get<0>(events));
+	}
+
 	/**
 	 * \brief Create an edge event list for a given list of primitives. 
 	 *
@@ -1668,37 +1769,34 @@ protected:
 	inline Float transitionToNLogN(BuildContext &ctx, unsigned int depth, KDNode *node, 
 			const AABBType &nodeAABB, index_type *indices,
 			size_type primCount, bool isLeftChild, size_type badRefines) {
+		if (m_parallelBuild) {
+			/* Queue the subtree for a builder thread. The index list 
+			   is copied, since the ordered allocators of this thread
+			   will reuse its memory right away */
+			BuildJob job;
+			job.depth = depth;
+			job.node = node;
+			job.nodeAABB = nodeAABB;
+			job.indices = new index_type[primCount];
+			job.primCount = primCount;
+			job.badRefines = badRefines;
+			memcpy(job.indices, indices, primCount * sizeof(index_type));
+			m_interface.addJob(job);
+
+			// Never tear down this subtree (return a cost of -infinity)
+			return -std::numeric_limits<Float>::infinity();
+		}
+
 		OrderedChunkAllocator &alloc = isLeftChild 
 				? ctx.leftAlloc : ctx.rightAlloc;
 		boost::tuple<EdgeEvent *, EdgeEvent *, size_type> events  
 				= createEventList(alloc, nodeAABB, indices, primCount);
-		Float cost;
-		if (m_parallelBuild) {
-			m_interface.mutex->lock();
-			m_interface.depth = depth;
-			m_interface.node = node;
-			m_interface.nodeAABB = nodeAABB;
-			m_interface.eventStart = boost::get<0>(events);
-			m_interface.eventEnd = boost::get<1>(events);
-			m_interface.primCount = boost::get<2>(events);
-			m_interface.badRefines = badRefines;
-			m_interface.cond->signal();
-
-			/* Wait for a worker thread to take this job */
-			while (m_interface.node)
-				m_interface.condJobTaken->wait();
-			m_interface.mutex->unlock();
-
-			// Never tear down this subtree (return a cost of -infinity)
-			cost = -std::numeric_limits<Float>::infinity();
-		} else {
-			std::sort(boost::get<0>(events), boost::get<1>(events), 
-					EdgeEventOrdering());
+		std::sort(boost::get<0>(events), boost::get<1>(events), 
+				EdgeEventOrdering());
 
-			cost = buildTree(ctx, depth, node, nodeAABB,
-				boost::get<0>(events), boost::get<1>(events), 
-				boost::get<2>(events), isLeftChild, badRefines);
-		}
+		Float cost = buildTree(ctx, depth, node, nodeAABB,
+			boost::get<0>(events), boost::get<1>(events), 
+			boost::get<2>(events), isLeftChild, badRefines);
 		alloc.release(boost::get<0>(events));
 		return cost;
 	}
@@ -1751,8 +1849,13 @@ protected:
 	    /*                              Binning                                 */
 	    /* ==================================================================== */
 
+		/* Large nodes near the top of the tree are binned and 
+		   partitioned in a data-parallel manner */
+		const int threadCount = primCount >= MTS_KD_MIN_PARALLEL_PRIMS
+			? (int) m_threadCount : 1;
+
 		ctx.minMaxBins.setAABB(tightAABB);
-		ctx.minMaxBins.bin(cast(), indices, primCount);
+		ctx.minMaxBins.bin(cast(), indices, primCount, threadCount);
 
 		/* ==================================================================== */
 	    /*                        Split candidate search                        */
@@ -1791,7 +1894,7 @@ protected:
 
 		boost::tuple<AABBType, index_type *, AABBType, index_type *> partition = 
 			ctx.minMaxBins.partition(ctx, cast(), indices, bestSplit, 
-				isLeftChild, m_traversalCost, m_queryCost);
+				isLeftChild, m_traversalCost, m_queryCost, threadCount);
 
 		/* ==================================================================== */
 	    /*                              Recursion                               */
@@ -2375,27 +2478,45 @@ protected:
 		 *     a given list of primitives
 		 * \param indices Primitive indirection list
 		 * \param primCount Specifies the length of \a indices
+		 * \param threadCount Number of threads that should be used
 		 */
 		void bin(const Derived *derived, index_type *indices, 
-				size_type primCount) {
+				size_type primCount, int threadCount = 1) {
+			const size_type binEntries = point_type::dim * m_binCount;
 			m_primCount = primCount;
-			memset(m_minBins, 0, sizeof(size_type) * point_type::dim * m_binCount);
-			memset(m_maxBins, 0, sizeof(size_type) * point_type::dim * m_binCount);
-			const int64_t maxBin = m_binCount-1;
+			memset(m_minBins, 0, sizeof(size_type) * binEntries);
+			memset(m_maxBins, 0, sizeof(size_type) * binEntries);
 
-			for (size_type i=0; i<m_primCount; ++i) {
-				const AABBType aabb = derived->getAABB(indices[i]);
-				for (int axis=0; axis<point_type::dim; ++axis) {
-					int64_t minIdx = (int64_t) ((aabb.min[axis] - m_aabb.min[axis]) 
-							* m_invBinSize[axis]);
-					int64_t maxIdx = (int64_t) ((aabb.max[axis] - m_aabb.min[axis]) 
-							* m_invBinSize[axis]);
-					m_maxBins[axis * m_binCount 
-						+ std::max((int64_t) 0, std::min(maxIdx, maxBin))]++;
-					m_minBins[axis * m_binCount 
-						+ std::max((int64_t) 0, std::min(minIdx, maxBin))]++;
+			if (threadCount <= 1) {
+				binRange(derived, indices, 0, primCount, m_minBins, m_maxBins);
+				return;
+			}
+
+			/* Bin chunks of the primitive list into separate 
+			   histograms, which are then added up */
+			const int chunkCount = (int) ((primCount + MTS_KD_PARALLEL_CHUNK - 1)
+				/ MTS_KD_PARALLEL_CHUNK);
+			size_type *chunkBins = new size_type[2 * binEntries * chunkCount];
+			memset(chunkBins, 0, sizeof(size_type) * 2 * binEntries * chunkCount);
+
+			#pragma omp parallel for num_threads(threadCount) schedule(dynamic)
+			for (int chunk=0; chunk<chunkCount; ++chunk) {
+				const size_type start = (size_type) chunk * MTS_KD_PARALLEL_CHUNK,
+					end = std::min((size_type) (start + MTS_KD_PARALLEL_CHUNK), primCount);
+				size_type *minBins = chunkBins + 2 * binEntries * chunk,
+						  *maxBins = minBins + binEntries;
+				binRange(derived, indices, start, end, minBins, maxBins);
+			}
+
+			for (int chunk=0; chunk<chunkCount; ++chunk) {
+				const size_type *minBins = chunkBins + 2 * binEntries * chunk,
+						  *maxBins = minBins + binEntries;
+				for (size_type i=0; i<binEntries; ++i) {
+					m_minBins[i] += minBins[i];
+					m_maxBins[i] += maxBins[i];
 				}
 			}
+			delete[] chunkBins;
 		}
 
 		/**
@@ -2514,11 +2635,16 @@ protected:
 		 * \brief Given a suitable split candiate, compute tight bounding
 		 * boxes for the left and right subtrees and return associated
 		 * primitive lists.
+		 *
+		 * When \c threadCount is larger than one, the primitives are 
+		 * classified in parallel (in chunks), and the index lists are 
+		 * then written at offsets given by a prefix sum over the chunks. 
+		 * The resulting lists are identical to those of the serial version.
 		 */
 		boost::tuple<AABBType, index_type *, AABBType, index_type *> partition(
 				BuildContext &ctx, const Derived *derived, index_type *primIndices,
 				SplitCandidate &split, bool isLeftChild, Float traversalCost, 
-				Float queryCost) {
+				Float queryCost, int threadCount = 1) {
 			const float splitPos = split.pos;
 			const int axis = split.axis;
 			size_type numLeft = 0, numRight = 0;
@@ -2535,26 +2661,101 @@ protected:
 				rightIndices = primIndices;
 			}
 
-			for (size_type i=0; i<m_primCount; ++i) {
-				const index_type primIndex = primIndices[i];
-				const AABBType aabb = derived->getAABB(primIndex);
-
-				if (aabb.max[axis] <= splitPos) {
-					KDAssert(numLeft < split.numLeft);
-					leftBounds.expandBy(aabb);
-					leftIndices[numLeft++] = primIndex;
-				} else if (aabb.min[axis] > splitPos) {
-					KDAssert(numRight < split.numRight);
-					rightBounds.expandBy(aabb);
-					rightIndices[numRight++] = primIndex;
-				} else {
-					leftBounds.expandBy(aabb);
-					rightBounds.expandBy(aabb);
-					KDAssert(numLeft < split.numLeft);
-					KDAssert(numRight < split.numRight);
-					leftIndices[numLeft++] = primIndex;
-					rightIndices[numRight++] = primIndex;
+			if (threadCount <= 1) {
+				for (size_type i=0; i<m_primCount; ++i) {
+					const index_type primIndex = primIndices[i];
+					const AABBType aabb = derived->getAABB(primIndex);
+
+					if (aabb.max[axis] <= splitPos) {
+						KDAssert(numLeft < split.numLeft);
+						leftBounds.expandBy(aabb);
+						leftIndices[numLeft++] = primIndex;
+					} else if (aabb.min[axis] > splitPos) {
+						KDAssert(numRight < split.numRight);
+						rightBounds.expandBy(aabb);
+						rightIndices[numRight++] = primIndex;
+					} else {
+						leftBounds.expandBy(aabb);
+						rightBounds.expandBy(aabb);
+						KDAssert(numLeft < split.numLeft);
+						KDAssert(numRight < split.numRight);
+						leftIndices[numLeft++] = primIndex;
+						rightIndices[numRight++] = primIndex;
+					}
 				}
+			} else {
+				const int chunkCount = (int) ((m_primCount + MTS_KD_PARALLEL_CHUNK - 1)
+					/ MTS_KD_PARALLEL_CHUNK);
+				std::vector<size_type> chunkLeft(chunkCount+1), chunkRight(chunkCount+1);
+				std::vector<AABBType> chunkLeftBounds(chunkCount), chunkRightBounds(chunkCount);
+
+				/* One of the output lists aliases the input -- work on a copy. 
+				   Also remember the classification of every primitive, so that 
+				   the AABBs don't have to be computed twice. */
+				index_type *source = new index_type[m_primCount];
+				uint8_t *classes = new uint8_t[m_primCount];
+				memcpy(source, primIndices, sizeof(index_type) * m_primCount);
+
+				#pragma omp parallel for num_threads(threadCount) schedule(dynamic)
+				for (int chunk=0; chunk<chunkCount; ++chunk) {
+					const size_type start = (size_type) chunk * MTS_KD_PARALLEL_CHUNK,
+						end = std::min((size_type) (start + MTS_KD_PARALLEL_CHUNK), m_primCount);
+					AABBType &left = chunkLeftBounds[chunk], &right = chunkRightBounds[chunk];
+					size_type nLeft = 0, nRight = 0;
+					left.reset(); right.reset();
+
+					for (size_type i=start; i<end; ++i) {
+						const AABBType aabb = derived->getAABB(source[i]);
+						if (aabb.max[axis] <= splitPos) {
+							left.expandBy(aabb);
+							classes[i] = ELeftSide;
+							nLeft++;
+						} else if (aabb.min[axis] > splitPos) {
+							right.expandBy(aabb);
+							classes[i] = ERightSide;
+							nRight++;
+						} else {
+							left.expandBy(aabb);
+							right.expandBy(aabb);
+							classes[i] = EBothSides;
+							nLeft++; nRight++;
+						}
+					}
+					chunkLeft[chunk+1] = nLeft;
+					chunkRight[chunk+1] = nRight;
+				}
+
+				/* Prefix sum -> output offset of each chunk */
+				chunkLeft[0] = chunkRight[0] = 0;
+				for (int chunk=0; chunk<chunkCount; ++chunk) {
+					chunkLeft[chunk+1] += chunkLeft[chunk];
+					chunkRight[chunk+1] += chunkRight[chunk];
+					leftBounds.expandBy(chunkLeftBounds[chunk]);
+					rightBounds.expandBy(chunkRightBounds[chunk]);
+				}
+				numLeft = chunkLeft[chunkCount];
+				numRight = chunkRight[chunkCount];
+				KDAssert(numLeft == split.numLeft);
+				KDAssert(numRight == split.numRight);
+
+				#pragma omp parallel for num_threads(threadCount) schedule(dynamic)
+				for (int chunk=0; chunk<chunkCount; ++chunk) {
+					const size_type start = (size_type) chunk * MTS_KD_PARALLEL_CHUNK,
+						end = std::min((size_type) (start + MTS_KD_PARALLEL_CHUNK), m_primCount);
+					index_type *left = leftIndices + chunkLeft[chunk],
+							   *right = rightIndices + chunkRight[chunk];
+
+					for (size_type i=start; i<end; ++i) {
+						const index_type primIndex = source[i];
+						if (classes[i] != ERightSide)
+							*left++ = primIndex;
+						if (classes[i] != ELeftSide)
+							*right++ = primIndex;
+					}
+				}
+
+				delete[] source;
+				delete[] classes;
 			}
 
 			leftBounds.clip(m_aabb);
@@ -2606,6 +2807,27 @@ protected:
 			return boost::make_tuple(leftBounds, leftIndices,
 					rightBounds, rightIndices);
 		}
+	private:
+		/// Add the primitives <tt>indices[start..end-1]</tt> to the given bins
+		void binRange(const Derived *derived, const index_type *indices,
+				size_type start, size_type end, size_type *minBins, 
+				size_type *maxBins) const {
+			const int64_t maxBin = m_binCount-1;
+
+			for (size_type i=start; i<end; ++i) {
+				const AABBType aabb = derived->getAABB(indices[i]);
+				for (int axis=0; axis<point_type::dim; ++axis) {
+					int64_t minIdx = (int64_t) ((aabb.min[axis] - m_aabb.min[axis]) 
+							* m_invBinSize[axis]);
+					int64_t maxIdx = (int64_t) ((aabb.max[axis] - m_aabb.min[axis]) 
+							* m_invBinSize[axis]);
+					maxBins[axis * m_binCount 
+						+ std::max((int64_t) 0, std::min(maxIdx, maxBin))]++;
+					minBins[axis * m_binCount 
+						+ std::max((int64_t) 0, std::min(minIdx, maxBin))]++;
+				}
+			}
+		}
 	private:
 		size_type *m_minBins;
 		size_type *m_maxBins;
@@ -2616,8 +2838,34 @@ protected:
 		vector_type m_invBinSize;
 	};
 
+	/**
+	 * \brief Initialize the tree from node and index arrays that were 
+	 * created by a previous build (e.g. memory-mapped from a cache file)
+	 *
+	 * The memory remains owned by the caller and must stay valid for the
+	 * lifetime of the kd-tree. The node array must follow the alignment
+	 * convention of \ref KDNode::getSibling(), i.e. its address must be
+	 * congruent to 8 modulo 16.
+	 */
+	void initializeExternal(KDNode *nodes, size_type nodeCount,
+			index_type *indices, size_type indexCount,
+			const AABBType &aabb, const AABBType &tightAABB) {
+		if (isBuilt()) 
+			KDLog(EError, "The kd-tree has already been built!");
+		if (((size_t) nodes & 15) != 8)
+			KDLog(EError, "initializeExternal(): invalid node alignment!");
+		m_nodes = nodes;
+		m_indices = indices;
+		m_nodeCount = nodeCount;
+		m_indexCount = indexCount;
+		m_aabb = aabb;
+		m_tightAABB = tightAABB;
+		m_externalStorage = true;
+	}
+
 protected:
 	index_type *m_indices;
+	bool m_externalStorage;
 	Float m_traversalCost;
 	Float m_queryCost;
 	Float m_emptySpaceBonus;
@@ -2627,6 +2875,8 @@ protected:
 	size_type m_maxBadRefines;
 	size_type m_exactPrimThreshold;
 	size_type m_minMaxBins;
+	size_type m_buildThreadCount;
+	size_type m_threadCount;
 	size_type m_nodeCount;
 	size_type m_indexCount;
 	std::vector<TreeBuilder *> m_builders;
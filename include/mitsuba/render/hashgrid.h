@@ -0,0 +1,147 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__HASHGRID_H)
+#define __HASHGRID_H
+
+#include <mitsuba/render/photon.h>
+#include <mitsuba/render/shape.h>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Spatial hash grid over the gather points of a progressive
+ * photon mapping pass
+ *
+ * This is an alternative to querying a photon map once per gather point:
+ * photons are splatted into the grid as soon as they have been traced,
+ * and each one is accumulated into all gather points whose search
+ * radius contains it. The contributions are identical to the ones computed
+ * by \ref PhotonMap::estimateRadianceRaw(), but no photon map needs to
+ * be allocated or balanced.
+ *
+ * The cell size is set to the largest search radius, and every
+ * gather point is registered in all cells overlapped by its bounding
+ * box. Hence, a photon only needs to look up a single cell. To keep
+ * the rejection of distant gather points cheap, each cell also stores
+ * a compact copy of their positions and radii.
+ */
+class MTS_EXPORT_RENDER GatherPointHashGrid : public Object {
+public:
+	/// Create an empty hash grid
+	GatherPointHashGrid();
+
+	/// Remove all gather points (but keep the allocated memory)
+	void clear();
+
+	/**
+	 * \brief Register a gather point
+	 *
+	 * \param its
+	 *     Surface interaction associated with the gather point.
+	 *     The grid only stores a pointer, hence this must remain
+	 *     valid until the next call to \ref clear().
+	 * \param radius
+	 *     Current search radius. Gather points with a zero
+	 *     radius are never associated with any photons.
+	 * \param maxDepth
+	 *     Photons with a larger depth value are ignored
+	 * \return
+	 *     Index of the gather point, which can be used to query
+	 *     the accumulated contributions
+	 */
+	inline uint32_t append(const Intersection &its, Float radius, int maxDepth) {
+		GatherPointEntry entry;
+		entry.its = &its;
+		entry.radius = (float) radius;
+		entry.maxDepth = maxDepth;
+		m_entries.push_back(entry);
+		return (uint32_t) (m_entries.size() - 1);
+	}
+
+	/**
+	 * \brief Construct the hash table over all registered gather
+	 * points and reset the accumulated contributions
+	 */
+	void build();
+
+	/**
+	 * \brief Accumulate the contribution of a photon into all
+	 * gather points within range.
+	 *
+	 * This function is thread-safe and can be called by
+	 * several threads at the same time.
+	 */
+	void splat(const Photon &photon);
+
+	/// Return the number of registered gather points
+	inline size_t getGatherPointCount() const { return m_entries.size(); }
+
+	/// Return the number of photons that were accumulated into a gather point
+	inline size_t getPhotonCount(uint32_t index) const { return (size_t) m_photonCount[index]; }
+
+	/// Return the flux that was accumulated into a gather point
+	inline Spectrum getFlux(uint32_t index) const {
+		Spectrum result;
+		for (int i=0; i<SPECTRUM_SAMPLES; ++i)
+			result[i] = m_flux[index * SPECTRUM_SAMPLES + i];
+		return result;
+	}
+
+	/// Return a string representation
+	std::string toString() const;
+
+	MTS_DECLARE_CLASS()
+protected:
+	struct GatherPointEntry {
+		const Intersection *its;
+		float radius;
+		int maxDepth;
+	};
+
+	struct CellPoint {
+		float x, y, z;
+		float radiusSquared;
+	};
+
+	/// Virtual destructor
+	virtual ~GatherPointHashGrid() { }
+
+	/// Map integer cell coordinates to an entry of the hash table
+	inline uint32_t hash(int x, int y, int z) const {
+		return (((uint32_t) x * 73856093u) ^ ((uint32_t) y * 19349663u)
+			^ ((uint32_t) z * 83492791u)) % m_tableSize;
+	}
+
+	/// Compute the (unique) hash table cells overlapped by a gather point
+	int getCells(const GatherPointEntry &entry, uint32_t *cells) const;
+private:
+	std::vector<GatherPointEntry> m_entries;
+	std::vector<uint32_t> m_cellStart;
+	std::vector<uint32_t> m_cellEntries;
+	std::vector<CellPoint> m_cellPoints;
+	std::vector<Float> m_flux;
+	std::vector<int32_t> m_photonCount;
+	AABB m_aabb;
+	Float m_invCellSize;
+	uint32_t m_tableSize;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __HASHGRID_H */
@@ -395,6 +395,16 @@ protected:
 protected:
 	/// Used to temporarily cache a parallel process while it is in operation
 	ref<ParallelProcess> m_process;
+
+	/**
+	 * \brief Trace camera rays as SSE packets of four in \ref renderBlock()?
+	 *
+	 * Only integrators, whose \ref Li() implementation accepts a 
+	 * precomputed first intersection (i.e. it relies on 
+	 * \ref RadianceQueryRecord::rayIntersect()), should enable this.
+	 * Requires \c MTS_HAS_COHERENT_RT and is ignored otherwise.
+	 */
+	bool m_packetTracing;
 };
 
 /*
@@ -204,13 +204,38 @@ public:
 	/**
 	 * Use the irradiance cache to interpolate/extrapolate an
 	 * irradiance value for the given position and surface normal
-	 * Returns false on a cache miss
+	 * Returns false on a cache miss. When \c updateStatistics is
+	 * \c false, the lookup is not counted in the cache statistics
+	 * (e.g. when repeating a lookup that was already counted).
 	 */
-	bool get(const Intersection &its, Spectrum &E) const;
+	bool get(const Intersection &its, Spectrum &E, 
+		bool updateStatistics = true) const;
 
-	/// Manually insert an irradiance record
+	/**
+	 * Batched version of \ref get(), which traverses the
+	 * cache only once for a whole set of surface points.
+	 *
+	 * \param its
+	 *      Array of \c count surface interactions
+	 * \param E
+	 *      Array of \c count irradiance values. Only the
+	 *      entries of points with a cache hit are written.
+	 * \param hit
+	 *      Array of \c count flags, which are set to a nonzero
+	 *      value when the lookup was successful
+	 * \return The number of cache hits
+	 */
+	size_t get(const Intersection *its, Spectrum *E, uint8_t *hit, size_t count) const;
+
+	/**
+	 * Manually insert an irradiance record. This function 
+	 * can safely be called from multiple threads.
+	 */
 	void insert(Record *rec);
 
+	/// Return the number of stored irradiance records
+	size_t getRecordCount() const;
+
 	/**
 	 * Serialize an irradiance cache to a binary data stream
 	 */
@@ -326,12 +351,12 @@ protected:
     /* ===================================================================== */
 
 	Octree<Record *> m_octree;
-	std::vector<Record *> m_records;
+	/* All records (most recent first) */
+	LockFreeList<Record *> m_records;
 	Float m_kappa;
 	Float m_sceneSize;
 	Float m_minDist, m_maxDist;
 	bool m_clampScreen, m_clampNeighbor, m_useGradients;
-	ref<Mutex> m_mutex;
 };
 
 MTS_NAMESPACE_END
@@ -0,0 +1,148 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__LIGHTTREE_H)
+#define __LIGHTTREE_H
+
+#include <mitsuba/render/luminaire.h>
+#include <mitsuba/core/pdf.h>
+
+MTS_NAMESPACE_BEGIN
+
+/// Number of bins per axis, which are evaluated when splitting a light tree node
+#define MTS_LIGHTTREE_BINS 12
+
+/**
+ * \brief Bounding volume hierarchy over the luminaires of a scene, which
+ * chooses a luminaire for direct illumination depending on the shading point
+ *
+ * Every node stores the power, a bounding box and a cone bounding the
+ * emission directions of the luminaires below it. When sampling, the tree
+ * is traversed from the root, and each child is chosen with a probability
+ * proportional to a conservative estimate of its contribution at the
+ * shading point, which accounts for distance and orientation. Luminaires
+ * that face away from the shading point are therefore rarely chosen.
+ * The tree is built top-down using the surface area orientation heuristic
+ * (see "Importance Sampling of Many Lights with Adaptive Tree Splitting"
+ * by Conty Estevez and Kulla).
+ *
+ * Luminaires without finite bounds (e.g. environment maps) are kept in a
+ * separate list. The total sampling weights of both sets determine how
+ * often either one is chosen, which matches the position-independent
+ * luminaire sampling strategy of \ref Scene.
+ */
+class MTS_EXPORT_RENDER LightTree : public Object {
+public:
+	/**
+	 * \brief Build a light tree over the given luminaires
+	 *
+	 * \param importanceSample
+	 *    When set to \c true, the power of the luminaires is multiplied
+	 *    by their sampling weight (see \ref Luminaire::getSamplingWeight())
+	 */
+	LightTree(const std::vector<Luminaire *> &luminaires, bool importanceSample);
+
+	/**
+	 * \brief Choose a luminaire for direct illumination at \c p
+	 *
+	 * \param sample
+	 *    A uniformly distributed sample, which is rescaled so
+	 *    that it can be reused
+	 * \param pdf
+	 *    Returns the probability of choosing the luminaire
+	 */
+	const Luminaire *sample(const Point &p, Float &sample, Float &pdf) const;
+
+	/// Return the probability of choosing \c luminaire at the point \c p
+	Float pdf(const Point &p, const Luminaire *luminaire) const;
+
+	/// Return the number of nodes
+	inline size_t getNodeCount() const { return m_nodes.size(); }
+
+	/// Return the number of luminaires, which are not part of the hierarchy
+	inline size_t getUnboundedCount() const { return m_unbounded.size(); }
+
+	/// Return a human-readable representation
+	std::string toString() const;
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Cone bounding a set of emission directions
+	struct Cone {
+		Vector axis;
+		Float thetaO, thetaE;
+
+		/// Return the union of two cones
+		static Cone merge(const Cone &a, const Cone &b);
+
+		/// Orientation measure used by the surface area orientation heuristic
+		Float getMeasure() const;
+	};
+
+	struct Node {
+		AABB aabb;
+		Cone cone;
+		Float power;
+		/// Index of the parent node (-1 for the root)
+		int parent;
+		/// Index of the right child (inner nodes) or luminaire (leaves)
+		int index;
+		bool leaf;
+	};
+
+	/// Luminaire reference used during the tree construction
+	struct Primitive {
+		AABB aabb;
+		Cone cone;
+		Float power;
+		Point centroid;
+		int index;
+	};
+
+	/// Virtual destructor
+	virtual ~LightTree() { }
+
+	/// Recursively build the subtree over a range of primitives
+	int build(std::vector<Primitive> &primitives, int start, int end, int parent);
+
+	/// Estimate the contribution of all luminaires below a node at \c p
+	Float importance(const Node &node, const Point &p) const;
+
+	/// Return the probability of choosing the left child of an inner node at \c p
+	Float getLeftProbability(int nodeIndex, const Point &p) const;
+
+	/// Size measure of a bounding box used by the construction heuristic
+	static Float getAreaMeasure(const AABB &aabb);
+private:
+	std::vector<Node> m_nodes;
+	/// Luminaires that are stored in the hierarchy
+	std::vector<const Luminaire *> m_bounded;
+	/// Leaf node of each luminaire in \c m_bounded
+	std::vector<int> m_leaves;
+	/// Luminaires without finite bounds
+	std::vector<const Luminaire *> m_unbounded;
+	DiscretePDF m_unboundedPDF;
+	/// Maps luminaires to their index in \c m_bounded or \c m_unbounded (negated, minus one)
+	std::map<const Luminaire *, int> m_indices;
+	/// Probability of choosing a luminaire from the hierarchy
+	Float m_treeProbability;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __LIGHTTREE_H */
@@ -116,6 +116,24 @@ public:
 	Float pdfDir;
 };
 
+/**
+ * \brief Conservative bounds on the positions and emission directions
+ * of a luminaire, which are used to build the light tree of \ref Scene.
+ */
+struct LuminaireBounds {
+	/// Bounding box of all emitting points
+	AABB aabb;
+
+	/// Central axis of the surface normals (or spot light directions)
+	Vector axis;
+
+	/// Maximal angle between \c axis and any normal (at most \a pi)
+	Float thetaO;
+
+	/// Maximal angle between a normal and an emitted direction
+	Float thetaE;
+};
+
 /**
  * \brief Abstract implementation of a luminaire. Supports emission and
  * direct illumination sampling strategies, and computes related probabilities.
@@ -159,6 +177,16 @@ public:
 	 */
 	virtual Spectrum getPower() const = 0;
 
+	/**
+	 * \brief Compute conservative bounds on the positions and emission 
+	 * directions of this luminaire.
+	 *
+	 * The default implementation returns \c false, which marks luminaires
+	 * that are infinitely far away or otherwise unbounded (e.g. environment
+	 * maps). These are not stored in the light tree of \ref Scene.
+	 */
+	virtual bool getBounds(LuminaireBounds &bounds) const;
+
 	/// Is this luminaire intersectable (e.g. can it be encountered by a tracing a ray)?
 	inline bool isIntersectable() const { return m_intersectable; }
 
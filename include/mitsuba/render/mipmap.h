@@ -20,12 +20,27 @@
 #define __MIPMAP_H
 
 #include <mitsuba/core/bitmap.h>
+#include <mitsuba/core/fstream.h>
 
 MTS_NAMESPACE_BEGIN
 
 #define MIPMAP_LUTSIZE 128
 
+/// Resolution of the square texel tiles used by out-of-core mip maps
+#define MIPMAP_TILESIZE 64
+
 /** \brief Isotropic/anisotropic EWA mip-map texture map class based on PBRT 
+ *
+ * A mip map either keeps its whole pyramid in memory or refers to a 
+ * pre-tiled mip file on disk (see \ref writeTileFile() and \ref 
+ * fromTileFile()). In the latter case, tiles are loaded on demand
+ * through the global \ref TextureCache, which limits the amount of 
+ * memory used by all out-of-core textures.
+ *
+ * To reduce the memory footprint and bandwidth requirements of lookups, 
+ * texels can optionally be stored in a reduced-precision RGB format (see 
+ * \ref EStorageFormat). They are then converted into spectra on the fly 
+ * during filtering.
  */
 class MTS_EXPORT_RENDER MIPMap : public Object {
 public:
@@ -45,18 +60,69 @@ public:
 		ENone
 	};
 
+	enum EStorageFormat {
+		/// Full-precision spectra
+		ESpectrum = 0,
+		/// Linear RGB values stored as half-precision floats
+		EHalfRGB,
+		/// Linear RGB values with 8 bits per component
+		ELinearRGB8,
+		/// sRGB-encoded RGB values with 8 bits per component
+		ESRGB8
+	};
+
 	/**
 	 * Construct a new mip-map from the given texture. Does not
 	 * need to have a power-of-two size.
 	 */
 	MIPMap(int width, int height, Spectrum *pixels, 
 		EFilterType filterType = EEWA, EWrapMode wrapMode = ERepeat,
-		Float maxAnisotropy = 8.0f);
+		Float maxAnisotropy = 8.0f, EStorageFormat storageFormat = ESpectrum);
 
 	/// Construct a mip map from a HDR bitmap
 	static ref<MIPMap> fromBitmap(Bitmap *bitmap, 
 		EFilterType filterType = EEWA, EWrapMode wrapMode = ERepeat,
-		Float maxAnisotropy = 8.0f);
+		Float maxAnisotropy = 8.0f, EStorageFormat storageFormat = ESpectrum);
+
+	/**
+	 * \brief Open a pre-tiled mip file for out-of-core lookups
+	 *
+	 * \param key
+	 *    Identifies the contents of the source texture (see 
+	 *    \ref getSourceKey()). 
+	 * \return The mip map or \c NULL when the file does not exist 
+	 *    or was created using a different key or different settings
+	 */
+	static ref<MIPMap> fromTileFile(const fs::path &path, uint64_t key,
+		EFilterType filterType = EEWA, EWrapMode wrapMode = ERepeat,
+		Float maxAnisotropy = 8.0f, EStorageFormat storageFormat = ESpectrum);
+
+	/**
+	 * \brief Store an in-memory mip map as a pre-tiled mip file,
+	 * which can later be opened using \ref fromTileFile()
+	 *
+	 * \return \c false if the file could not be written
+	 */
+	bool writeTileFile(const fs::path &path, uint64_t key) const;
+
+	/**
+	 * \brief Compute a key that identifies the contents of a texture 
+	 * file based on its size and modification time and on an additional
+	 * parameter which affects the texel values (e.g. a gamma value)
+	 */
+	static uint64_t getSourceKey(const fs::path &path, Float parameter = 0);
+
+	/// Are the texels loaded on demand from a pre-tiled mip file?
+	inline bool isTiled() const { return m_tileFile.get() != NULL; }
+
+	/// Return the storage format of the texels
+	inline EStorageFormat getStorageFormat() const { return m_storageFormat; }
+
+	/**
+	 * \brief Return the amount of memory used by the texels of
+	 * an in-memory mip map in bytes (zero for out-of-core mip maps)
+	 */
+	size_t getMemoryUsage() const;
 
 	/// Do a mip-map lookup at the appropriate level
 	Spectrum getValue(Float u, Float v,
@@ -74,11 +140,24 @@ public:
 	/// Return the height of the represented texture
 	inline int getHeight() const { return m_height; }
 
-	/// Return a pointer to internal image representation at full resolution
-	inline const Spectrum *getImageData() const { return m_pyramid[0]; }
+	/**
+	 * \brief Return a pointer to internal image representation at full 
+	 * resolution (only available for in-memory mip maps storing spectra)
+	 */
+	inline const Spectrum *getImageData() const { 
+		Assert(m_pyramid);
+		return m_pyramid[0]; 
+	}
 	
-	/// Return a pointer to internal image representation at the specified resolution
-	inline const Spectrum *getImageData(int level) const { return m_pyramid[level]; }
+	/**
+	 * \brief Return a pointer to internal image representation at the
+	 * specified resolution (only available for in-memory mip maps 
+	 * storing spectra)
+	 */
+	inline const Spectrum *getImageData(int level) const { 
+		Assert(m_pyramid);
+		return m_pyramid[level]; 
+	}
 
 	/// Return the resolution of the specified level
 	inline const Vector2i getLevelResolution(int level) const {
@@ -96,25 +175,60 @@ public:
 
 	MTS_DECLARE_CLASS()
 protected:
+	friend class TextureCache;
+
 	/// \cond
 	struct ResampleWeight {
 		int firstTexel;
 		Float weight[4];
 	};
+
+	/// Tiles that are pinned during a lookup of an out-of-core mip map
+	struct TileLookup;
 	/// \endcond
 
+	/// Create an out-of-core mip map (used by \ref fromTileFile())
+	MIPMap(FileStream *file, int width, int height, int levels,
+		const int *levelWidth, const int *levelHeight, const Spectrum &maximum,
+		EFilterType filterType, EWrapMode wrapMode, Float maxAnisotropy,
+		EStorageFormat storageFormat);
+
+	/// Initialize the EWA weight lookup table
+	void initializeWeights();
+
+	/// Load the texels of a tile of an out-of-core mip map
+	void loadTile(uint32_t index, uint8_t *target) const;
+
+	/// Convert a stored texel into a spectrum
+	inline Spectrum decodeTexel(const uint8_t *data) const;
+
+	/// Convert a spectrum into the storage format
+	void encodeTexel(const Spectrum &value, uint8_t *data) const;
+
+	/// Return the in-memory size of a texel using the given format
+	static size_t getTexelSize(EStorageFormat format);
+
 	/// Calculate weights for up-sampling a texture
 	ResampleWeight *resampleWeights(int oldRes, int newRes) const;
 
 	/// Look up a texel at the given hierarchy level
 	Spectrum getTexel(int level, int x, int y) const;
 
+	/// Look up a texel at the given hierarchy level
+	Spectrum getTexel(TileLookup &lookup, int level, int x, int y) const;
+
+	/// Return a texel at the given hierarchy level (without wrapping)
+	Spectrum getStoredTexel(TileLookup &lookup, int level, int x, int y) const;
+
+	/// Bilinear interpolation using a triangle filter
+	Spectrum triangle(TileLookup &lookup, int level, Float x, Float y) const;
+
 	/**
 	 * Calculate the elliptically weighted average of a sample with
      * differential uv information
 	 */
-	Spectrum EWA(Float u, Float v, Float dudx, Float dudy, Float dvdx, 
-		Float dvdy, int level) const;
+	Spectrum EWA(TileLookup &lookup, Float u, Float v, Float dudx, Float dudy,
+		Float dvdx, Float dvdy, int level) const;
 
 	/* Virtual destructor */
 	virtual ~MIPMap();
@@ -124,10 +238,22 @@ private:
 	int *m_levelWidth;
 	int *m_levelHeight;
 	Spectrum **m_pyramid;
+	uint8_t **m_packedPyramid;
+	EStorageFormat m_storageFormat;
+	size_t m_texelSize;
 	EFilterType m_filterType;
 	EWrapMode m_wrapMode;
 	Float *m_weightLut;
 	Float m_maxAnisotropy;
+
+	/* Out-of-core storage */
+	mutable ref<FileStream> m_tileFile;
+	mutable ref<Mutex> m_tileFileMutex;
+	int64_t m_tileFileOffset;
+	int *m_levelTilesX;
+	int *m_levelTileOffset;
+	uint32_t m_cacheID;
+	Spectrum m_maximum;
 };
 
 MTS_NAMESPACE_END
@@ -84,8 +84,14 @@ public:
 	 * Recursively build a left-balanced kd-tree. This has to be
 	 * done once after all photons have been stored, but prior to
 	 * executing any queries.
+	 *
+	 * \param parallel
+	 *      When set to \c true, the upper levels of the tree are
+	 *      balanced one level at a time, and the resulting independent
+	 *      subtrees are processed by multiple threads. The resulting
+	 *      tree is identical to the one created by the serial version.
 	 */
-	void balance();
+	void balance(bool parallel = true);
 
 	/**
 	 * Using the photon map, estimate the irradiance on a surface (Unfiltered)
@@ -259,6 +265,18 @@ protected:
 		float value;
 	};
 
+	/**
+	 * Positions of four consecutive leaf photons (heap indices 4i..4i+3)
+	 * stored in SoA form, so that they can be tested using a single 
+	 * cache line and a few SIMD instructions. Unused lanes are set
+	 * to infinity.
+	 */
+	struct PositionBlock {
+		float x[4];
+		float y[4];
+		float z[4];
+	};
+
 	/// Distance metric used to build MAX-heaps for nearest-neighbor searches
 	struct distanceMetric : public 
 		std::binary_function<search_result, search_result, bool> {
@@ -317,6 +335,13 @@ protected:
 		photon_iterator sortEnd,
 		std::vector<size_t> &heapPermutation,
 		AABB &aabb, size_t heapIndex) const;
+
+	/**
+	 * Create the blocked SoA copy of the leaf photon positions
+	 * that is used to accelerate nearest-neighbor searches.
+	 * Must be called after the photon array has been balanced.
+	 */
+	void buildPositionBlocks();
 private:
     /* ===================================================================== */
     /*                        Protected attributes                           */
@@ -327,6 +352,8 @@ private:
 	size_t m_maxPhotons;
 	size_t m_lastInnerNode;
 	size_t m_lastRChildNode;
+	PositionBlock *m_blocks;
+	size_t m_firstBlock, m_blockCount;
 	bool m_balanced;
 	Float m_scale;
 };
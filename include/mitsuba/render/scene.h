@@ -26,6 +26,7 @@
 #include <mitsuba/render/skdtree.h>
 #include <mitsuba/render/camera.h>
 #include <mitsuba/render/luminaire.h>
+#include <mitsuba/render/lighttree.h>
 #include <mitsuba/render/integrator.h>
 #include <mitsuba/render/bsdf.h>
 #include <mitsuba/render/subsurface.h>
@@ -231,6 +232,25 @@ public:
 		return m_kdtree->rayIntersect(ray, t, shape, n);
 	}
 
+#if defined(MTS_HAS_COHERENT_RT)
+	/**
+	 * \brief Intersect a group of four rays against all primitives stored
+	 * in the scene and return detailed intersection information
+	 *
+	 * When the rays are coherent, they are traced as a single SSE packet.
+	 *
+	 * \param rays
+	 *    Pointer to an array of four rays
+	 *
+	 * \param its
+	 *    Pointer to an array of four intersection records, which will
+	 *    be filled by the intersection query
+	 */
+	inline void rayIntersectPacket(const Ray *rays, Intersection *its) const {
+		m_kdtree->rayIntersectPacket(rays, its);
+	}
+#endif
+
 	/**
 	 * \brief Test for occlusion between \c p1 and \c p2 at the
 	 * specified time
@@ -562,6 +582,15 @@ protected:
 	/// Add a shape to the scene
 	void addShape(Shape *shape);
 
+	/**
+	 * \brief Choose a luminaire for direct illumination at \c p. The sample
+	 * value is rescaled so that it can be reused.
+	 */
+	const Luminaire *chooseLuminaire(const Point &p, Float &sample, Float &pdf) const;
+
+	/// Return the probability of choosing \c luminaire in \ref chooseLuminaire()
+	Float pdfChooseLuminaire(const Point &p, const Luminaire *luminaire) const;
+
 private:
 	ref<ShapeKDTree> m_kdtree;
 	ref<Camera> m_camera;
@@ -578,9 +607,11 @@ private:
 	fs::path m_sourceFile;
 	fs::path m_destinationFile;
 	DiscretePDF m_luminairePDF;
+	ref<LightTree> m_lightTree;
 	AABB m_aabb;
 	BSphere m_bsphere;
 	bool m_importanceSampleLuminaires;
+	bool m_useLightTree;
 	ETestType m_testType;
 	Float m_testThresh;
 	int m_blockSize;
@@ -22,12 +22,7 @@
 #include <mitsuba/render/shape.h>
 #include <mitsuba/render/sahkdtree3.h>
 #include <mitsuba/render/triaccel.h>
-
-#if defined(MTS_KD_CONSERVE_MEMORY)
-#if defined(MTS_HAS_COHERENT_RT)
-#error MTS_KD_CONSERVE_MEMORY & MTS_HAS_COHERENT_RT are incompatible
-#endif
-#endif
+#include <mitsuba/core/mmap.h>
 
 #if defined(SINGLE_PRECISION)
 /// 32 byte temporary storage for intersection computations 
@@ -59,7 +54,7 @@ typedef const Shape * ConstShapePtr;
  *
  * When compiled with \c MTS_KD_CONSERVE_MEMORY, the Moeller-Trumbore intersection 
  * test is used instead, which doesn't need any extra storage. However, it also
- * tends to be quite a bit slower.
+ * tends to be quite a bit slower. Both variants support coherent ray packets.
  *
  * \sa GenericKDTree
  */
@@ -96,6 +91,21 @@ public:
 	/// Return an bounding sphere containing all primitives
 	inline const BSphere &getBSphere() const { return m_bsphere; }
 
+	/**
+	 * \brief Set a directory for caching built kd-trees on disk
+	 *
+	 * When set, \ref build() first computes a hash of the geometry and 
+	 * of all tree construction parameters. If a matching cache file 
+	 * exists in this directory, its node and index arrays are mapped into 
+	 * memory instead of rebuilding the tree. Otherwise, the tree is built 
+	 * as usual and then written to the cache. An empty path (the default) 
+	 * disables caching.
+	 */
+	inline void setCacheDirectory(const fs::path &path) { m_cacheDirectory = path; }
+
+	/// Return the kd-tree cache directory (or an empty path if disabled)
+	inline const fs::path &getCacheDirectory() const { return m_cacheDirectory; }
+
 	/// Build the kd-tree (needs to be called before tracing any rays)
 	void build();
 
@@ -184,6 +194,23 @@ public:
 	 */
 	void rayIntersectPacketIncoherent(const RayPacket4 &packet, 
 		const RayInterval4 &interval, Intersection4 &its, void *temp) const;
+
+	/**
+	 * \brief Intersect a group of four rays against all primitives stored
+	 * in the kd-tree and return detailed intersection information
+	 *
+	 * The rays are traced as a single SSE packet when their direction
+	 * signs agree (e.g. camera rays through the same pixel). Otherwise,
+	 * this function falls back to \ref rayIntersectPacketIncoherent.
+	 *
+	 * \param rays
+	 *    Pointer to an array of four rays
+	 *
+	 * \param its
+	 *    Pointer to an array of four intersection records. Entries
+	 *    without an intersection are marked as invalid.
+	 */
+	void rayIntersectPacket(const Ray *rays, Intersection *its) const;
 #endif
 	//! @}
 	// =============================================================
@@ -357,9 +384,6 @@ protected:
 			const TriMesh *trimesh = static_cast<const TriMesh *>(shape);
 			const Triangle &tri = trimesh->getTriangles()[cache->primIndex];
 			const Point *vertexPositions = trimesh->getVertexPositions();
-			const Normal *vertexNormals = trimesh->getVertexNormals();
-			const Point2 *vertexTexcoords = trimesh->getVertexTexcoords();
-			const Spectrum *vertexColors = trimesh->getVertexColors();
 			const TangentSpace *vertexTangents = trimesh->getVertexTangents();
 			const Vector b(1 - cache->u - cache->v, cache->u, cache->v);
 
@@ -380,10 +404,11 @@ protected:
 
 			its.geoFrame = Frame(faceNormal);
 
-			if (EXPECT_TAKEN(vertexNormals)) {
-				const Normal &n0 = vertexNormals[idx0];
-				const Normal &n1 = vertexNormals[idx1];
-				const Normal &n2 = vertexNormals[idx2];
+			/* The per-vertex accessors transparently decode compact attributes */
+			if (EXPECT_TAKEN(trimesh->hasVertexNormals())) {
+				const Normal n0 = trimesh->getVertexNormal(idx0);
+				const Normal n1 = trimesh->getVertexNormal(idx1);
+				const Normal n2 = trimesh->getVertexNormal(idx2);
 
 				if (EXPECT_TAKEN(!vertexTangents)) {
 					its.shFrame = Frame(normalize(n0 * b.x + n1 * b.y + n2 * b.z));
@@ -405,19 +430,19 @@ protected:
 				its.dpdu = its.dpdv = Vector(0.0f);
 			}
 
-			if (EXPECT_TAKEN(vertexTexcoords)) {
-				const Point2 &t0 = vertexTexcoords[idx0];
-				const Point2 &t1 = vertexTexcoords[idx1];
-				const Point2 &t2 = vertexTexcoords[idx2];
+			if (EXPECT_TAKEN(trimesh->hasVertexTexcoords())) {
+				const Point2 t0 = trimesh->getVertexTexcoord(idx0);
+				const Point2 t1 = trimesh->getVertexTexcoord(idx1);
+				const Point2 t2 = trimesh->getVertexTexcoord(idx2);
 				its.uv = t0 * b.x + t1 * b.y + t2 * b.z;
 			} else {
 				its.uv = Point2(0.0f);
 			}
 
-			if (EXPECT_NOT_TAKEN(vertexColors)) {
-				const Spectrum &c0 = vertexColors[idx0],
-							&c1 = vertexColors[idx1],
-							&c2 = vertexColors[idx2];
+			if (EXPECT_NOT_TAKEN(trimesh->hasVertexColors())) {
+				const Spectrum c0 = trimesh->getVertexColor(idx0),
+							   c1 = trimesh->getVertexColor(idx1),
+							   c2 = trimesh->getVertexColor(idx2);
 				its.color = c0 * b.x + c1 * b.y + c2 * b.z;
 			}
 
@@ -461,6 +486,18 @@ protected:
 		return false;
 	}
 
+	/**
+	 * \brief Compute a hash of the stored geometry and the tree
+	 * construction parameters, which serves as the cache key
+	 */
+	uint64_t getCacheHash() const;
+
+	/// Try to load the tree from the cache file. Returns \c false on failure
+	bool loadCache(const fs::path &filename, uint64_t hash);
+
+	/// Write the tree to a cache file
+	void saveCache(const fs::path &filename, uint64_t hash) const;
+
 	/// Virtual destructor
 	virtual ~ShapeKDTree();
 private:
@@ -471,6 +508,8 @@ private:
 	TriAccel *m_triAccel;
 #endif
 	BSphere m_bsphere;
+	fs::path m_cacheDirectory;
+	ref<MemoryMappedFile> m_cacheFile;
 };
 
 MTS_NAMESPACE_END
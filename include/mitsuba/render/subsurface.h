@@ -20,6 +20,10 @@
 #define __SUBSURFACE_H
 
 #include <mitsuba/core/netobject.h>
+#include <mitsuba/core/lock.h>
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
 
 MTS_NAMESPACE_BEGIN
 
@@ -27,15 +31,52 @@ MTS_NAMESPACE_BEGIN
  * A storage place for material properties for the subsurface
  * integrators in use. It is implemented as a singlton object
  * and offers speed-ups when used e.g. for LUT storage.
- * ToDo: Add mutex.
+ *
+ * LUTs can additionally be kept in a persistent cache directory,
+ * so that they are shared between renderings. The directory is
+ * taken from the \c MTS_LUT_CACHE environment variable. Otherwise,
+ * a directory named \c lutcache is used if the file resolver of
+ * the calling thread can find one (e.g. next to the scene file).
+ * Files are written under a temporary name and renamed afterwards,
+ * hence multiple processes can safely share the directory.
  */
 class MTS_EXPORT_RENDER SubsurfaceMaterialManager : public Object {
 
     /* private constructor */
-    SubsurfaceMaterialManager( ) { }
+    SubsurfaceMaterialManager();
 
 public:
-    typedef std::vector<Spectrum> LUTType;
+    /**
+     * Reference-counted look-up-table storing a spectrum per entry
+     */
+    class LUTType : public Object {
+    public:
+        inline LUTType(size_t size) : m_entries(size) { }
+
+        /// Unserialize a look-up-table from a binary data stream
+        inline LUTType(Stream *stream) : m_entries(stream->readSize()) {
+            for (size_t i=0; i<m_entries.size(); ++i)
+                m_entries[i] = Spectrum(stream);
+        }
+
+        /// Serialize a look-up-table to a binary data stream
+        inline void serialize(Stream *stream) const {
+            stream->writeSize(m_entries.size());
+            for (size_t i=0; i<m_entries.size(); ++i)
+                m_entries[i].serialize(stream);
+        }
+
+        inline size_t size() const { return m_entries.size(); }
+
+        inline Spectrum &at(size_t index) { return m_entries.at(index); }
+
+        inline const Spectrum &at(size_t index) const { return m_entries.at(index); }
+    protected:
+        /* Virtual destructor */
+        virtual ~LUTType() { }
+    private:
+        std::vector<Spectrum> m_entries;
+    };
 
     /**
      * Small data structure to store information about a look-up-table.
@@ -56,12 +97,23 @@ public:
 
 	MTS_DECLARE_CLASS()
 public:
-    bool hasLUT(const std::string &hash) const;
+    /**
+     * Check whether a LUT is available. When it is not in memory,
+     * an attempt is made to load it from the cache directory.
+     */
+    bool hasLUT(const std::string &hash);
 
+    /// Store a LUT in memory and in the cache directory (if any)
     void addLUT(const std::string &hash, const LUTRecord &lutRec);
 
     LUTRecord getLUT(const std::string &hash) const;
 
+    /**
+     * Explicitly set the LUT cache directory. An empty path
+     * disables the persistent cache.
+     */
+    void setCacheDirectory(const fs::path &path);
+
     std::string getMultipoleLUTHashR(Float resolution, Float errorThreshold,
         const Spectrum &sigmaTr, const Spectrum &alphaPrime, int numExtraDipoles,
         const std::vector<Spectrum> &zrList, const std::vector<Spectrum> &zvList) const;
@@ -88,9 +140,26 @@ protected:
     /* singlton instance */
     static ref<SubsurfaceMaterialManager> m_instance;
 
+    /// Return the cache directory (or an empty path if there is none)
+    fs::path getCacheDirectory() const;
+
+    /// Try to load a LUT from the cache directory
+    bool loadLUT(const fs::path &directory, const std::string &hash,
+        LUTRecord &lutRec) const;
+
+    /// Write a LUT to the cache directory
+    void saveLUT(const fs::path &directory, const std::string &hash,
+        const LUTRecord &lutRec) const;
+
     /* lut map */
     StorageType m_lutRecords;
 
+    /* persistent cache directory */
+    fs::path m_cacheDirectory;
+    bool m_cacheDirectorySet;
+
+    mutable ref<Mutex> m_mutex;
+
 	/* Virtual destructor */
 	virtual ~SubsurfaceMaterialManager();
 };
@@ -0,0 +1,146 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__TEXCACHE_H)
+#define __TEXCACHE_H
+
+#include <mitsuba/core/lock.h>
+#include <mitsuba/core/atomic.h>
+
+MTS_NAMESPACE_BEGIN
+
+/// Number of independently locked parts of the texture cache
+#define MTS_TEXCACHE_SHARDS 64
+
+/// Default memory budget of the texture cache (in MiB)
+#define MTS_TEXCACHE_DEFAULT_BUDGET 512
+
+/**
+ * \brief Global cache for the texel tiles of out-of-core mip maps
+ *
+ * Tiles are loaded on demand by their owning \ref MIPMap and evicted in
+ * least-recently-used order once the memory budget is exceeded. To keep
+ * contention low when many threads perform texture lookups at the same
+ * time, the cache is split into \ref MTS_TEXCACHE_SHARDS shards with
+ * separate locks, each of which receives an equal share of the budget.
+ * Tile data is loaded without holding any lock.
+ *
+ * A tile returned by \ref get() is pinned and cannot be evicted until
+ * it is handed back using \ref release().
+ */
+class MTS_EXPORT_RENDER TextureCache : public Object {
+public:
+	/// A tile of texels, which is resident in the cache
+	struct Tile {
+		uint64_t key;
+		/// Texels in the storage format of the mip map
+		uint8_t *data;
+		size_t size;
+		/// Number of lookups that currently use the tile
+		volatile int32_t pins;
+		/// Neighbors in the LRU list of the shard
+		Tile *prev, *next;
+	};
+
+	/// Return the global texture cache
+	static TextureCache *getInstance() { return m_instance; }
+
+	/// Allocate a unique identifier for the tiles of a mip map
+	uint32_t allocateID();
+
+	/**
+	 * \brief Look up and pin the tile with index \c index of the mip
+	 * map with the identifier \c id. On a cache miss, the tile is
+	 * loaded using \ref MIPMap::loadTile().
+	 */
+	Tile *get(const MIPMap *mipmap, uint32_t id, uint32_t index);
+
+	/// Unpin a tile that was returned by \ref get()
+	inline void release(Tile *tile) {
+		atomicAdd(&tile->pins, -1);
+	}
+
+	/**
+	 * \brief Remove all tiles of the mip map with the given identifier.
+	 * None of them may be pinned.
+	 */
+	void purge(uint32_t id);
+
+	/// Set the memory budget of the cache in bytes
+	void setMemoryBudget(size_t budget);
+
+	/// Return the memory budget of the cache in bytes
+	inline size_t getMemoryBudget() const { return m_budget; }
+
+	/// Return the amount of memory used by resident tiles in bytes
+	size_t getMemoryUsage() const;
+
+	/// Return a human-readable representation
+	std::string toString() const;
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Independently locked part of the cache
+	struct Shard {
+		mutable ref<Mutex> mutex;
+		std::map<uint64_t, Tile *> tiles;
+		/// Sentinel of the LRU list (most recently used tile first)
+		Tile lru;
+		size_t memory;
+	};
+
+	/// Create a new texture cache
+	TextureCache();
+
+	/// Virtual destructor
+	virtual ~TextureCache();
+
+	/// Select the shard that is responsible for a key
+	inline Shard &getShard(uint64_t key) {
+		return m_shards[(key * 0x9E3779B97F4A7C15ULL) >> 58];
+	}
+
+	/// Evict unpinned tiles until the shard fits into its budget
+	void evict(Shard &shard);
+
+	/// Unlink a tile from the LRU list
+	static inline void unlink(Tile *tile) {
+		tile->prev->next = tile->next;
+		tile->next->prev = tile->prev;
+	}
+
+	/// Insert a tile at the front of the LRU list
+	static inline void linkFront(Shard &shard, Tile *tile) {
+		tile->prev = &shard.lru;
+		tile->next = shard.lru.next;
+		shard.lru.next->prev = tile;
+		shard.lru.next = tile;
+	}
+
+	/// Release the memory of a tile
+	static void freeTile(Tile *tile);
+private:
+	static ref<TextureCache> m_instance;
+	Shard m_shards[MTS_TEXCACHE_SHARDS];
+	size_t m_budget;
+	volatile int32_t m_nextID;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __TEXCACHE_H */
@@ -48,6 +48,14 @@ struct TangentSpace {
  */
 class MTS_EXPORT_RENDER TriMesh : public Shape {
 public:
+	/// Storage of the data blocks written by \ref serialize(Stream *, ECompressionMode)
+	enum ECompressionMode {
+		/// Compress every block separately (the default)
+		ECompressed = 0,
+		/// Store the blocks without compression, which is faster to load
+		EUncompressed
+	};
+
 	/// Create a new, empty triangle mesh with the specified state
 	TriMesh(const std::string &name, 
 			size_t triangleCount, size_t vertexCount,
@@ -65,6 +73,10 @@ public:
 	 * will remain stable as Mitsuba evolves. The files
 	 * can optionally contain multiple meshes -- in that case,
 	 * the specified index determines which one to load.
+	 *
+	 * When \c stream is a \ref MemoryStream (e.g. wrapping a
+	 * memory-mapped file), the data blocks of the current format
+	 * version are decoded in parallel without any further copies.
 	 */
 	TriMesh(Stream *stream, int idx = 0);
 	
@@ -111,26 +123,58 @@ public:
 	/// Return the vertex positions
 	inline Point *getVertexPositions() { return m_positions; };
 
-	/// Return the vertex normals (const version)
+	/**
+	 * \brief Return the vertex normals (const version)
+	 *
+	 * Returns \c NULL when the normals are stored in compact form.
+	 * \ref getVertexNormal() works in either case.
+	 */
 	inline const Normal *getVertexNormals() const { return m_normals; };
 	/// Return the vertex normals
 	inline Normal *getVertexNormals() { return m_normals; };
 	/// Does the mesh have vertex normals?
-	inline bool hasVertexNormals() const { return m_normals != NULL; };
+	inline bool hasVertexNormals() const { return m_normals != NULL || m_packedNormals != NULL; };
+	/// Return the normal of a single vertex
+	inline Normal getVertexNormal(size_t index) const {
+		return m_normals ? m_normals[index] : unpackNormal(m_packedNormals[index]);
+	}
 
-	/// Return the vertex colors (const version)
+	/**
+	 * \brief Return the vertex colors (const version)
+	 *
+	 * Returns \c NULL when the colors are stored in compact form.
+	 * \ref getVertexColor() works in either case.
+	 */
 	inline const Spectrum *getVertexColors() const { return m_colors; };
 	/// Return the vertex colors
 	inline Spectrum *getVertexColors() { return m_colors; };
 	/// Does the mesh have vertex colors?
-	inline bool hasVertexColors() const { return m_colors != NULL; };
+	inline bool hasVertexColors() const { return m_colors != NULL || m_packedColors != NULL; };
+	/// Return the color of a single vertex
+	inline Spectrum getVertexColor(size_t index) const {
+		return m_colors ? m_colors[index] : unpackColor(m_packedColors[index]);
+	}
 
-	/// Return the vertex texture coordinates (const version)
+	/**
+	 * \brief Return the vertex texture coordinates (const version)
+	 *
+	 * Returns \c NULL when the texture coordinates are stored in compact
+	 * form. \ref getVertexTexcoord() works in either case.
+	 */
 	inline const Point2 *getVertexTexcoords() const { return m_texcoords; };
 	/// Return the vertex texture coordinates
 	inline Point2 *getVertexTexcoords() { return m_texcoords; };
 	/// Does the mesh have vertex texture coordinates?
-	inline bool hasVertexTexcoords() const { return m_texcoords != NULL; };
+	inline bool hasVertexTexcoords() const { return m_texcoords != NULL || m_packedTexcoords != NULL; };
+	/// Return the texture coordinates of a single vertex
+	inline Point2 getVertexTexcoord(size_t index) const {
+		if (m_texcoords)
+			return m_texcoords[index];
+		uint32_t value = m_packedTexcoords[index];
+		return Point2(
+			m_texcoordOffset.x + (Float) (value & 0xFFFF) * m_texcoordScale.x,
+			m_texcoordOffset.y + (Float) (value >> 16) * m_texcoordScale.y);
+	}
 
 	/// Return the vertex tangents (const version)
 	inline const TangentSpace *getVertexTangents() const { return m_tangents; };
@@ -173,6 +217,56 @@ public:
 	/// Generate surface normals
 	void computeNormals();
 
+	/**
+	 * \brief Convert the vertex normals, texture coordinates and colors
+	 * into a compact representation, which uses 4 bytes per vertex
+	 * and attribute.
+	 *
+	 * Normals are octahedrally encoded using 2x16 bits, texture
+	 * coordinates are quantized to 2x16 bits relative to their
+	 * bounding box, and colors are converted to RGBE. The attributes
+	 * are decoded when filling intersection records.
+	 *
+	 * This is done at the end of \ref configure() when the
+	 * \c compactAttributes parameter is set. Afterwards, the
+	 * mesh topology and its tangents can no longer be changed.
+	 */
+	void compactAttributes();
+
+	/// Are any vertex attributes stored in compact form?
+	inline bool hasCompactAttributes() const {
+		return m_packedNormals || m_packedTexcoords || m_packedColors;
+	}
+
+	/// Decode an octahedrally encoded normal (see \ref compactAttributes())
+	static inline Normal unpackNormal(uint32_t value) {
+		if (EXPECT_NOT_TAKEN(value == 0x80008000u))
+			return Normal(0.0f); /* Reserved for zero-valued normals */
+		Float x = (int16_t) (value & 0xFFFF) * (1.0f / 32767.0f),
+		      y = (int16_t) (value >> 16) * (1.0f / 32767.0f),
+		      z = 1.0f - std::abs(x) - std::abs(y);
+		if (z < 0) {
+			Float tmp = (1.0f - std::abs(y)) * (x >= 0 ? 1.0f : -1.0f);
+			y = (1.0f - std::abs(x)) * (y >= 0 ? 1.0f : -1.0f);
+			x = tmp;
+		}
+		return normalize(Normal(x, y, z));
+	}
+
+	/// Decode an RGBE-encoded color (see \ref compactAttributes())
+	static inline Spectrum unpackColor(uint32_t value) {
+		Spectrum result(0.0f);
+		int exponent = (int) (value >> 24);
+		if (exponent != 0) {
+			Float scale = std::ldexp((Float) 1, exponent - (128+8));
+			result.fromLinearRGB(
+				((value & 0xFF) + 0.5f) * scale,
+				(((value >> 8) & 0xFF) + 0.5f) * scale,
+				(((value >> 16) & 0xFF) + 0.5f) * scale);
+		}
+		return result;
+	}
+
 	/**
 	 * \brief Regenerate the triangulation so that adjacent faces
 	 * with an angle greater than \a maxAngle degrees become disconnected.
@@ -197,8 +291,13 @@ public:
 	 * This is an alternative routine, which \a only loads triangle
 	 * data (no BSDF, Sub-surface integrator, etc.) in a format that
 	 * will remain stable as Mitsuba evolves.
+	 *
+	 * The mesh data is split into blocks of at most 1 MiB, which
+	 * are compressed independently and listed in an offset table.
+	 * This allows them to be decoded in parallel. The stream
+	 * must support \ref Stream::getPos().
 	 */
-	void serialize(Stream *stream) const;
+	void serialize(Stream *stream, ECompressionMode mode = ECompressed) const;
 
 	/**
 	 * \brief Build a discrete probability distribution 
@@ -222,6 +321,15 @@ protected:
 	/// Create a new triangle mesh
 	TriMesh(const Properties &props);
 
+	/**
+	 * \brief Load the vertex and triangle data of a mesh that was
+	 * written by \ref serialize(Stream *, ECompressionMode)
+	 *
+	 * This function is used by the unserialization constructor
+	 * and overwrites \c m_faceNormals.
+	 */
+	void readSerialized(Stream *stream, int index);
+
 	/// Virtual destructor
 	virtual ~TriMesh();
 protected:
@@ -234,10 +342,16 @@ protected:
 	Point2 *m_texcoords;
 	TangentSpace *m_tangents;
 	Spectrum *m_colors;
+	uint32_t *m_packedNormals;
+	uint32_t *m_packedTexcoords;
+	uint32_t *m_packedColors;
+	Point2 m_texcoordOffset;
+	Vector2 m_texcoordScale;
 	size_t m_triangleCount;
 	size_t m_vertexCount;
 	bool m_flipNormals;
 	bool m_faceNormals;
+	bool m_compactAttributes;
 	Float m_surfaceArea;
 	Float m_invSurfaceArea;
 };
@@ -21,9 +21,73 @@
 
 #include <mitsuba/core/cobject.h>
 #include <mitsuba/core/aabb.h>
+#include <mitsuba/core/transform.h>
 
 MTS_NAMESPACE_BEGIN
 
+/**
+ * \brief Coarse grid storing bounds on the values of a scalar volume
+ *
+ * Every cell stores the minimum and maximum value that can be returned 
+ * by \ref VolumeDataSource::lookupFloat() within its extents. Tracking-based 
+ * integration methods can use this information to work with local 
+ * majorants and to skip over empty regions.
+ */
+class MTS_EXPORT_RENDER MajorantGrid : public Object {
+public:
+	/**
+	 * \brief Create a new majorant grid with all bounds set to zero
+	 *
+	 * \param res
+	 *    Number of cells along each axis
+	 * \param worldToGrid
+	 *    Transformation from world space into grid space, where cell 
+	 *    <tt>(x, y, z)</tt> covers the region <tt>[x, x+1] x [y, y+1] x [z, z+1]</tt>.
+	 *    Must be affine.
+	 */
+	MajorantGrid(const Vector3i &res, const Transform &worldToGrid);
+
+	/// Return the number of cells along each axis
+	inline const Vector3i &getResolution() const { return m_res; }
+
+	/// Return the transformation from world space into grid space
+	inline const Transform &getWorldToGrid() const { return m_worldToGrid; }
+
+	/// Return the linear index of a cell
+	inline size_t getCellIndex(int x, int y, int z) const {
+		return ((size_t) z * m_res.y + y) * m_res.x + x;
+	}
+
+	/// Return the smallest value within a cell
+	inline Float getMinimum(size_t index) const { return (Float) m_min[index]; }
+
+	/// Return the largest value within a cell
+	inline Float getMaximum(size_t index) const { return (Float) m_max[index]; }
+
+	/// Set the bounds of a cell
+	inline void setBounds(size_t index, Float min, Float max) {
+		m_min[index] = (float) min; m_max[index] = (float) max;
+	}
+
+	/// Return the largest value within the whole grid
+	Float getMaximum() const;
+
+	/// Return the fraction of cells with a maximum of zero
+	Float getEmptyFraction() const;
+
+	/// Return a string representation
+	std::string toString() const;
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Virtual destructor
+	virtual ~MajorantGrid() { }
+protected:
+	Vector3i m_res;
+	Transform m_worldToGrid;
+	std::vector<float> m_min, m_max;
+};
+
 /**
  * Generalized source of volumetric information
  */
@@ -69,6 +133,22 @@ public:
 	 */
 	virtual Float getMaximumFloatValue() const = 0;
 
+	/**
+	 * \brief Return an upper bound on the values returned by
+	 * \ref lookupFloat() within a world-space region.
+	 *
+	 * The default implementation returns \ref getMaximumFloatValue().
+	 */
+	virtual Float getLocalMaximumFloatValue(const AABB &aabb) const;
+
+	/**
+	 * \brief Return a coarse grid of bounds on the values
+	 * returned by \ref lookupFloat(), if available.
+	 *
+	 * The default implementation returns \c NULL.
+	 */
+	virtual const MajorantGrid *getMajorantGrid() const;
+
 	MTS_DECLARE_CLASS()
 protected:
 	/// Virtual destructor
@@ -43,6 +43,9 @@ protected:
 		}
 	};
 
+	/* Needed by Film::accumulateSpan() */
+	BOOST_STATIC_ASSERT(sizeof(Pixel) == sizeof(Float) * (SPECTRUM_SAMPLES + 2));
+
 	Pixel *m_pixels;
 	bool m_hasBanner;
 	bool m_hasAlpha;
@@ -128,31 +131,14 @@ public:
 	}
 
 	void putImageBlock(const ImageBlock *block) {
-		int entry=0, imageY = block->getOffset().y - 
-			block->getBorder() - m_cropOffset.y - 1;
-
-		for (int y=0; y<block->getFullSize().y; ++y) {
-			if (++imageY < 0 || imageY >= m_cropSize.y) {
-				/// Skip a row if it is outside of the crop region
-				entry += block->getFullSize().x;
-				continue;
-			}
-
-			int imageX = block->getOffset().x - block->getBorder()
-				- m_cropOffset.x - 1;
-			for (int x=0; x<block->getFullSize().x; ++x) {
-				if (++imageX < 0 || imageX >= m_cropSize.x) {
-					++entry;
-					continue;
-				}
-
-				Pixel &pixel = m_pixels[imageY * m_cropSize.x + imageX];
+		putImageBlockTiled(this, block);
+	}
 
-				pixel.spec += block->getPixel(entry);
-				pixel.alpha += block->getAlpha(entry);
-				pixel.weight += block->getWeight(entry++);
-			}
-		}
+	/// Merge a span of image block entries (called by putImageBlockTiled())
+	inline void accumulate(const ImageBlock *block, size_t entry,
+			size_t index, int count) {
+		accumulateSpan(reinterpret_cast<Float *>(m_pixels + index), 
+			block, entry, count);
 	}
 	
 	void develop(const fs::path &destFile) {
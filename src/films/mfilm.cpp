@@ -116,56 +116,28 @@ public:
 	}
 
 	void putImageBlock(const ImageBlock *block) {
-		int entry=0, imageY = block->getOffset().y - 
-			block->getBorder() - m_cropOffset.y - 1;
+		if (block->collectStatistics()) {
+			Assert(block->getBorder() == 0);
+			m_hasVariances = true;
+		}
+		putImageBlockTiled(this, block);
+	}
 
+	/// Merge a span of image block entries (called by putImageBlockTiled())
+	inline void accumulate(const ImageBlock *block, size_t entry,
+			size_t index, int count) {
+		Pixel *pixel = m_pixels + index;
 		if (!block->collectStatistics()) {
-			for (int y=0; y<block->getFullSize().y; ++y) {
-				if (++imageY < 0 || imageY >= m_cropSize.y) {
-					/// Skip a row if it is outside of the crop region
-					entry += block->getFullSize().x;
-					continue;
-				}
-
-				int imageX = block->getOffset().x - block->getBorder()
-					- m_cropOffset.x - 1;
-				for (int x=0; x<block->getFullSize().x; ++x) {
-					if (++imageX < 0 || imageX >= m_cropSize.x) {
-						++entry;
-						continue;
-					}
-
-					Pixel &pixel = m_pixels[imageY * m_cropSize.x + imageX];
-
-					pixel.spec += block->getPixel(entry);
-					pixel.weight += block->getWeight(entry++);
-				}
+			for (int i=0; i<count; ++i, ++pixel, ++entry) {
+				pixel->spec += block->getPixel(entry);
+				pixel->weight += block->getWeight(entry);
 			}
 		} else {
-			Assert(block->getBorder() == 0);
-			m_hasVariances = true;
-			for (int y=0; y<block->getFullSize().y; ++y) {
-				if (++imageY < 0 || imageY >= m_cropSize.y) {
-					/// Skip a row if it is outside of the crop region
-					entry += block->getFullSize().x;
-					continue;
-				}
-
-				int imageX = block->getOffset().x - block->getBorder()
-					- m_cropOffset.x - 1;
-				for (int x=0; x<block->getFullSize().x; ++x) {
-					if (++imageX < 0 || imageX >= m_cropSize.x) {
-						++entry;
-						continue;
-					}
-
-					Pixel &pixel = m_pixels[imageY * m_cropSize.x + imageX];
-
-					pixel.spec += block->getPixel(entry);
-					pixel.weight = block->getWeight(entry);
-					pixel.nSamples = block->getSampleCount(entry);
-					pixel.variance = block->getVariance(entry++);
-				}
+			for (int i=0; i<count; ++i, ++pixel, ++entry) {
+				pixel->spec += block->getPixel(entry);
+				pixel->weight = block->getWeight(entry);
+				pixel->nSamples = block->getSampleCount(entry);
+				pixel->variance = block->getVariance(entry);
 			}
 		}
 	}
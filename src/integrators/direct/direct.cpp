@@ -34,6 +34,8 @@ public:
 		m_luminaireSamples = props.getInteger("luminaireSamples", 1);
 		/* Number of samples to take using the BSDF sampling technique */
 		m_bsdfSamples = props.getInteger("bsdfSamples", 1);
+		/* Trace camera rays as coherent packets of four */
+		m_packetTracing = props.getBoolean("packets", true);
 
 		Assert(m_luminaireSamples + m_bsdfSamples > 0);
 	}
@@ -86,11 +86,9 @@ public:
 		IrradianceRecordVector *result = static_cast<IrradianceRecordVector *>(workResult);
 		const SampleIntegrator *integrator = m_subIntegrator.get();
 
-		Intersection its;
-		Spectrum E;
 		RadianceQueryRecord rRec(m_scene, m_sampler);
 		const Point2 lensSample(0, 0);
-		RayDifferential eyeRay;
+		Spectrum E;
 		int x, y;
 
 		const int sx = rect->getOffset().x,
@@ -99,11 +97,15 @@ public:
 				ey = sy + rect->getSize().y;
 		result->clear();
 
+		/* Trace all eye rays of the block and look them up in 
+		   the irradiance cache using a single batched query */
+		m_rays.clear();
+		m_its.clear();
 		for (y = sy; y < ey; y++) {
 			for (x = sx; x < ex; x++) {
-				if (stop) 
-					break;
 				Point2 sample(x + .5f, y + .5f);
+				RayDifferential eyeRay;
+				Intersection its;
 				m_camera->generateRayDifferential(sample, lensSample, 0.0f, eyeRay);
 				if (m_scene->rayIntersect(eyeRay, its)) {
 					const BSDF *bsdf = its.shape->getBSDF();
@@ -111,33 +113,52 @@ public:
 						continue;
 					if (!bsdf->getType() == BSDF::EDiffuseReflection)
 						continue;
-					if (m_irrCache->get(its, E))
-						continue;
+					m_rays.push_back(eyeRay);
+					m_its.push_back(its);
+				}
+			}
+		}
 
-					/* Irradiance cache miss - create a record. The following
-					   generates stratified cosine-weighted samples and computes
-					   rotational + translational gradients */
-					m_hs->generateDirections(its, m_sampler);
-					m_sampler->generate();
-
-					for (unsigned int j=0; j<m_hs->getM(); j++) {
-						for (unsigned int k=0; k<m_hs->getN(); k++) {
-							HemisphereSampler::SampleEntry &entry = (*m_hs)(j, k);
-							entry.dist = std::numeric_limits<Float>::infinity();
-							rRec.newQuery(RadianceQueryRecord::ERadianceNoEmission
-								| RadianceQueryRecord::EDistance, m_camera->getMedium());
-							rRec.depth = 2;
-							rRec.extra = 1; // mark as irradiance cache query
-							entry.L = integrator->Li(RayDifferential(its.p, entry.d, 0.0f), rRec);
-							entry.dist = rRec.dist;
-							m_sampler->advance();
-						}
-					}
-
-					m_hs->process(its);
-					result->put(m_irrCache->put(eyeRay, its, *m_hs));
+		const size_t count = m_its.size();
+		if (count == 0)
+			return;
+		m_E.resize(count);
+		m_hit.resize(count);
+		m_irrCache->get(&m_its[0], &m_E[0], &m_hit[0], count);
+
+		for (size_t i=0; i<count; ++i) {
+			if (stop)
+				break;
+			const RayDifferential &eyeRay = m_rays[i];
+			const Intersection &its = m_its[i];
+
+			/* Records created earlier in this block may cover the point as 
+			   well. The batched lookup already counted it in the statistics */
+			if (m_hit[i] || m_irrCache->get(its, E, false))
+				continue;
+
+			/* Irradiance cache miss - create a record. The following
+			   generates stratified cosine-weighted samples and computes
+			   rotational + translational gradients */
+			m_hs->generateDirections(its, m_sampler);
+			m_sampler->generate();
+
+			for (unsigned int j=0; j<m_hs->getM(); j++) {
+				for (unsigned int k=0; k<m_hs->getN(); k++) {
+					HemisphereSampler::SampleEntry &entry = (*m_hs)(j, k);
+					entry.dist = std::numeric_limits<Float>::infinity();
+					rRec.newQuery(RadianceQueryRecord::ERadianceNoEmission
+						| RadianceQueryRecord::EDistance, m_camera->getMedium());
+					rRec.depth = 2;
+					rRec.extra = 1; // mark as irradiance cache query
+					entry.L = integrator->Li(RayDifferential(its.p, entry.d, 0.0f), rRec);
+					entry.dist = rRec.dist;
+					m_sampler->advance();
 				}
 			}
+
+			m_hs->process(its);
+			result->put(m_irrCache->put(eyeRay, its, *m_hs));
 		}
 	}
 
@@ -156,6 +177,10 @@ private:
 	ref<HemisphereSampler> m_hs;
 	ref<SampleIntegrator> m_subIntegrator;
 	ref<IrradianceCache> m_irrCache;
+	std::vector<RayDifferential> m_rays;
+	std::vector<Intersection> m_its;
+	std::vector<Spectrum> m_E;
+	std::vector<uint8_t> m_hit;
 	int m_resolution;
 	bool m_gradients, m_clampNeighbor, m_clampScreen;
 	Float m_influenceMin, m_influenceMax;
@@ -27,6 +27,8 @@ static StatsCounter avgPathLength("Path tracer", "Average path length", EAverage
  * \parameters{
  *     \parameter{maxDepth}{\Integer}{Maximum path depth \default{-1}}
  *     \parameter{strictNormals}{\Boolean}{Strict normals?}
+ *     \parameter{packets}{\Boolean}{Trace camera rays as coherent 
+ *        packets of four \default{true}}
  * }
  * Extended path tracer -- uses multiple importance sampling to combine 
  * two sampling strategies, namely BSDF and luminaire sampling. 
@@ -38,6 +40,8 @@ public:
 	MIPathTracer(const Properties &props)
 		: MonteCarloIntegrator(props) {
 		//m_shadingSamples = props.getInteger("shadingSamples");
+		/* Trace camera rays as coherent packets of four */
+		m_packetTracing = props.getBoolean("packets", true);
 	}
 
 	/// Unserialize from a binary data stream
@@ -65,6 +65,9 @@ public:
 		m_blockSize = props.getInteger("blockSize", 32);
 		/* Indicates if the gathering steps should be canceled if not enough photons are generated. */
 		m_autoCancelGathering = props.getBoolean("autoCancelGathering", true);
+		/* Splat photons into a hash grid over the gather points instead of 
+		   building and querying a photon map in every pass */
+		m_useHashGrid = props.getBoolean("hashGrid", false);
 		m_mutex = new Mutex();
 #if defined(__OSX__)
 		Log(EError, "Progressive photon mapping currently doesn't work "
@@ -128,6 +131,8 @@ public:
 
 		m_gatherPoints.clear();
 		m_running = true;
+		if (m_useHashGrid)
+			m_grid = new GatherPointHashGrid();
 		for (size_t i=0; i<m_blocks.size(); ++i)
 			m_blocks[i]->decRef();
 		m_blocks.clear();
@@ -276,11 +281,27 @@ public:
 		Log(EInfo, "Performing a photon mapping pass %i", it);
 		ref<Scheduler> sched = Scheduler::getInstance();
 
-		/* Generate the global photon map */
+		/* Register all gather points with the hash grid (if enabled) */
+		std::vector<uint32_t> gridOffsets(m_gatherPoints.size());
+		if (m_grid) {
+			m_grid->clear();
+			for (size_t blockIdx=0; blockIdx<m_gatherPoints.size(); ++blockIdx) {
+				const std::vector<GatherPoint> &gatherPoints = m_gatherPoints[blockIdx];
+				gridOffsets[blockIdx] = (uint32_t) m_grid->getGatherPointCount();
+				for (size_t i=0; i<gatherPoints.size(); ++i) {
+					const GatherPoint &g = gatherPoints[i];
+					m_grid->append(g.its, g.radius, 
+						m_maxDepth == -1 ? INT_MAX : (m_maxDepth-g.depth));
+				}
+			}
+			m_grid->build();
+		}
+
+		/* Generate the global photon map, or splat into the hash grid */
 		ref<GatherPhotonProcess> proc = new GatherPhotonProcess(
 			GatherPhotonProcess::EAllSurfacePhotons, m_photonCount,
 			m_granularity, m_maxDepth == -1 ? -1 : (m_maxDepth-1), m_rrDepth, true,
-			m_autoCancelGathering, job);
+			m_autoCancelGathering, job, m_grid);
 
 		proc->bindResource("scene", sceneResID);
 		proc->bindResource("camera", cameraResID);
@@ -290,7 +311,8 @@ public:
 		sched->wait(proc);
 
 		ref<PhotonMap> photonMap = proc->getPhotonMap();
-		photonMap->balance();
+		if (photonMap)
+			photonMap->balance();
 		Log(EDebug, "Photon map full. Shot " SIZE_T_FMT " particles, excess photons due to parallelism: " 
 			SIZE_T_FMT, proc->getShotParticles(), proc->getExcessPhotons());
 
@@ -314,8 +336,15 @@ public:
 					continue;
 				}
 
-				Float M = (Float) photonMap->estimateRadianceRaw(
-					g.its, g.radius, flux, m_maxDepth == -1 ? INT_MAX : (m_maxDepth-g.depth));
+				Float M;
+				if (m_grid) {
+					uint32_t gridIndex = gridOffsets[blockIdx] + (uint32_t) i;
+					M = (Float) m_grid->getPhotonCount(gridIndex);
+					flux = m_grid->getFlux(gridIndex);
+				} else {
+					M = (Float) photonMap->estimateRadianceRaw(
+						g.its, g.radius, flux, m_maxDepth == -1 ? INT_MAX : (m_maxDepth-g.depth));
+				}
 				Float N = g.N;
 
 				if (N+M == 0) {
@@ -347,6 +376,7 @@ private:
 	const TabulatedFilter *m_filter;
 	std::vector<ImageBlock *> m_blocks;
 	std::vector<std::vector<GatherPoint> > m_gatherPoints;
+	ref<GatherPointHashGrid> m_grid;
 	ref<Mutex> m_mutex;
 	Float m_initialRadius, m_alpha;
 	int m_photonCount, m_granularity;
@@ -355,6 +385,7 @@ private:
 	int m_blockSize;
 	bool m_running;
 	bool m_autoCancelGathering;
+	bool m_useHashGrid;
 };
 
 MTS_IMPLEMENT_CLASS_S(ProgressivePhotonMapIntegrator, false, Integrator)
@@ -66,6 +66,9 @@ public:
 		m_blockSize = props.getInteger("blockSize", 32);
 		/* Indicates if the gathering steps should be canceled if not enough photons are generated. */
 		m_autoCancelGathering = props.getBoolean("autoCancelGathering", true);
+		/* Splat photons into a hash grid over the gather points instead of 
+		   building and querying a photon map in every pass */
+		m_useHashGrid = props.getBoolean("hashGrid", false);
 		m_mutex = new Mutex();
 #if defined(__OSX__)
 		Log(EError, "Stochastic progressive photon mapping currently doesn't work "
@@ -120,6 +123,8 @@ public:
 
 		m_gatherBlocks.clear();
 		m_running = true;
+		if (m_useHashGrid)
+			m_grid = new GatherPointHashGrid();
 		m_totalEmitted = 0;
 
 		ref<Sampler> sampler = static_cast<Sampler *> (PluginManager::getInstance()->
@@ -264,11 +269,27 @@ public:
 		Log(EInfo, "Performing a photon mapping pass %i", it);
 		ref<Scheduler> sched = Scheduler::getInstance();
 
-		/* Generate the global photon map */
+		/* Register all gather points with the hash grid (if enabled) */
+		std::vector<uint32_t> gridOffsets(m_gatherBlocks.size());
+		if (m_grid) {
+			m_grid->clear();
+			for (size_t blockIdx=0; blockIdx<m_gatherBlocks.size(); ++blockIdx) {
+				const std::vector<GatherPoint> &gatherPoints = m_gatherBlocks[blockIdx];
+				gridOffsets[blockIdx] = (uint32_t) m_grid->getGatherPointCount();
+				for (size_t i=0; i<gatherPoints.size(); ++i) {
+					const GatherPoint &gp = gatherPoints[i];
+					m_grid->append(gp.its, gp.depth != -1 ? gp.radius : 0,
+						m_maxDepth-gp.depth);
+				}
+			}
+			m_grid->build();
+		}
+
+		/* Generate the global photon map, or splat into the hash grid */
 		ref<GatherPhotonProcess> proc = new GatherPhotonProcess(
 			GatherPhotonProcess::EAllSurfacePhotons, m_photonCount,
 			m_granularity, m_maxDepth-1, m_rrDepth, true,
-			m_autoCancelGathering, job);
+			m_autoCancelGathering, job, m_grid);
 
 		proc->bindResource("scene", sceneResID);
 		proc->bindResource("camera", cameraResID);
@@ -278,7 +299,8 @@ public:
 		sched->wait(proc);
 
 		ref<PhotonMap> photonMap = proc->getPhotonMap();
-		photonMap->balance();
+		if (photonMap)
+			photonMap->balance();
 		Log(EDebug, "Photon map full. Shot " SIZE_T_FMT " particles, excess photons due to parallelism: " 
 			SIZE_T_FMT, proc->getShotParticles(), proc->getExcessPhotons());
 
@@ -296,8 +318,14 @@ public:
 				Spectrum flux, contrib;
 
 				if (gp.depth != -1) {
-					M = (Float) photonMap->estimateRadianceRaw(
-						gp.its, gp.radius, flux, m_maxDepth-gp.depth);
+					if (m_grid) {
+						uint32_t gridIndex = gridOffsets[blockIdx] + (uint32_t) i;
+						M = (Float) m_grid->getPhotonCount(gridIndex);
+						flux = m_grid->getFlux(gridIndex);
+					} else {
+						M = (Float) photonMap->estimateRadianceRaw(
+							gp.its, gp.radius, flux, m_maxDepth-gp.depth);
+					}
 				} else {
 					M = 0;
 					flux = Spectrum(0.0f);
@@ -336,6 +364,7 @@ private:
 	std::vector<Point2i> m_offset;
 	ref<Mutex> m_mutex;
 	ref<Bitmap> m_bitmap;
+	ref<GatherPointHashGrid> m_grid;
 	Float m_initialRadius, m_alpha;
 	int m_photonCount, m_granularity;
 	int m_maxDepth, m_rrDepth;
@@ -343,6 +372,7 @@ private:
 	int m_blockSize;
 	bool m_running;
 	bool m_autoCancelGathering;
+	bool m_useHashGrid;
 };
 
 MTS_IMPLEMENT_CLASS_S(StochasticProgressivePhotonMapIntegrator, false, Integrator)
@@ -0,0 +1,169 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/core/statistics.h>
+#include "vpltree.h"
+
+MTS_NAMESPACE_BEGIN
+
+static StatsCounter avgCutSize("Lightcuts", "Average cut size", EAverage);
+
+/**
+ * CPU-based virtual point light renderer, which does not require
+ * graphics hardware. The VPLs are generated in the same way as in the
+ * \c vpl integrator and then clustered into a light tree. At every
+ * pixel, a cut through the tree determines which clusters can be
+ * approximated by a single representative VPL without exceeding a given
+ * relative error. See "Lightcuts: a scalable approach to illumination"
+ * by Bruce Walter et al. in ACM Transactions on Graphics 24(3), 2005.
+ *
+ * Like the hardware renderer, this integrator does not follow
+ * specular reflection or refraction.
+ */
+class LightcutsIntegrator : public SampleIntegrator {
+public:
+	LightcutsIntegrator(const Properties &props) : SampleIntegrator(props) {
+		/* Number of virtual point lights */
+		m_vplCount = props.getInteger("vplCount", 10000);
+		/* Max. depth (expressed as path length) */
+		m_maxDepth = props.getInteger("maxDepth", 5);
+		/* Relative clamping factor (0=no clamping, 1=full clamping) */
+		m_clamping = props.getFloat("clamping", 0.1f);
+		/* Maximum error of a cluster relative to the total estimate */
+		m_errorThreshold = props.getFloat("errorThreshold", 0.02f);
+		/* Maximum number of clusters in a cut */
+		m_maxCutSize = props.getInteger("maxCutSize", 1000);
+
+		if (m_errorThreshold < 0 || m_maxCutSize < 1)
+			Log(EError, "Invalid error threshold or maximum cut size!");
+
+		m_random = new Random();
+	}
+
+	/// Unserialize from a binary data stream
+	LightcutsIntegrator(Stream *stream, InstanceManager *manager)
+	 : SampleIntegrator(stream, manager) {
+		m_vplCount = stream->readInt();
+		m_maxDepth = stream->readInt();
+		m_clamping = stream->readFloat();
+		m_errorThreshold = stream->readFloat();
+		m_maxCutSize = stream->readInt();
+		m_random = new Random();
+	}
+
+	void serialize(Stream *stream, InstanceManager *manager) const {
+		SampleIntegrator::serialize(stream, manager);
+		stream->writeInt(m_vplCount);
+		stream->writeInt(m_maxDepth);
+		stream->writeFloat(m_clamping);
+		stream->writeFloat(m_errorThreshold);
+		stream->writeInt(m_maxCutSize);
+	}
+
+	bool preprocess(const Scene *scene, RenderQueue *queue, const RenderJob *job,
+		int sceneResID, int cameraResID, int samplerResID) {
+		SampleIntegrator::preprocess(scene, queue, job, sceneResID, cameraResID, samplerResID);
+
+		if (m_tree.get() == NULL) {
+			std::deque<VPL> vpls;
+			Float normalization = (Float) 1 / generateVPLs(scene, m_random,
+					0, m_vplCount, m_maxDepth, true, vpls);
+			for (size_t i=0; i<vpls.size(); ++i)
+				vpls[i].P *= normalization;
+			Log(EInfo, "Generated " SIZE_T_FMT " virtual point lights", vpls.size());
+
+			m_tree = new VPLTree(scene, vpls, m_clamping);
+			m_treeID = Scheduler::getInstance()->registerResource(m_tree);
+		}
+		return true;
+	}
+
+	/// Specify globally shared resources
+	void bindUsedResources(ParallelProcess *proc) const {
+		if (m_tree.get())
+			proc->bindResource("vplTree", m_treeID);
+	}
+
+	/// Connect to globally shared resources
+	void wakeup(std::map<std::string, SerializableObject *> &params) {
+		if (!m_tree.get() && params.find("vplTree") != params.end())
+			m_tree = static_cast<VPLTree *>(params["vplTree"]);
+	}
+
+	Spectrum Li(const RayDifferential &ray, RadianceQueryRecord &rRec) const {
+		const Scene *scene = rRec.scene;
+		Intersection &its = rRec.its;
+		Spectrum Li(0.0f);
+
+		/* Perform the first ray intersection (or ignore if the
+		   intersection has already been provided). */
+		if (!rRec.rayIntersect(ray)) {
+			/* If no intersection could be found, possibly return
+			   radiance from a background luminaire */
+			if (rRec.type & RadianceQueryRecord::EEmittedRadiance)
+				return scene->LeBackground(ray);
+			else
+				return Spectrum(0.0f);
+		}
+
+		/* Possibly include emitted radiance if requested */
+		if (its.isLuminaire() && (rRec.type & RadianceQueryRecord::EEmittedRadiance))
+			Li += its.Le(-ray.d);
+
+		/* Include radiance from a subsurface integrator if requested */
+		if (its.hasSubsurface() && (rRec.type & RadianceQueryRecord::ESubsurfaceRadiance))
+			Li += its.LoSub(scene, rRec.sampler, -ray.d, rRec.depth);
+
+		const BSDF *bsdf = its.getBSDF(ray);
+		if (!bsdf || !(rRec.type & RadianceQueryRecord::EDirectSurfaceRadiance))
+			return Li;
+
+		int cutSize;
+		Li += m_tree->Lo(scene, its, bsdf, m_errorThreshold, m_maxCutSize, cutSize);
+
+		/* Store statistics */
+		avgCutSize.incrementBase();
+		avgCutSize += cutSize;
+
+		return Li;
+	}
+
+	std::string toString() const {
+		std::ostringstream oss;
+		oss << "LightcutsIntegrator[" << std::endl
+			<< "  vplCount = " << m_vplCount << "," << std::endl
+			<< "  maxDepth = " << m_maxDepth << "," << std::endl
+			<< "  clamping = " << m_clamping << "," << std::endl
+			<< "  errorThreshold = " << m_errorThreshold << "," << std::endl
+			<< "  maxCutSize = " << m_maxCutSize << std::endl
+			<< "]";
+		return oss.str();
+	}
+
+	MTS_DECLARE_CLASS()
+private:
+	ref<VPLTree> m_tree;
+	ref<Random> m_random;
+	int m_treeID;
+	int m_vplCount, m_maxDepth, m_maxCutSize;
+	Float m_clamping, m_errorThreshold;
+};
+
+MTS_IMPLEMENT_CLASS_S(LightcutsIntegrator, false, SampleIntegrator)
+MTS_EXPORT_PLUGIN(LightcutsIntegrator, "Lightcuts integrator");
+MTS_NAMESPACE_END
@@ -0,0 +1,551 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/core/timer.h>
+#include <queue>
+#include "vpltree.h"
+
+MTS_NAMESPACE_BEGIN
+
+/// Number of directions, which are used to estimate the peak of a BSDF
+#define MTS_VPLTREE_DIRECTIONS 32
+
+/// Return one of a fixed set of well-distributed directions on the sphere
+static inline Vector getDirection(int i) {
+	Point2 seed((i + 0.5f) / MTS_VPLTREE_DIRECTIONS, radicalInverse(2, i + 1));
+	return squareToSphere(seed);
+}
+
+/// Cosine of an angle, which is clamped to [0, pi/2]
+static inline Float cosineBound(Float theta) {
+	if (theta <= 0)
+		return 1.0f;
+	else if (theta >= M_PI / 2)
+		return 0.0f;
+	return std::cos(theta);
+}
+
+/// Coordinate of a primitive along one of the spatial (0-2) or orientation (3-5) dimensions
+template <typename T> static inline Float getCoordinate(const T &prim, int dim, Float orientationScale) {
+	return dim < 3 ? prim.p[dim] : prim.axis[dim - 3] * orientationScale;
+}
+
+/// Selects the primitives, whose coordinate falls into one of the first bins
+struct VPLBinPredicate {
+	inline VPLBinPredicate(int dim, int split, Float min, Float scale, Float orientationScale)
+		: dim(dim), split(split), min(min), scale(scale), orientationScale(orientationScale) { }
+
+	template <typename T> inline bool operator()(const T &prim) const {
+		int bin = std::min((int) ((getCoordinate(prim, dim, orientationScale) - min) * scale),
+			MTS_VPLTREE_BINS - 1);
+		return bin <= split;
+	}
+
+	int dim, split;
+	Float min, scale, orientationScale;
+};
+
+/// Cluster of the current cut
+struct CutEntry {
+	inline CutEntry(int node, Float bound, const Spectrum &estimate)
+		: node(node), bound(bound), estimate(estimate) { }
+
+	inline bool operator<(const CutEntry &entry) const {
+		return bound < entry.bound;
+	}
+
+	int node;
+	Float bound;
+	Spectrum estimate;
+};
+
+/**
+ * Compute the minimum distance of the geometric term in the same way as
+ * the hardware VPL renderer: based on the distances to the surfaces
+ * that are visible from the VPL.
+ */
+static Float getMinDist(const Scene *scene, const VPL &vpl, Float clamping) {
+	if (clamping == 0)
+		return 0.0f;
+
+	Float nearClip =  std::numeric_limits<Float>::infinity(),
+		  farClip  = -std::numeric_limits<Float>::infinity();
+	const int sampleCount = 64;
+	Intersection its;
+	Ray ray;
+	ray.o = vpl.its.p;
+
+	for (int i=1; i<=sampleCount; ++i) {
+		Point2 seed(i / (Float) sampleCount, radicalInverse(2, i));
+		Vector dir;
+		if (vpl.type == ESurfaceVPL || vpl.luminaire->getType() & Luminaire::EOnSurface)
+			dir = vpl.its.shFrame.toWorld(squareToHemispherePSA(seed));
+		else
+			dir = squareToSphere(seed);
+		ray.setDirection(dir);
+		if (scene->rayIntersect(ray, its)) {
+			nearClip = std::min(nearClip, its.t);
+			farClip = std::max(farClip, its.t);
+		}
+	}
+
+	if (farClip < nearClip)
+		return 0.0f;
+	return nearClip + (farClip - nearClip) * clamping;
+}
+
+VPLTree::VPLTree(const Scene *scene, const std::deque<VPL> &vpls, Float clamping) {
+	ref<Timer> timer = new Timer();
+	std::map<const Shape *, int> shapeIndices;
+	std::map<const Luminaire *, int> luminaireIndices;
+	for (size_t i=0; i<scene->getShapes().size(); ++i)
+		shapeIndices[scene->getShapes()[i]] = (int) i;
+	for (size_t i=0; i<scene->getLuminaires().size(); ++i)
+		luminaireIndices[scene->getLuminaires()[i]] = (int) i;
+
+	std::vector<Primitive> primitives;
+	AABB bounds;
+	size_t unindexed = 0;
+	m_lights.reserve(vpls.size());
+
+	for (size_t i=0; i<vpls.size(); ++i) {
+		const VPL &vpl = vpls[i];
+		Light light;
+		Primitive prim;
+		light.p = vpl.its.p;
+		light.frame = vpl.its.shFrame;
+		light.P = vpl.P;
+		light.type = (uint8_t) vpl.type;
+		light.minDist = getMinDist(scene, vpl, clamping);
+		prim.axis = Vector(0.0f);
+
+		Float peak = 0;
+		if (vpl.type == ESurfaceVPL) {
+			const BSDF *bsdf = vpl.its.shape->getBSDF();
+			std::map<const Shape *, int>::const_iterator it = shapeIndices.find(vpl.its.shape);
+			if (it != shapeIndices.end()) {
+				light.index = it->second;
+			} else {
+				/* Shapes that are part of an instance cannot be referenced
+				   -- fall back to their diffuse reflectance */
+				light.index = -1;
+				++unindexed;
+			}
+			light.uv = vpl.its.uv;
+			light.wi = vpl.its.wi;
+			light.color = vpl.its.color;
+			light.reflectance = bsdf->getDiffuseReflectance(vpl.its);
+			light.onSurface = true;
+			if (!bsdf->hasComponent(BSDF::ETransmission))
+				prim.axis = Frame::cosTheta(light.wi) > 0 ? Vector(light.frame.n) : -Vector(light.frame.n);
+
+			/* Also consider the mirror direction, which is
+			   where glossy reflection lobes usually peak */
+			Vector mirror = light.frame.toWorld(Vector(-light.wi.x, -light.wi.y, light.wi.z));
+			peak = getEmission(scene, light, mirror).getLuminance();
+		} else {
+			light.index = luminaireIndices[vpl.luminaire];
+			light.uv = Point2(0.0f);
+			light.wi = Vector(0.0f);
+			light.color = light.reflectance = Spectrum(0.0f);
+			light.onSurface = vpl.luminaire->getType() & Luminaire::EOnSurface;
+			if (light.onSurface)
+				prim.axis = Vector(light.frame.n);
+		}
+
+		for (int j=0; j<MTS_VPLTREE_DIRECTIONS; ++j)
+			peak = std::max(peak, getEmission(scene, light, getDirection(j)).getLuminance());
+		light.intensity = light.P.getLuminance() * peak;
+		if (!(light.intensity > 0))
+			continue;
+
+		prim.p = light.p;
+		prim.intensity = light.intensity;
+		prim.index = (int) m_lights.size();
+		bounds.expandBy(light.p);
+		m_lights.push_back(light);
+		primitives.push_back(prim);
+	}
+
+	if (unindexed > 0)
+		Log(EWarn, SIZE_T_FMT " VPLs are located on shapes, which are not directly "
+			"part of the scene -- approximating them as diffuse reflectors", unindexed);
+
+	if (primitives.size() > 0) {
+		/* Orientations, which span all directions, are weighted
+		   about as much as the spatial extent of all VPLs */
+		Float orientationScale = bounds.getExtents().length() / 4;
+		ref<Random> random = new Random((uint64_t) 1);
+		m_nodes.reserve(2 * primitives.size() - 1);
+		build(primitives, 0, (int) primitives.size(), orientationScale, random);
+	}
+
+	Log(EInfo, "Built a light tree over " SIZE_T_FMT " VPLs (" SIZE_T_FMT
+		" nodes, %s) in %i ms", m_lights.size(), m_nodes.size(),
+		memString(m_lights.size() * sizeof(Light) + m_nodes.size() * sizeof(Node)).c_str(),
+		timer->getMilliseconds());
+}
+
+VPLTree::VPLTree(Stream *stream, InstanceManager *manager) {
+	size_t lightCount = stream->readSize();
+	m_lights.resize(lightCount);
+	for (size_t i=0; i<lightCount; ++i) {
+		Light &light = m_lights[i];
+		light.p = Point(stream);
+		light.frame = Frame(stream);
+		light.uv = Point2(stream);
+		light.wi = Vector(stream);
+		light.P = Spectrum(stream);
+		light.color = Spectrum(stream);
+		light.reflectance = Spectrum(stream);
+		light.intensity = stream->readFloat();
+		light.minDist = stream->readFloat();
+		light.index = stream->readInt();
+		light.type = stream->readUChar();
+		light.onSurface = stream->readBool();
+	}
+
+	size_t nodeCount = stream->readSize();
+	m_nodes.resize(nodeCount);
+	for (size_t i=0; i<nodeCount; ++i) {
+		Node &node = m_nodes[i];
+		node.aabb = AABB(stream);
+		node.axis = Vector(stream);
+		node.cosTheta = stream->readFloat();
+		node.intensity = stream->readFloat();
+		node.minDist = stream->readFloat();
+		node.light = stream->readInt();
+		node.right = stream->readInt();
+	}
+}
+
+void VPLTree::serialize(Stream *stream, InstanceManager *manager) const {
+	stream->writeSize(m_lights.size());
+	for (size_t i=0; i<m_lights.size(); ++i) {
+		const Light &light = m_lights[i];
+		light.p.serialize(stream);
+		light.frame.serialize(stream);
+		light.uv.serialize(stream);
+		light.wi.serialize(stream);
+		light.P.serialize(stream);
+		light.color.serialize(stream);
+		light.reflectance.serialize(stream);
+		stream->writeFloat(light.intensity);
+		stream->writeFloat(light.minDist);
+		stream->writeInt(light.index);
+		stream->writeUChar(light.type);
+		stream->writeBool(light.onSurface);
+	}
+
+	stream->writeSize(m_nodes.size());
+	for (size_t i=0; i<m_nodes.size(); ++i) {
+		const Node &node = m_nodes[i];
+		node.aabb.serialize(stream);
+		node.axis.serialize(stream);
+		stream->writeFloat(node.cosTheta);
+		stream->writeFloat(node.intensity);
+		stream->writeFloat(node.minDist);
+		stream->writeInt(node.light);
+		stream->writeInt(node.right);
+	}
+}
+
+int VPLTree::build(std::vector<Primitive> &primitives, int start, int end,
+		Float orientationScale, Random *random) {
+	int nodeIndex = (int) m_nodes.size();
+	m_nodes.push_back(Node());
+
+	AABB aabb, axisBounds;
+	Vector axisSum(0.0f);
+	Float intensity = 0, minDist = std::numeric_limits<Float>::infinity();
+	bool oriented = true;
+	for (int i=start; i<end; ++i) {
+		const Primitive &prim = primitives[i];
+		aabb.expandBy(prim.p);
+		axisBounds.expandBy(Point(prim.axis));
+		axisSum += prim.axis;
+		oriented &= !prim.axis.isZero();
+		intensity += prim.intensity;
+		minDist = std::min(minDist, m_lights[prim.index].minDist);
+	}
+
+	Node node;
+	node.aabb = aabb;
+	node.intensity = intensity;
+	node.minDist = minDist;
+	node.axis = Vector(0, 0, 1);
+	node.cosTheta = -1;
+	if (oriented && axisSum.lengthSquared() > 0) {
+		node.axis = normalize(axisSum);
+		node.cosTheta = 1;
+		for (int i=start; i<end; ++i)
+			node.cosTheta = std::min(node.cosTheta, dot(node.axis, primitives[i].axis));
+	}
+
+	if (end - start == 1) {
+		node.light = primitives[start].index;
+		node.right = -1;
+		m_nodes[nodeIndex] = node;
+		return nodeIndex;
+	}
+
+	/* Evaluate a set of binned splits along the spatial and orientation
+	   dimensions. The cost of a cluster is its intensity times its
+	   squared extent (see the Lightcuts paper) */
+	Float bestCost = std::numeric_limits<Float>::infinity();
+	int bestDim = -1, bestSplit = -1;
+	Float bestMin = 0, bestScale = 0;
+
+	for (int dim=0; dim<6; ++dim) {
+		Float min = dim < 3 ? aabb.min[dim] : axisBounds.min[dim-3] * orientationScale,
+			  max = dim < 3 ? aabb.max[dim] : axisBounds.max[dim-3] * orientationScale;
+		if (max - min <= 0)
+			continue;
+
+		AABB binBounds[MTS_VPLTREE_BINS], binAxes[MTS_VPLTREE_BINS];
+		Float binIntensity[MTS_VPLTREE_BINS];
+		for (int i=0; i<MTS_VPLTREE_BINS; ++i)
+			binIntensity[i] = 0;
+
+		Float scale = MTS_VPLTREE_BINS / (max - min);
+		for (int i=start; i<end; ++i) {
+			const Primitive &prim = primitives[i];
+			int bin = std::min((int) ((getCoordinate(prim, dim, orientationScale) - min) * scale),
+				MTS_VPLTREE_BINS - 1);
+			binBounds[bin].expandBy(prim.p);
+			binAxes[bin].expandBy(Point(prim.axis));
+			binIntensity[bin] += prim.intensity;
+		}
+
+		/* Sweep from the right to accumulate the costs of the right halves */
+		Float rightCost[MTS_VPLTREE_BINS];
+		AABB rightBounds, rightAxes;
+		Float rightIntensity = 0;
+		for (int i=MTS_VPLTREE_BINS-1; i>0; --i) {
+			if (binBounds[i].isValid()) {
+				rightBounds.expandBy(binBounds[i]);
+				rightAxes.expandBy(binAxes[i]);
+				rightIntensity += binIntensity[i];
+			}
+			rightCost[i] = !rightBounds.isValid() ? -1 : rightIntensity
+				* (rightBounds.getExtents().lengthSquared() + orientationScale
+				* orientationScale * rightAxes.getExtents().lengthSquared());
+		}
+
+		AABB leftBounds, leftAxes;
+		Float leftIntensity = 0;
+		for (int i=0; i<MTS_VPLTREE_BINS-1; ++i) {
+			if (binBounds[i].isValid()) {
+				leftBounds.expandBy(binBounds[i]);
+				leftAxes.expandBy(binAxes[i]);
+				leftIntensity += binIntensity[i];
+			}
+			if (!leftBounds.isValid() || rightCost[i+1] < 0)
+				continue;
+			Float cost = leftIntensity * (leftBounds.getExtents().lengthSquared()
+				+ orientationScale * orientationScale * leftAxes.getExtents().lengthSquared())
+				+ rightCost[i+1];
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestDim = dim;
+				bestSplit = i;
+				bestMin = min;
+				bestScale = scale;
+			}
+		}
+	}
+
+	int middle;
+	if (bestDim != -1) {
+		Primitive *split = std::partition(&primitives[0] + start, &primitives[0] + end,
+			VPLBinPredicate(bestDim, bestSplit, bestMin, bestScale, orientationScale));
+		middle = (int) (split - &primitives[0]);
+	} else {
+		/* All VPLs coincide -- split by count */
+		middle = (start + end) / 2;
+	}
+	Assert(middle > start && middle < end);
+
+	int left = build(primitives, start, middle, orientationScale, random);
+	int right = build(primitives, middle, end, orientationScale, random);
+
+	/* Choose the representative among those of the children
+	   with a probability proportional to their intensity */
+	const Node &leftNode = m_nodes[left], &rightNode = m_nodes[right];
+	node.light = random->nextFloat() * (leftNode.intensity + rightNode.intensity)
+		< leftNode.intensity ? leftNode.light : rightNode.light;
+	node.right = right;
+	m_nodes[nodeIndex] = node;
+	return nodeIndex;
+}
+
+void VPLTree::getIntersection(const Scene *scene, const Light &light, Intersection &its) const {
+	its.p = light.p;
+	its.shFrame = its.geoFrame = light.frame;
+	its.uv = light.uv;
+	its.dpdu = light.frame.s;
+	its.dpdv = light.frame.t;
+	its.wi = light.wi;
+	its.color = light.color;
+	its.shape = scene->getShapes()[light.index];
+	its.t = 0;
+	its.time = 0;
+	its.hasUVPartials = false;
+}
+
+Spectrum VPLTree::getEmission(const Scene *scene, const Light &light, const Vector &d) const {
+	if (light.type == ELuminaireVPL) {
+		EmissionRecord eRec(scene->getLuminaires()[light.index],
+			ShapeSamplingRecord(light.p, light.frame.n), d);
+		eRec.type = EmissionRecord::EPreview;
+		return eRec.luminaire->fDirection(eRec);
+	} else if (light.index == -1) {
+		if (Frame::cosTheta(light.wi) * dot(light.frame.n, d) <= 0)
+			return Spectrum(0.0f);
+		return light.reflectance * INV_PI;
+	}
+
+	Intersection its;
+	getIntersection(scene, light, its);
+	BSDFQueryRecord bRec(its, its.toLocal(d));
+	bRec.quantity = EImportance;
+	return its.shape->getBSDF()->f(bRec);
+}
+
+Spectrum VPLTree::getContribution(const Scene *scene, const Intersection &its,
+		const BSDF *bsdf, const Light &light) const {
+	Vector d = light.p - its.p;
+	Float dist2 = d.lengthSquared();
+	if (dist2 == 0)
+		return Spectrum(0.0f);
+	d /= std::sqrt(dist2);
+
+	Spectrum result = bsdf->fCos(BSDFQueryRecord(its, its.toLocal(d)));
+	if (result.isZero())
+		return result;
+
+	result *= getEmission(scene, light, -d);
+	if (light.onSurface)
+		result *= absDot(light.frame.n, d);
+	if (result.isZero() || scene->isOccluded(its.p, light.p, its.time))
+		return Spectrum(0.0f);
+
+	return result * light.P / std::max(dist2, light.minDist * light.minDist);
+}
+
+Float VPLTree::getErrorBound(const Node &node, const Point &p, const Vector &n,
+		Float bsdfBound) const {
+	Float dist2 = std::max(node.aabb.squaredDistanceTo(p), node.minDist * node.minDist);
+	if (dist2 == 0)
+		return std::numeric_limits<Float>::infinity();
+	Float bound = node.intensity * bsdfBound / dist2;
+
+	/* Bound the cosine factors using the bounding sphere of the cluster */
+	Vector d = node.aabb.getCenter() - p;
+	Float centerDist2 = d.lengthSquared(),
+		  radius2 = node.aabb.getExtents().lengthSquared() * 0.25f;
+	if (centerDist2 <= radius2)
+		return bound;
+	Float centerDist = std::sqrt(centerDist2);
+	d /= centerDist;
+	Float thetaU = std::asin(std::min((Float) 1, std::sqrt(radius2 / centerDist2)));
+
+	if (!n.isZero())
+		bound *= cosineBound(unitAngle(n, d) - thetaU);
+	if (node.cosTheta > -1)
+		bound *= cosineBound(unitAngle(node.axis, -d) - std::acos(node.cosTheta) - thetaU);
+	return bound;
+}
+
+Spectrum VPLTree::Lo(const Scene *scene, const Intersection &its, const BSDF *bsdf,
+		Float threshold, int maxCutSize, int &cutSize) const {
+	cutSize = 0;
+	if (m_nodes.size() == 0)
+		return Spectrum(0.0f);
+
+	/* Bound the BSDF of the receiver */
+	Float bsdfBound = 0;
+	if (bsdf->getType() == BSDF::EDiffuseReflection) {
+		bsdfBound = bsdf->getDiffuseReflectance(its).getLuminance() * INV_PI;
+	} else {
+		Vector mirror(-its.wi.x, -its.wi.y, its.wi.z);
+		bsdfBound = bsdf->f(BSDFQueryRecord(its, mirror)).getLuminance();
+		for (int i=0; i<MTS_VPLTREE_DIRECTIONS; ++i)
+			bsdfBound = std::max(bsdfBound,
+				bsdf->f(BSDFQueryRecord(its, getDirection(i))).getLuminance());
+	}
+
+	/* Light can only arrive from one side of opaque surfaces */
+	Vector n(0.0f);
+	if (!bsdf->hasComponent(BSDF::ETransmission))
+		n = Frame::cosTheta(its.wi) > 0 ? Vector(its.shFrame.n) : -Vector(its.shFrame.n);
+
+	const Node &root = m_nodes[0];
+	const Light &rootLight = m_lights[root.light];
+	Spectrum total = getContribution(scene, its, bsdf, rootLight)
+		* (root.intensity / rootLight.intensity);
+	std::priority_queue<CutEntry> cut;
+	if (root.right != -1)
+		cut.push(CutEntry(0, getErrorBound(root, its.p, n, bsdfBound), total));
+	cutSize = 1;
+
+	while (!cut.empty() && cutSize < maxCutSize) {
+		const CutEntry entry = cut.top();
+		if (entry.bound <= threshold * total.getLuminance())
+			break;
+		cut.pop();
+
+		/* Replace the cluster by its children. One of them shares the
+		   representative, whose contribution can be reused */
+		const Node &node = m_nodes[entry.node];
+		total -= entry.estimate;
+		int children[2] = { entry.node + 1, node.right };
+		for (int i=0; i<2; ++i) {
+			const Node &child = m_nodes[children[i]];
+			Spectrum estimate;
+			if (child.light == node.light) {
+				estimate = entry.estimate * (child.intensity / node.intensity);
+			} else {
+				const Light &light = m_lights[child.light];
+				estimate = getContribution(scene, its, bsdf, light)
+					* (child.intensity / light.intensity);
+			}
+			total += estimate;
+			if (child.right != -1)
+				cut.push(CutEntry(children[i],
+					getErrorBound(child, its.p, n, bsdfBound), estimate));
+		}
+		++cutSize;
+	}
+
+	/* Guard against round-off from the subtractions */
+	total.clampNegative();
+	return total;
+}
+
+std::string VPLTree::toString() const {
+	std::ostringstream oss;
+	oss << "VPLTree[" << endl
+		<< "  vplCount = " << m_lights.size() << "," << endl
+		<< "  nodeCount = " << m_nodes.size() << endl
+		<< "]";
+	return oss.str();
+}
+
+MTS_IMPLEMENT_CLASS_S(VPLTree, false, SerializableObject)
+MTS_NAMESPACE_END
@@ -0,0 +1,164 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__VPLTREE_H)
+#define __VPLTREE_H
+
+#include <mitsuba/render/vpl.h>
+
+MTS_NAMESPACE_BEGIN
+
+/// Number of bins per dimension, which are evaluated when splitting a node
+#define MTS_VPLTREE_BINS 8
+
+/**
+ * Light tree over a set of virtual point lights, which computes the
+ * illumination at a surface point using lightcuts (see "Lightcuts:
+ * a scalable approach to illumination" by Bruce Walter et al.).
+ *
+ * Every node represents a cluster of VPLs by one of them, whose
+ * contribution is scaled by the total intensity of the cluster. Starting
+ * at the root, the cluster with the largest error bound is repeatedly
+ * replaced by its children, until all bounds fall below a fraction of the
+ * total estimate. The bounds are exact for diffuse surfaces; the peaks of
+ * glossy BSDFs are estimated by evaluating them in a set of directions.
+ *
+ * VPLs refer to shapes and luminaires by their index within the scene,
+ * which allows sending the tree to remote workers.
+ */
+class VPLTree : public SerializableObject {
+public:
+	/**
+	 * \brief Build a tree over the given VPLs
+	 *
+	 * \param clamping
+	 *    Relative clamping factor of the geometric term (0=no clamping,
+	 *    1=full clamping), which is applied like in the \c vpl integrator
+	 */
+	VPLTree(const Scene *scene, const std::deque<VPL> &vpls, Float clamping);
+
+	/// Unserialize a VPL tree from a binary data stream
+	VPLTree(Stream *stream, InstanceManager *manager);
+
+	/// Serialize to a binary data stream
+	void serialize(Stream *stream, InstanceManager *manager) const;
+
+	/**
+	 * \brief Compute the radiance, which is reflected by the surface
+	 * interaction \c its into the direction \c its.wi
+	 *
+	 * \param threshold
+	 *    Maximum error of a cluster relative to the total estimate
+	 * \param maxCutSize
+	 *    Maximum number of clusters
+	 * \param cutSize
+	 *    Returns the number of clusters used by the estimate
+	 */
+	Spectrum Lo(const Scene *scene, const Intersection &its, const BSDF *bsdf,
+		Float threshold, int maxCutSize, int &cutSize) const;
+
+	/// Return the number of VPLs
+	inline size_t getVPLCount() const { return m_lights.size(); }
+
+	/// Return the number of nodes
+	inline size_t getNodeCount() const { return m_nodes.size(); }
+
+	/// Return a human-readable representation
+	std::string toString() const;
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Compact VPL representation
+	struct Light {
+		Point p;
+		Frame frame;
+		Point2 uv;
+		/// Incident direction in the local frame (surface VPLs)
+		Vector wi;
+		Spectrum P;
+		/// Vertex color of the surface (surface VPLs)
+		Spectrum color;
+		/// Diffuse reflectance (surface VPLs without a shape index)
+		Spectrum reflectance;
+		/// Luminance of \c P times a bound on the directional emission
+		Float intensity;
+		/// Minimum distance used by the geometric term
+		Float minDist;
+		/// Index of the shape or luminaire within the scene (or -1)
+		int index;
+		uint8_t type;
+		bool onSurface;
+	};
+
+	struct Node {
+		AABB aabb;
+		/// Cone bounding the emission directions of one-sided VPLs
+		Vector axis;
+		/// Cosine of the cone angle (-1 when the directions are unbounded)
+		Float cosTheta;
+		Float intensity;
+		Float minDist;
+		/// Index of the representative VPL
+		int light;
+		/// Index of the right child (the left one follows the node, -1 for leaves)
+		int right;
+	};
+
+	/// VPL reference used during the tree construction
+	struct Primitive {
+		Point p;
+		/// Emission axis, or zero when the VPL is not one-sided
+		Vector axis;
+		Float intensity;
+		int index;
+	};
+
+	/// Release all memory
+	virtual ~VPLTree() { }
+
+	/**
+	 * \brief Recursively build the subtree over a range of primitives
+	 *
+	 * \param orientationScale
+	 *    Weight of the emission axes relative to the positions when
+	 *    clustering VPLs
+	 */
+	int build(std::vector<Primitive> &primitives, int start, int end,
+		Float orientationScale, Random *random);
+
+	/// Create an intersection record, which can be used to query the BSDF of a surface VPL
+	void getIntersection(const Scene *scene, const Light &light, Intersection &its) const;
+
+	/// Directional emission of a VPL towards \c d (without the cosine factor)
+	Spectrum getEmission(const Scene *scene, const Light &light, const Vector &d) const;
+
+	/// Contribution of a single VPL, which accounts for its visibility
+	Spectrum getContribution(const Scene *scene, const Intersection &its,
+		const BSDF *bsdf, const Light &light) const;
+
+	/// Upper bound on the contribution of all VPLs below a node
+	Float getErrorBound(const Node &node, const Point &p, const Vector &n,
+		Float bsdfBound) const;
+private:
+	std::vector<Light> m_lights;
+	std::vector<Node> m_nodes;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __VPLTREE_H */
@@ -339,5 +339,39 @@ bool FileStream::canWrite() const {
 	return m_write;
 }
 
+AtomicFileStream::AtomicFileStream(const fs::path &path, EFileMode mode)
+ : m_targetPath(path), m_committed(false) {
+	open(path.parent_path() / formatString("%s.%s-%i.tmp", 
+		path.filename().c_str(), getHostName().c_str(), getProcessId()), mode);
+}
+
+AtomicFileStream::~AtomicFileStream() {
+	if (m_committed)
+		return;
+	try {
+		if (m_file != 0)
+			close();
+		fs::remove(m_path);
+	} catch (const std::exception &) {
+		/* Don't throw from the destructor */
+	}
+}
+
+void AtomicFileStream::commit() {
+	close();
+	replaceFile(m_path.file_string(), m_targetPath.file_string());
+	m_committed = true;
+}
+
+std::string AtomicFileStream::toString() const {
+	std::ostringstream oss;
+	oss << "AtomicFileStream[" << Stream::toString()
+		<< ", path=\"" << m_path.file_string()
+		<< "\", targetPath=\"" << m_targetPath.file_string()
+		<< "\", mode=" << m_mode << "]";
+	return oss.str();
+}
+
 MTS_IMPLEMENT_CLASS(FileStream, false, Stream)
+MTS_IMPLEMENT_CLASS(AtomicFileStream, false, FileStream)
 MTS_NAMESPACE_END
@@ -18,7 +18,7 @@ MemoryMappedFile::MemoryMappedFile(const fs::path &filename) : m_filename(filena
 	if (fd == -1)
 		Log(EError, "Could not open \"%s\"!", m_filename.file_string().c_str());
 	m_data = mmap(NULL, m_size, PROT_READ, MAP_SHARED, fd, 0);
-	if (m_data == NULL)
+	if (m_data == MAP_FAILED)
 		Log(EError, "Could not map \"%s\" to memory!", m_filename.file_string().c_str());
 	if (close(fd) != 0)
 		Log(EError, "close(): unable to close file!");
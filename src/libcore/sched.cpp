@@ -19,6 +19,8 @@
 #include <mitsuba/core/sched.h>
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/mstream.h>
+#include <mitsuba/core/atomic.h>
+#include <mitsuba/core/statistics.h>
 
 MTS_NAMESPACE_BEGIN
 
@@ -50,17 +52,53 @@ bool ParallelProcess::isLocal() const {
 
 ref<Scheduler> Scheduler::m_scheduler;
 
+/* The statistics counters are created on first use, since the
+   scheduler may be used before libcore's static initialization
+   has finished */
+static StatsCounter &statsLockContention() {
+	static StatsCounter counter("Scheduler", 
+		"Main lock contention", EPercentage);
+	return counter;
+}
+
+static StatsCounter &statsStolenWork() {
+	static StatsCounter counter("Scheduler", 
+		"Stolen work units", EPercentage);
+	return counter;
+}
+
 Scheduler::Scheduler() {
 	m_mutex = new Mutex();
 	m_workAvailable = new ConditionVariable(m_mutex);
 	m_resourceCounter = 0;
 	m_processCounter = 0;
+	m_queuedUnits = 0;
+	m_workPrefetch = 4;
 	m_running = false;
 }
 
 Scheduler::~Scheduler() {
 	for (size_t i=0; i<m_workers.size(); ++i)
 		m_workers[i]->decRef();
+	for (size_t i=0; i<m_workQueues.size(); ++i)
+		delete m_workQueues[i];
+}
+
+void Scheduler::acquireLock() {
+	StatsCounter &contention = statsLockContention();
+	if (!m_mutex->tryLock()) {
+		++contention;
+		m_mutex->lock();
+	}
+	contention.incrementBase();
+}
+
+void Scheduler::setWorkPrefetch(int count) {
+	if (count < 1)
+		Log(EError, "setWorkPrefetch(): the count must be at least 1!");
+	m_mutex->lock();
+	m_workPrefetch = count;
+	m_mutex->unlock();
 }
 
 void Scheduler::registerWorker(Worker *worker) {
@@ -413,6 +451,24 @@ bool Scheduler::cancel(ParallelProcess *process, bool reduceInflight) {
 	m_remoteQueue.erase(std::remove(m_remoteQueue.begin(), m_remoteQueue.end(), rec->id), 
 		m_remoteQueue.end());
 
+	/* Discard any work units of this process that were generated 
+	   ahead of time, but haven't been picked up by a worker yet */
+	for (size_t i=0; i<m_workQueues.size(); ++i) {
+		LocalQueue *lq = m_workQueues[i];
+		lq->mutex->lock();
+		std::deque<std::pair<int, ref<WorkUnit> > >::iterator it = lq->units.begin();
+		while (it != lq->units.end()) {
+			if ((*it).first == rec->id) {
+				it = lq->units.erase(it);
+				atomicAdd(&m_queuedUnits, -1);
+				--rec->inflight;
+			} else {
+				++it;
+			}
+		}
+		lq->mutex->unlock();
+	}
+
 	/* Ensure that the process won't be considered 'done' when the
 	   last in-flight work unit is returned */
 	rec->morework = true;
@@ -456,7 +512,7 @@ bool Scheduler::cancel(ParallelProcess *process, bool reduceInflight) {
 
 Scheduler::EStatus Scheduler::acquireWork(Item &item, 
 		bool local, bool onlyTry, bool keepLock) {
-	m_mutex->lock();
+	acquireLock();
 	std::deque<int> &queue = local ? m_localQueue : m_remoteQueue;
 	while (true) {
 		if (onlyTry && queue.size() == 0) {
@@ -524,7 +580,143 @@ Scheduler::EStatus Scheduler::acquireWork(Item &item,
 	sched_yield();
 	return EOK;
 }
-		
+
+bool Scheduler::popLocalWork(LocalQueue *queue, std::pair<int, ref<WorkUnit> > &unit) {
+	if (queue->units.empty()) /* Unsynchronized peek -- rechecked below */
+		return false;
+	bool success = false;
+	queue->mutex->lock();
+	if (!queue->units.empty()) {
+		unit = queue->units.front();
+		queue->units.pop_front();
+		atomicAdd(&m_queuedUnits, -1);
+		success = true;
+	}
+	queue->mutex->unlock();
+	return success;
+}
+
+bool Scheduler::stealLocalWork(int workerIndex, std::pair<int, ref<WorkUnit> > &unit) {
+	const int queueCount = (int) m_workQueues.size();
+	for (int i=1; i<queueCount && m_queuedUnits > 0; ++i) {
+		LocalQueue *victim = m_workQueues[(workerIndex + i) % queueCount];
+		if (victim->units.empty())
+			continue;
+		bool success = false;
+		victim->mutex->lock();
+		if (!victim->units.empty()) {
+			unit = victim->units.back();
+			victim->units.pop_back();
+			atomicAdd(&m_queuedUnits, -1);
+			success = true;
+		}
+		victim->mutex->unlock();
+		if (success)
+			return true;
+	}
+	return false;
+}
+
+Scheduler::EStatus Scheduler::acquireLocalWork(Item &item) {
+	LocalQueue *ownQueue = m_workQueues[item.workerIndex];
+	std::pair<int, ref<WorkUnit> > unit;
+	StatsCounter &stolenWork = statsStolenWork();
+
+	while (true) {
+		/* Process pre-generated work units first. This also drains 
+		   the queue when the scheduler is about to be paused */
+		if (popLocalWork(ownQueue, unit))
+			break;
+		if (m_running && stealLocalWork(item.workerIndex, unit)) {
+			++stolenWork;
+			break;
+		}
+
+		acquireLock();
+
+		/* Wait until work is available and return false 
+		   if stop() is called */
+		while (m_localQueue.size() == 0 && m_queuedUnits == 0 && m_running) 
+			m_workAvailable->wait();
+
+		if (!m_running) {
+			m_mutex->unlock();
+			return EStop;
+		}
+
+		/* Generate a batch of work units from the parallel process 
+		   currently on top of the queue. The batch never spans
+		   multiple processes. */
+		int generated = 0, batchID = -1;
+		while (generated < m_workPrefetch && m_localQueue.size() > 0) {
+			ParallelProcess::EStatus wStatus;
+			ref<WorkUnit> workUnit;
+			int id = m_localQueue.front();
+			if (generated > 0 && id != batchID)
+				break;
+			try {
+				if (item.id != id) {
+					/* First work unit from this parallel process - establish
+					   connections to referenced resources and prepare the 
+					   work processor */
+					setProcessByID(item, id);
+				}
+
+				workUnit = item.wp->createWorkUnit();
+				wStatus = item.proc->generateWork(workUnit, item.workerIndex);
+			} catch (const std::exception &ex) {
+				Log(EWarn, "Caught an exception - canceling process %i: %s",
+					item.id, ex.what());
+				cancel(item.proc);
+				continue;
+			}
+
+			if (wStatus == ParallelProcess::ESuccess) {
+				item.rec->inflight++;
+				batchID = id;
+				ownQueue->mutex->lock();
+				ownQueue->units.push_back(std::make_pair(id, workUnit));
+				ownQueue->mutex->unlock();
+				atomicAdd(&m_queuedUnits, 1);
+				++generated;
+			} else if (wStatus == ParallelProcess::EFailure) {
+#if defined(DEBUG_SCHED)
+				if (item.rec->morework)
+					Log(item.rec->logLevel, "Process %i has finished generating work", item.rec->id);
+#endif
+				item.rec->morework = false;
+				item.rec->active = false;
+				m_localQueue.pop_front();
+				if (item.rec->inflight == 0)
+					signalProcessTermination(item.proc, item.rec);
+			} else if (wStatus == ParallelProcess::EPause) {
+#if defined(DEBUG_SCHED)
+				Log(item.rec->logLevel, "Pausing process %i", item.rec->id);
+#endif
+				item.rec->active = false;
+				m_localQueue.pop_front();
+			}
+		}
+
+		/* Let idle workers know that there is something to steal */
+		if (generated > 1)
+			m_workAvailable->broadcast();
+
+		m_mutex->unlock();
+	}
+
+	stolenWork.incrementBase();
+
+	if (item.id != unit.first)
+		setProcessByID(item, unit.first);
+
+	item.workUnit = unit.second;
+	/* The process may have been cancelled while the unit was in transit */
+	item.stop = item.rec->cancelled;
+
+	return EOK;
+}
+
 void Scheduler::signalProcessTermination(ParallelProcess *proc, ProcessRecord *rec) {
 #if defined(DEBUG_SCHED)
 	Log(rec->logLevel, "Process %i is complete.", rec->id);
@@ -559,6 +751,10 @@ void Scheduler::start() {
 	if (m_workers.size() == 0)
 		Log(EError, "Cannot start the scheduler - there are no registered workers!");
 
+	/* Create one queue for pre-generated work units per worker */
+	for (size_t i=m_workQueues.size(); i<m_workers.size(); ++i)
+		m_workQueues.push_back(new LocalQueue());
+
 	int coreIndex = 0;
 	for (size_t i=0; i<m_workers.size(); ++i) {
 		m_workers[i]->start(this, (int) i, coreIndex);
@@ -601,6 +797,12 @@ void Scheduler::stop() {
 	m_idToProcess.clear();
 	m_localQueue.clear();
 	m_remoteQueue.clear();
+	for (size_t i=0; i<m_workQueues.size(); ++i) {
+		m_workQueues[i]->mutex->lock();
+		m_workQueues[i]->units.clear();
+		m_workQueues[i]->mutex->unlock();
+	}
+	m_queuedUnits = 0;
 	for (std::map<int, ResourceRecord *>::iterator
 		it = m_resources.begin(); it != m_resources.end(); ++it) {
 		ResourceRecord *rec = (*it).second;
@@ -677,7 +879,7 @@ LocalWorker::~LocalWorker() {
 }
 
 void LocalWorker::run() {
-	while (acquireWork(true) != Scheduler::EStop) {
+	while (acquireLocalWork() != Scheduler::EStop) {
 		try {
 			m_schedItem.wp->process(m_schedItem.workUnit, m_schedItem.workResult, m_schedItem.stop);
 		} catch (const std::exception &ex) {
@@ -39,6 +39,7 @@
 #include <sys/socket.h>
 #include <netdb.h>
 #include <fenv.h>
+#include <unistd.h>
 #endif
 
 #if !defined(L1_CACHE_LINE_SIZE)
@@ -326,6 +327,26 @@ std::string getHostName() {
 	return hostName;
 }
 
+int getProcessId() {
+#if defined(WIN32)
+	return (int) GetCurrentProcessId();
+#else
+	return (int) getpid();
+#endif
+}
+
+void replaceFile(const std::string &source, const std::string &target) {
+#if defined(WIN32)
+	if (!MoveFileEx(source.c_str(), target.c_str(), MOVEFILE_REPLACE_EXISTING))
+		SLog(EError, "Could not replace \"%s\" by \"%s\": %s", target.c_str(),
+			source.c_str(), lastErrorText().c_str());
+#else
+	if (::rename(source.c_str(), target.c_str()) != 0)
+		SLog(EError, "Could not replace \"%s\" by \"%s\": %s", target.c_str(),
+			source.c_str(), strerror(errno));
+#endif
+}
+
 std::string getFQDN() {
 	struct addrinfo *addrInfo = NULL, hints;
 	memset(&hints, 0, sizeof(addrinfo));
@@ -443,6 +464,37 @@ uint64_t roundToPow2(uint64_t i) {
 	return i+1;
 }
 
+uint64_t hashBuffer(const void *data, size_t size, uint64_t seed) {
+	const uint64_t m = 0xc6a4a7935bd1e995ULL;
+	const int r = 47;
+	const uint8_t *ptr = static_cast<const uint8_t *>(data);
+	const uint8_t *end = ptr + (size & ~(size_t) 7);
+	uint64_t h = seed ^ (size * m);
+
+	while (ptr != end) {
+		uint64_t k;
+		memcpy(&k, ptr, sizeof(uint64_t));
+		ptr += sizeof(uint64_t);
+
+		k *= m; k ^= k >> r; k *= m;
+		h ^= k; h *= m;
+	}
+
+	switch (size & 7) {
+		case 7: h ^= (uint64_t) ptr[6] << 48;
+		case 6: h ^= (uint64_t) ptr[5] << 40;
+		case 5: h ^= (uint64_t) ptr[4] << 32;
+		case 4: h ^= (uint64_t) ptr[3] << 24;
+		case 3: h ^= (uint64_t) ptr[2] << 16;
+		case 2: h ^= (uint64_t) ptr[1] << 8;
+		case 1: h ^= (uint64_t) ptr[0];
+				h *= m;
+	};
+
+	h ^= h >> r; h *= m; h ^= h >> r;
+	return h;
+}
+
 // -----------------------------------------------------------------------
 //  Numerical utility functions
 // -----------------------------------------------------------------------
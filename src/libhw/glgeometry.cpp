@@ -40,13 +40,13 @@ void GLGeometry::init() {
 void GLGeometry::refresh() {
 	Assert(m_vertexID != 0 && m_indexID != 0);
 	m_stride = 3;
-	if (m_mesh->getVertexNormals())
+	if (m_mesh->hasVertexNormals())
 		m_stride += 3;
-	if (m_mesh->getVertexTexcoords())
+	if (m_mesh->hasVertexTexcoords())
 		m_stride += 2;
-	if (m_mesh->getVertexTangents())
+	if (m_mesh->hasVertexTangents())
 		m_stride += 3;
-	if (m_mesh->getVertexColors())
+	if (m_mesh->hasVertexColors())
 		m_stride += 3;
 	m_stride *= sizeof(GLfloat);
 
@@ -64,33 +64,35 @@ void GLGeometry::refresh() {
 		* m_stride/sizeof(GLfloat)];
 	GLuint *indices = (GLuint *) m_mesh->getTriangles();
 	const Point *sourcePositions = m_mesh->getVertexPositions();
-	const Normal *sourceNormals = m_mesh->getVertexNormals();
-	const Point2 *sourceTexcoords = m_mesh->getVertexTexcoords();
-	const Spectrum *sourceColors = m_mesh->getVertexColors();
 	const TangentSpace *sourceTangents = m_mesh->getVertexTangents();
+	bool hasNormals = m_mesh->hasVertexNormals(),
+		 hasTexcoords = m_mesh->hasVertexTexcoords(),
+		 hasColors = m_mesh->hasVertexColors();
 
 	size_t pos = 0;
 	for (size_t i=0; i<m_mesh->getVertexCount(); ++i) {
 		vertices[pos++] = (float) sourcePositions[i].x;
 		vertices[pos++] = (float) sourcePositions[i].y;
 		vertices[pos++] = (float) sourcePositions[i].z;
-		if (sourceNormals) {
-			vertices[pos++] = (float) sourceNormals[i].x;
-			vertices[pos++] = (float) sourceNormals[i].y;
-			vertices[pos++] = (float) sourceNormals[i].z;
+		if (hasNormals) {
+			Normal n = m_mesh->getVertexNormal(i);
+			vertices[pos++] = (float) n.x;
+			vertices[pos++] = (float) n.y;
+			vertices[pos++] = (float) n.z;
 		}
-		if (sourceTexcoords) {
-			vertices[pos++] = (float) sourceTexcoords[i].x;
-			vertices[pos++] = (float) sourceTexcoords[i].y;
+		if (hasTexcoords) {
+			Point2 uv = m_mesh->getVertexTexcoord(i);
+			vertices[pos++] = (float) uv.x;
+			vertices[pos++] = (float) uv.y;
 		}
 		if (sourceTangents) {
 			vertices[pos++] = (float) sourceTangents[i].dpdu.x;
 			vertices[pos++] = (float) sourceTangents[i].dpdu.y;
 			vertices[pos++] = (float) sourceTangents[i].dpdu.z;
 		}
-		if (sourceColors) {
+		if (hasColors) {
 			Float r, g, b;
-			sourceColors[i].toLinearRGB(r, g, b);
+			m_mesh->getVertexColor(i).toLinearRGB(r, g, b);
 			vertices[pos++] = (float) r;
 			vertices[pos++] = (float) g;
 			vertices[pos++] = (float) b;
@@ -425,8 +425,10 @@ void GLRenderer::drawTriMesh(const TriMesh *mesh) {
 
 		glVertexPointer(3, dataType, 0, positions);
 
+		/* Compact vertex attributes (TriMesh::compactAttributes()) can
+		   only be drawn using VBOs, hence check the arrays themselves */
 		if (!m_transmitOnlyPositions) {
-			if (mesh->hasVertexNormals()) {
+			if (normals) {
 				if (!m_normalsEnabled) {
 					glEnableClientState(GL_NORMAL_ARRAY);
 					m_normalsEnabled = true;
@@ -438,7 +440,7 @@ void GLRenderer::drawTriMesh(const TriMesh *mesh) {
 			}
 
 			glClientActiveTexture(GL_TEXTURE0);
-			if (mesh->hasVertexTexcoords()) {
+			if (texcoords) {
 				if (!m_texcoordsEnabled) {
 					glEnableClientState(GL_TEXTURE_COORD_ARRAY);
 					m_texcoordsEnabled = true;
@@ -462,7 +464,7 @@ void GLRenderer::drawTriMesh(const TriMesh *mesh) {
 				m_tangentsEnabled = false;
 			}
 
-			if (mesh->hasVertexColors()) {
+			if (colors) {
 				if (!m_colorsEnabled) {
 					glEnableClientState(GL_COLOR_ARRAY);
 					m_colorsEnabled = true;
@@ -18,6 +18,7 @@
 
 #include <mitsuba/render/film.h>
 #include <mitsuba/core/plugin.h>
+#include <mitsuba/core/sse.h>
 
 MTS_NAMESPACE_BEGIN
 
@@ -49,6 +50,8 @@ Film::Film(const Properties &props)
 	   quality at the edges especially with large reconstruction 
 	   filters. */
 	m_highQualityEdges = props.getBoolean("highQualityEdges", false);
+
+	initializeTileLocks();
 }
 
 Film::Film(Stream *stream, InstanceManager *manager) 
@@ -59,11 +62,55 @@ Film::Film(Stream *stream, InstanceManager *manager)
 	m_highQualityEdges = stream->readBool();
 	m_filter = static_cast<ReconstructionFilter *>(manager->getInstance(stream));
 	m_tabulatedFilter = new TabulatedFilter(m_filter);
+	initializeTileLocks();
 }
 
 Film::~Film() {
 }
 
+void Film::initializeTileLocks() {
+	m_tileCount = Vector2i(
+		(m_cropSize.x + MTS_FILM_TILE_SIZE - 1) / MTS_FILM_TILE_SIZE,
+		(m_cropSize.y + MTS_FILM_TILE_SIZE - 1) / MTS_FILM_TILE_SIZE
+	);
+	m_tileLocks.resize(m_tileCount.x * m_tileCount.y);
+	for (size_t i=0; i<m_tileLocks.size(); ++i)
+		m_tileLocks[i] = new Mutex();
+}
+
+void Film::accumulateSpan(Float *target, const ImageBlock *block,
+		size_t entry, int count) {
+	const int stride = SPECTRUM_SAMPLES + 2;
+	const Float *spec = reinterpret_cast<const Float *>(&block->getPixel(entry));
+	int i = 0;
+
+#if defined(MTS_SSE) && defined(SINGLE_PRECISION) && SPECTRUM_SAMPLES == 3
+	/* Add the spectrum and alpha value using a single 4-wide operation. The
+	   unaligned load of the block spectrum reads one value past the current
+	   entry, hence the last pixel is handled by the scalar loop below */
+	for (; i < count - 1; ++i) {
+		__m128 value = _mm_loadu_ps(spec + 3*i),
+			   a = _mm_set1_ps(block->getAlpha(entry + i));
+
+		/* (v0, v1, v2, *) -> (v0, v1, v2, a) */
+		a = _mm_shuffle_ps(value, a, _MM_SHUFFLE(0, 0, 2, 2));
+		value = _mm_shuffle_ps(value, a, _MM_SHUFFLE(2, 0, 1, 0));
+
+		Float *pixel = target + i * stride;
+		_mm_storeu_ps(pixel, _mm_add_ps(_mm_loadu_ps(pixel), value));
+		pixel[4] += block->getWeight(entry + i);
+	}
+#endif
+
+	for (; i < count; ++i) {
+		Float *pixel = target + i * stride;
+		for (int j=0; j<SPECTRUM_SAMPLES; ++j)
+			pixel[j] += spec[i * SPECTRUM_SAMPLES + j];
+		pixel[SPECTRUM_SAMPLES] += block->getAlpha(entry + i);
+		pixel[SPECTRUM_SAMPLES + 1] += block->getWeight(entry + i);
+	}
+}
+
 void Film::serialize(Stream *stream, InstanceManager *manager) const {
 	ConfigurableObject::serialize(stream, manager);
 	m_size.serialize(stream);
@@ -170,11 +170,17 @@ protected:
 
 GatherPhotonProcess::GatherPhotonProcess(EGatherType type, size_t photonCount, 
 	size_t granularity, int maxDepth, int rrDepth, bool isLocal, bool autoCancel,
-	const void *progressReporterPayload)
+	const void *progressReporterPayload, GatherPointHashGrid *grid)
 	: ParticleProcess(ParticleProcess::EGather, photonCount, granularity, "Gathering photons", 
-	  progressReporterPayload), m_type(type), m_photonCount(photonCount), m_maxDepth(maxDepth),
-	  m_rrDepth(rrDepth),  m_isLocal(isLocal), m_autoCancel(autoCancel), m_excess(0), m_numShot(0) {
-	m_photonMap = new PhotonMap(photonCount);
+	  progressReporterPayload), m_type(type), m_grid(grid), m_splatCount(0), m_photonCount(photonCount), 
+	  m_maxDepth(maxDepth), m_rrDepth(rrDepth),  m_isLocal(isLocal), m_autoCancel(autoCancel), 
+	  m_excess(0), m_numShot(0) {
+	if (m_grid) {
+		if (!m_isLocal)
+			Log(EError, "Splatting photons into a hash grid requires a local process!");
+	} else {
+		m_photonMap = new PhotonMap(photonCount);
+	}
 }
 	
 bool GatherPhotonProcess::isLocal() const {
@@ -191,6 +197,34 @@ void GatherPhotonProcess::processResult(const WorkResult *wr, bool cancelled) {
 	const PhotonVector &vec = *static_cast<const PhotonVector *>(wr);
 	m_resultMutex->lock();
 
+	if (m_grid) {
+		/* Reserve space for the photons of this work result. The actual
+		   splatting happens without holding the lock, so that several
+		   workers can do it at the same time */
+		size_t photonCount = vec.getPhotonCount(),
+			   nParticles = vec.getParticleCount(),
+			   accepted = std::min(photonCount, m_photonCount - 
+					std::min(m_photonCount, m_splatCount));
+
+		if (accepted < photonCount) {
+			/* Only account for the particles that were (partially) used */
+			m_excess += photonCount - accepted;
+			nParticles = 0;
+			while (nParticles < vec.getParticleCount() && 
+					vec.getParticleIndex(nParticles) <= accepted)
+				++nParticles;
+		}
+
+		m_splatCount += accepted;
+		m_numShot += nParticles;
+		increaseResultCount(photonCount);
+		m_resultMutex->unlock();
+
+		for (size_t i=0; i<accepted; ++i)
+			m_grid->splat(vec[i]);
+		return;
+	}
+
 	size_t nParticles = 0;
 	for (size_t i=0; i<vec.getParticleCount(); ++i) {
 		size_t start = vec.getParticleIndex(i),
@@ -215,7 +249,8 @@ void GatherPhotonProcess::processResult(const WorkResult *wr, bool cancelled) {
 ParallelProcess::EStatus GatherPhotonProcess::generateWork(WorkUnit *unit, int worker) {
 	/* Use the same approach as PBRT for auto canceling */
 	if (m_autoCancel && m_numShot > 500000
-			&& unsuccessful(m_photonCount, m_photonMap->getPhotonCount(), m_numShot)) {
+			&& unsuccessful(m_photonCount, m_grid ? m_splatCount
+				: m_photonMap->getPhotonCount(), m_numShot)) {
 		Log(EInfo, "Not enough photons could be collected, giving up");
 		return EFailure;
 	}
@@ -0,0 +1,193 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/hashgrid.h>
+#include <mitsuba/render/scene.h>
+#include <mitsuba/core/atomic.h>
+
+/// Maximum number of cells overlapped by a single gather point
+#define MTS_HASHGRID_MAX_CELLS 27
+
+MTS_NAMESPACE_BEGIN
+
+GatherPointHashGrid::GatherPointHashGrid() : m_invCellSize(0), m_tableSize(0) { }
+
+void GatherPointHashGrid::clear() {
+	m_entries.clear();
+	m_cellStart.clear();
+	m_cellEntries.clear();
+	m_cellPoints.clear();
+	m_aabb.reset();
+	m_tableSize = 0;
+}
+
+int GatherPointHashGrid::getCells(const GatherPointEntry &entry, uint32_t *cells) const {
+	const Point &p = entry.its->p;
+	const Vector extents(entry.radius);
+
+	Vector minCell = (p - extents - m_aabb.min) * m_invCellSize,
+	       maxCell = (p + extents - m_aabb.min) * m_invCellSize;
+
+	int nCells = 0;
+	for (int z = std::max(0, (int) minCell.z); z <= (int) maxCell.z; ++z) {
+		for (int y = std::max(0, (int) minCell.y); y <= (int) maxCell.y; ++y) {
+			for (int x = std::max(0, (int) minCell.x); x <= (int) maxCell.x; ++x) {
+				/* The cell size matches the largest radius, hence there
+				   are at most 27 cells. Remove duplicates caused by hash
+				   collisions, since these would lead to photons being
+				   counted twice */
+				uint32_t cell = hash(x, y, z);
+				bool duplicate = false;
+				for (int i=0; i<nCells; ++i)
+					duplicate |= cells[i] == cell;
+				if (!duplicate && nCells < MTS_HASHGRID_MAX_CELLS)
+					cells[nCells++] = cell;
+			}
+		}
+	}
+	return nCells;
+}
+
+void GatherPointHashGrid::build() {
+	size_t entryCount = m_entries.size();
+	m_flux.resize(entryCount * SPECTRUM_SAMPLES);
+	m_photonCount.resize(entryCount);
+	std::fill(m_flux.begin(), m_flux.end(), (Float) 0);
+	std::fill(m_photonCount.begin(), m_photonCount.end(), 0);
+
+	m_aabb.reset();
+	Float maxRadius = 0;
+	for (size_t i=0; i<entryCount; ++i) {
+		const GatherPointEntry &entry = m_entries[i];
+		if (entry.radius <= 0)
+			continue;
+		const Vector extents(entry.radius);
+		m_aabb.expandBy(entry.its->p - extents);
+		m_aabb.expandBy(entry.its->p + extents);
+		maxRadius = std::max(maxRadius, (Float) entry.radius);
+	}
+
+	if (maxRadius == 0) {
+		m_tableSize = 0;
+		return;
+	}
+
+	m_invCellSize = 1 / maxRadius;
+	m_tableSize = (uint32_t) entryCount;
+	m_cellStart.resize(m_tableSize + 1);
+	std::fill(m_cellStart.begin(), m_cellStart.end(), 0);
+
+	/* Count the number of gather points per hash table entry */
+	uint32_t cells[MTS_HASHGRID_MAX_CELLS];
+	for (size_t i=0; i<entryCount; ++i) {
+		const GatherPointEntry &entry = m_entries[i];
+		if (entry.radius <= 0)
+			continue;
+		int nCells = getCells(entry, cells);
+		for (int j=0; j<nCells; ++j)
+			m_cellStart[cells[j] + 1]++;
+	}
+
+	for (uint32_t i=0; i<m_tableSize; ++i)
+		m_cellStart[i+1] += m_cellStart[i];
+
+	/* Store the gather point indices in a compact list */
+	m_cellEntries.resize(m_cellStart[m_tableSize]);
+	m_cellPoints.resize(m_cellStart[m_tableSize]);
+	std::vector<uint32_t> fill(m_cellStart.begin(), m_cellStart.end() - 1);
+	for (size_t i=0; i<entryCount; ++i) {
+		const GatherPointEntry &entry = m_entries[i];
+		if (entry.radius <= 0)
+			continue;
+		CellPoint point;
+		point.x = (float) entry.its->p.x;
+		point.y = (float) entry.its->p.y;
+		point.z = (float) entry.its->p.z;
+		point.radiusSquared = entry.radius * entry.radius;
+
+		int nCells = getCells(entry, cells);
+		for (int j=0; j<nCells; ++j) {
+			uint32_t pos = fill[cells[j]]++;
+			m_cellEntries[pos] = (uint32_t) i;
+			m_cellPoints[pos] = point;
+		}
+	}
+}
+
+void GatherPointHashGrid::splat(const Photon &photon) {
+	if (m_tableSize == 0)
+		return;
+
+	const Point p = photon.getPosition();
+	if (!m_aabb.contains(p))
+		return;
+
+	Vector cell = (p - m_aabb.min) * m_invCellSize;
+	uint32_t index = hash((int) cell.x, (int) cell.y, (int) cell.z);
+	uint32_t start = m_cellStart[index], end = m_cellStart[index+1];
+	if (start == end)
+		return;
+
+	const Normal photonNormal(photon.getNormal());
+	const Vector wiWorld = -photon.getDirection();
+	const Spectrum power = photon.getPower();
+
+	for (uint32_t i=start; i<end; ++i) {
+		/* Use the same criteria as PhotonMap::estimateRadianceRaw(). The
+		   distance test only touches the compact per-cell copy */
+		const CellPoint &point = m_cellPoints[i];
+		if (photon.distSquared(&point.x) >= point.radiusSquared)
+			continue;
+
+		uint32_t entryIndex = m_cellEntries[i];
+		const GatherPointEntry &entry = m_entries[entryIndex];
+		const Intersection &its = *entry.its;
+
+		if (photon.getDepth() > entry.maxDepth || dot(photonNormal, its.shFrame.n) < .1
+			|| dot(photonNormal, wiWorld) < 1e-2)
+			continue;
+
+		Vector wiLocal = its.toLocal(wiWorld);
+		BSDFQueryRecord bRec(its, wiLocal);
+		bRec.quantity = EImportance;
+		std::swap(bRec.wi, bRec.wo);
+
+		/* Account for non-symmetry due to shading normals */
+		Spectrum contrib = power * its.shape->getBSDF()->f(bRec) *
+			std::abs(Frame::cosTheta(wiLocal) / dot(photonNormal, wiWorld));
+
+		Float *flux = &m_flux[entryIndex * SPECTRUM_SAMPLES];
+		for (int j=0; j<SPECTRUM_SAMPLES; ++j)
+			atomicAdd(flux + j, contrib[j]);
+		atomicAdd(&m_photonCount[entryIndex], 1);
+	}
+}
+
+std::string GatherPointHashGrid::toString() const {
+	std::ostringstream oss;
+	oss << "GatherPointHashGrid[" << endl
+		<< "  gatherPointCount = " << m_entries.size() << "," << endl
+		<< "  tableSize = " << m_tableSize << "," << endl
+		<< "  cellSize = " << (m_invCellSize == 0 ? 0 : 1/m_invCellSize) << "," << endl
+		<< "  aabb = " << m_aabb.toString() << endl
+		<< "]";
+	return oss.str();
+}
+
+MTS_IMPLEMENT_CLASS(GatherPointHashGrid, false, Object)
+MTS_NAMESPACE_END
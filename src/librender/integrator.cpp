@@ -41,13 +41,16 @@ void Integrator::serialize(Stream *stream, InstanceManager *manager) const {
 const Integrator *Integrator::getSubIntegrator() const { return NULL; }
 
 SampleIntegrator::SampleIntegrator(const Properties &props)
- : Integrator(props) { }
+ : Integrator(props), m_packetTracing(false) { }
 
 SampleIntegrator::SampleIntegrator(Stream *stream, InstanceManager *manager)
- : Integrator(stream, manager) { }
+ : Integrator(stream, manager) {
+	m_packetTracing = stream->readBool();
+}
 
 void SampleIntegrator::serialize(Stream *stream, InstanceManager *manager) const {
 	Integrator::serialize(stream, manager);
+	stream->writeBool(m_packetTracing);
 }
 
 Spectrum SampleIntegrator::E(const Scene *scene, const Point &p, const Normal &n, Float time,
@@ -128,21 +131,140 @@ void SampleIntegrator::wakeup(std::map<std::string, SerializableObject *> &) {
 	/* Do nothing by default */
 }
 
+/**
+ * Helper class, which generates the camera rays of a pixel for
+ * \ref SampleIntegrator::renderBlock(). When packet tracing is enabled,
+ * the rays of four consecutive samples are traced jointly as an SSE
+ * packet. The resulting intersections are then handed to the integrator
+ * through the radiance query record, which causes it to skip the 
+ * first ray intersection.
+ */
+class CameraRayGenerator {
+public:
+	CameraRayGenerator(const Scene *scene, const Camera *camera, 
+			Sampler *sampler, bool packets) : m_scene(scene), 
+			m_camera(camera), m_sampler(sampler), m_packetStart(0), 
+			m_packetValid(false) {
+		m_needsLensSample = camera->needsLensSample();
+		m_needsTimeSample = camera->needsTimeSample();
+		m_scaleFactor = 1.0f/std::sqrt((Float) sampler->getSampleCount());
+#if defined(MTS_HAS_COHERENT_RT)
+		m_packets = packets && sampler->getSampleCount() >= 4;
+#else
+		m_packets = false;
+#endif
+	}
+
+	/**
+	 * \brief Start a new camera ray query for the current sample
+	 * of the pixel at position \c offset
+	 */
+	inline void next(RadianceQueryRecord &rRec, const Point2i &offset,
+			Point2 &sample, RayDifferential &eyeRay) {
+		rRec.newQuery(RadianceQueryRecord::ECameraRay, m_camera->getMedium());
+#if defined(MTS_HAS_COHERENT_RT)
+		if (m_packets) {
+			size_t sampleIndex = m_sampler->getSampleIndex();
+			if (!m_packetValid || offset != m_packetOffset ||
+				sampleIndex < m_packetStart || sampleIndex >= m_packetStart + 4) {
+				if (sampleIndex + 4 > m_sampler->getSampleCount()) {
+					/* Not enough samples left for a full packet */
+					m_packetValid = false;
+					generate(rRec, offset, sample, eyeRay);
+					return;
+				}
+				tracePacket(rRec, offset, sampleIndex);
+			}
+
+			/* Consume the same sample dimensions as the scalar path */
+			if (m_needsLensSample)
+				rRec.nextSample2D();
+			if (m_needsTimeSample)
+				rRec.nextSample1D();
+			rRec.nextSample2D();
+
+			int idx = (int) (sampleIndex - m_packetStart);
+			sample = m_samples[idx];
+			eyeRay = m_rays[idx];
+			rRec.its = m_its[idx];
+			rRec.type &= ~RadianceQueryRecord::EIntersection;
+
+			if (rRec.type & RadianceQueryRecord::EOpacity) {
+				if (rRec.its.isValid())
+					rRec.alpha = 1.0f;
+				else if (rRec.medium == NULL)
+					rRec.alpha = 0.0f;
+				else
+					rRec.alpha = 1-rRec.medium->getTransmittance(eyeRay).average();
+			}
+			if (rRec.type & RadianceQueryRecord::EDistance)
+				rRec.dist = rRec.its.t;
+			return;
+		}
+#endif
+		generate(rRec, offset, sample, eyeRay);
+	}
+protected:
+	/// Generate a camera ray for the current sample
+	inline void generate(RadianceQueryRecord &rRec, const Point2i &offset,
+			Point2 &sample, RayDifferential &eyeRay) {
+		Point2 lensSample;
+		Float timeSample = 0;
+		if (m_needsLensSample)
+			lensSample = rRec.nextSample2D();
+		if (m_needsTimeSample)
+			timeSample = rRec.nextSample1D();
+		sample = rRec.nextSample2D();
+		sample.x += offset.x; sample.y += offset.y;
+		m_camera->generateRayDifferential(sample, 
+			lensSample, timeSample, eyeRay);
+		eyeRay.scaleDifferential(m_scaleFactor);
+	}
+
+#if defined(MTS_HAS_COHERENT_RT)
+	/**
+	 * Generate the camera rays of the samples <tt>sampleIndex, .., 
+	 * sampleIndex+3</tt>, trace them as a packet, and rewind the sampler
+	 */
+	void tracePacket(RadianceQueryRecord &rRec, const Point2i &offset,
+			size_t sampleIndex) {
+		for (int i=0; i<4; ++i) {
+			m_sampler->setSampleIndex(sampleIndex + i);
+			generate(rRec, offset, m_samples[i], m_rays[i]);
+		}
+		m_sampler->setSampleIndex(sampleIndex);
+		m_scene->rayIntersectPacket(m_rays, m_its);
+		m_packetOffset = offset;
+		m_packetStart = sampleIndex;
+		m_packetValid = true;
+	}
+#endif
+private:
+	const Scene *m_scene;
+	const Camera *m_camera;
+	Sampler *m_sampler;
+	bool m_needsLensSample, m_needsTimeSample;
+	bool m_packets;
+	Float m_scaleFactor;
+	RayDifferential m_rays[4];
+	Intersection m_its[4];
+	Point2 m_samples[4];
+	Point2i m_packetOffset;
+	size_t m_packetStart;
+	bool m_packetValid;
+};
+
 void SampleIntegrator::renderBlock(const Scene *scene,
 	const Camera *camera, Sampler *sampler, ImageBlock *block, 
 	const bool &stop, const std::vector<Point2i> *points) const {
-	Point2 sample, lensSample;
+	Point2 sample;
 	RayDifferential eyeRay;
-	Float timeSample = 0;
 	Spectrum spec;
 
-
 	block->clear();
 	RadianceQueryRecord rRec(scene, sampler);
-	bool needsLensSample = camera->needsLensSample();
-	bool needsTimeSample = camera->needsTimeSample();
+	CameraRayGenerator rayGen(scene, camera, sampler, m_packetTracing);
 	const TabulatedFilter *filter = camera->getFilm()->getTabulatedFilter();
-	Float scaleFactor = 1.0f/std::sqrt((Float) sampler->getSampleCount());
 
 	if (points) {
 		/* Use a prescribed traversal order (e.g. using a space-filling curve) */
@@ -153,16 +275,7 @@ void SampleIntegrator::renderBlock(const Scene *scene,
 					break;
 				sampler->generate();
 				for (size_t j = 0; j<sampler->getSampleCount(); j++) {
-					rRec.newQuery(RadianceQueryRecord::ECameraRay, camera->getMedium());
-					if (needsLensSample)
-						lensSample = rRec.nextSample2D();
-					if (needsTimeSample)
-						timeSample = rRec.nextSample1D();
-					sample = rRec.nextSample2D();
-					sample.x += offset.x; sample.y += offset.y;
-					camera->generateRayDifferential(sample, 
-						lensSample, timeSample, eyeRay);
-					eyeRay.scaleDifferential(scaleFactor);
+					rayGen.next(rRec, offset, sample, eyeRay);
 					spec = Li(eyeRay, rRec);
 					block->putSample(sample, spec, rRec.alpha, filter);
 					sampler->advance();
@@ -177,16 +290,7 @@ void SampleIntegrator::renderBlock(const Scene *scene,
 				sampler->generate();
 				mean = meanSqr = Spectrum(0.0f);
 				for (size_t j = 0; j<sampler->getSampleCount(); j++) {
-					rRec.newQuery(RadianceQueryRecord::ECameraRay, camera->getMedium());
-					if (needsLensSample)
-						lensSample = rRec.nextSample2D();
-					if (needsTimeSample)
-						timeSample = rRec.nextSample1D();
-					sample = rRec.nextSample2D();
-					sample.x += offset.x; sample.y += offset.y;
-					camera->generateRayDifferential(sample, 
-						lensSample, timeSample, eyeRay);
-					eyeRay.scaleDifferential(scaleFactor);
+					rayGen.next(rRec, offset, sample, eyeRay);
 					spec = Li(eyeRay, rRec);
 
 					/* Numerically robust online variance estimation using an
@@ -215,16 +319,7 @@ void SampleIntegrator::renderBlock(const Scene *scene,
 						break;
 					sampler->generate();
 					for (size_t j = 0; j<sampler->getSampleCount(); j++) {
-						rRec.newQuery(RadianceQueryRecord::ECameraRay, camera->getMedium());
-						if (needsLensSample)
-							lensSample = rRec.nextSample2D();
-						if (needsTimeSample)
-							timeSample = rRec.nextSample1D();
-						sample = rRec.nextSample2D();
-						sample.x += x; sample.y += y;
-						camera->generateRayDifferential(sample, 
-							lensSample, timeSample, eyeRay);
-						eyeRay.scaleDifferential(scaleFactor);
+						rayGen.next(rRec, Point2i(x, y), sample, eyeRay);
 						spec = Li(eyeRay, rRec);
 						block->putSample(sample, spec, rRec.alpha, filter);
 						sampler->advance();
@@ -240,16 +335,7 @@ void SampleIntegrator::renderBlock(const Scene *scene,
 					sampler->generate();
 					mean = meanSqr = Spectrum(0.0f);
 					for (size_t j = 0; j<sampler->getSampleCount(); j++) {
-						rRec.newQuery(RadianceQueryRecord::ECameraRay, camera->getMedium());
-						if (needsLensSample)
-							lensSample = rRec.nextSample2D();
-						if (needsTimeSample)
-							timeSample = rRec.nextSample1D();
-						sample = rRec.nextSample2D();
-						sample.x += x; sample.y += y;
-						camera->generateRayDifferential(sample, 
-							lensSample, timeSample, eyeRay);
-						eyeRay.scaleDifferential(scaleFactor);
+						rayGen.next(rRec, Point2i(x, y), sample, eyeRay);
 						spec = Li(eyeRay, rRec);
 
 						/* Numerically robust online variance estimation using an
@@ -180,11 +180,13 @@ struct clamp_neighbors_functor {
 
 /* Irradiance interpolation functor */
 struct irr_interp_functor {
-	irr_interp_functor(const Intersection &its, Float kappa, bool gradients) : its(its), 
-		kappa(kappa), weightSum(0), gradients(gradients), E(0.0f) {
+	irr_interp_functor(const Intersection &its, Float kappa, bool gradients) : its(&its), 
+		kappa(kappa), weightSum(0), gradients(gradients), E(0.0f), recordCount(0) {
 	}
 
 	void operator()(const IrradianceCache::Record *sample) {
+		const Intersection &its = *this->its;
+		++recordCount;
 		Float weight = sample->getWeight(its.p, its.geoFrame.n, kappa);
 
 		if (weight == 0)
@@ -209,17 +211,17 @@ struct irr_interp_functor {
 		weightSum += weight;
 	}
 
-	const Intersection &its;
+	const Intersection *its;
 	Float kappa, weightSum;
 	bool gradients;
 	Spectrum E;
+	size_t recordCount;
 };
 
 IrradianceCache::IrradianceCache(const AABB &aabb) 
  : m_octree(aabb) {
 	/* Use the longest AABB axis as an estimate of the scene dimensions */
 	m_sceneSize = (aabb.max-aabb.min)[aabb.getLargestAxis()];
-	m_mutex = new Mutex();
 
 	/* Reasonable default settings */
 	setQuality(1.0f);
@@ -231,7 +233,6 @@ IrradianceCache::IrradianceCache(const AABB &aabb)
 
 IrradianceCache::IrradianceCache(Stream *stream, InstanceManager *manager) : 
 	m_octree(AABB(stream)) {
-	m_mutex = new Mutex();
 	m_kappa = stream->readFloat();
 	m_sceneSize = stream->readFloat();
 	m_minDist = stream->readFloat();
@@ -240,21 +241,16 @@ IrradianceCache::IrradianceCache(Stream *stream, InstanceManager *manager) :
 	m_clampNeighbor = stream->readBool();
 	m_useGradients = stream->readBool();
 	size_t recordCount = stream->readSize();
-	m_records.reserve(recordCount);
-	for (size_t i=0; i<recordCount; ++i) {
-		Record *sample = new Record(stream);
-		Float validRadius = sample->R0 / (2*m_kappa);
-		m_octree.insert(sample, AABB(
-			sample->p-Vector(1,1,1)*validRadius,
-			sample->p+Vector(1,1,1)*validRadius
-		));
-		m_records.push_back(sample);
-	}
+	for (size_t i=0; i<recordCount; ++i)
+		insert(new Record(stream));
 }
 
 IrradianceCache::~IrradianceCache() {
-	for (size_t i=0; i<m_records.size(); ++i)
-		delete m_records[i];
+	const LockFreeList<Record *>::ListItem *item = m_records.head();
+	while (item) {
+		delete item->value;
+		item = item->next;
+	}
 }
 
 void IrradianceCache::serialize(Stream *stream, InstanceManager *manager) const {
@@ -266,9 +262,27 @@ void IrradianceCache::serialize(Stream *stream, InstanceManager *manager) const
 	stream->writeBool(m_clampScreen);
 	stream->writeBool(m_clampNeighbor);
 	stream->writeBool(m_useGradients);
-	stream->writeSize(m_records.size());
-	for (uint32_t i=0; i<m_records.size(); ++i)
-		m_records[i]->serialize(stream);
+
+	/* Write the records in the order of their insertion */
+	std::vector<const Record *> records;
+	const LockFreeList<Record *>::ListItem *item = m_records.head();
+	while (item) {
+		records.push_back(item->value);
+		item = item->next;
+	}
+	stream->writeSize(records.size());
+	for (size_t i=records.size(); i-- > 0; )
+		records[i]->serialize(stream);
+}
+
+size_t IrradianceCache::getRecordCount() const {
+	size_t count = 0;
+	const LockFreeList<Record *>::ListItem *item = m_records.head();
+	while (item) {
+		++count;
+		item = item->next;
+	}
+	return count;
 }
 
 IrradianceCache::Record *IrradianceCache::put(const RayDifferential &ray, const Intersection &its, 
@@ -348,35 +362,98 @@ IrradianceCache::Record *IrradianceCache::put(const RayDifferential &ray, const
 	return record;
 }
 
+static StatsCounter irradHits("Irradiance cache", "Hits");
+static StatsCounter irradMisses("Irradiance cache", "Misses");
+static StatsCounter irradContended("Irradiance cache", "Contended insertions", EPercentage);
+static StatsCounter irradRecordsPerLookup("Irradiance cache", "Records per lookup", EAverage);
+
 void IrradianceCache::insert(Record *record) {
 	Float validRadius = record->R0 / (2*m_kappa);
-	m_octree.insert(record, AABB(
+	/* Both the octree and the record list are lock-free -- 
+	   keep track of how often concurrent insertions collide */
+	int retries = m_octree.insert(record, AABB(
 		record->p-Vector(1,1,1)*validRadius,
 		record->p+Vector(1,1,1)*validRadius
 	));
-	m_mutex->lock();
-	m_records.push_back(record);
-	m_mutex->unlock();
-}
+	retries += m_records.push(record);
 
-static StatsCounter irradHits("Irradiance cache", "Hits");
-static StatsCounter irradMisses("Irradiance cache", "Misses");
+	irradContended.incrementBase();
+	if (retries > 0)
+		++irradContended;
+}
 
-bool IrradianceCache::get(const Intersection &its, Spectrum &E) const {
+bool IrradianceCache::get(const Intersection &its, Spectrum &E, 
+		bool updateStatistics) const {
 	irr_interp_functor functor(its, m_kappa, m_useGradients);
 	m_octree.lookup(its.p, functor);
 
+	if (updateStatistics) {
+		irradRecordsPerLookup.incrementBase();
+		irradRecordsPerLookup += functor.recordCount;
+	}
+
 	if (functor.weightSum > 0) {
 		E = functor.E / functor.weightSum;
-		++irradHits;
+		if (updateStatistics)
+			++irradHits;
 		Assert(!E.isNaN());
 		return true;
 	}
 
-	++irradMisses;
+	if (updateStatistics)
+		++irradMisses;
 	return false;
 }
 
+/* Adapter, which forwards the records of a batched
+   octree lookup to the per-point interpolation functors */
+struct irr_batch_functor {
+	irr_batch_functor(irr_interp_functor *functors) : functors(functors) { }
+
+	inline void operator()(uint32_t index, const IrradianceCache::Record *sample) {
+		functors[index](sample);
+	}
+
+	irr_interp_functor *functors;
+};
+
+size_t IrradianceCache::get(const Intersection *its, Spectrum *E, 
+		uint8_t *hit, size_t count) const {
+	if (count == 0)
+		return 0;
+
+	std::vector<irr_interp_functor> functors;
+	std::vector<Point> points(count);
+	std::vector<uint32_t> indices(count);
+	functors.reserve(count);
+	for (size_t i=0; i<count; ++i) {
+		functors.push_back(irr_interp_functor(its[i], m_kappa, m_useGradients));
+		points[i] = its[i].p;
+	}
+
+	irr_batch_functor batchFunctor(&functors[0]);
+	m_octree.lookup(&points[0], count, &indices[0], batchFunctor);
+
+	size_t hits = 0, recordCount = 0;
+	for (size_t i=0; i<count; ++i) {
+		const irr_interp_functor &functor = functors[i];
+		recordCount += functor.recordCount;
+
+		hit[i] = functor.weightSum > 0 ? 1 : 0;
+		if (hit[i]) {
+			E[i] = functor.E / functor.weightSum;
+			Assert(!E[i].isNaN());
+			++hits;
+		}
+	}
+	irradRecordsPerLookup.incrementBase(count);
+	irradRecordsPerLookup += recordCount;
+	irradHits += hits;
+	irradMisses += count - hits;
+
+	return hits;
+}
+
 void IrradianceCache::clampInfluence(Float min, Float max) {
 	Assert(min > 0.0f && min < 1.0f && max > 0.0f
 		&& max <= 1.0f && min < max);
@@ -387,7 +464,7 @@ void IrradianceCache::clampInfluence(Float min, Float max) {
 std::string IrradianceCache::toString() const {
 	std::ostringstream oss;
 	oss << "IrradianceCache[" << endl
-		<< "  records = " << m_records.size() << "," << endl
+		<< "  records = " << getRecordCount() << "," << endl
 		<< "  quality = " << m_kappa << "," << endl
 		<< "  sceneSize = " << m_sceneSize << "," << endl
 		<< "  minDist = " << m_minDist << "," << endl
@@ -0,0 +1,354 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/lighttree.h>
+#include <mitsuba/core/timer.h>
+
+MTS_NAMESPACE_BEGIN
+
+/// Selects the primitives, whose centroid falls into one of the first bins
+struct BinPredicate {
+	inline BinPredicate(int axis, int split, Float min, Float scale)
+		: axis(axis), split(split), min(min), scale(scale) { }
+
+	template <typename T> inline bool operator()(const T &prim) const {
+		int bin = std::min((int) ((prim.centroid[axis] - min) * scale),
+			MTS_LIGHTTREE_BINS - 1);
+		return bin <= split;
+	}
+
+	int axis, split;
+	Float min, scale;
+};
+
+LightTree::Cone LightTree::Cone::merge(const Cone &a, const Cone &b) {
+	if (a.thetaO < b.thetaO)
+		return merge(b, a);
+
+	Cone result;
+	result.axis = a.axis;
+	result.thetaE = std::max(a.thetaE, b.thetaE);
+
+	Float thetaD = unitAngle(a.axis, b.axis);
+	if (std::min(thetaD + b.thetaO, (Float) M_PI) <= a.thetaO) {
+		/* The cone of 'a' already contains 'b' */
+		result.thetaO = a.thetaO;
+		return result;
+	}
+
+	Float thetaO = (a.thetaO + thetaD + b.thetaO) / 2;
+	if (thetaO >= M_PI) {
+		result.thetaO = M_PI;
+		return result;
+	}
+
+	/* Rotate the axis of 'a' towards 'b' */
+	Float thetaR = thetaO - a.thetaO;
+	Vector ortho = b.axis - a.axis * dot(a.axis, b.axis);
+	if (ortho.lengthSquared() < 1e-12f) {
+		Vector unused;
+		coordinateSystem(a.axis, ortho, unused);
+	} else {
+		ortho = normalize(ortho);
+	}
+	result.axis = normalize(a.axis * std::cos(thetaR) + ortho * std::sin(thetaR));
+	result.thetaO = thetaO;
+	return result;
+}
+
+Float LightTree::Cone::getMeasure() const {
+	Float thetaW = std::min(thetaO + thetaE, (Float) M_PI);
+	Float cosThetaO = std::cos(thetaO), sinThetaO = std::sin(thetaO);
+	return 2 * M_PI * (1 - cosThetaO) + M_PI / 2 * (2 * thetaW * sinThetaO
+		- std::cos(thetaO - 2 * thetaW) - 2 * thetaO * sinThetaO + cosThetaO);
+}
+
+Float LightTree::getAreaMeasure(const AABB &aabb) {
+	/* Fall back to the squared diagonal for flat or degenerate
+	   boxes, e.g. a row of street lights */
+	return std::max(aabb.getSurfaceArea(), aabb.getExtents().lengthSquared());
+}
+
+LightTree::LightTree(const std::vector<Luminaire *> &luminaires, bool importanceSample) {
+	ref<Timer> timer = new Timer();
+	std::vector<Primitive> primitives;
+	Float treeWeight = 0, unboundedWeight = 0;
+
+	for (size_t i=0; i<luminaires.size(); ++i) {
+		const Luminaire *luminaire = luminaires[i];
+		Float weight = importanceSample ? luminaire->getSamplingWeight() : 1.0f;
+		LuminaireBounds bounds;
+		if (!luminaire->getBounds(bounds) || !bounds.aabb.isValid()) {
+			m_indices[luminaire] = -(int) m_unbounded.size() - 1;
+			m_unbounded.push_back(luminaire);
+			m_unboundedPDF.put(weight);
+			unboundedWeight += weight;
+			continue;
+		}
+
+		Primitive prim;
+		prim.aabb = bounds.aabb;
+		prim.cone.axis = bounds.axis;
+		prim.cone.thetaO = bounds.thetaO;
+		prim.cone.thetaE = bounds.thetaE;
+		prim.power = luminaire->getPower().getLuminance() * weight;
+		prim.centroid = bounds.aabb.getCenter();
+		prim.index = (int) m_bounded.size();
+		m_indices[luminaire] = prim.index;
+		m_bounded.push_back(luminaire);
+		primitives.push_back(prim);
+		treeWeight += weight;
+	}
+
+	if (m_unbounded.size() > 0)
+		m_unboundedPDF.build();
+	if (treeWeight + unboundedWeight > 0)
+		m_treeProbability = treeWeight / (treeWeight + unboundedWeight);
+	else
+		m_treeProbability = m_unbounded.size() > 0 ? 0.0f : 1.0f;
+
+	if (primitives.size() > 0) {
+		m_leaves.resize(primitives.size());
+		m_nodes.reserve(2 * primitives.size() - 1);
+		build(primitives, 0, (int) primitives.size(), -1);
+	}
+
+	Log(EDebug, "Built a light tree over " SIZE_T_FMT " luminaires (" SIZE_T_FMT
+		" nodes, " SIZE_T_FMT " unbounded luminaires) in %i ms", m_bounded.size(),
+		m_nodes.size(), m_unbounded.size(), timer->getMilliseconds());
+}
+
+int LightTree::build(std::vector<Primitive> &primitives, int start, int end, int parent) {
+	int nodeIndex = (int) m_nodes.size();
+	m_nodes.push_back(Node());
+
+	AABB aabb, centroidBounds;
+	Cone cone = primitives[start].cone;
+	Float power = 0;
+	for (int i=start; i<end; ++i) {
+		const Primitive &prim = primitives[i];
+		aabb.expandBy(prim.aabb);
+		centroidBounds.expandBy(prim.centroid);
+		if (i > start)
+			cone = Cone::merge(cone, prim.cone);
+		power += prim.power;
+	}
+
+	Node &node = m_nodes[nodeIndex];
+	node.aabb = aabb;
+	node.cone = cone;
+	node.power = power;
+	node.parent = parent;
+
+	if (end - start == 1) {
+		node.leaf = true;
+		node.index = primitives[start].index;
+		m_leaves[node.index] = nodeIndex;
+		return nodeIndex;
+	}
+	node.leaf = false;
+
+	/* Evaluate the surface area orientation heuristic on a set of bins
+	   along every axis of the centroid bounds */
+	Vector extents = centroidBounds.getExtents();
+	Float maxExtent = std::max(extents.x, std::max(extents.y, extents.z));
+	Float bestCost = std::numeric_limits<Float>::infinity();
+	int bestAxis = -1, bestSplit = -1;
+
+	for (int axis=0; axis<3; ++axis) {
+		if (extents[axis] <= 0)
+			continue;
+
+		AABB binBounds[MTS_LIGHTTREE_BINS];
+		Cone binCones[MTS_LIGHTTREE_BINS];
+		Float binPower[MTS_LIGHTTREE_BINS];
+		int binCount[MTS_LIGHTTREE_BINS];
+		for (int i=0; i<MTS_LIGHTTREE_BINS; ++i) {
+			binPower[i] = 0;
+			binCount[i] = 0;
+		}
+
+		Float scale = MTS_LIGHTTREE_BINS / extents[axis];
+		for (int i=start; i<end; ++i) {
+			const Primitive &prim = primitives[i];
+			int bin = std::min((int) ((prim.centroid[axis] - centroidBounds.min[axis]) * scale),
+				MTS_LIGHTTREE_BINS - 1);
+			binCones[bin] = binCount[bin] == 0 ? prim.cone : Cone::merge(binCones[bin], prim.cone);
+			binBounds[bin].expandBy(prim.aabb);
+			binPower[bin] += prim.power;
+			binCount[bin]++;
+		}
+
+		/* Sweep from the right to accumulate the costs of the right halves */
+		Float rightCost[MTS_LIGHTTREE_BINS];
+		AABB rightBounds;
+		Cone rightCone;
+		Float rightPower = 0;
+		int rightCount = 0;
+		for (int i=MTS_LIGHTTREE_BINS-1; i>0; --i) {
+			if (binCount[i] > 0) {
+				rightBounds.expandBy(binBounds[i]);
+				rightCone = rightCount == 0 ? binCones[i] : Cone::merge(rightCone, binCones[i]);
+				rightPower += binPower[i];
+				rightCount += binCount[i];
+			}
+			rightCost[i] = rightCount == 0 ? -1 : rightPower
+				* rightCone.getMeasure() * getAreaMeasure(rightBounds);
+		}
+
+		/* Regularization, which avoids thin nodes */
+		Float kr = maxExtent / extents[axis];
+		AABB leftBounds;
+		Cone leftCone;
+		Float leftPower = 0;
+		int leftCount = 0;
+		for (int i=0; i<MTS_LIGHTTREE_BINS-1; ++i) {
+			if (binCount[i] > 0) {
+				leftBounds.expandBy(binBounds[i]);
+				leftCone = leftCount == 0 ? binCones[i] : Cone::merge(leftCone, binCones[i]);
+				leftPower += binPower[i];
+				leftCount += binCount[i];
+			}
+			if (leftCount == 0 || rightCost[i+1] < 0)
+				continue;
+			Float cost = kr * (leftPower * leftCone.getMeasure()
+				* getAreaMeasure(leftBounds) + rightCost[i+1]);
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = i;
+			}
+		}
+	}
+
+	int middle;
+	if (bestAxis != -1) {
+		Float scale = MTS_LIGHTTREE_BINS / extents[bestAxis];
+		Float splitPos = centroidBounds.min[bestAxis];
+		Primitive *split = std::partition(&primitives[0] + start, &primitives[0] + end,
+			BinPredicate(bestAxis, bestSplit, splitPos, scale));
+		middle = (int) (split - &primitives[0]);
+	} else {
+		/* All centroids coincide -- split by count */
+		middle = (start + end) / 2;
+	}
+	Assert(middle > start && middle < end);
+
+	build(primitives, start, middle, nodeIndex);
+	int right = build(primitives, middle, end, nodeIndex);
+	m_nodes[nodeIndex].index = right;
+	return nodeIndex;
+}
+
+Float LightTree::importance(const Node &node, const Point &p) const {
+	Vector d = p - node.aabb.getCenter();
+	Float dist2 = d.lengthSquared(),
+		  radius2 = node.aabb.getExtents().lengthSquared() * 0.25f;
+
+	/* Inside of the bounding sphere, the orientation cannot be bounded */
+	if (dist2 <= radius2)
+		return node.power / std::max(radius2, (Float) Epsilon);
+
+	Float dist = std::sqrt(dist2);
+	Float theta = unitAngle(node.cone.axis, d / dist),
+		  thetaU = std::asin(std::min((Float) 1, std::sqrt(radius2 / dist2)));
+	Float thetaP = std::max((Float) 0, theta - node.cone.thetaO - thetaU);
+	if (thetaP >= node.cone.thetaE)
+		return 0.0f;
+
+	return node.power * std::max((Float) 0, std::cos(thetaP)) / dist2;
+}
+
+Float LightTree::getLeftProbability(int nodeIndex, const Point &p) const {
+	const Node &node = m_nodes[nodeIndex];
+	const Node &left = m_nodes[nodeIndex + 1], &right = m_nodes[node.index];
+	Float weight0 = importance(left, p), weight1 = importance(right, p);
+
+	if (!(weight0 + weight1 > 0)) {
+		/* The shading point cannot be reached by any of the luminaires -- fall
+		   back to the power so that all luminaires keep a nonzero probability */
+		weight0 = left.power; weight1 = right.power;
+		if (!(weight0 + weight1 > 0))
+			return 0.5f;
+	}
+	return weight0 / (weight0 + weight1);
+}
+
+const Luminaire *LightTree::sample(const Point &p, Float &sample, Float &pdf) const {
+	if (sample >= m_treeProbability) {
+		sample = std::min((sample - m_treeProbability) / (1 - m_treeProbability),
+			(Float) 0.99999994f);
+		int index = m_unboundedPDF.sampleReuse(sample, pdf);
+		pdf *= 1 - m_treeProbability;
+		return m_unbounded[index];
+	}
+
+	sample /= m_treeProbability;
+	pdf = m_treeProbability;
+	int nodeIndex = 0;
+
+	while (!m_nodes[nodeIndex].leaf) {
+		Float prob = getLeftProbability(nodeIndex, p);
+		if (sample < prob) {
+			sample /= prob;
+			pdf *= prob;
+			nodeIndex = nodeIndex + 1;
+		} else {
+			sample = (sample - prob) / (1 - prob);
+			pdf *= 1 - prob;
+			nodeIndex = m_nodes[nodeIndex].index;
+		}
+		sample = std::min(sample, (Float) 0.99999994f);
+	}
+
+	return m_bounded[m_nodes[nodeIndex].index];
+}
+
+Float LightTree::pdf(const Point &p, const Luminaire *luminaire) const {
+	std::map<const Luminaire *, int>::const_iterator it = m_indices.find(luminaire);
+	if (it == m_indices.end())
+		return 0.0f;
+
+	int index = it->second;
+	if (index < 0)
+		return m_unboundedPDF[-index - 1] * (1 - m_treeProbability);
+
+	Float pdf = m_treeProbability;
+	int nodeIndex = m_leaves[index];
+	while (m_nodes[nodeIndex].parent != -1) {
+		int parent = m_nodes[nodeIndex].parent;
+		Float prob = getLeftProbability(parent, p);
+		pdf *= (nodeIndex == parent + 1) ? prob : 1 - prob;
+		nodeIndex = parent;
+	}
+	return pdf;
+}
+
+std::string LightTree::toString() const {
+	std::ostringstream oss;
+	oss << "LightTree[" << endl
+		<< "  boundedLuminaires = " << m_bounded.size() << "," << endl
+		<< "  unboundedLuminaires = " << m_unbounded.size() << "," << endl
+		<< "  nodeCount = " << m_nodes.size() << "," << endl
+		<< "  treeProbability = " << m_treeProbability << endl
+		<< "]";
+	return oss.str();
+}
+
+MTS_IMPLEMENT_CLASS(LightTree, false, Object)
+MTS_NAMESPACE_END
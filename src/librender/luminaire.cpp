@@ -81,6 +81,10 @@ bool Luminaire::createEmissionRecord(EmissionRecord &eRec, const Ray &ray) const
 void Luminaire::preprocess(const Scene *scene) {
 }
 
+bool Luminaire::getBounds(LuminaireBounds &bounds) const {
+	return false;
+}
+
 bool Luminaire::isBackgroundLuminaire() const {
 	return false;
 }
@@ -18,17 +18,124 @@
 
 #include <mitsuba/core/statistics.h>
 #include <mitsuba/render/mipmap.h>
+#include <mitsuba/render/texcache.h>
+
+/// Identifies pre-tiled mip files
+#define MIPMAP_TILEFILE_MAGIC "MTS_MIPS"
+#define MIPMAP_TILEFILE_VERSION 2
 
 MTS_NAMESPACE_BEGIN
 
 static StatsCounter mipmapLookups("Texture", "Mip-map texture lookups");
 static StatsCounter ewaLookups("Texture", "EWA texture lookups");
 
+/// \cond
+/* Conversion between single and half precision (round to nearest even) */
+static inline float halfToFloat(uint16_t value) {
+	uint32_t bits = (uint32_t) (value & 0x7FFF) << 13;
+	if (bits >= (0x7C00 << 13)) /* Infinity or NaN */
+		bits |= 0x7F800000; 
+	/* Adjust the exponent bias (also handles denormalized values) */
+	float result = union_cast<float>(bits) * 5.192296858534828e+33f; 
+	return (value & 0x8000) ? -result : result;
+}
+
+static inline uint16_t floatToHalf(float value) {
+	uint32_t bits = union_cast<uint32_t>(value);
+	uint16_t sign = (uint16_t) ((bits >> 16) & 0x8000);
+	bits &= 0x7FFFFFFF;
+
+	if (bits >= 0x47800000) {
+		/* Overflow, infinity or NaN */
+		return sign | (bits > 0x7F800000 ? 0x7E00 : 0x7C00);
+	} else if (bits < 0x38800000) {
+		/* Denormalized result -- let the FPU do the rounding */
+		float result = union_cast<float>(bits) + 0.5f;
+		return sign | (uint16_t) (union_cast<uint32_t>(result) - 0x3F000000);
+	} else {
+		uint32_t mantissaOdd = (bits >> 13) & 1;
+		bits += ((uint32_t) (15 - 127) << 23) + 0xFFF + mantissaOdd;
+		return sign | (uint16_t) (bits >> 13);
+	}
+}
+
+static inline Float toSRGBComponent(Float value) {
+	if (value <= (Float) 0.0031308)
+		return (Float) 12.92 * value;
+	return (Float) 1.055 * std::pow(value, (Float) (1.0/2.4)) - (Float) 0.055;
+}
+
+static inline uint8_t toUInt8(Float value) {
+	return (uint8_t) std::min(255, std::max(0, (int) (value * 255 + (Float) 0.5)));
+}
+
+/* Decoding table for sRGB-encoded 8-bit texels */
+static struct SRGBTable {
+	Float values[256];
+
+	SRGBTable() {
+		for (int i=0; i<256; ++i) {
+			Float value = i / (Float) 255;
+			if (value <= (Float) 0.04045)
+				values[i] = value / (Float) 12.92;
+			else
+				values[i] = std::pow((value + (Float) 0.055) / (Float) 1.055, (Float) 2.4);
+		}
+	}
+} srgbTable;
+/// \endcond
+
+/// \cond
+/**
+ * Keeps the most recently used tiles of an out-of-core mip map pinned
+ * for the duration of a single texture lookup. This way, only the first
+ * access to each tile has to go through the (locked) texture cache.
+ */
+struct MIPMap::TileLookup {
+	enum { ESlots = 4 };
+	const MIPMap *mipmap;
+	TextureCache::Tile *tiles[ESlots];
+	uint32_t indices[ESlots];
+	int next;
+
+	inline TileLookup(const MIPMap *mipmap) : mipmap(mipmap), next(0) {
+		for (int i=0; i<ESlots; ++i)
+			tiles[i] = NULL;
+	}
+
+	inline ~TileLookup() {
+		for (int i=0; i<ESlots; ++i) {
+			if (tiles[i])
+				TextureCache::getInstance()->release(tiles[i]);
+		}
+	}
+
+	inline const uint8_t *getTile(uint32_t index) {
+		for (int i=0; i<ESlots; ++i) {
+			if (tiles[i] && indices[i] == index)
+				return tiles[i]->data;
+		}
+		TextureCache *cache = TextureCache::getInstance();
+		if (tiles[next])
+			cache->release(tiles[next]);
+		TextureCache::Tile *tile = cache->get(mipmap, mipmap->m_cacheID, index);
+		tiles[next] = tile;
+		indices[next] = index;
+		next = (next + 1) % ESlots;
+		return tile->data;
+	}
+};
+/// \endcond
+
 /* Isotropic/anisotropic EWA mip-map texture map class based on PBRT */
 MIPMap::MIPMap(int width, int height, Spectrum *pixels, 
-	EFilterType filterType, EWrapMode wrapMode, Float maxAnisotropy) 
-		: m_width(width), m_height(height), m_filterType(filterType), 
-		  m_wrapMode(wrapMode), m_maxAnisotropy(maxAnisotropy) {
+	EFilterType filterType, EWrapMode wrapMode, Float maxAnisotropy,
+	EStorageFormat storageFormat) 
+		: m_width(width), m_height(height), m_packedPyramid(NULL),
+		  m_storageFormat(storageFormat), m_texelSize(getTexelSize(storageFormat)),
+		  m_filterType(filterType), m_wrapMode(wrapMode), m_maxAnisotropy(maxAnisotropy),
+		  m_tileFileOffset(0), m_levelTilesX(NULL), m_levelTileOffset(NULL),
+		  m_cacheID(0) {
 	Spectrum *texture = pixels;
 
 	if (filterType != ENone && (!isPow2(width) || !isPow2(height))) {
@@ -100,6 +207,7 @@ MIPMap::MIPMap(int width, int height, Spectrum *pixels,
 	m_levelHeight[0] = m_height;
 
 	/* Generate the mip-map hierarchy */
+	TileLookup lookup(this);
 	for (int i=1; i<m_levels; i++) {
 		m_levelWidth[i]  = std::max(1, m_levelWidth[i-1]/2);
 		m_levelHeight[i] = std::max(1, m_levelHeight[i-1]/2);
@@ -107,14 +215,73 @@ MIPMap::MIPMap(int width, int height, Spectrum *pixels,
 		for (int y = 0; y < m_levelHeight[i]; y++) {
 			for (int x = 0; x < m_levelWidth[i]; x++) {
 				m_pyramid[i][x+y*m_levelWidth[i]] = (
-					getTexel(i-1, 2*x, 2*y) + 
-					getTexel(i-1, 2*x+1, 2*y) + 
-					getTexel(i-1, 2*x, 2*y+1) + 
-					getTexel(i-1, 2*x+1, 2*y+1)) * 0.25f;
+					getTexel(lookup, i-1, 2*x, 2*y) + 
+					getTexel(lookup, i-1, 2*x+1, 2*y) + 
+					getTexel(lookup, i-1, 2*x, 2*y+1) + 
+					getTexel(lookup, i-1, 2*x+1, 2*y+1)) * 0.25f;
 			}
 		}
 	}
 
+	if (m_storageFormat != ESpectrum) {
+		/* Convert the hierarchy into the reduced-precision format */
+		m_packedPyramid = new uint8_t*[m_levels];
+		for (int i=0; i<m_levels; i++) {
+			size_t texelCount = (size_t) m_levelWidth[i] * (size_t) m_levelHeight[i];
+			m_packedPyramid[i] = new uint8_t[texelCount * m_texelSize];
+			for (size_t j=0; j<texelCount; ++j)
+				encodeTexel(m_pyramid[i][j], m_packedPyramid[i] + j*m_texelSize);
+			delete[] m_pyramid[i];
+		}
+		delete[] m_pyramid;
+		m_pyramid = NULL;
+	}
+
+	/* Compute the component-wise maximum of the stored zero level */
+	m_maximum = Spectrum(0.0f);
+	for (int y=0; y<m_height; ++y) {
+		for (int x=0; x<m_width; ++x) {
+			Spectrum value = getStoredTexel(lookup, 0, x, y);
+			for (int j=0; j<SPECTRUM_SAMPLES; ++j)
+				m_maximum[j] = std::max(m_maximum[j], value[j]);
+		}
+	}
+
+	initializeWeights();
+}
+
+MIPMap::MIPMap(FileStream *file, int width, int height, int levels,
+		const int *levelWidth, const int *levelHeight, const Spectrum &maximum,
+		EFilterType filterType, EWrapMode wrapMode, Float maxAnisotropy,
+		EStorageFormat storageFormat)
+		: m_width(width), m_height(height), m_levels(levels), m_pyramid(NULL),
+		  m_packedPyramid(NULL), m_storageFormat(storageFormat),
+		  m_texelSize(getTexelSize(storageFormat)),
+		  m_filterType(filterType), m_wrapMode(wrapMode), 
+		  m_maxAnisotropy(maxAnisotropy), m_tileFile(file),
+		  m_maximum(maximum) {
+	m_tileFileMutex = new Mutex();
+	m_tileFileOffset = (int64_t) file->getPos();
+	m_cacheID = TextureCache::getInstance()->allocateID();
+	m_levelWidth = new int[m_levels];
+	m_levelHeight = new int[m_levels];
+	m_levelTilesX = new int[m_levels];
+	m_levelTileOffset = new int[m_levels];
+
+	int tileCount = 0;
+	for (int i=0; i<m_levels; ++i) {
+		m_levelWidth[i] = levelWidth[i];
+		m_levelHeight[i] = levelHeight[i];
+		m_levelTilesX[i] = (m_levelWidth[i] + MIPMAP_TILESIZE - 1) / MIPMAP_TILESIZE;
+		m_levelTileOffset[i] = tileCount;
+		tileCount += m_levelTilesX[i] * ((m_levelHeight[i]
+			+ MIPMAP_TILESIZE - 1) / MIPMAP_TILESIZE);
+	}
+
+	initializeWeights();
+}
+
+void MIPMap::initializeWeights() {
 	if (m_filterType == EEWA) {
 		m_weightLut = static_cast<Float *>(allocAligned(sizeof(Float)*MIPMAP_LUTSIZE));
 		for (int i=0; i<MIPMAP_LUTSIZE; ++i) {
@@ -127,25 +294,25 @@ MIPMap::MIPMap(int width, int height, Spectrum *pixels,
 MIPMap::~MIPMap() {
 	if (m_filterType == EEWA) 
 		freeAligned(m_weightLut);
-	for (int i=0; i<m_levels; i++)
-		delete[] m_pyramid[i];
+	if (m_pyramid) {
+		for (int i=0; i<m_levels; i++)
+			delete[] m_pyramid[i];
+		delete[] m_pyramid;
+	} else if (m_packedPyramid) {
+		for (int i=0; i<m_levels; i++)
+			delete[] m_packedPyramid[i];
+		delete[] m_packedPyramid;
+	} else {
+		TextureCache::getInstance()->purge(m_cacheID);
+		delete[] m_levelTilesX;
+		delete[] m_levelTileOffset;
+	}
 	delete[] m_levelHeight;
 	delete[] m_levelWidth;
-	delete[] m_pyramid;
 }
 
 Spectrum MIPMap::getMaximum() const {
-	Spectrum max(0.0f);
-	int height = m_levelHeight[0];
-	int width = m_levelWidth[0];
-	Spectrum *pixels = m_pyramid[0];
-	for (int y=0; y<height; ++y) {
-		for (int x=0; x<width; ++x) {
-			Spectrum value = *pixels++;
-			for (int j=0; j<SPECTRUM_SAMPLES; ++j)
-				max[j] = std::max(max[j], value[j]);
-		}
-	}
+	Spectrum max(m_maximum);
 	if (m_wrapMode == EWhite) {
 		for (int i=0; i<SPECTRUM_SAMPLES; ++i)
 			max[i] = std::max(max[i], (Float) 1.0f);
@@ -154,7 +321,7 @@ Spectrum MIPMap::getMaximum() const {
 }
 	
 ref<MIPMap> MIPMap::fromBitmap(Bitmap *bitmap, EFilterType filterType,
-		EWrapMode wrapMode, Float maxAnisotropy) {
+		EWrapMode wrapMode, Float maxAnisotropy, EStorageFormat storageFormat) {
 	int width = bitmap->getWidth();
 	int height = bitmap->getHeight();
 	float *data = bitmap->getFloatData();
@@ -173,7 +340,7 @@ ref<MIPMap> MIPMap::fromBitmap(Bitmap *bitmap, EFilterType filterType,
 	}
 
 	return new MIPMap(width, height, pixels,
-		filterType, wrapMode, maxAnisotropy);
+		filterType, wrapMode, maxAnisotropy, storageFormat);
 }
 
 MIPMap::ResampleWeight *MIPMap::resampleWeights(int oldRes, int newRes) const {
@@ -201,6 +368,11 @@ MIPMap::ResampleWeight *MIPMap::resampleWeights(int oldRes, int newRes) const {
 }
 	
 Spectrum MIPMap::getTexel(int level, int x, int y) const {
+	TileLookup lookup(this);
+	return getTexel(lookup, level, x, y);
+}
+
+Spectrum MIPMap::getTexel(TileLookup &lookup, int level, int x, int y) const {
 	int levelWidth = m_levelWidth[level];
 	int levelHeight = m_levelHeight[level];
 
@@ -221,29 +393,117 @@ Spectrum MIPMap::getTexel(int level, int x, int y) const {
 		}
 	}
 
-	return m_pyramid[level][x + levelWidth*y];
+	return getStoredTexel(lookup, level, x, y);
+}
+
+Spectrum MIPMap::getStoredTexel(TileLookup &lookup, int level, int x, int y) const {
+	if (m_pyramid)
+		return m_pyramid[level][x + m_levelWidth[level]*y];
+	else if (m_packedPyramid)
+		return decodeTexel(m_packedPyramid[level] 
+			+ m_texelSize * (x + m_levelWidth[level]*y));
+
+	const uint8_t *tile = lookup.getTile((uint32_t) (m_levelTileOffset[level]
+		+ (y / MIPMAP_TILESIZE) * m_levelTilesX[level] + x / MIPMAP_TILESIZE));
+	return decodeTexel(tile + m_texelSize * ((x % MIPMAP_TILESIZE) 
+		+ (y % MIPMAP_TILESIZE) * MIPMAP_TILESIZE));
+}
+
+inline Spectrum MIPMap::decodeTexel(const uint8_t *data) const {
+	Float r, g, b;
+	switch (m_storageFormat) {
+		case ESpectrum:
+			return *reinterpret_cast<const Spectrum *>(data);
+		case EHalfRGB: {
+				const uint16_t *values = reinterpret_cast<const uint16_t *>(data);
+				r = (Float) halfToFloat(values[0]);
+				g = (Float) halfToFloat(values[1]);
+				b = (Float) halfToFloat(values[2]);
+			}
+			break;
+		case ELinearRGB8:
+			r = data[0] * (Float) (1.0f / 255.0f);
+			g = data[1] * (Float) (1.0f / 255.0f);
+			b = data[2] * (Float) (1.0f / 255.0f);
+			break;
+		default:
+			r = srgbTable.values[data[0]];
+			g = srgbTable.values[data[1]];
+			b = srgbTable.values[data[2]];
+	}
+	Spectrum result;
+	result.fromLinearRGB(r, g, b);
+	return result;
+}
+
+void MIPMap::encodeTexel(const Spectrum &value, uint8_t *data) const {
+	Float r, g, b;
+	if (m_storageFormat == ESpectrum) {
+		*reinterpret_cast<Spectrum *>(data) = value;
+		return;
+	}
+	value.toLinearRGB(r, g, b);
+	switch (m_storageFormat) {
+		case EHalfRGB: {
+				uint16_t *values = reinterpret_cast<uint16_t *>(data);
+				values[0] = floatToHalf((float) std::max(r, (Float) 0));
+				values[1] = floatToHalf((float) std::max(g, (Float) 0));
+				values[2] = floatToHalf((float) std::max(b, (Float) 0));
+			}
+			break;
+		case ELinearRGB8:
+			data[0] = toUInt8(r); data[1] = toUInt8(g); data[2] = toUInt8(b);
+			break;
+		default:
+			data[0] = toUInt8(toSRGBComponent(std::max(r, (Float) 0)));
+			data[1] = toUInt8(toSRGBComponent(std::max(g, (Float) 0)));
+			data[2] = toUInt8(toSRGBComponent(std::max(b, (Float) 0)));
+	}
+}
+
+size_t MIPMap::getTexelSize(EStorageFormat format) {
+	switch (format) {
+		case ESpectrum: return sizeof(Spectrum);
+		case EHalfRGB: return 3 * sizeof(uint16_t);
+		default: return 3 * sizeof(uint8_t);
+	}
+}
+
+size_t MIPMap::getMemoryUsage() const {
+	if (isTiled())
+		return 0;
+	size_t texelCount = 0;
+	for (int i=0; i<m_levels; ++i)
+		texelCount += (size_t) m_levelWidth[i] * (size_t) m_levelHeight[i];
+	return texelCount * m_texelSize;
 }
 	
 Spectrum MIPMap::triangle(int level, Float x, Float y) const {
+	TileLookup lookup(this);
+	return triangle(lookup, level, x, y);
+}
+
+Spectrum MIPMap::triangle(TileLookup &lookup, int level, Float x, Float y) const {
 	if (m_filterType == ENone) {
 		int xPos = floorToInt(x*m_levelWidth[0]),
 			yPos = floorToInt(y*m_levelHeight[0]);
-		return getTexel(0, xPos, yPos);
+		return getTexel(lookup, 0, xPos, yPos);
 	} else {
 		level = clamp(level, 0, m_levels - 1);
 		x = x * m_levelWidth[level] - 0.5f;
 		y = y * m_levelHeight[level] - 0.5f;
 		int xPos = floorToInt(x), yPos = floorToInt(y);
 		Float dx = x - xPos, dy = y - yPos;
-		return getTexel(level, xPos, yPos) * (1.0f - dx) * (1.0f - dy)
-			+ getTexel(level, xPos, yPos + 1) * (1.0f - dx) * dy
-			+ getTexel(level, xPos + 1, yPos) * dx * (1.0f - dy)
-			+ getTexel(level, xPos + 1, yPos + 1) * dx * dy;
+		return getTexel(lookup, level, xPos, yPos) * (1.0f - dx) * (1.0f - dy)
+			+ getTexel(lookup, level, xPos, yPos + 1) * (1.0f - dx) * dy
+			+ getTexel(lookup, level, xPos + 1, yPos) * dx * (1.0f - dy)
+			+ getTexel(lookup, level, xPos + 1, yPos + 1) * dx * dy;
 	}	
 }
 		
 Spectrum MIPMap::getValue(Float u, Float v, 
 		Float dudx, Float dudy, Float dvdx, Float dvdy) const {
+	TileLookup lookup(this);
 	if (m_filterType == ETrilinear) {
 		++mipmapLookups;
 		/* Conservatively estimate a square lookup region */
@@ -255,16 +515,16 @@ Spectrum MIPMap::getValue(Float u, Float v,
 
 		if (mipmapLevel < 0) {
 			/* The lookup is smaller than one pixel */
-			return triangle(0, u, v);
+			return triangle(lookup, 0, u, v);
 		} else if (mipmapLevel >= m_levels - 1) {
 			/* The lookup is larger than the whole texture */
-			return getTexel(m_levels - 1, 0, 0);
+			return getTexel(lookup, m_levels - 1, 0, 0);
 		} else {
 			/* Tri-linear interpolation */
 			int level = (int) mipmapLevel;
 			Float delta = mipmapLevel - level;
-			return triangle(level, u, v) * (1.0f - delta)
-				+ triangle(level, u, v) * delta;
+			return triangle(lookup, level, u, v) * (1.0f - delta)
+				+ triangle(lookup, level, u, v) * delta;
 		}
 	} else if (m_filterType == EEWA) {
 		if (dudx*dudx + dudy*dudy < dvdx*dvdx + dvdy*dvdy) {
@@ -282,7 +542,7 @@ Spectrum MIPMap::getValue(Float u, Float v,
 		}
 
 		if (minorLength == 0)
-			return triangle(0, u, v);
+			return triangle(lookup, 0, u, v);
 	
 		// The min() below avoids overflow in the int conversion when lod=inf
 		Float lod = 
@@ -291,20 +551,20 @@ Spectrum MIPMap::getValue(Float u, Float v,
 		int ilod = floorToInt(lod);
 		Float d = lod - ilod;
 
-		return EWA(u, v, dudx, dudy, dvdx, dvdy, ilod)   * (1-d) +
-			   EWA(u, v, dudx, dudy, dvdx, dvdy, ilod+1) * d;
+		return EWA(lookup, u, v, dudx, dudy, dvdx, dvdy, ilod)   * (1-d) +
+			   EWA(lookup, u, v, dudx, dudy, dvdx, dvdy, ilod+1) * d;
 	} else {
 		int xPos = floorToInt(u*m_levelWidth[0]),
 			yPos = floorToInt(v*m_levelHeight[0]);
-		return getTexel(0, xPos, yPos);
+		return getTexel(lookup, 0, xPos, yPos);
 	}
 }
 	
-Spectrum MIPMap::EWA(Float u, Float v, Float dudx, Float dudy, Float dvdx, 
-	Float dvdy, int level) const {
+Spectrum MIPMap::EWA(TileLookup &lookup, Float u, Float v, Float dudx, Float dudy,
+	Float dvdx, Float dvdy, int level) const {
 	++ewaLookups;
 	if (level >= m_levels)
-		return getTexel(m_levels-1, 0, 0);
+		return getTexel(lookup, m_levels-1, 0, 0);
 
 	Spectrum result(0.0f);
 	Float denominator = 0.0f;
@@ -332,7 +592,7 @@ Spectrum MIPMap::EWA(Float u, Float v, Float dudx, Float dudy, Float dvdx,
 			if (r2 < 1) {
 				const Float weight = m_weightLut[
 					std::max(0, std::min((int) (r2 * MIPMAP_LUTSIZE), MIPMAP_LUTSIZE - 1))];
-				result += getTexel(level, ut, vt) * weight;
+				result += getTexel(lookup, level, ut, vt) * weight;
 				denominator += weight;
 			}
 		}
@@ -343,12 +603,12 @@ Spectrum MIPMap::EWA(Float u, Float v, Float dudx, Float dudy, Float dvdx,
 Bitmap *MIPMap::getBitmap() const {
 	Bitmap *bitmap = new Bitmap(m_width, m_height, 128);
 	float *floatData = bitmap->getFloatData();
-	Spectrum *specData = m_pyramid[0];
+	TileLookup lookup(this);
 
 	for (int y=0; y<m_height; ++y) {
 		for (int x=0; x<m_width; ++x) {
 			Float r, g, b;
-			(specData++)->toLinearRGB(r, g, b);
+			getStoredTexel(lookup, 0, x, y).toLinearRGB(r, g, b);
 			*floatData++ = r;
 			*floatData++ = g;
 			*floatData++ = b;
@@ -361,12 +621,12 @@ Bitmap *MIPMap::getBitmap() const {
 Bitmap *MIPMap::getLDRBitmap() const {
 	Bitmap *bitmap = new Bitmap(m_width, m_height, 24);
 	uint8_t *data = bitmap->getData();
-	Spectrum *specData = m_pyramid[0];
+	TileLookup lookup(this);
 
 	for (int y=0; y<m_height; ++y) {
 		for (int x=0; x<m_width; ++x) {
 			Float r, g, b;
-			(specData++)->toLinearRGB(r, g, b);
+			getStoredTexel(lookup, 0, x, y).toLinearRGB(r, g, b);
 			*data++ = (uint8_t) std::min(255, std::max(0, (int) (r*255)));
 			*data++ = (uint8_t) std::min(255, std::max(0, (int) (g*255)));
 			*data++ = (uint8_t) std::min(255, std::max(0, (int) (b*255)));
@@ -375,5 +635,176 @@ Bitmap *MIPMap::getLDRBitmap() const {
 	return bitmap;
 }
 
+uint64_t MIPMap::getSourceKey(const fs::path &path, Float parameter) {
+	uint64_t key = (uint64_t) fs::file_size(path);
+	key = key * 0x9E3779B97F4A7C15ULL + (uint64_t) fs::last_write_time(path);
+	key = key * 0x9E3779B97F4A7C15ULL + union_cast<uint32_t>((float) parameter);
+	return key;
+}
+
+/// Size of a texel in a pre-tiled mip file
+static size_t getFileTexelSize(MIPMap::EStorageFormat format) {
+	switch (format) {
+		case MIPMap::ESpectrum: return SPECTRUM_SAMPLES * sizeof(float);
+		case MIPMap::EHalfRGB: return 3 * sizeof(uint16_t);
+		default: return 3 * sizeof(uint8_t);
+	}
+}
+
+bool MIPMap::writeTileFile(const fs::path &path, uint64_t key) const {
+	Assert(!isTiled());
+
+	try {
+		ref<AtomicFileStream> fs = new AtomicFileStream(path, FileStream::ETruncReadWrite);
+		fs->setByteOrder(Stream::ELittleEndian);
+		fs->write(MIPMAP_TILEFILE_MAGIC, 8);
+		fs->writeUInt(MIPMAP_TILEFILE_VERSION);
+		fs->writeUInt(SPECTRUM_SAMPLES);
+		fs->writeULong(key);
+		fs->writeUInt(m_filterType);
+		fs->writeUInt(m_wrapMode);
+		fs->writeUInt(m_storageFormat);
+		fs->writeInt(m_width);
+		fs->writeInt(m_height);
+		fs->writeInt(m_levels);
+		fs->writeInt(MIPMAP_TILESIZE);
+		for (int i=0; i<SPECTRUM_SAMPLES; ++i)
+			fs->writeSingle((float) m_maximum[i]);
+		for (int i=0; i<m_levels; ++i) {
+			fs->writeInt(m_levelWidth[i]);
+			fs->writeInt(m_levelHeight[i]);
+		}
+
+		/* Store the tiles of each level in scanline order. Texels
+		   outside of the level are never accessed and set to zero */
+		size_t texelSize = getFileTexelSize(m_storageFormat),
+			   tileSize = MIPMAP_TILESIZE * MIPMAP_TILESIZE * texelSize;
+		std::vector<uint8_t> tile(tileSize);
+		for (int level=0; level<m_levels; ++level) {
+			int width = m_levelWidth[level], height = m_levelHeight[level];
+			for (int ty=0; ty<height; ty += MIPMAP_TILESIZE) {
+				for (int tx=0; tx<width; tx += MIPMAP_TILESIZE) {
+					memset(&tile[0], 0, tileSize);
+					for (int y=ty; y<std::min(ty+MIPMAP_TILESIZE, height); ++y) {
+						for (int x=tx; x<std::min(tx+MIPMAP_TILESIZE, width); ++x) {
+							uint8_t *target = &tile[0] + texelSize * ((x-tx) 
+								+ (y-ty) * MIPMAP_TILESIZE);
+							if (m_pyramid) {
+								const Spectrum &value = m_pyramid[level][x + width*y];
+								for (int i=0; i<SPECTRUM_SAMPLES; ++i)
+									reinterpret_cast<float *>(target)[i] = (float) value[i];
+							} else {
+								memcpy(target, m_packedPyramid[level] 
+									+ m_texelSize * (x + width*y), texelSize);
+							}
+						}
+					}
+					if (m_storageFormat == ESpectrum)
+						fs->writeSingleArray(reinterpret_cast<float *>(&tile[0]),
+							tileSize / sizeof(float));
+					else if (m_storageFormat == EHalfRGB)
+						fs->writeUShortArray(reinterpret_cast<uint16_t *>(&tile[0]),
+							tileSize / sizeof(uint16_t));
+					else
+						fs->write(&tile[0], tileSize);
+				}
+			}
+		}
+		fs->commit();
+	} catch (const std::exception &ex) {
+		Log(EWarn, "Could not write the tiled mip map \"%s\": %s",
+			path.file_string().c_str(), ex.what());
+		return false;
+	}
+	return true;
+}
+
+ref<MIPMap> MIPMap::fromTileFile(const fs::path &path, uint64_t key,
+		EFilterType filterType, EWrapMode wrapMode, Float maxAnisotropy,
+		EStorageFormat storageFormat) {
+	if (!fs::exists(path))
+		return NULL;
+
+	ref<FileStream> fs = new FileStream(path, FileStream::EReadOnly);
+	fs->setByteOrder(Stream::ELittleEndian);
+
+	char magic[8];
+	if (fs->getSize() < 52)
+		return NULL;
+	fs->read(magic, 8);
+	if (memcmp(magic, MIPMAP_TILEFILE_MAGIC, 8) != 0
+		|| fs->readUInt() != MIPMAP_TILEFILE_VERSION
+		|| fs->readUInt() != SPECTRUM_SAMPLES
+		|| fs->readULong() != key
+		|| fs->readUInt() != (uint32_t) filterType
+		|| fs->readUInt() != (uint32_t) wrapMode
+		|| fs->readUInt() != (uint32_t) storageFormat) {
+		SLog(EDebug, "The tiled mip map \"%s\" is outdated", path.leaf().c_str());
+		return NULL;
+	}
+
+	int width = fs->readInt(), height = fs->readInt(),
+		levels = fs->readInt(), tileSize = fs->readInt();
+	if (tileSize != MIPMAP_TILESIZE || levels <= 0 || levels > 32)
+		return NULL;
+
+	Spectrum maximum;
+	for (int i=0; i<SPECTRUM_SAMPLES; ++i)
+		maximum[i] = (Float) fs->readSingle();
+
+	std::vector<int> levelWidth(levels), levelHeight(levels);
+	size_t tileCount = 0;
+	for (int i=0; i<levels; ++i) {
+		levelWidth[i] = fs->readInt();
+		levelHeight[i] = fs->readInt();
+		tileCount += (size_t) ((levelWidth[i] + MIPMAP_TILESIZE - 1) / MIPMAP_TILESIZE)
+			* (size_t) ((levelHeight[i] + MIPMAP_TILESIZE - 1) / MIPMAP_TILESIZE);
+	}
+
+	size_t tileBytes = MIPMAP_TILESIZE * MIPMAP_TILESIZE * getFileTexelSize(storageFormat);
+	if (fs->getSize() != fs->getPos() + tileCount * tileBytes) {
+		SLog(EWarn, "The tiled mip map \"%s\" is truncated", path.leaf().c_str());
+		return NULL;
+	}
+
+	SLog(EDebug, "Opened the tiled mip map \"%s\" (%ix%i, " SIZE_T_FMT " tiles)",
+		path.leaf().c_str(), width, height, tileCount);
+
+	return new MIPMap(fs, width, height, levels, &levelWidth[0], &levelHeight[0],
+		maximum, filterType, wrapMode, maxAnisotropy, storageFormat);
+}
+
+void MIPMap::loadTile(uint32_t index, uint8_t *target) const {
+	const size_t texelCount = MIPMAP_TILESIZE * MIPMAP_TILESIZE;
+	m_tileFileMutex->lock();
+	try {
+		m_tileFile->setPos((size_t) m_tileFileOffset 
+			+ (size_t) index * texelCount * getFileTexelSize(m_storageFormat));
+		if (m_storageFormat == ESpectrum) {
+#if defined(SINGLE_PRECISION)
+			m_tileFile->readSingleArray(reinterpret_cast<float *>(target), 
+				texelCount * SPECTRUM_SAMPLES);
+#else
+			Spectrum *spectra = reinterpret_cast<Spectrum *>(target);
+			float *buffer = new float[texelCount * SPECTRUM_SAMPLES];
+			m_tileFile->readSingleArray(buffer, texelCount * SPECTRUM_SAMPLES);
+			for (size_t i=0; i<texelCount; ++i)
+				for (int j=0; j<SPECTRUM_SAMPLES; ++j)
+					spectra[i][j] = (Float) buffer[i*SPECTRUM_SAMPLES + j];
+			delete[] buffer;
+#endif
+		} else if (m_storageFormat == EHalfRGB) {
+			m_tileFile->readUShortArray(reinterpret_cast<uint16_t *>(target),
+				texelCount * 3);
+		} else {
+			m_tileFile->read(target, texelCount * 3);
+		}
+	} catch (...) {
+		m_tileFileMutex->unlock();
+		throw;
+	}
+	m_tileFileMutex->unlock();
+}
+
 MTS_IMPLEMENT_CLASS(MIPMap, false, Object)
 MTS_NAMESPACE_END
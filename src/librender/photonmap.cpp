@@ -20,11 +20,71 @@
 #include <mitsuba/render/scene.h>
 #include <mitsuba/render/phase.h>
 #include <fstream>
+#include <limits>
+
+/**
+ * Subtrees are balanced in parallel once at least this many
+ * of them are available per processor core
+ */
+#define MTS_PHOTONMAP_TASKS_PER_CORE 8
+
+/// Don't bother with parallel balancing for small photon maps
+#define MTS_PHOTONMAP_MIN_PARALLEL 50000
 
 MTS_NAMESPACE_BEGIN
 
+namespace {
+	/// Unprocessed subtree during the level-by-level parallel balancing
+	struct BalanceTask {
+		size_t start, end, heapIndex;
+		AABB aabb;
+
+		inline BalanceTask() : heapIndex(0) { }
+
+		inline BalanceTask(size_t start, size_t end, 
+			size_t heapIndex, const AABB &aabb) : start(start),
+			end(end), heapIndex(heapIndex), aabb(aabb) { }
+	};
+
+	/**
+	 * Add a photon to the result list of a nearest-neighbor search.
+	 * Similarly to Jensen's implementation, the search switches to a 
+	 * priority queue when the available search result space is exhausted
+	 */
+	template <typename SearchResult, typename DistanceMetric> FINLINE void 
+			insertSearchResult(SearchResult *results, size_t &fill, size_t maxSize,
+			bool &isPriorityQueue, float &distSquared, 
+			const SearchResult &result) {
+		if (result.first >= distSquared)
+			return;
+
+		if (fill < maxSize) {
+			/* There is still room, just add the photon to the search 
+			   result list */
+			results[fill++] = result;
+		} else {
+			SearchResult *begin = results,
+						 *end = begin + maxSize + 1;
+			if (!isPriorityQueue) {
+				/* Establish the MAX-heap property */
+				std::make_heap(begin, begin + maxSize, DistanceMetric());
+				isPriorityQueue = true;
+			}
+
+			/* Add the new photon, remove the one farthest away */
+			results[fill] = result;
+			std::push_heap(begin, end, DistanceMetric());
+			std::pop_heap(begin, end, DistanceMetric());
+
+			/* Reduce the search radius accordingly */
+			distSquared = results[0].first;
+		}
+	}
+}
+
 PhotonMap::PhotonMap(size_t maxPhotons) 
- : m_photonCount(0), m_maxPhotons(maxPhotons), m_balanced(false), m_scale(1.0f) {
+ : m_photonCount(0), m_maxPhotons(maxPhotons), m_blocks(NULL),
+   m_firstBlock(0), m_blockCount(0), m_balanced(false), m_scale(1.0f) {
 	Assert(Photon::m_precompTableReady);
 
 	/* For convenient heap addressing, the the photon list
@@ -40,13 +100,19 @@ PhotonMap::PhotonMap(Stream *stream, InstanceManager *manager) {
 	m_lastRChildNode = stream->readSize();
 	m_scale = (Float) stream->readFloat();
 	m_photonCount = stream->readSize();
-	m_photons = new Photon[m_maxPhotons + 1];
+	m_photons = (Photon *) allocAligned(sizeof(Photon) * (m_maxPhotons+1));
 	for (size_t i=1; i<=m_maxPhotons; ++i) 
 		m_photons[i] = Photon(stream);
+	m_blocks = NULL;
+	m_firstBlock = m_blockCount = 0;
+	if (m_balanced)
+		buildPositionBlocks();
 }
 
 PhotonMap::~PhotonMap() {
 	freeAligned(m_photons);
+	if (m_blocks)
+		freeAligned(m_blocks);
 }
 
 std::string PhotonMap::toString() const {
@@ -219,7 +285,7 @@ size_t PhotonMap::leftSubtreeSize(size_t treeSize) const {
 	return p - 1;
 }
 
-void PhotonMap::balance() {
+void PhotonMap::balance(bool parallel) {
 	if (m_photonCount == 0) {
 		Log(EInfo, "Photon map: no need for balancing, no photons available.");
 		m_balanced = true;
@@ -241,8 +307,69 @@ void PhotonMap::balance() {
 	Log(EInfo, "Photon map: balancing %i photons (%s)..", m_photonCount,
 		memString(sizeof(Photon) * (m_photonCount+1)).c_str());
 
-	balanceRecursive(photonPointers.begin(), photonPointers.begin()+1, 
-		photonPointers.end(), heapPermutation, m_aabb, 1);
+	photon_iterator basePtr = photonPointers.begin();
+	std::vector<BalanceTask> tasks, children;
+	tasks.push_back(BalanceTask(1, m_photonCount + 1, 1, m_aabb));
+
+	/* Balance the upper levels of the tree one level at a time, where 
+	   all subtrees of a level are processed in parallel. Once there 
+	   are sufficiently many of them to keep all cores busy, each
+	   remaining subtree is balanced recursively by a single thread.
+	   This produces exactly the same tree as the serial version. */
+	size_t targetTasks = 0;
+	if (parallel && m_photonCount >= MTS_PHOTONMAP_MIN_PARALLEL)
+		targetTasks = MTS_PHOTONMAP_TASKS_PER_CORE * getProcessorCount();
+
+	while (!tasks.empty() && tasks.size() < targetTasks) {
+		children.clear();
+		children.resize(2*tasks.size());
+
+		#pragma omp parallel for schedule(dynamic)
+		for (int i=0; i<(int) tasks.size(); ++i) {
+			const BalanceTask &task = tasks[i];
+			photon_iterator sortStart = basePtr + task.start,
+				sortEnd = basePtr + task.end;
+			int splitAxis = task.aabb.getLargestAxis();
+			photon_iterator pivot = sortStart
+				+ leftSubtreeSize(sortEnd - sortStart);
+
+			quickPartition(sortStart, sortEnd, pivot, splitAxis);
+			Float splitPos = (*pivot)->pos[splitAxis];
+			heapPermutation[task.heapIndex] = *pivot - *basePtr;
+			(*pivot)->axis = splitAxis;
+
+			if (pivot > sortStart + 1) {
+				BalanceTask &left = children[2*i];
+				left = BalanceTask(task.start, pivot - basePtr,
+					leftChild(task.heapIndex), task.aabb);
+				left.aabb.max[splitAxis] = splitPos;
+			} else if (pivot > sortStart) {
+				heapPermutation[leftChild(task.heapIndex)] = *sortStart - *basePtr;
+			}
+
+			if (pivot < sortEnd - 2) {
+				BalanceTask &right = children[2*i+1];
+				right = BalanceTask(pivot + 1 - basePtr, task.end,
+					rightChild(task.heapIndex), task.aabb);
+				right.aabb.min[splitAxis] = splitPos;
+			} else if (pivot < sortEnd - 1) {
+				heapPermutation[rightChild(task.heapIndex)] = *(sortEnd-1) - *basePtr;
+			}
+		}
+
+		tasks.clear();
+		for (size_t i=0; i<children.size(); ++i) {
+			if (children[i].heapIndex != 0)
+				tasks.push_back(children[i]);
+		}
+	}
+
+	#pragma omp parallel for schedule(dynamic)
+	for (int i=0; i<(int) tasks.size(); ++i) {
+		BalanceTask &task = tasks[i];
+		balanceRecursive(basePtr, basePtr + task.start, basePtr + task.end,
+			heapPermutation, task.aabb, task.heapIndex);
+	}
 
 	Log(EInfo, "Done (took %i ms)", timer->getMilliseconds());
 	timer->reset();
@@ -260,6 +387,42 @@ void PhotonMap::balance() {
 	m_lastInnerNode = m_photonCount/2;
 	m_lastRChildNode = (m_photonCount-1)/2;
 	m_balanced = true;
+
+	buildPositionBlocks();
+}
+
+void PhotonMap::buildPositionBlocks() {
+	if (m_blocks) {
+		freeAligned(m_blocks);
+		m_blocks = NULL;
+	}
+
+	/* Block 'i' stores the photons with heap indices 4i..4i+3. Only
+	   the blocks of nodes whose grandchildren are all leaves are needed */
+	m_firstBlock = m_lastInnerNode/4 + 1;
+	size_t lastBlock = m_photonCount/4;
+	m_blockCount = lastBlock >= m_firstBlock ? (lastBlock - m_firstBlock + 1) : 0;
+	if (m_blockCount == 0)
+		return;
+
+	m_blocks = (PositionBlock *) allocAligned(sizeof(PositionBlock) * m_blockCount);
+	const float inf = std::numeric_limits<float>::infinity();
+
+	#pragma omp parallel for
+	for (int i=0; i<(int) m_blockCount; ++i) {
+		PositionBlock &block = m_blocks[i];
+		size_t index = 4 * (m_firstBlock + (size_t) i);
+		for (int j=0; j<4; ++j) {
+			if (index + j <= m_photonCount) {
+				const Photon &photon = m_photons[index + j];
+				block.x[j] = photon.pos[0];
+				block.y[j] = photon.pos[1];
+				block.z[j] = photon.pos[2];
+			} else {
+				block.x[j] = block.y[j] = block.z[j] = inf;
+			}
+		}
+	}
 }
 
 void PhotonMap::balanceRecursive(photon_iterator basePtr, 
@@ -327,9 +490,76 @@ size_t PhotonMap::nnSearch(const Point &p, Float &searchRadiusSquared,
 	float distSquared = (float) searchRadiusSquared;
 	stack[0] = 0;
 
+#if defined(MTS_SSE)
+	const __m128 
+		qx = _mm_set1_ps(pos[0]),
+		qy = _mm_set1_ps(pos[1]),
+		qz = _mm_set1_ps(pos[2]);
+#endif
+
 	while (index > 0) {
 		const_photon_ptr photon = &m_photons[index];
 
+		if (index >= m_firstBlock && isInnerNode(index)) {
+			/* All grandchildren of this node are leaves. Instead of 
+			   traversing the remaining (at most 7) nodes one by one, 
+			   test them all -- the four grandchildren are stored
+			   contiguously in a SoA block. The result is the same, 
+			   since the search region is only ever used for pruning */
+			insertSearchResult<search_result, distanceMetric>(results, fill,
+				maxSize, isPriorityQueue, distSquared, search_result(
+				photon->distSquared(pos), photon));
+
+			const_photon_ptr child = &m_photons[leftChild(index)];
+			insertSearchResult<search_result, distanceMetric>(results, fill,
+				maxSize, isPriorityQueue, distSquared, search_result(
+				child->distSquared(pos), child));
+
+			if (hasRightChild(index)) {
+				child = &m_photons[rightChild(index)];
+				insertSearchResult<search_result, distanceMetric>(results, fill,
+					maxSize, isPriorityQueue, distSquared, search_result(
+					child->distSquared(pos), child));
+			}
+
+			if (index - m_firstBlock < m_blockCount) {
+				const PositionBlock &block = m_blocks[index - m_firstBlock];
+				const_photon_ptr base = &m_photons[4*index];
+#if defined(MTS_SSE)
+				const __m128
+					dx = _mm_sub_ps(_mm_load_ps(block.x), qx),
+					dy = _mm_sub_ps(_mm_load_ps(block.y), qy),
+					dz = _mm_sub_ps(_mm_load_ps(block.z), qz),
+					dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx),
+						_mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+				int mask = _mm_movemask_ps(
+					_mm_cmplt_ps(dist, _mm_set1_ps(distSquared)));
+
+				if (mask) {
+					SSEVector distances(dist);
+					for (int j=0; j<4; ++j) {
+						if (mask & (1 << j))
+							insertSearchResult<search_result, distanceMetric>(
+								results, fill, maxSize, isPriorityQueue,
+								distSquared, search_result(distances.f[j], base + j));
+					}
+				}
+#else
+				for (int j=0; j<4; ++j) {
+					float dx = block.x[j] - pos[0], dy = block.y[j] - pos[1],
+						  dz = block.z[j] - pos[2];
+					insertSearchResult<search_result, distanceMetric>(
+						results, fill, maxSize, isPriorityQueue, distSquared, 
+						search_result(dx*dx + dy*dy + dz*dz, base + j));
+				}
+#endif
+			}
+
+			index = stack[--stackPos];
+			continue;
+		}
+
 		/* Recurse on inner nodes */
 		if (isInnerNode(index)) {
 			float distToPlane = pos[photon->axis] - photon->pos[photon->axis];
@@ -362,34 +592,9 @@ size_t PhotonMap::nnSearch(const Point &p, Float &searchRadiusSquared,
 		}
 
 		/* Check if the current photon is within the query's search radius */
-		const float photonDistSquared = photon->distSquared(pos);
-
-		if (photonDistSquared < distSquared) {
-			/* Similarly to Jensen's implementation, the search switches 
-			   to a priority queue when the available search result space 
-			   is exhausted */
-			if (fill < maxSize) {
-				/* There is still room, just add the photon to the search 
-				   result list */
-				results[fill++] = search_result(photonDistSquared, photon);
-			} else {
-				search_result *begin = results,
-							  *end = begin + maxSize + 1;
-				if (!isPriorityQueue) {
-					/* Establish the MAX-heap property */
-					std::make_heap(begin, begin + maxSize, distanceMetric());
-					isPriorityQueue = true;
-				}
-
-				/* Add the new photon, remove the one farthest away */
-				results[fill] = search_result(photonDistSquared, photon);
-				std::push_heap(begin, end, distanceMetric());
-				std::pop_heap(begin, end, distanceMetric());
-
-				/* Reduce the search radius accordingly */
-				distSquared = results[0].first;
-			}
-		}
+		insertSearchResult<search_result, distanceMetric>(results, fill, 
+			maxSize, isPriorityQueue, distSquared, search_result(
+			photon->distSquared(pos), photon));
 	}
 
 	searchRadiusSquared = (Float) distSquared;
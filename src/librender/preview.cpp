@@ -300,19 +300,16 @@ void PreviewWorker::processCoherent(const WorkUnit *workUnit, WorkResult *workRe
 				if (EXPECT_TAKEN(primIndex != KNoTriangleFlag)) {
 					const TriMesh *mesh = static_cast<const TriMesh *>(shape);
 					const Triangle &t = mesh->getTriangles()[primIndex];
-					const Normal *normals = mesh->getVertexNormals();
-					const Point2 *texcoords = mesh->getVertexTexcoords();
-					const Spectrum *colors = mesh->getVertexColors();
 					const TangentSpace * tangents = mesh->getVertexTangents();
 					const Float beta  = its4.u.f[idx],
 								gamma = its4.v.f[idx],
 								alpha = 1.0f - beta - gamma;
 					const uint32_t idx0 = t.idx[0], idx1 = t.idx[1], idx2 = t.idx[2];
 
-					if (EXPECT_TAKEN(normals)) {
-						const Normal &n0 = normals[idx0],
-							  		 &n1 = normals[idx1],
-									 &n2 = normals[idx2];
+					if (EXPECT_TAKEN(mesh->hasVertexNormals())) {
+						const Normal n0 = mesh->getVertexNormal(idx0),
+							  		 n1 = mesh->getVertexNormal(idx1),
+									 n2 = mesh->getVertexNormal(idx2);
 						its.shFrame.n = normalize(n0 * alpha + n1 * beta + n2 * gamma);
 					} else {
 						const Point *positions = mesh->getVertexPositions();
@@ -327,19 +324,19 @@ void PreviewWorker::processCoherent(const WorkUnit *workUnit, WorkResult *workRe
 						its.shFrame.n = Normal(n);
 					}
 
-					if (EXPECT_TAKEN(texcoords)) {
-						const Point2 &t0 = texcoords[idx0],
-							  		 &t1 = texcoords[idx1],
-									 &t2 = texcoords[idx2];
+					if (EXPECT_TAKEN(mesh->hasVertexTexcoords())) {
+						const Point2 t0 = mesh->getVertexTexcoord(idx0),
+							  		 t1 = mesh->getVertexTexcoord(idx1),
+									 t2 = mesh->getVertexTexcoord(idx2);
 						its.uv = t0 * alpha + t1 * beta + t2 * gamma;
 					} else {
 						its.uv = Point2(0.0f);
 					}
 
-					if (EXPECT_NOT_TAKEN(colors)) {
-						const Spectrum &c0 = colors[idx0],
-							  		   &c1 = colors[idx1],
-									   &c2 = colors[idx2];
+					if (EXPECT_NOT_TAKEN(mesh->hasVertexColors())) {
+						const Spectrum c0 = mesh->getVertexColor(idx0),
+							  		   c1 = mesh->getVertexColor(idx1),
+									   c2 = mesh->getVertexColor(idx2);
 						its.color = c0 * alpha + c1 * beta + c2 * gamma;
 					}
 
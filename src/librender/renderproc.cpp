@@ -122,8 +122,10 @@ ref<WorkProcessor> BlockedRenderProcess::createWorkProcessor() const {
 
 void BlockedRenderProcess::processResult(const WorkResult *result, bool cancelled) {
 	const ImageBlock *block = static_cast<const ImageBlock *>(result);
-	m_resultMutex->lock();
+	/* Films merge blocks using per-tile locks, hence only the
+	   progress update needs to be serialized */
 	m_film->putImageBlock(block);
+	m_resultMutex->lock();
 	m_progress->update(++m_resultCount);
 	m_resultMutex->unlock();
 	m_queue->signalWorkEnd(m_parent, block);
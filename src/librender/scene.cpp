@@ -49,6 +49,19 @@ Scene::Scene(const Properties &props)
 	  dependent on the emitted power. Setting this parameter to false switches 
 	  to uniform sampling. */
 	m_importanceSampleLuminaires = props.getBoolean("importanceSampleLuminaires", true);
+	/* Strategy for choosing a luminaire for direct illumination: "global" picks
+	  luminaires independently of the shading point as described above. "tree"
+	  uses a bounding volume hierarchy over the luminaires to prefer the ones,
+	  which are close to and facing the shading point. This is recommended for 
+	  scenes with many luminaires. */
+	std::string luminaireSampling = props.getString("luminaireSampling", "global");
+	if (luminaireSampling == "global")
+		m_useLightTree = false;
+	else if (luminaireSampling == "tree")
+		m_useLightTree = true;
+	else
+		Log(EError, "Unknown luminaire sampling strategy \"%s\" specified (must be \"global\" or \"tree\")",
+			luminaireSampling.c_str());
 	/* kd-tree construction: Enable primitive clipping? Generally leads to a 
 	  significant improvement of the resulting tree. */
 	if (props.hasProperty("kdClip"))
@@ -86,6 +99,11 @@ Scene::Scene(const Properties &props)
 	   in succession before a leaf node will be created.*/
 	if (props.hasProperty("kdMaxBadRefines"))
 		m_kdtree->setMaxBadRefines(props.getInteger("kdMaxBadRefines"));
+	/* kd-tree construction: Directory, in which built kd-trees are cached. A 
+	   later run with identical geometry and construction parameters maps the
+	   cached tree into memory instead of rebuilding it. Disabled by default. */
+	if (props.hasProperty("kdCacheDir"))
+		m_kdtree->setCacheDirectory(props.getString("kdCacheDir"));
 }
 
 Scene::Scene(Scene *scene) : NetworkedObject(Properties()) {
@@ -102,6 +120,8 @@ Scene::Scene(Scene *scene) : NetworkedObject(Properties()) {
 	m_destinationFile = scene->m_destinationFile;
 	m_luminairePDF = scene->m_luminairePDF;
 	m_importanceSampleLuminaires = scene->m_importanceSampleLuminaires;
+	m_useLightTree = scene->m_useLightTree;
+	m_lightTree = scene->m_lightTree;
 	m_shapes = scene->m_shapes;
 	for (size_t i=0; i<m_shapes.size(); ++i)
 		m_shapes[i]->incRef();
@@ -141,6 +161,7 @@ Scene::Scene(Stream *stream, InstanceManager *manager)
 	m_kdtree->setRetract(stream->readBool());
 	m_kdtree->setMaxBadRefines(stream->readUInt());
 	m_importanceSampleLuminaires = stream->readBool();
+	m_useLightTree = stream->readBool();
 	m_testType = (ETestType) stream->readInt();
 	m_testThresh = stream->readFloat();
 	m_blockSize = stream->readInt();
@@ -333,6 +354,9 @@ void Scene::initialize() {
 			it != m_luminaires.end(); ++it) 
 			(*it)->preprocess(this);
 	}
+
+	if (m_useLightTree && m_lightTree == NULL)
+		m_lightTree = new LightTree(m_luminaires, m_importanceSampleLuminaires);
 }
 
 bool Scene::preprocess(RenderQueue *queue, const RenderJob *job, 
@@ -378,19 +402,30 @@ void Scene::postprocess(RenderQueue *queue, const RenderJob *job,
 	m_camera->getFilm()->develop(m_destinationFile);
 }
 
-Float Scene::pdfLuminaire(const Point &p,
-		const LuminaireSamplingRecord &lRec, bool delta) const {
-	const Luminaire *luminaire = lRec.luminaire;
-	Float luminance;
+const Luminaire *Scene::chooseLuminaire(const Point &p, Float &sample, Float &pdf) const {
+	if (m_lightTree.get())
+		return m_lightTree->sample(p, sample, pdf);
+	return m_luminaires[m_luminairePDF.sampleReuse(sample, pdf)];
+}
 
+Float Scene::pdfChooseLuminaire(const Point &p, const Luminaire *luminaire) const {
+	if (m_lightTree.get())
+		return m_lightTree->pdf(p, luminaire);
+
+	Float luminance;
 	if (m_importanceSampleLuminaires)
 		luminance = luminaire->getSamplingWeight();
 	else 
 		luminance = 1.0f;
 
 	/* Calculate the probability of importance sampling this luminaire */
-	const Float fraction = luminance / m_luminairePDF.getOriginalSum();
-	return luminaire->pdf(p, lRec, delta) * fraction;
+	return luminance / m_luminairePDF.getOriginalSum();
+}
+
+Float Scene::pdfLuminaire(const Point &p,
+		const LuminaireSamplingRecord &lRec, bool delta) const {
+	const Luminaire *luminaire = lRec.luminaire;
+	return luminaire->pdf(p, lRec, delta) * pdfChooseLuminaire(p, luminaire);
 }
 
 bool Scene::sampleLuminaire(const Point &p, Float time,
@@ -398,8 +433,7 @@ bool Scene::sampleLuminaire(const Point &p, Float time,
 		bool testVisibility) const {
 	Point2 sample(s);
 	Float lumPdf;
-	size_t index = m_luminairePDF.sampleReuse(sample.x, lumPdf);
-	const Luminaire *luminaire = m_luminaires[index];
+	const Luminaire *luminaire = chooseLuminaire(p, sample.x, lumPdf);
 	luminaire->sample(p, lRec, sample);
 
 	if (lRec.pdf != 0) {
@@ -501,8 +535,7 @@ bool Scene::sampleAttenuatedLuminaire(const Point &p, Float time,
 	const Point2 &s, Sampler *sampler) const {
 	Point2 sample(s);
 	Float lumPdf;
-	const Luminaire *luminaire = m_luminaires[
-		m_luminairePDF.sampleReuse(sample.x, lumPdf)];
+	const Luminaire *luminaire = chooseLuminaire(p, sample.x, lumPdf);
 	luminaire->sample(p, lRec, sample);
 
 	if (lRec.pdf != 0) {
@@ -522,8 +555,7 @@ bool Scene::sampleAttenuatedLuminaire(const Intersection &its,
 	const Point2 &s, Sampler *sampler) const {
 	Point2 sample(s);
 	Float lumPdf;
-	const Luminaire *luminaire = m_luminaires[
-		m_luminairePDF.sampleReuse(sample.x, lumPdf)];
+	const Luminaire *luminaire = chooseLuminaire(its.p, sample.x, lumPdf);
 	luminaire->sample(its.p, lRec, sample);
 
 	if (lRec.pdf != 0) {
@@ -720,6 +752,7 @@ void Scene::serialize(Stream *stream, InstanceManager *manager) const {
 	stream->writeBool(m_kdtree->getRetract());
 	stream->writeUInt(m_kdtree->getMaxBadRefines());
 	stream->writeBool(m_importanceSampleLuminaires);
+	stream->writeBool(m_useLightTree);
 	stream->writeInt(m_testType);
 	stream->writeFloat(m_testThresh);
 	stream->writeInt(m_blockSize);
@@ -757,6 +790,7 @@ std::string Scene::toString() const {
 		<< "  testType = " << ((m_testType == ETTest) ? "t-test" : "relerr") << ", " << endl
 		<< "  testThresh = " << m_testThresh << ", " << endl
 		<< "  importanceSampleLuminaires = " << (int) m_importanceSampleLuminaires << ", " << endl
+		<< "  luminaireSampling = " << (m_useLightTree ? "tree" : "global") << ", " << endl
 		<< "  camera = " << indent(m_camera.toString()) << "," << endl
 		<< "  sampler = " << indent(m_sampler.toString()) << "," << endl
 		<< "  integrator = " << indent(m_integrator.toString()) << "," << endl
@@ -18,9 +18,36 @@
 
 #include <mitsuba/render/skdtree.h>
 #include <mitsuba/core/statistics.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/timer.h>
+
+/// Version of the on-disk kd-tree cache format
+#define MTS_KD_CACHE_VERSION 1
 
 MTS_NAMESPACE_BEGIN
 
+/**
+ * Header of a kd-tree cache file. It is followed by the node array 
+ * (starting at a file offset that is congruent to 8 modulo 16, see
+ * \ref KDNode::getSibling()) and the index list
+ */
+struct KDCacheHeader {
+	char magic[8];
+	uint32_t version;
+	/* sizeof(Float) | sizeof(index_type) << 8 | sizeof(KDNode) << 16 */
+	uint32_t format;
+	uint64_t hash;
+	uint64_t primCount;
+	uint64_t nodeCount;
+	uint64_t indexCount;
+	uint64_t nodeOffset;
+	uint64_t indexOffset;
+	Float aabb[6];
+	Float tightAABB[6];
+};
+
+static const char kdCacheMagic[8] = { 'M', 'T', 'S', '_', 'K', 'D', 'C', '\0' };
+
 ShapeKDTree::ShapeKDTree() {
 #if !defined(MTS_KD_CONSERVE_MEMORY)
 	m_triAccel = NULL;
@@ -63,7 +90,21 @@ void ShapeKDTree::build() {
 	for (size_t i=1; i<m_shapeMap.size(); ++i)
 		m_shapeMap[i] += m_shapeMap[i-1];
 
-	SAHKDTree3D<ShapeKDTree>::buildInternal();
+	if (!m_cacheDirectory.empty() && getPrimitiveCount() > 0) {
+		ref<Timer> timer = new Timer();
+		uint64_t hash = getCacheHash();
+		fs::path filename = m_cacheDirectory / 
+			formatString("kdtree_%016llx.kdc", (unsigned long long) hash);
+		Log(EDebug, "Computed the kd-tree cache key (took %i ms)",
+			timer->getMilliseconds());
+
+		if (!loadCache(filename, hash)) {
+			SAHKDTree3D<ShapeKDTree>::buildInternal();
+			saveCache(filename, hash);
+		}
+	} else {
+		SAHKDTree3D<ShapeKDTree>::buildInternal();
+	}
 		
 	m_bsphere = m_aabb.getBSphere();
 
@@ -105,6 +146,137 @@ void ShapeKDTree::build() {
 #endif
 }
 
+uint64_t ShapeKDTree::getCacheHash() const {
+	/* Construction parameters */
+	uint64_t params[9];
+	params[0] = (uint64_t) union_cast<uint32_t>((float) m_traversalCost);
+	params[1] = (uint64_t) union_cast<uint32_t>((float) m_queryCost);
+	params[2] = (uint64_t) union_cast<uint32_t>((float) m_emptySpaceBonus);
+	params[3] = (uint64_t) m_stopPrims;
+	params[4] = (uint64_t) m_maxDepth;
+	params[5] = (uint64_t) m_maxBadRefines;
+	params[6] = (uint64_t) m_exactPrimThreshold;
+	params[7] = (uint64_t) m_minMaxBins;
+	params[8] = (m_clip ? 1 : 0) | (m_retract ? 2 : 0);
+	uint64_t hash = hashBuffer(params, sizeof(params), MTS_KD_CACHE_VERSION);
+
+	/* Geometry */
+	for (size_t i=0; i<m_shapes.size(); ++i) {
+		const Shape *shape = m_shapes[i];
+		if (m_triangleFlag[i]) {
+			const TriMesh *mesh = static_cast<const TriMesh *>(shape);
+			hash = hashBuffer(mesh->getVertexPositions(), 
+				mesh->getVertexCount() * sizeof(Point), hash);
+			hash = hashBuffer(mesh->getTriangles(), 
+				mesh->getTriangleCount() * sizeof(Triangle), hash);
+		} else {
+			/* Generic shapes only enter the tree through their (clipped)
+			   bounding boxes, which depend on the shape parameters */
+			std::string desc = shape->toString();
+			AABB aabb = shape->getAABB();
+			hash = hashBuffer(desc.c_str(), desc.length(), hash);
+			hash = hashBuffer(&aabb, sizeof(AABB), hash);
+		}
+	}
+	return hash;
+}
+
+bool ShapeKDTree::loadCache(const fs::path &filename, uint64_t hash) {
+	if (!fs::exists(filename))
+		return false;
+	if (fs::file_size(filename) < sizeof(KDCacheHeader)) {
+		Log(EWarn, "Ignoring the kd-tree cache file \"%s\" (truncated)", 
+			filename.file_string().c_str());
+		return false;
+	}
+
+	ref<Timer> timer = new Timer();
+	ref<MemoryMappedFile> mmap = new MemoryMappedFile(filename);
+	const uint8_t *data = static_cast<const uint8_t *>(mmap->getData());
+	size_t size = mmap->getSize();
+	const KDCacheHeader *header = reinterpret_cast<const KDCacheHeader *>(data);
+	const uint32_t format = (uint32_t) (sizeof(Float) 
+		| (sizeof(index_type) << 8) | (sizeof(KDNode) << 16));
+
+	if (memcmp(header->magic, kdCacheMagic, sizeof(kdCacheMagic)) != 0
+			|| header->version != MTS_KD_CACHE_VERSION
+			|| header->format != format) {
+		Log(EWarn, "Ignoring the kd-tree cache file \"%s\" (incompatible format)", 
+			filename.file_string().c_str());
+		return false;
+	}
+
+	if (header->hash != hash || header->primCount != getPrimitiveCount()
+			|| (header->nodeOffset & 15) != 8
+			|| header->nodeOffset + header->nodeCount * sizeof(KDNode) > size
+			|| header->indexOffset + header->indexCount * sizeof(index_type) > size) {
+		Log(EWarn, "Ignoring the kd-tree cache file \"%s\" (corrupted or "
+			"does not match the scene)", filename.file_string().c_str());
+		return false;
+	}
+
+	AABB aabb, tightAABB;
+	for (int i=0; i<3; ++i) {
+		aabb.min[i] = header->aabb[i]; aabb.max[i] = header->aabb[i+3];
+		tightAABB.min[i] = header->tightAABB[i]; tightAABB.max[i] = header->tightAABB[i+3];
+	}
+
+	/* The tree is never modified after construction, hence the 
+	   read-only mapping can be used directly */
+	initializeExternal(
+		reinterpret_cast<KDNode *>(const_cast<uint8_t *>(data + header->nodeOffset)), 
+		(size_type) header->nodeCount,
+		reinterpret_cast<index_type *>(const_cast<uint8_t *>(data + header->indexOffset)),
+		(size_type) header->indexCount, aabb, tightAABB);
+	m_cacheFile = mmap;
+
+	Log(EInfo, "Loaded the kd-tree from \"%s\" (%s, took %i ms)",
+		filename.file_string().c_str(), memString(size).c_str(),
+		timer->getMilliseconds());
+	return true;
+}
+
+void ShapeKDTree::saveCache(const fs::path &filename, uint64_t hash) const {
+	KDCacheHeader header;
+	memset(&header, 0, sizeof(KDCacheHeader));
+	memcpy(header.magic, kdCacheMagic, sizeof(kdCacheMagic));
+	header.version = MTS_KD_CACHE_VERSION;
+	header.format = (uint32_t) (sizeof(Float) 
+		| (sizeof(index_type) << 8) | (sizeof(KDNode) << 16));
+	header.hash = hash;
+	header.primCount = getPrimitiveCount();
+	header.nodeCount = m_nodeCount;
+	header.indexCount = m_indexCount;
+	header.nodeOffset = ((sizeof(KDCacheHeader) + 8 + 15) & ~(size_t) 15) - 8;
+	header.indexOffset = header.nodeOffset + m_nodeCount * sizeof(KDNode);
+	for (int i=0; i<3; ++i) {
+		header.aabb[i] = m_aabb.min[i]; header.aabb[i+3] = m_aabb.max[i];
+		header.tightAABB[i] = m_tightAABB.min[i]; header.tightAABB[i+3] = m_tightAABB.max[i];
+	}
+
+	ref<Timer> timer = new Timer();
+	try {
+		if (!fs::exists(m_cacheDirectory))
+			fs::create_directories(m_cacheDirectory);
+
+		ref<AtomicFileStream> stream = new AtomicFileStream(filename);
+		uint8_t padding[16];
+		memset(padding, 0, sizeof(padding));
+		stream->write(&header, sizeof(KDCacheHeader));
+		stream->write(padding, (size_t) header.nodeOffset - sizeof(KDCacheHeader));
+		stream->write(m_nodes, m_nodeCount * sizeof(KDNode));
+		stream->write(m_indices, m_indexCount * sizeof(index_type));
+		stream->commit();
+	} catch (const std::exception &ex) {
+		Log(EWarn, "Unable to write the kd-tree cache file \"%s\": %s",
+			filename.file_string().c_str(), ex.what());
+		return;
+	}
+
+	Log(EInfo, "Wrote the kd-tree to \"%s\" (took %i ms)",
+		filename.file_string().c_str(), timer->getMilliseconds());
+}
+
 bool ShapeKDTree::rayIntersect(const Ray &ray, Intersection &its) const {
 	uint8_t temp[MTS_KD_INTERSECTION_TEMP];
 	its.t = std::numeric_limits<Float>::infinity(); 
@@ -275,12 +447,36 @@ void ShapeKDTree::rayIntersectPacket(const RayPacket4 &packet,
 					_mm_mul_ps(interval.maxt.ps, SSEConstants::op_eps.ps)));
 
 			for (index_type entry=primStart; entry != primEnd; entry++) {
+#if defined(MTS_KD_CONSERVE_MEMORY)
+				index_type primIndex = m_indices[entry];
+				const index_type shapeIndex = findShape(primIndex);
+				const bool isTriangle = m_triangleFlag[shapeIndex];
+#else
 				const TriAccel &kdTri = m_triAccel[m_indices[entry]];
-				if (EXPECT_TAKEN(kdTri.k != KNoTriangleFlag)) {
+				const index_type shapeIndex = kdTri.shapeIndex;
+				const bool isTriangle = kdTri.k != KNoTriangleFlag;
+#endif
+				if (EXPECT_TAKEN(isTriangle)) {
+#if defined(MTS_KD_CONSERVE_MEMORY)
+					const TriMesh *mesh = 
+						static_cast<const TriMesh *>(m_shapes[shapeIndex]);
+					const __m128 hasIts = mesh->getTriangles()[primIndex].rayIntersectPacket(
+						mesh->getVertexPositions(), packet, searchStart.ps, 
+						searchEnd.ps, masked.ps, its);
+					if (_mm_movemask_ps(hasIts) != 0) {
+						const __m128i mask = pstoepi32(hasIts);
+						its.primIndex.pi = mux_epi32(mask, 
+							load1_epi32((int) primIndex), its.primIndex.pi);
+						its.shapeIndex.pi = mux_epi32(mask,
+							load1_epi32((int) shapeIndex), its.shapeIndex.pi);
+						itsFound.ps = _mm_or_ps(itsFound.ps, hasIts);
+					}
+#else
 					itsFound.ps = _mm_or_ps(itsFound.ps, 
 						kdTri.rayIntersectPacket(packet, searchStart.ps, searchEnd.ps, masked.ps, its));
+#endif
 				} else {
-					const Shape *shape = m_shapes[kdTri.shapeIndex];
+					const Shape *shape = m_shapes[shapeIndex];
 
 					for (int i=0; i<4; ++i) {
 						if (masked.i[i])
@@ -297,7 +493,7 @@ void ShapeKDTree::rayIntersectPacket(const RayPacket4 &packet,
 								reinterpret_cast<uint8_t *>(temp)
 								+ i * MTS_KD_INTERSECTION_TEMP + 8)) {
 							its.t.f[i] = t;
-							its.shapeIndex.i[i] = kdTri.shapeIndex;
+							its.shapeIndex.i[i] = shapeIndex;
 							its.primIndex.i[i] = KNoTriangleFlag;
 							itsFound.i[i] = 0xFFFFFFFF;
 						}
@@ -346,6 +542,46 @@ void ShapeKDTree::rayIntersectPacketIncoherent(const RayPacket4 &packet,
 	}
 }
 
+void ShapeKDTree::rayIntersectPacket(const Ray *rays, Intersection *its) const {
+	uint8_t temp[4 * MTS_KD_INTERSECTION_TEMP];
+	RayPacket4 MM_ALIGN16 packet;
+	RayInterval4 MM_ALIGN16 interval(rays);
+	Intersection4 MM_ALIGN16 its4;
+
+	for (int i=0; i<4; i++) {
+		/* Use an adaptive ray epsilon */
+		const Ray &ray = rays[i];
+		if (ray.mint == Epsilon)
+			interval.mint.f[i] *= std::max(std::max(std::max(std::abs(ray.o.x), 
+				std::abs(ray.o.y)), std::abs(ray.o.z)), Epsilon);
+	}
+
+	raysTraced += 4;
+	if (packet.load(rays))
+		rayIntersectPacket(packet, interval, its4, temp);
+	else
+		rayIntersectPacketIncoherent(packet, interval, its4, temp);
+
+	for (int i=0; i<4; i++) {
+		its[i].t = its4.t.f[i];
+		if (!its[i].isValid())
+			continue;
+
+		/* Reconstruct the temporary information collected by intersect() */
+		uint8_t *rayTemp = temp + i * MTS_KD_INTERSECTION_TEMP;
+		IntersectionCache *cache = reinterpret_cast<IntersectionCache *>(rayTemp);
+		cache->shapeIndex = its4.shapeIndex.i[i];
+		cache->primIndex = its4.primIndex.i[i];
+		if (cache->primIndex != KNoTriangleFlag) {
+			/* Don't clobber the shape-specific data of other primitives */
+			cache->u = its4.u.f[i];
+			cache->v = its4.v.f[i];
+		}
+
+		fillIntersectionRecord<true>(rays[i], rayTemp, its[i]);
+	}
+}
+
 #endif
 
 MTS_IMPLEMENT_CLASS(ShapeKDTree, false, KDTreeBase)
@@ -17,11 +17,34 @@
 */
 
 #include <mitsuba/core/properties.h>
+#include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/mmap.h>
 #include <mitsuba/render/subsurface.h>
 #include <mitsuba/render/shape.h>
 
+/// Version of the on-disk LUT cache format
+#define MTS_LUT_CACHE_VERSION 1
+
 MTS_NAMESPACE_BEGIN
 
+/**
+ * Header of a LUT cache file. It is followed by the hash string and
+ * the table entries (single precision, starting at \c dataOffset)
+ */
+struct LUTCacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t spectrumSamples;
+	uint64_t hash;
+	double resolution;
+	uint64_t entryCount;
+	uint32_t keyLength;
+	uint32_t dataOffset;
+};
+
+static const char lutCacheMagic[8] = { 'M', 'T', 'S', '_', 'L', 'U', 'T', '\0' };
+
 Subsurface::Subsurface(const Properties &props)
  : NetworkedObject(props) {
 	/* Skim milk data from "A Practical Model for Subsurface scattering" (Jensen et al.) */
@@ -96,17 +119,168 @@ void Subsurface::serialize(Stream *stream, InstanceManager *manager) const {
 
 ref<SubsurfaceMaterialManager> SubsurfaceMaterialManager::m_instance = new SubsurfaceMaterialManager();
 
-bool SubsurfaceMaterialManager::hasLUT(const std::string &hash) const {
-   return m_lutRecords.find(hash) != m_lutRecords.end();
+SubsurfaceMaterialManager::SubsurfaceMaterialManager() {
+    m_mutex = new Mutex();
+    const char *directory = getenv("MTS_LUT_CACHE");
+    m_cacheDirectorySet = directory != NULL;
+    if (directory)
+        m_cacheDirectory = directory;
+}
+
+bool SubsurfaceMaterialManager::hasLUT(const std::string &hash) {
+    m_mutex->lock();
+    bool found = m_lutRecords.find(hash) != m_lutRecords.end();
+    m_mutex->unlock();
+    if (found)
+        return true;
+
+    fs::path directory = getCacheDirectory();
+    LUTRecord lutRec;
+    if (directory.empty() || !loadLUT(directory, hash, lutRec))
+        return false;
+
+    m_mutex->lock();
+    if (m_lutRecords.find(hash) == m_lutRecords.end())
+        m_lutRecords[hash] = lutRec;
+    m_mutex->unlock();
+    return true;
 } 
 
 void SubsurfaceMaterialManager::addLUT(const std::string &hash, const LUTRecord &lutRec) {
-    if (!hasLUT(hash))
+    m_mutex->lock();
+    bool added = m_lutRecords.find(hash) == m_lutRecords.end();
+    if (added)
         m_lutRecords[hash] = LUTRecord(lutRec.lut, lutRec.resolution);
+    m_mutex->unlock();
+
+    fs::path directory = getCacheDirectory();
+    if (added && !directory.empty())
+        saveLUT(directory, hash, lutRec);
 }
 
 SubsurfaceMaterialManager::LUTRecord SubsurfaceMaterialManager::getLUT(const std::string &hash) const {
-    return m_lutRecords.find(hash)->second;
+    m_mutex->lock();
+    LUTRecord lutRec = m_lutRecords.find(hash)->second;
+    m_mutex->unlock();
+    return lutRec;
+}
+
+void SubsurfaceMaterialManager::setCacheDirectory(const fs::path &path) {
+    m_mutex->lock();
+    m_cacheDirectory = path;
+    m_cacheDirectorySet = true;
+    m_mutex->unlock();
+}
+
+fs::path SubsurfaceMaterialManager::getCacheDirectory() const {
+    m_mutex->lock();
+    fs::path directory = m_cacheDirectory;
+    bool set = m_cacheDirectorySet;
+    m_mutex->unlock();
+    if (set)
+        return directory;
+
+    /* Look for a 'lutcache' directory using the file resolver */
+    Thread *thread = Thread::getThread();
+    if (!thread || !thread->getFileResolver())
+        return fs::path();
+    directory = thread->getFileResolver()->resolve("lutcache");
+    if (fs::exists(directory) && fs::is_directory(directory))
+        return directory;
+    return fs::path();
+}
+
+static fs::path getLUTCacheFile(const fs::path &directory, uint64_t hash) {
+    return directory / formatString("%016llx.lut", (unsigned long long) hash);
+}
+
+bool SubsurfaceMaterialManager::loadLUT(const fs::path &directory,
+        const std::string &hash, LUTRecord &lutRec) const {
+    uint64_t fileHash = hashBuffer(hash.c_str(), hash.length(), MTS_LUT_CACHE_VERSION);
+    fs::path filename = getLUTCacheFile(directory, fileHash);
+
+    try {
+        if (!fs::exists(filename) || fs::file_size(filename) < sizeof(LUTCacheHeader))
+            return false;
+
+        ref<MemoryMappedFile> mmap = new MemoryMappedFile(filename);
+        const uint8_t *data = static_cast<const uint8_t *>(mmap->getData());
+        const LUTCacheHeader *header = reinterpret_cast<const LUTCacheHeader *>(data);
+        size_t size = mmap->getSize();
+
+        if (memcmp(header->magic, lutCacheMagic, sizeof(lutCacheMagic)) != 0
+                || header->version != MTS_LUT_CACHE_VERSION
+                || header->spectrumSamples != SPECTRUM_SAMPLES
+                || header->hash != fileHash
+                || header->keyLength != hash.length()
+                || sizeof(LUTCacheHeader) + header->keyLength > size
+                || header->dataOffset + header->entryCount 
+                    * SPECTRUM_SAMPLES * sizeof(float) > size
+                || memcmp(data + sizeof(LUTCacheHeader), hash.c_str(), hash.length()) != 0) {
+            Log(EWarn, "Ignoring the LUT cache file \"%s\" (truncated, incompatible "
+                "format or hash collision)", filename.file_string().c_str());
+            return false;
+        }
+
+        const float *entries = reinterpret_cast<const float *>(data + header->dataOffset);
+        ref<LUTType> lut = new LUTType((size_t) header->entryCount);
+        for (size_t i=0; i<lut->size(); ++i) 
+            for (int j=0; j<SPECTRUM_SAMPLES; ++j)
+                lut->at(i)[j] = (Float) *entries++;
+        lutRec = LUTRecord(lut, (Float) header->resolution);
+    } catch (const std::exception &ex) {
+        Log(EWarn, "Unable to read the LUT cache file \"%s\": %s",
+            filename.file_string().c_str(), ex.what());
+        return false;
+    }
+
+    Log(EInfo, "Loaded a look-up-table with " SIZE_T_FMT " entries from \"%s\"",
+        lutRec.lut->size(), filename.file_string().c_str());
+    return true;
+}
+
+void SubsurfaceMaterialManager::saveLUT(const fs::path &directory,
+        const std::string &hash, const LUTRecord &lutRec) const {
+    uint64_t fileHash = hashBuffer(hash.c_str(), hash.length(), MTS_LUT_CACHE_VERSION);
+    fs::path filename = getLUTCacheFile(directory, fileHash);
+
+    LUTCacheHeader header;
+    memset(&header, 0, sizeof(LUTCacheHeader));
+    memcpy(header.magic, lutCacheMagic, sizeof(lutCacheMagic));
+    header.version = MTS_LUT_CACHE_VERSION;
+    header.spectrumSamples = SPECTRUM_SAMPLES;
+    header.hash = fileHash;
+    header.resolution = (double) lutRec.resolution;
+    header.entryCount = lutRec.lut->size();
+    header.keyLength = (uint32_t) hash.length();
+    header.dataOffset = (uint32_t) ((sizeof(LUTCacheHeader) + hash.length() + 15) & ~(size_t) 15);
+
+    std::vector<float> entries(lutRec.lut->size() * SPECTRUM_SAMPLES);
+    for (size_t i=0; i<lutRec.lut->size(); ++i)
+        for (int j=0; j<SPECTRUM_SAMPLES; ++j)
+            entries[i*SPECTRUM_SAMPLES + j] = (float) lutRec.lut->at(i)[j];
+
+    try {
+        if (!fs::exists(directory))
+            fs::create_directories(directory);
+
+        ref<AtomicFileStream> stream = new AtomicFileStream(filename);
+        uint8_t padding[16];
+        memset(padding, 0, sizeof(padding));
+        stream->write(&header, sizeof(LUTCacheHeader));
+        stream->write(hash.c_str(), hash.length());
+        stream->write(padding, header.dataOffset - sizeof(LUTCacheHeader) - hash.length());
+        if (entries.size() > 0)
+            stream->write(&entries[0], entries.size() * sizeof(float));
+        stream->commit();
+    } catch (const std::exception &ex) {
+        Log(EWarn, "Unable to write the LUT cache file \"%s\": %s",
+            filename.file_string().c_str(), ex.what());
+        return;
+    }
+
+    Log(EInfo, "Wrote a look-up-table with " SIZE_T_FMT " entries to \"%s\"",
+        lutRec.lut->size(), filename.file_string().c_str());
 }
 
 std::string SubsurfaceMaterialManager::getMultipoleLUTHashR(Float resolution, Float errorThreshold,
@@ -0,0 +1,178 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/core/statistics.h>
+#include <mitsuba/render/texcache.h>
+#include <mitsuba/render/mipmap.h>
+
+MTS_NAMESPACE_BEGIN
+
+static StatsCounter tileHits("Texture cache", "Tile hits");
+static StatsCounter tileMisses("Texture cache", "Tile misses", EPercentage);
+static StatsCounter tileEvictions("Texture cache", "Evicted tiles");
+static StatsCounter tileBytesRead("Texture cache", "Tile data read", EByteCount);
+
+ref<TextureCache> TextureCache::m_instance = new TextureCache();
+
+TextureCache::TextureCache() : m_nextID(0) {
+	for (int i=0; i<MTS_TEXCACHE_SHARDS; ++i) {
+		Shard &shard = m_shards[i];
+		shard.mutex = new Mutex();
+		shard.lru.prev = shard.lru.next = &shard.lru;
+		shard.memory = 0;
+	}
+	m_budget = (size_t) MTS_TEXCACHE_DEFAULT_BUDGET * 1024 * 1024;
+}
+
+TextureCache::~TextureCache() {
+	for (int i=0; i<MTS_TEXCACHE_SHARDS; ++i) {
+		Shard &shard = m_shards[i];
+		for (std::map<uint64_t, Tile *>::iterator it = shard.tiles.begin();
+				it != shard.tiles.end(); ++it)
+			freeTile(it->second);
+	}
+}
+
+uint32_t TextureCache::allocateID() {
+	return (uint32_t) atomicAdd(&m_nextID, 1);
+}
+
+void TextureCache::freeTile(Tile *tile) {
+	delete[] tile->data;
+	delete tile;
+}
+
+TextureCache::Tile *TextureCache::get(const MIPMap *mipmap, uint32_t id, uint32_t index) {
+	uint64_t key = ((uint64_t) id << 32) | index;
+	Shard &shard = getShard(key);
+	tileMisses.incrementBase();
+
+	shard.mutex->lock();
+	std::map<uint64_t, Tile *>::iterator it = shard.tiles.find(key);
+	if (it != shard.tiles.end()) {
+		Tile *tile = it->second;
+		/* Pins are only acquired while holding the lock, hence
+		   an unpinned tile cannot be evicted concurrently */
+		atomicAdd(&tile->pins, 1);
+		unlink(tile);
+		linkFront(shard, tile);
+		shard.mutex->unlock();
+		++tileHits;
+		return tile;
+	}
+	shard.mutex->unlock();
+
+	/* Load the tile without blocking other lookups in this shard */
+	++tileMisses;
+	Tile *tile = new Tile();
+	tile->key = key;
+	tile->size = mipmap->m_texelSize * MIPMAP_TILESIZE * MIPMAP_TILESIZE;
+	tile->data = new uint8_t[tile->size];
+	tile->pins = 1;
+	try {
+		mipmap->loadTile(index, tile->data);
+	} catch (...) {
+		freeTile(tile);
+		throw;
+	}
+	tileBytesRead += tile->size;
+
+	shard.mutex->lock();
+	it = shard.tiles.find(key);
+	if (it != shard.tiles.end()) {
+		/* Another thread loaded the same tile in the meantime */
+		freeTile(tile);
+		tile = it->second;
+		atomicAdd(&tile->pins, 1);
+		unlink(tile);
+	} else {
+		shard.tiles[key] = tile;
+		shard.memory += tile->size;
+	}
+	linkFront(shard, tile);
+	evict(shard);
+	shard.mutex->unlock();
+	return tile;
+}
+
+void TextureCache::evict(Shard &shard) {
+	size_t budget = m_budget / MTS_TEXCACHE_SHARDS;
+	Tile *tile = shard.lru.prev;
+	while (shard.memory > budget && tile != &shard.lru) {
+		Tile *prev = tile->prev;
+		if (tile->pins == 0) {
+			unlink(tile);
+			shard.tiles.erase(tile->key);
+			shard.memory -= tile->size;
+			freeTile(tile);
+			++tileEvictions;
+		}
+		tile = prev;
+	}
+}
+
+void TextureCache::purge(uint32_t id) {
+	uint64_t start = (uint64_t) id << 32, end = start + ((uint64_t) 1 << 32);
+	for (int i=0; i<MTS_TEXCACHE_SHARDS; ++i) {
+		Shard &shard = m_shards[i];
+		shard.mutex->lock();
+		std::map<uint64_t, Tile *>::iterator it = shard.tiles.lower_bound(start);
+		while (it != shard.tiles.end() && it->first < end) {
+			Tile *tile = it->second;
+			Assert(tile->pins == 0);
+			unlink(tile);
+			shard.memory -= tile->size;
+			freeTile(tile);
+			shard.tiles.erase(it++);
+		}
+		shard.mutex->unlock();
+	}
+}
+
+void TextureCache::setMemoryBudget(size_t budget) {
+	m_budget = budget;
+	for (int i=0; i<MTS_TEXCACHE_SHARDS; ++i) {
+		Shard &shard = m_shards[i];
+		shard.mutex->lock();
+		evict(shard);
+		shard.mutex->unlock();
+	}
+}
+
+size_t TextureCache::getMemoryUsage() const {
+	size_t memory = 0;
+	for (int i=0; i<MTS_TEXCACHE_SHARDS; ++i) {
+		const Shard &shard = m_shards[i];
+		shard.mutex->lock();
+		memory += shard.memory;
+		shard.mutex->unlock();
+	}
+	return memory;
+}
+
+std::string TextureCache::toString() const {
+	std::ostringstream oss;
+	oss << "TextureCache[" << endl
+		<< "  budget = " << memString(m_budget) << "," << endl
+		<< "  usage = " << memString(getMemoryUsage()) << endl
+		<< "]";
+	return oss.str();
+}
+
+MTS_IMPLEMENT_CLASS(TextureCache, false, Object)
+MTS_NAMESPACE_END
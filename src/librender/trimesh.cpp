@@ -20,6 +20,7 @@
 #include <mitsuba/core/random.h>
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/zstream.h>
+#include <mitsuba/core/mstream.h>
 #include <mitsuba/core/timer.h>
 #include <mitsuba/core/properties.h>
 #include <mitsuba/render/subsurface.h>
@@ -29,6 +30,10 @@
 
 #define MTS_FILEFORMAT_HEADER 0x041C
 #define MTS_FILEFORMAT_VERSION_V3 0x03
+#define MTS_FILEFORMAT_VERSION_V4 0x04
+
+/// Uncompressed size of the data blocks in version 4 of the file format
+#define MTS_FILEFORMAT_BLOCK_SIZE (1024*1024)
 
 MTS_NAMESPACE_BEGIN
 
@@ -46,12 +51,15 @@ TriMesh::TriMesh(const std::string &name, size_t triangleCount,
 	m_texcoords = hasTexcoords ? new Point2[m_vertexCount] : NULL;
 	m_colors = hasVertexColors ? new Spectrum[m_vertexCount] : NULL;
 	m_tangents = NULL;
+	m_packedNormals = m_packedTexcoords = m_packedColors = NULL;
+	m_compactAttributes = false;
 }
 
 TriMesh::TriMesh(const Properties &props) 
  : Shape(props), m_triangles(NULL), m_positions(NULL),
 	m_normals(NULL), m_texcoords(NULL), m_tangents(NULL),
-	m_colors(NULL) {
+	m_colors(NULL), m_packedNormals(NULL), m_packedTexcoords(NULL),
+	m_packedColors(NULL) {
 
 	/* By default, any existing normals will be used for
 	   rendering. If no normals are found, Mitsuba will
@@ -64,6 +72,10 @@ TriMesh::TriMesh(const Properties &props)
 
 	/* Causes all normals to be flipped */
 	m_flipNormals = props.getBoolean("flipNormals", false);
+
+	/* Store normals, texture coordinates and colors using 4 bytes
+	   per vertex and attribute (see \ref compactAttributes()) */
+	m_compactAttributes = props.getBoolean("compactAttributes", false);
 	
 	m_triangles = NULL;
 }
@@ -75,12 +87,15 @@ enum ETriMeshFlags {
 	EHasTangents     = 0x0004,
 	EHasColors       = 0x0008,
 	EFaceNormals     = 0x0010,
+	ENoCompression   = 0x0020,
+	ECompactStorage  = 0x0040,
 	ESinglePrecision = 0x1000,
 	EDoublePrecision = 0x2000
 };
 
 TriMesh::TriMesh(Stream *stream, InstanceManager *manager) 
-	: Shape(stream, manager), m_tangents(NULL) {
+	: Shape(stream, manager), m_tangents(NULL), m_packedNormals(NULL),
+	  m_packedTexcoords(NULL), m_packedColors(NULL), m_compactAttributes(false) {
 	m_name = stream->readString();
 	m_aabb = AABB(stream);
 
@@ -93,29 +108,50 @@ TriMesh::TriMesh(Stream *stream, InstanceManager *manager)
 		m_vertexCount * sizeof(Point)/sizeof(Float));
 
 	m_faceNormals = flags & EFaceNormals;
-
-	if (flags & EHasNormals) {
-		m_normals = new Normal[m_vertexCount];
-		stream->readFloatArray(reinterpret_cast<Float *>(m_normals), 
-			m_vertexCount * sizeof(Normal)/sizeof(Float));
+	m_normals = NULL;
+	m_texcoords = NULL;
+	m_colors = NULL;
+
+	if (flags & ECompactStorage) {
+		/* Compact attributes are transferred as-is, together with
+		   the tangents that can no longer be computed from them */
+		if (flags & EHasNormals) {
+			m_packedNormals = new uint32_t[m_vertexCount];
+			stream->readUIntArray(m_packedNormals, m_vertexCount);
+		}
+		if (flags & EHasTexcoords) {
+			m_texcoordOffset = Point2(stream);
+			m_texcoordScale = Vector2(stream);
+			m_packedTexcoords = new uint32_t[m_vertexCount];
+			stream->readUIntArray(m_packedTexcoords, m_vertexCount);
+		}
+		if (flags & EHasColors) {
+			m_packedColors = new uint32_t[m_vertexCount];
+			stream->readUIntArray(m_packedColors, m_vertexCount);
+		}
+		if (flags & EHasTangents) {
+			m_tangents = new TangentSpace[m_vertexCount];
+			stream->readFloatArray(reinterpret_cast<Float *>(m_tangents), 
+				m_vertexCount * sizeof(TangentSpace)/sizeof(Float));
+		}
 	} else {
-		m_normals = NULL;
-	}
+		if (flags & EHasNormals) {
+			m_normals = new Normal[m_vertexCount];
+			stream->readFloatArray(reinterpret_cast<Float *>(m_normals), 
+				m_vertexCount * sizeof(Normal)/sizeof(Float));
+		}
 
-	if (flags & EHasTexcoords) {
-		m_texcoords = new Point2[m_vertexCount];
-		stream->readFloatArray(reinterpret_cast<Float *>(m_texcoords), 
-			m_vertexCount * sizeof(Point2)/sizeof(Float));
-	} else {
-		m_texcoords = NULL;
-	}
+		if (flags & EHasTexcoords) {
+			m_texcoords = new Point2[m_vertexCount];
+			stream->readFloatArray(reinterpret_cast<Float *>(m_texcoords), 
+				m_vertexCount * sizeof(Point2)/sizeof(Float));
+		}
 
-	if (flags & EHasColors) {
-		m_colors = new Spectrum[m_vertexCount];
-		stream->readFloatArray(reinterpret_cast<Float *>(m_colors), 
-			m_vertexCount * sizeof(Spectrum)/sizeof(Float));
-	} else {
-		m_colors = NULL;
+		if (flags & EHasColors) {
+			m_colors = new Spectrum[m_vertexCount];
+			stream->readFloatArray(reinterpret_cast<Float *>(m_colors), 
+				m_vertexCount * sizeof(Spectrum)/sizeof(Float));
+		}
 	}
 
 	m_triangles = new Triangle[m_triangleCount];
@@ -153,8 +189,59 @@ static void readHelper(Stream *stream, bool fileDoublePrecision,
 	}
 }
 
-TriMesh::TriMesh(Stream *_stream, int index)
-		: Shape(Properties()), m_tangents(NULL) {
+/// Array of a serialized mesh, consisting of either Float or uint32_t values
+struct SerializedArray {
+	void *data;
+	size_t count;
+	bool isFloat;
+
+	inline SerializedArray(void *data, size_t count, bool isFloat)
+		: data(data), count(count), isFloat(isFloat) { }
+};
+
+/**
+ * \brief Independently stored part of a serialized array (file format
+ * version 4). The offset is relative to the start of the mesh.
+ */
+struct SerializedBlock {
+	size_t array, start, count;
+	uint64_t offset;
+	uint32_t storedSize, size;
+};
+
+/**
+ * Split the arrays of a serialized mesh into blocks. Together with
+ * the mesh flags and sizes, this fully determines the block layout.
+ */
+static std::vector<SerializedBlock> getSerializedBlocks(
+		const std::vector<SerializedArray> &arrays, bool fileDoublePrecision) {
+	std::vector<SerializedBlock> blocks;
+	for (size_t i=0; i<arrays.size(); ++i) {
+		size_t scalarSize = (arrays[i].isFloat && fileDoublePrecision)
+			? sizeof(double) : sizeof(uint32_t);
+		size_t scalarsPerBlock = MTS_FILEFORMAT_BLOCK_SIZE / scalarSize;
+		for (size_t start=0; start<arrays[i].count; start += scalarsPerBlock) {
+			SerializedBlock block;
+			block.array = i;
+			block.start = start;
+			block.count = std::min(scalarsPerBlock, arrays[i].count - start);
+			block.offset = 0;
+			block.size = (uint32_t) (block.count * scalarSize);
+			block.storedSize = 0;
+			blocks.push_back(block);
+		}
+	}
+	return blocks;
+}
+
+TriMesh::TriMesh(Stream *stream, int index)
+		: Shape(Properties()), m_tangents(NULL), m_packedNormals(NULL),
+		  m_packedTexcoords(NULL), m_packedColors(NULL), m_compactAttributes(false) {
+	readSerialized(stream, index);
+	m_flipNormals = false;
+}
+
+void TriMesh::readSerialized(Stream *_stream, int index) {
 	ref<Stream> stream = _stream;
 
 	if (index != 0) {
@@ -176,6 +263,7 @@ TriMesh::TriMesh(Stream *_stream, int index)
 		Log(EError, "Tried to unserialize a shape from a stream, "
 		"which was not previously set to little endian byte order!");
 
+	const size_t meshStart = stream->getPos();
 	short format = stream->readShort();
 	if (format == 0x1C04)
 		Log(EError, "Encountered a geometry file generated by an old "
@@ -186,9 +274,10 @@ TriMesh::TriMesh(Stream *_stream, int index)
 		Log(EError, "Encountered an invalid file format!");
 
 	short version = stream->readShort();
-	if (version != MTS_FILEFORMAT_VERSION_V3)
+	if (version != MTS_FILEFORMAT_VERSION_V3 && version != MTS_FILEFORMAT_VERSION_V4)
 		Log(EError, "Encountered an incompatible file version!");
-	stream = new ZStream(stream);
+	if (version == MTS_FILEFORMAT_VERSION_V3)
+		stream = new ZStream(stream);
 
 	uint32_t flags = stream->readUInt();
 	m_vertexCount = stream->readSize();
@@ -198,42 +287,126 @@ TriMesh::TriMesh(Stream *_stream, int index)
 	m_faceNormals = flags & EFaceNormals;
 
 	m_positions = new Point[m_vertexCount];
-	readHelper(stream, fileDoublePrecision,
-			reinterpret_cast<Float *>(m_positions),
-			m_vertexCount, sizeof(Point)/sizeof(Float));
-
-	if (flags & EHasNormals) {
-		m_normals = new Normal[m_vertexCount];
-		readHelper(stream, fileDoublePrecision, 
-				reinterpret_cast<Float *>(m_normals),
-				m_vertexCount, sizeof(Normal)/sizeof(Float));
-	} else {
-		m_normals = NULL;
-	}
+	m_normals = (flags & EHasNormals) ? new Normal[m_vertexCount] : NULL;
+	m_texcoords = (flags & EHasTexcoords) ? new Point2[m_vertexCount] : NULL;
+	m_colors = (flags & EHasColors) ? new Spectrum[m_vertexCount] : NULL;
+	m_triangles = new Triangle[m_triangleCount];
 
-	if (flags & EHasTexcoords) {
-		m_texcoords = new Point2[m_vertexCount];
+	if (version == MTS_FILEFORMAT_VERSION_V3) {
 		readHelper(stream, fileDoublePrecision,
-				reinterpret_cast<Float *>(m_texcoords),
-				m_vertexCount, sizeof(Point2)/sizeof(Float));
-	} else {
-		m_texcoords = NULL;
+				reinterpret_cast<Float *>(m_positions),
+				m_vertexCount, sizeof(Point)/sizeof(Float));
+
+		if (m_normals)
+			readHelper(stream, fileDoublePrecision, 
+					reinterpret_cast<Float *>(m_normals),
+					m_vertexCount, sizeof(Normal)/sizeof(Float));
+
+		if (m_texcoords)
+			readHelper(stream, fileDoublePrecision,
+					reinterpret_cast<Float *>(m_texcoords),
+					m_vertexCount, sizeof(Point2)/sizeof(Float));
+
+		if (m_colors)
+			readHelper(stream, fileDoublePrecision, 
+					reinterpret_cast<Float *>(m_colors),
+					m_vertexCount, sizeof(Spectrum)/sizeof(Float));
+
+		stream->readUIntArray(reinterpret_cast<uint32_t *>(m_triangles), 
+			m_triangleCount * sizeof(Triangle)/sizeof(uint32_t));
+		return;
 	}
 
-	if (flags & EHasColors) {
-		m_colors = new Spectrum[m_vertexCount];
-		readHelper(stream, fileDoublePrecision, 
-				reinterpret_cast<Float *>(m_colors),
-				m_vertexCount, sizeof(Spectrum)/sizeof(Float));
-	} else {
-		m_colors = NULL;
+	/* Version 4: read the block table */
+	std::vector<SerializedArray> arrays;
+	arrays.push_back(SerializedArray(m_positions, m_vertexCount * sizeof(Point)/sizeof(Float), true));
+	if (m_normals)
+		arrays.push_back(SerializedArray(m_normals, m_vertexCount * sizeof(Normal)/sizeof(Float), true));
+	if (m_texcoords)
+		arrays.push_back(SerializedArray(m_texcoords, m_vertexCount * sizeof(Point2)/sizeof(Float), true));
+	if (m_colors)
+		arrays.push_back(SerializedArray(m_colors, m_vertexCount * sizeof(Spectrum)/sizeof(Float), true));
+	arrays.push_back(SerializedArray(m_triangles, m_triangleCount * sizeof(Triangle)/sizeof(uint32_t), false));
+
+	std::vector<SerializedBlock> blocks = getSerializedBlocks(arrays, fileDoublePrecision);
+	uint32_t blockCount = stream->readUInt();
+	if (blockCount != blocks.size())
+		Log(EError, "Encountered an invalid file format (the block table is inconsistent)!");
+
+	uint64_t payloadStart = std::numeric_limits<uint64_t>::max(), payloadEnd = 0;
+	for (size_t i=0; i<blocks.size(); ++i) {
+		SerializedBlock &block = blocks[i];
+		block.offset = stream->readULong();
+		block.storedSize = stream->readUInt();
+		if (stream->readUInt() != block.size)
+			Log(EError, "Encountered an invalid file format (the block table is inconsistent)!");
+		payloadStart = std::min(payloadStart, block.offset);
+		payloadEnd = std::max(payloadEnd, block.offset + block.storedSize);
+	}
+	if (blocks.empty())
+		return;
+
+	bool compressed = !(flags & ENoCompression);
+	MemoryStream *mstream = NULL;
+	if (stream->getClass()->derivesFrom(MTS_CLASS(MemoryStream)))
+		mstream = static_cast<MemoryStream *>(stream.get());
+
+	if (!mstream && !compressed) {
+		/* Nothing to decode -- read straight into the final arrays */
+		for (size_t i=0; i<blocks.size(); ++i) {
+			const SerializedBlock &block = blocks[i];
+			const SerializedArray &array = arrays[block.array];
+			stream->setPos(meshStart + (size_t) block.offset);
+			if (array.isFloat)
+				readHelper(stream, fileDoublePrecision,
+					static_cast<Float *>(array.data) + block.start, block.count, 1);
+			else
+				stream->readUIntArray(static_cast<uint32_t *>(array.data) + block.start,
+					block.count);
+		}
+		return;
 	}
 
-	m_triangles = new Triangle[m_triangleCount];
-	stream->readUIntArray(reinterpret_cast<uint32_t *>(m_triangles), 
-		m_triangleCount * sizeof(Triangle)/sizeof(uint32_t));
+	/* Decode the blocks in parallel. Memory streams are accessed
+	   directly, other streams are first read into a buffer */
+	std::vector<uint8_t> buffer;
+	uint8_t *payload;
+	if (mstream) {
+		if (meshStart + payloadEnd > mstream->getSize())
+			Log(EError, "Read less data than expected!");
+		payload = mstream->getData() + meshStart;
+	} else {
+		buffer.resize((size_t) (payloadEnd - payloadStart));
+		stream->setPos(meshStart + (size_t) payloadStart);
+		stream->read(&buffer[0], buffer.size());
+		payload = &buffer[0] - (size_t) payloadStart;
+	}
 
-	m_flipNormals = false;
+	std::string error;
+	#pragma omp parallel for schedule(dynamic)
+	for (int i=0; i<(int) blocks.size(); ++i) {
+		const SerializedBlock &block = blocks[i];
+		const SerializedArray &array = arrays[block.array];
+		try {
+			ref<Stream> blockStream = new MemoryStream(payload + block.offset, block.storedSize);
+			blockStream->setByteOrder(Stream::ELittleEndian);
+			if (compressed) {
+				blockStream = new ZStream(blockStream);
+				blockStream->setByteOrder(Stream::ELittleEndian);
+			}
+			if (array.isFloat)
+				readHelper(blockStream, fileDoublePrecision,
+					static_cast<Float *>(array.data) + block.start, block.count, 1);
+			else
+				blockStream->readUIntArray(static_cast<uint32_t *>(array.data) + block.start,
+					block.count);
+		} catch (const std::exception &e) {
+			#pragma omp critical
+			error = e.what();
+		}
+	}
+	if (!error.empty())
+		Log(EError, "Unable to unserialize mesh: %s", error.c_str());
 }
 
 TriMesh::~TriMesh() {
@@ -247,6 +420,12 @@ TriMesh::~TriMesh() {
 		delete[] m_tangents;
 	if (m_colors)
 		delete[] m_colors;
+	if (m_packedNormals)
+		delete[] m_packedNormals;
+	if (m_packedTexcoords)
+		delete[] m_packedTexcoords;
+	if (m_packedColors)
+		delete[] m_packedColors;
 	if (m_triangles)
 		delete[] m_triangles;
 }
@@ -288,6 +467,9 @@ void TriMesh::configure() {
 	if (hasBSDF() && ((m_bsdf->getType() & BSDF::EAnisotropic)
 		|| m_bsdf->usesRayDifferentials()) && !m_tangents) 
 		computeTangentSpaceBasis();
+
+	if (m_compactAttributes)
+		compactAttributes();
 }
 
 Float TriMesh::getSurfaceArea() const {
@@ -297,7 +479,21 @@ Float TriMesh::getSurfaceArea() const {
 Float TriMesh::sampleArea(ShapeSamplingRecord &sRec, const Point2 &sample) const {
 	Point2 newSeed = sample;
 	int index = m_areaPDF.sampleReuse(newSeed.y);
-	sRec.p = m_triangles[index].sample(m_positions, m_normals, sRec.n, newSeed);
+	if (EXPECT_TAKEN(!m_packedNormals)) {
+		sRec.p = m_triangles[index].sample(m_positions, m_normals, sRec.n, newSeed);
+	} else {
+		/* Sample a copy of the triangle with decoded normals */
+		const Triangle &tri = m_triangles[index];
+		Triangle local;
+		Point positions[3];
+		Normal normals[3];
+		for (int i=0; i<3; ++i) {
+			local.idx[i] = i;
+			positions[i] = m_positions[tri.idx[i]];
+			normals[i] = getVertexNormal(tri.idx[i]);
+		}
+		sRec.p = local.sample(positions, normals, sRec.n, newSeed);
+	}
 	return m_invSurfaceArea;
 }
 
@@ -349,6 +545,10 @@ void TriMesh::rebuildTopology(Float maxAngle) {
 	typedef std::pair<Vertex, TopoData> MPair;
 	const Float dpThresh = std::cos(degToRad(maxAngle));
 
+	if (hasCompactAttributes())
+		Log(EError, "\"%s\": rebuildTopology(): the vertex attributes "
+			"have already been compacted!", m_name.c_str());
+
 	if (m_normals) {
 		delete[] m_normals;
 		m_normals = NULL;
@@ -472,6 +672,11 @@ void TriMesh::rebuildTopology(Float maxAngle) {
 
 void TriMesh::computeNormals() {
 	int invalidNormals = 0;
+	if (m_packedNormals) {
+		/* Compact normals are only created from final normals */
+		return;
+	}
+
 	if (m_faceNormals) {
 		if (m_normals) {
 			delete[] m_normals;
@@ -559,6 +764,10 @@ bool TriMesh::computeTangentSpaceBasis() {
 	if (m_tangents)
 		Log(EError, "Tangent space vectors have already been generated!");
 
+	if (hasCompactAttributes())
+		Log(EError, "\"%s\": computeTangentSpace(): tangents must be generated "
+			"before the vertex attributes are compacted!", m_name.c_str());
+
 	if (!m_normals) {
 		Log(EWarn, "Vertex normals are required to compute a tangent space basis!");
 		return false;
@@ -668,6 +877,125 @@ bool TriMesh::computeTangentSpaceBasis() {
 	return true;
 }
 
+/// Octahedral encoding of a normal (see \ref TriMesh::unpackNormal())
+static uint32_t packNormal(const Normal &n) {
+	Float length = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	if (!(length > 0))
+		return 0x80008000u;
+
+	Float x = n.x / length, y = n.y / length;
+	if (n.z < 0) {
+		Float tmp = (1 - std::abs(y)) * (x >= 0 ? 1 : -1);
+		y = (1 - std::abs(x)) * (y >= 0 ? 1 : -1);
+		x = tmp;
+	}
+
+	/* Choose the rounding direction with the smallest angular error */
+	const Vector target = normalize(n);
+	int baseX = floorToInt(x * 32767), baseY = floorToInt(y * 32767);
+	uint32_t result = 0;
+	Float bestDot = -std::numeric_limits<Float>::infinity();
+	for (int i=0; i<4; ++i) {
+		int qx = std::max(-32767, std::min(32767, baseX + (i & 1))),
+		    qy = std::max(-32767, std::min(32767, baseY + (i >> 1)));
+		uint32_t value = (uint32_t) (uint16_t) (int16_t) qx
+			| ((uint32_t) (uint16_t) (int16_t) qy << 16);
+		Float d = dot(TriMesh::unpackNormal(value), target);
+		if (d > bestDot) {
+			bestDot = d;
+			result = value;
+		}
+	}
+	return result;
+}
+
+/// RGBE encoding of a color (see \ref TriMesh::unpackColor())
+static uint32_t packColor(const Spectrum &color) {
+	Float rgb[3];
+	color.toLinearRGB(rgb[0], rgb[1], rgb[2]);
+	Float maxValue = 0;
+	for (int i=0; i<3; ++i) {
+		rgb[i] = std::max(rgb[i], (Float) 0);
+		maxValue = std::max(maxValue, rgb[i]);
+	}
+	if (maxValue < 1e-32f)
+		return 0;
+
+	int exponent;
+	std::frexp(maxValue, &exponent);
+	if (exponent + 128 < 1)
+		return 0;
+	exponent = std::min(exponent, 127);
+
+	Float scale = std::ldexp((Float) 1, 8 - exponent);
+	uint32_t result = (uint32_t) (exponent + 128) << 24;
+	for (int i=0; i<3; ++i)
+		result |= (uint32_t) std::min((int) (rgb[i] * scale), 255) << (8*i);
+	return result;
+}
+
+void TriMesh::compactAttributes() {
+	size_t before = 0, after = 0;
+	int vertexCount = (int) m_vertexCount;
+
+	if (m_normals) {
+		m_packedNormals = new uint32_t[m_vertexCount];
+		#pragma omp parallel for schedule(static)
+		for (int i=0; i<vertexCount; ++i)
+			m_packedNormals[i] = packNormal(m_normals[i]);
+		delete[] m_normals;
+		m_normals = NULL;
+		before += sizeof(Normal) * m_vertexCount;
+		after += sizeof(uint32_t) * m_vertexCount;
+	}
+
+	if (m_texcoords) {
+		/* Quantize relative to the bounding box of the texture coordinates */
+		Point2 min(std::numeric_limits<Float>::infinity()),
+		       max(-std::numeric_limits<Float>::infinity());
+		for (size_t i=0; i<m_vertexCount; ++i) {
+			const Point2 &uv = m_texcoords[i];
+			min.x = std::min(min.x, uv.x); max.x = std::max(max.x, uv.x);
+			min.y = std::min(min.y, uv.y); max.y = std::max(max.y, uv.y);
+		}
+		m_texcoordOffset = min;
+		m_texcoordScale = (max - min) / (Float) 0xFFFF;
+		Vector2 invScale(
+			m_texcoordScale.x > 0 ? 1 / m_texcoordScale.x : 0,
+			m_texcoordScale.y > 0 ? 1 / m_texcoordScale.y : 0);
+
+		m_packedTexcoords = new uint32_t[m_vertexCount];
+		#pragma omp parallel for schedule(static)
+		for (int i=0; i<vertexCount; ++i) {
+			const Point2 &uv = m_texcoords[i];
+			int u = floorToInt((uv.x - min.x) * invScale.x + 0.5f),
+			    v = floorToInt((uv.y - min.y) * invScale.y + 0.5f);
+			u = std::max(0, std::min(0xFFFF, u));
+			v = std::max(0, std::min(0xFFFF, v));
+			m_packedTexcoords[i] = (uint32_t) u | ((uint32_t) v << 16);
+		}
+		delete[] m_texcoords;
+		m_texcoords = NULL;
+		before += sizeof(Point2) * m_vertexCount;
+		after += sizeof(uint32_t) * m_vertexCount;
+	}
+
+	if (m_colors) {
+		m_packedColors = new uint32_t[m_vertexCount];
+		#pragma omp parallel for schedule(static)
+		for (int i=0; i<vertexCount; ++i)
+			m_packedColors[i] = packColor(m_colors[i]);
+		delete[] m_colors;
+		m_colors = NULL;
+		before += sizeof(Spectrum) * m_vertexCount;
+		after += sizeof(uint32_t) * m_vertexCount;
+	}
+
+	if (before > 0)
+		Log(EDebug, "\"%s\": compacted the vertex attributes (%s -> %s)",
+			m_name.c_str(), memString(before).c_str(), memString(after).c_str());
+}
+
 ref<TriMesh> TriMesh::createTriMesh() {
 	return this;
 }
@@ -675,14 +1003,19 @@ ref<TriMesh> TriMesh::createTriMesh() {
 void TriMesh::serialize(Stream *stream, InstanceManager *manager) const {
 	Shape::serialize(stream, manager);
 	uint32_t flags = 0;
-	if (m_normals)
+	if (hasVertexNormals())
 		flags |= EHasNormals;
-	if (m_texcoords)
+	if (hasVertexTexcoords())
 		flags |= EHasTexcoords;
-	if (m_colors)
+	if (hasVertexColors())
 		flags |= EHasColors;
 	if (m_faceNormals)
 		flags |= EFaceNormals;
+	if (hasCompactAttributes()) {
+		flags |= ECompactStorage;
+		if (m_tangents)
+			flags |= EHasTangents;
+	}
 	stream->writeString(m_name);
 	m_aabb.serialize(stream);
 	stream->writeUInt(flags);
@@ -691,15 +1024,30 @@ void TriMesh::serialize(Stream *stream, InstanceManager *manager) const {
 
 	stream->writeFloatArray(reinterpret_cast<Float *>(m_positions), 
 		m_vertexCount * sizeof(Point)/sizeof(Float));
-	if (m_normals)
-		stream->writeFloatArray(reinterpret_cast<Float *>(m_normals), 
-			m_vertexCount * sizeof(Normal)/sizeof(Float));
-	if (m_texcoords)
-		stream->writeFloatArray(reinterpret_cast<Float *>(m_texcoords), 
-			m_vertexCount * sizeof(Point2)/sizeof(Float));
-	if (m_colors)
-		stream->writeFloatArray(reinterpret_cast<Float *>(m_colors), 
-			m_vertexCount * sizeof(Spectrum)/sizeof(Float));
+	if (hasCompactAttributes()) {
+		if (m_packedNormals)
+			stream->writeUIntArray(m_packedNormals, m_vertexCount);
+		if (m_packedTexcoords) {
+			m_texcoordOffset.serialize(stream);
+			m_texcoordScale.serialize(stream);
+			stream->writeUIntArray(m_packedTexcoords, m_vertexCount);
+		}
+		if (m_packedColors)
+			stream->writeUIntArray(m_packedColors, m_vertexCount);
+		if (m_tangents)
+			stream->writeFloatArray(reinterpret_cast<Float *>(m_tangents), 
+				m_vertexCount * sizeof(TangentSpace)/sizeof(Float));
+	} else {
+		if (m_normals)
+			stream->writeFloatArray(reinterpret_cast<Float *>(m_normals), 
+				m_vertexCount * sizeof(Normal)/sizeof(Float));
+		if (m_texcoords)
+			stream->writeFloatArray(reinterpret_cast<Float *>(m_texcoords), 
+				m_vertexCount * sizeof(Point2)/sizeof(Float));
+		if (m_colors)
+			stream->writeFloatArray(reinterpret_cast<Float *>(m_colors), 
+				m_vertexCount * sizeof(Spectrum)/sizeof(Float));
+	}
 	stream->writeUIntArray(reinterpret_cast<uint32_t *>(m_triangles), 
 		m_triangleCount * sizeof(Triangle)/sizeof(uint32_t));
 }
@@ -714,16 +1062,17 @@ void TriMesh::writeOBJ(const fs::path &path) const {
 			<< m_positions[i].z << endl;
 	}
 
-	if (m_normals) {
+	if (hasVertexNormals()) {
 		for (size_t i=0; i<m_vertexCount; ++i) {
+			Normal n = getVertexNormal(i);
 			os << "vn " 
-				<< m_normals[i].x << " "
-				<< m_normals[i].y << " "
-				<< m_normals[i].z << endl;
+				<< n.x << " "
+				<< n.y << " "
+				<< n.z << endl;
 		}
 	}
 
-	if (m_normals) {
+	if (hasVertexNormals()) {
 		for (size_t i=0; i<m_triangleCount; ++i) {
 			os << "f " 
 				<< m_triangles[i].idx[0] + 1 << "//" 
@@ -745,49 +1094,105 @@ void TriMesh::writeOBJ(const fs::path &path) const {
 	os.close();
 }
 
-void TriMesh::serialize(Stream *_stream) const {
-	ref<Stream> stream = _stream;
-
+void TriMesh::serialize(Stream *stream, ECompressionMode mode) const {
 	if (stream->getByteOrder() != Stream::ELittleEndian) 
 		Log(EError, "Tried to unserialize a shape from a stream, "
 			"which was not previously set to little endian byte order!");
 
-	stream->writeShort(MTS_FILEFORMAT_HEADER);
-	stream->writeShort(MTS_FILEFORMAT_VERSION_V3);
-	stream = new ZStream(stream);
-
 #if defined(SINGLE_PRECISION)
 	uint32_t flags = ESinglePrecision;
+	bool doublePrecision = false;
 #else
 	uint32_t flags = EDoublePrecision;
+	bool doublePrecision = true;
 #endif
 
-	if (m_normals)
+	/* Compact attributes are written in full precision */
+	std::vector<Normal> normals;
+	std::vector<Point2> texcoords;
+	std::vector<Spectrum> colors;
+	if (m_packedNormals && m_vertexCount > 0) {
+		normals.resize(m_vertexCount);
+		for (size_t i=0; i<m_vertexCount; ++i)
+			normals[i] = getVertexNormal(i);
+	}
+	if (m_packedTexcoords && m_vertexCount > 0) {
+		texcoords.resize(m_vertexCount);
+		for (size_t i=0; i<m_vertexCount; ++i)
+			texcoords[i] = getVertexTexcoord(i);
+	}
+	if (m_packedColors && m_vertexCount > 0) {
+		colors.resize(m_vertexCount);
+		for (size_t i=0; i<m_vertexCount; ++i)
+			colors[i] = getVertexColor(i);
+	}
+
+	std::vector<SerializedArray> arrays;
+	arrays.push_back(SerializedArray(m_positions, m_vertexCount * sizeof(Point)/sizeof(Float), true));
+	if (hasVertexNormals()) {
 		flags |= EHasNormals;
-	if (m_texcoords)
+		arrays.push_back(SerializedArray(normals.empty() ? m_normals : &normals[0],
+			m_vertexCount * sizeof(Normal)/sizeof(Float), true));
+	}
+	if (hasVertexTexcoords()) {
 		flags |= EHasTexcoords;
-	if (m_colors)
+		arrays.push_back(SerializedArray(texcoords.empty() ? m_texcoords : &texcoords[0],
+			m_vertexCount * sizeof(Point2)/sizeof(Float), true));
+	}
+	if (hasVertexColors()) {
 		flags |= EHasColors;
+		arrays.push_back(SerializedArray(colors.empty() ? m_colors : &colors[0],
+			m_vertexCount * sizeof(Spectrum)/sizeof(Float), true));
+	}
+	arrays.push_back(SerializedArray(m_triangles, m_triangleCount * sizeof(Triangle)/sizeof(uint32_t), false));
 	if (m_faceNormals)
 		flags |= EFaceNormals;
+	if (mode == EUncompressed)
+		flags |= ENoCompression;
+
+	/* Encode the blocks in parallel */
+	std::vector<SerializedBlock> blocks = getSerializedBlocks(arrays, doublePrecision);
+	std::vector<ref<MemoryStream> > blockData(blocks.size());
+
+	#pragma omp parallel for schedule(dynamic)
+	for (int i=0; i<(int) blocks.size(); ++i) {
+		const SerializedBlock &block = blocks[i];
+		const SerializedArray &array = arrays[block.array];
+		ref<MemoryStream> mstream = new MemoryStream(mode == ECompressed
+			? block.size / 2 + 1024 : block.size);
+		mstream->setByteOrder(Stream::ELittleEndian);
+		ref<Stream> blockStream = mstream.get();
+		if (mode == ECompressed) {
+			blockStream = new ZStream(mstream);
+			blockStream->setByteOrder(Stream::ELittleEndian);
+		}
+		if (array.isFloat)
+			blockStream->writeFloatArray(static_cast<Float *>(array.data) + block.start, block.count);
+		else
+			blockStream->writeUIntArray(static_cast<uint32_t *>(array.data) + block.start, block.count);
+		/* Releasing the compression stream flushes it */
+		blockStream = NULL;
+		blockData[i] = mstream;
+	}
+
+	/* Header, block table, and payload */
+	uint64_t offset = 2*sizeof(short) + 2*sizeof(uint32_t) + 2*sizeof(uint64_t)
+		+ blocks.size() * (sizeof(uint64_t) + 2*sizeof(uint32_t));
 
+	stream->writeShort(MTS_FILEFORMAT_HEADER);
+	stream->writeShort(MTS_FILEFORMAT_VERSION_V4);
 	stream->writeUInt(flags);
 	stream->writeSize(m_vertexCount);
 	stream->writeSize(m_triangleCount);
-
-	stream->writeFloatArray(reinterpret_cast<Float *>(m_positions), 
-		m_vertexCount * sizeof(Point)/sizeof(Float));
-	if (m_normals)
-		stream->writeFloatArray(reinterpret_cast<Float *>(m_normals), 
-			m_vertexCount * sizeof(Normal)/sizeof(Float));
-	if (m_texcoords)
-		stream->writeFloatArray(reinterpret_cast<Float *>(m_texcoords), 
-			m_vertexCount * sizeof(Point2)/sizeof(Float));
-	if (m_colors)
-		stream->writeFloatArray(reinterpret_cast<Float *>(m_colors), 
-			m_vertexCount * sizeof(Spectrum)/sizeof(Float));
-	stream->writeUIntArray(reinterpret_cast<uint32_t *>(m_triangles), 
-		m_triangleCount * sizeof(Triangle)/sizeof(uint32_t));
+	stream->writeUInt((uint32_t) blocks.size());
+	for (size_t i=0; i<blocks.size(); ++i) {
+		stream->writeULong(offset);
+		stream->writeUInt((uint32_t) blockData[i]->getSize());
+		stream->writeUInt(blocks[i].size);
+		offset += blockData[i]->getSize();
+	}
+	for (size_t i=0; i<blocks.size(); ++i)
+		stream->write(blockData[i]->getData(), blockData[i]->getSize());
 }
 
 std::string TriMesh::toString() const {
@@ -797,10 +1202,11 @@ std::string TriMesh::toString() const {
 		<< "  triangleCount = " << m_triangleCount << "," << endl
 		<< "  vertexCount = " << m_vertexCount << "," << endl
 		<< "  faceNormals = " << (m_faceNormals ? "true" : "false") << "," << endl
-		<< "  hasNormals = " << (m_normals ? "true" : "false") << "," << endl
-		<< "  hasTexcoords = " << (m_texcoords ? "true" : "false") << "," << endl
+		<< "  hasNormals = " << (hasVertexNormals() ? "true" : "false") << "," << endl
+		<< "  hasTexcoords = " << (hasVertexTexcoords() ? "true" : "false") << "," << endl
 		<< "  hasTangents = " << (m_tangents ? "true" : "false") << "," << endl
-		<< "  hasColors = " << (m_colors ? "true" : "false") << "," << endl
+		<< "  hasColors = " << (hasVertexColors() ? "true" : "false") << "," << endl
+		<< "  compactAttributes = " << (hasCompactAttributes() ? "true" : "false") << "," << endl
 		<< "  surfaceArea = " << m_surfaceArea << "," << endl
 		<< "  aabb = " << m_aabb.toString() << "," << endl
 		<< "  bsdf = " << indent(m_bsdf.toString()) << "," << endl
@@ -25,6 +25,37 @@
 
 MTS_NAMESPACE_BEGIN
 
+MajorantGrid::MajorantGrid(const Vector3i &res, const Transform &worldToGrid)
+	: m_res(res), m_worldToGrid(worldToGrid) {
+	size_t cellCount = (size_t) res.x * (size_t) res.y * (size_t) res.z;
+	m_min.resize(cellCount, 0.0f);
+	m_max.resize(cellCount, 0.0f);
+}
+
+Float MajorantGrid::getMaximum() const {
+	float result = 0;
+	for (size_t i=0; i<m_max.size(); ++i)
+		result = std::max(result, m_max[i]);
+	return (Float) result;
+}
+
+Float MajorantGrid::getEmptyFraction() const {
+	size_t empty = 0;
+	for (size_t i=0; i<m_max.size(); ++i)
+		empty += m_max[i] == 0 ? 1 : 0;
+	return m_max.size() > 0 ? empty / (Float) m_max.size() : (Float) 0;
+}
+
+std::string MajorantGrid::toString() const {
+	std::ostringstream oss;
+	oss << "MajorantGrid[" << endl
+		<< "  res = " << m_res.toString() << "," << endl
+		<< "  maximum = " << getMaximum() << "," << endl
+		<< "  emptyFraction = " << getEmptyFraction() << endl
+		<< "]";
+	return oss.str();
+}
+
 VolumeDataSource::VolumeDataSource(Stream *stream, InstanceManager *manager) :
 	ConfigurableObject(stream, manager) {
 	m_aabb = AABB(stream);
@@ -66,6 +97,15 @@ bool VolumeDataSource::supportsVectorLookups() const {
 	return false;
 }
 
+Float VolumeDataSource::getLocalMaximumFloatValue(const AABB &aabb) const {
+	return getMaximumFloatValue();
+}
+
+const MajorantGrid *VolumeDataSource::getMajorantGrid() const {
+	return NULL;
+}
+
+MTS_IMPLEMENT_CLASS(MajorantGrid, false, Object)
 MTS_IMPLEMENT_CLASS(VolumeDataSource, true, ConfigurableObject)
 MTS_NAMESPACE_END
 
@@ -59,6 +59,59 @@ public:
 		return m_intensity * m_shape->getSurfaceArea() * M_PI;
 	}
 
+	bool getBounds(LuminaireBounds &bounds) const {
+		bounds.aabb = m_shape->getAABB();
+		bounds.axis = Vector(0, 0, 1);
+		bounds.thetaO = M_PI;
+		bounds.thetaE = M_PI / 2;
+		if (!m_shape->getClass()->derivesFrom(MTS_CLASS(TriMesh)))
+			return true;
+
+		/* Bound the normals of the mesh by a cone around their
+		   area-weighted average. Interpolated shading normals stay 
+		   inside of the cone as long as it is convex. */
+		const TriMesh *mesh = static_cast<const TriMesh *>(m_shape);
+		const Triangle *triangles = mesh->getTriangles();
+		const Point *positions = mesh->getVertexPositions();
+		size_t triangleCount = mesh->getTriangleCount(),
+			   vertexCount = mesh->getVertexCount();
+		bool hasNormals = mesh->hasVertexNormals();
+
+		Vector axis(0.0f);
+		for (size_t i=0; i<triangleCount; ++i) {
+			const Triangle &tri = triangles[i];
+			axis += cross(positions[tri.idx[1]] - positions[tri.idx[0]],
+				positions[tri.idx[2]] - positions[tri.idx[0]]);
+		}
+		if (hasNormals) {
+			for (size_t i=0; i<vertexCount; ++i)
+				axis += Vector(mesh->getVertexNormal(i));
+		}
+		if (axis.isZero())
+			return true;
+		axis = normalize(axis);
+
+		Float thetaO = 0;
+		for (size_t i=0; i<triangleCount; ++i) {
+			const Triangle &tri = triangles[i];
+			Vector n = cross(positions[tri.idx[1]] - positions[tri.idx[0]],
+				positions[tri.idx[2]] - positions[tri.idx[0]]);
+			if (!n.isZero())
+				thetaO = std::max(thetaO, unitAngle(axis, normalize(n)));
+		}
+		if (hasNormals) {
+			for (size_t i=0; i<vertexCount; ++i)
+				thetaO = std::max(thetaO, unitAngle(axis, 
+					normalize(Vector(mesh->getVertexNormal(i)))));
+		}
+
+		if (thetaO < M_PI / 2) {
+			bounds.axis = axis;
+			bounds.thetaO = thetaO;
+		}
+		return true;
+	}
+
 	Spectrum Le(const ShapeSamplingRecord &sRec, const Vector &d) const {
 		if (dot(d, sRec.n) <= 0)
 			return Spectrum(0.0f);
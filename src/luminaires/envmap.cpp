@@ -30,10 +30,18 @@
 MTS_NAMESPACE_BEGIN
 
 /**
- * Basic environment map implementation without importance sampling.
- * Uses the scene's bounding sphere to simulate an infinitely far-away
- * light source. Expects an EXR image in latitude-longitude 
- * (equirectangular) format.
+ * Environment map implementation, which importance samples the 
+ * luminance of the map. Uses the scene's bounding sphere to simulate an 
+ * infinitely far-away light source. Expects an EXR image in 
+ * latitude-longitude (equirectangular) format.
+ *
+ * The sampling density is built from the mip map level \c samplingLevel
+ * (default: 3, i.e. 1/8th of the resolution). By default, it is sampled
+ * using a single \ref DiscretePDF over all pixels. Setting \c sampling
+ * to \c "hierarchical" instead selects a hierarchical warp
+ * (\ref HierarchicalPDF2D). Tiles of that density, whose average is less
+ * than \c pruneThreshold times the global average (default: 0) are 
+ * sampled uniformly to save memory.
  */
 class EnvMapLuminaire : public Luminaire {
 public:
@@ -44,6 +52,17 @@ public:
 		ref<Stream> is = new FileStream(m_path, FileStream::EReadOnly);
 		ref<Bitmap> bitmap = new Bitmap(Bitmap::EEXR, is);
 
+		std::string sampling = props.getString("sampling", "cdf");
+		if (sampling == "hierarchical")
+			m_hierarchical = true;
+		else if (sampling == "cdf")
+			m_hierarchical = false;
+		else
+			Log(EError, "Unknown sampling method '%s' -- must be "
+				"'hierarchical' or 'cdf'!", sampling.c_str());
+		m_samplingLevel = props.getInteger("samplingLevel", 3);
+		m_pruneThreshold = props.getFloat("pruneThreshold", 0.0f);
+
 		m_mipmap = MIPMap::fromBitmap(bitmap);
 		m_average = m_mipmap->triangle(m_mipmap->getLevels()-1, 0, 0) * m_intensityScale;
 		m_type = EOnSurface;
@@ -54,6 +73,9 @@ public:
 		m_intensityScale = stream->readFloat();
 		m_path = stream->readString();
 		m_bsphere = BSphere(stream);
+		m_hierarchical = stream->readBool();
+		m_samplingLevel = stream->readInt();
+		m_pruneThreshold = stream->readFloat();
 		Log(EInfo, "Unserializing environment map \"%s\"", m_path.leaf().c_str());
 		uint32_t size = stream->readUInt();
 		ref<MemoryStream> mStream = new MemoryStream(size);
@@ -81,6 +103,9 @@ public:
 		stream->writeFloat(m_intensityScale);
 		stream->writeString(m_path.file_string());
 		m_bsphere.serialize(stream);
+		stream->writeBool(m_hierarchical);
+		stream->writeInt(m_samplingLevel);
+		stream->writeFloat(m_pruneThreshold);
 
 		if (m_stream.get()) {
 			stream->writeUInt((unsigned int) m_stream->getSize());
@@ -93,22 +118,34 @@ public:
 	}
 
 	void configure() {
-		int mipMapLevel = std::min(3, m_mipmap->getLevels()-1);
+		int mipMapLevel = std::max(0, std::min(m_samplingLevel, m_mipmap->getLevels()-1));
 		m_pdfResolution = m_mipmap->getLevelResolution(mipMapLevel);
 		m_pdfInvResolution = Vector2(1.0f / m_pdfResolution.x, 1.0f / m_pdfResolution.y);
 
 		Log(EDebug, "Creating a %ix%i sampling density", m_pdfResolution.x, m_pdfResolution.y);
 		const Spectrum *coarseImage = m_mipmap->getImageData(mipMapLevel);
+		std::vector<Float> weights(m_pdfResolution.x * m_pdfResolution.y);
 		int index = 0;
-		m_pdf = DiscretePDF(m_pdfResolution.x * m_pdfResolution.y);
 		for (int y=0; y<m_pdfResolution.y; ++y) {
 			float sinFactor = std::sin(M_PI * (y + .5f) / m_pdfResolution.y);
 
 			for (int x=0; x<m_pdfResolution.x; ++x)
-				m_pdf[index++] = coarseImage[x + y * m_pdfResolution.x].getLuminance() * sinFactor;
+				weights[index++] = coarseImage[x + y * m_pdfResolution.x].getLuminance() * sinFactor;
 		}
 		m_pdfPixelSize = Vector2(2 * M_PI / m_pdfResolution.x, M_PI / m_pdfResolution.y);
-		m_pdf.build();
+
+		if (m_hierarchical) {
+			m_pdf = DiscretePDF();
+			m_hpdf.build(&weights[0], m_pdfResolution.x, m_pdfResolution.y, m_pruneThreshold);
+			Log(EDebug, "Hierarchical sampling density: %s, %.1f%% of the tiles are pruned",
+				memString(m_hpdf.getMemoryUsage()).c_str(), m_hpdf.getPrunedFraction() * 100);
+		} else {
+			m_hpdf = HierarchicalPDF2D();
+			m_pdf = DiscretePDF(weights.size());
+			for (size_t i=0; i<weights.size(); ++i)
+				m_pdf[i] = weights[i];
+			m_pdf.build();
+		}
 	}
 
 	void preprocess(const Scene *scene) {
@@ -138,10 +175,16 @@ public:
 		value = Le(-d);
 		return d;
 #else
-		int idx = m_pdf.sampleReuse(sample.x, pdf);
-		int row = idx / m_pdfResolution.x;
-		int col = idx - m_pdfResolution.x * row;
-		Float x = col + sample.x, y = row + sample.y;
+		Float x, y;
+		if (m_hierarchical) {
+			Point2 pos = m_hpdf.sample(sample, pdf);
+			x = pos.x; y = pos.y;
+		} else {
+			int idx = m_pdf.sampleReuse(sample.x, pdf);
+			int row = idx / m_pdfResolution.x;
+			int col = idx - m_pdfResolution.x * row;
+			x = col + sample.x; y = row + sample.y;
+		}
 		value = m_mipmap->triangle(0, x * m_pdfInvResolution.x, y * m_pdfInvResolution.y) 
 			* m_intensityScale;
 		Float theta = m_pdfPixelSize.y * y, phi = m_pdfPixelSize.x * x - M_PI;
@@ -191,7 +234,8 @@ public:
 		int xPos = std::min(std::max((int) std::floor(x), 0), m_pdfResolution.x-1);
 		int yPos = std::min(std::max((int) std::floor(y), 0), m_pdfResolution.y-1);
 
-		Float pdf = m_pdf[xPos + yPos * m_pdfResolution.x];
+		Float pdf = m_hierarchical ? m_hpdf.pdf(xPos, yPos) 
+			: m_pdf[xPos + yPos * m_pdfResolution.x];
 		Float sinTheta = std::sqrt(std::max((Float) Epsilon, 1-d.y*d.y));
 
 		return pdf / (m_pdfPixelSize.x * m_pdfPixelSize.y * sinTheta);
@@ -322,6 +366,9 @@ public:
 			<< "  name = \"" << m_name << "\"," << std::endl
 			<< "  path = \"" << m_path << "\"," << std::endl
 			<< "  intensityScale = " << m_intensityScale << "," << std::endl
+			<< "  sampling = " << (m_hierarchical ? "hierarchical" : "cdf") << "," << std::endl
+			<< "  samplingLevel = " << m_samplingLevel << "," << std::endl
+			<< "  pruneThreshold = " << m_pruneThreshold << "," << std::endl
 			<< "  power = " << getPower().toString() << "," << std::endl
 			<< "  bsphere = " << m_bsphere.toString() << std::endl
 			<< "]";
@@ -341,6 +388,10 @@ private:
 	ref<MIPMap> m_mipmap;
 	ref<MemoryStream> m_stream;
 	DiscretePDF m_pdf;
+	HierarchicalPDF2D m_hpdf;
+	bool m_hierarchical;
+	int m_samplingLevel;
+	Float m_pruneThreshold;
 	Vector2i m_pdfResolution;
 	Vector2 m_pdfInvResolution;
 	Vector2 m_pdfPixelSize;
@@ -47,6 +47,14 @@ public:
 		return m_intensity * 4 * M_PI;
 	}
 
+	bool getBounds(LuminaireBounds &bounds) const {
+		bounds.aabb = AABB(m_position);
+		bounds.axis = Vector(0, 0, 1);
+		bounds.thetaO = M_PI;
+		bounds.thetaE = M_PI / 2;
+		return true;
+	}
+
 	Float pdf(const Point &p, const LuminaireSamplingRecord &lRec, bool delta) const {
 		/* PDF is a delta function - zero probability when a sample point was not
 		   generated using sample() */
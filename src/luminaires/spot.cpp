@@ -84,6 +84,14 @@ public:
         return radToDeg(m_cutoffAngle);
     }
 
+	bool getBounds(LuminaireBounds &bounds) const {
+		bounds.aabb = AABB(m_position);
+		bounds.axis = normalize(m_luminaireToWorld(Vector(0, 0, 1)));
+		bounds.thetaO = 0;
+		bounds.thetaE = m_cutoffAngle;
+		return true;
+	}
+
 	inline Spectrum falloffCurve(const Vector &d, bool throughputOnly = false) const {
 		Spectrum result(throughputOnly ? Spectrum(1.0f) : m_intensity);
 		Vector localDir = m_worldToLuminaire(d);
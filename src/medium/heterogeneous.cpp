@@ -42,8 +42,21 @@ static StatsCounter avgRayMarchingStepsSampling("Heterogeneous volume",
 		"Avg. # of ray marching steps (sampling)", EAverage);
 static StatsCounter earlyExits("Heterogeneous volume", 
 		"Number of early exits", EPercentage);
+static StatsCounter majorantViolations("Heterogeneous volume", 
+		"Lookups exceeding the local majorant", EPercentage);
 #endif
 
+static StatsCounter avgLookupsSampling("Heterogeneous volume", 
+		"Avg. # of density lookups per ray (sampling)", EAverage);
+static StatsCounter avgLookupsTransmittance("Heterogeneous volume", 
+		"Avg. # of density lookups per ray (transmittance)", EAverage);
+
+/// Default resolution of majorant grids along the longest axis
+#define HETVOL_MAJORANT_RESOLUTION 32
+
+/// Russian roulette threshold of the ratio tracking weight
+#define HETVOL_RATIO_RR_THRESHOLD 0.1f
+
 /**
  * Flexible heterogeneous medium implementation, which acquires its data from 
  * nested \ref Volume instances. These can be constant, use a procedural 
@@ -63,6 +76,19 @@ static StatsCounter earlyExits("Heterogeneous volume",
  * which contains local particle orientation that will be passed to
  * scattering models such as a the Micro-flake or Kajiya-Kay phase functions.
  *
+ * When the density volume provides a \ref MajorantGrid (e.g. the sparse 
+ * grid data source), Woodcock tracking traverses its cells using a 3D-DDA
+ * and samples tentative collisions using the local majorant of every cell.
+ * Empty cells are skipped without performing any density lookups.
+ *
+ * The 'ratio' integration method always works with local majorants: 
+ * if the density volume does not provide a majorant grid, a coarse one
+ * (\c majorantResolution cells along the longest axis) is built from
+ * conservative per-cell bounds reported by the volume. Distances are 
+ * sampled using the same DDA-based delta tracking, while transmittances
+ * are estimated using ratio tracking, which has much lower variance than
+ * the binary estimates produced by Woodcock tracking.
+ *
  * \author Wenzel Jakob
  */
 class HeterogeneousMedium : public Medium {
@@ -80,7 +106,15 @@ public:
 		 * faster and more robust, but has the disadvantage of being
 		 * incompatible with bidirectional rendering methods.
 		 */
-		EWoodcockTracking
+		EWoodcockTracking,
+
+		/**
+		 * \brief Use delta tracking with local majorants to sample
+		 * scattering locations and ratio tracking to compute 
+		 * transmittances. Like Woodcock tracking, this is incompatible
+		 * with bidirectional rendering methods.
+		 */
+		ERatioTracking
 	};
 
 	HeterogeneousMedium(const Properties &props) 
@@ -96,8 +130,15 @@ public:
 			m_method = EWoodcockTracking;
 		else if (method == "simpson")
 			m_method = ESimpsonQuadrature;
+		else if (method == "ratio")
+			m_method = ERatioTracking;
 		else
 			Log(EError, "Unsupported integration method \"%s\"!", method.c_str());
+
+		/* Resolution of the majorant grid used by the 'ratio' method
+		   along the longest axis (when not provided by the density) */
+		m_majorantResolution = props.getInteger("majorantResolution", 
+			HETVOL_MAJORANT_RESOLUTION);
 	}
 
 	/* Unserialize from a binary data stream */
@@ -108,6 +149,7 @@ public:
 		m_albedo = static_cast<VolumeDataSource *>(manager->getInstance(stream));
 		m_orientation = static_cast<VolumeDataSource *>(manager->getInstance(stream));
 		m_stepSize = stream->readFloat();
+		m_majorantResolution = stream->readInt();
 		configure();
 	}
 
@@ -119,6 +161,7 @@ public:
 		manager->serialize(stream, m_albedo.get());
 		manager->serialize(stream, m_orientation.get());
 		stream->writeFloat(m_stepSize);
+		stream->writeInt(m_majorantResolution);
 	}
 
 	void configure() {
@@ -138,6 +181,15 @@ public:
 			m_maxDensity *= m_phaseFunction->sigmaDirMax();
 		m_invMaxDensity = 1.0f/m_maxDensity;
 
+		m_majorants = m_density->getMajorantGrid();
+		if (m_majorants == NULL && m_method == ERatioTracking) {
+			m_ownMajorants = buildMajorantGrid();
+			m_majorants = m_ownMajorants.get();
+		}
+		m_majorantScale = m_densityMultiplier;
+		if (m_anisotropicMedium)
+			m_majorantScale *= m_phaseFunction->sigmaDirMax();
+
 		if (m_stepSize == 0) {
 			m_stepSize = std::min(
 				m_density->getStepSize(), m_albedo->getStepSize());
@@ -444,9 +496,6 @@ public:
 		if (m_method == ESimpsonQuadrature || sampler == NULL) {
 			return Spectrum(std::exp(-integrateDensity(ray)));
 		} else {
-			/* When Woodcock tracking is selected as the sampling method,
-			   we can use this method to get a noisy estimate of 
-			   the transmittance */
 			Float mint, maxt;
 			if (!m_densityAABB.rayIntersect(ray, mint, maxt))
 				return Spectrum(1.0f);
@@ -456,30 +505,51 @@ public:
 			#if defined(HETVOL_STATISTICS)
 				avgRayMarchingStepsTransmittance.incrementBase();
 			#endif
-			int nSamples = 2; /// XXX make configurable
+			size_t lookups = 0;
 			Float result = 0;
 
-			for (int i=0; i<nSamples; ++i) {
-				Float t = mint;
-				while (true) {
-					t -= std::log(1-sampler->next1D()) * m_invMaxDensity;
-					if (t >= maxt) {
-						result += 1;
-						break;
+			if (m_method == ERatioTracking) {
+				result = ratioTracking(ray, mint, maxt, sampler, lookups);
+			} else {
+				/* When Woodcock tracking is selected as the sampling method,
+				   we can use this method to get a noisy estimate of 
+				   the transmittance */
+				int nSamples = 2; /// XXX make configurable
+
+				for (int i=0; i<nSamples; ++i) {
+					if (m_majorants) {
+						Float t, densityAtT;
+						if (!deltaTracking(ray, mint, maxt, sampler, t, densityAtT, lookups))
+							result += 1;
+						continue;
 					}
-				
-					Point p = ray(t);
-					Float density = lookupDensity(p, ray.d) * m_densityMultiplier;
-					
-					#if defined(HETVOL_STATISTICS)
-						++avgRayMarchingStepsTransmittance;
-					#endif
 
-					if (density * m_invMaxDensity > sampler->next1D()) 
-						break;
+					Float t = mint;
+					while (true) {
+						t -= std::log(1-sampler->next1D()) * m_invMaxDensity;
+						if (t >= maxt) {
+							result += 1;
+							break;
+						}
+					
+						Point p = ray(t);
+						Float density = lookupDensity(p, ray.d) * m_densityMultiplier;
+						++lookups;
+						
+						#if defined(HETVOL_STATISTICS)
+							++avgRayMarchingStepsTransmittance;
+						#endif
+
+						if (density * m_invMaxDensity > sampler->next1D()) 
+							break;
+					}
 				}
+				result /= nSamples;
 			}
-			return Spectrum(result/nSamples);
+
+			avgLookupsTransmittance += lookups;
+			avgLookupsTransmittance.incrementBase();
+			return Spectrum(result);
 		}
 	}
 
@@ -526,30 +596,41 @@ public:
 			maxt = std::min(maxt, ray.maxt);
 
 			Float t = mint, densityAtT = 0;
-			while (true) {
-				t -= std::log(1-sampler->next1D()) * m_invMaxDensity;
-				if (t >= maxt)
-					break;
+			size_t lookups = 0;
+			if (m_majorants) {
+				success = deltaTracking(ray, mint, maxt, sampler, t, densityAtT, lookups);
+			} else {
+				while (true) {
+					t -= std::log(1-sampler->next1D()) * m_invMaxDensity;
+					if (t >= maxt)
+						break;
 
-				Point p = ray(t);
-				densityAtT = lookupDensity(p, ray.d) * m_densityMultiplier;
-				#if defined(HETVOL_STATISTICS)
-					++avgRayMarchingStepsSampling;
-				#endif
-				if (densityAtT * m_invMaxDensity > sampler->next1D()) {
-					mRec.t = t;
-					mRec.p = p;
-					Spectrum albedo = m_albedo->lookupSpectrum(p);
-					mRec.sigmaS = albedo * densityAtT;
-					mRec.sigmaA = Spectrum(densityAtT) - mRec.sigmaS;
-					mRec.albedo = albedo.max();
-					mRec.transmittance = albedo/mRec.sigmaS;
-					mRec.orientation = m_orientation != NULL 
-						? m_orientation->lookupVector(p) : Vector(0.0f);
-					success = true;
-					break;
+					densityAtT = lookupDensity(ray(t), ray.d) * m_densityMultiplier;
+					++lookups;
+					#if defined(HETVOL_STATISTICS)
+						++avgRayMarchingStepsSampling;
+					#endif
+					if (densityAtT * m_invMaxDensity > sampler->next1D()) {
+						success = true;
+						break;
+					}
 				}
 			}
+			avgLookupsSampling += lookups;
+			avgLookupsSampling.incrementBase();
+
+			if (success) {
+				Point p = ray(t);
+				mRec.t = t;
+				mRec.p = p;
+				Spectrum albedo = m_albedo->lookupSpectrum(p);
+				mRec.sigmaS = albedo * densityAtT;
+				mRec.sigmaA = Spectrum(densityAtT) - mRec.sigmaS;
+				mRec.albedo = albedo.max();
+				mRec.transmittance = albedo/mRec.sigmaS;
+				mRec.orientation = m_orientation != NULL 
+					? m_orientation->lookupVector(p) : Vector(0.0f);
+			}
 		}
 
 		return success && mRec.pdfSuccess > 0;
@@ -588,6 +669,251 @@ public:
 
 	MTS_DECLARE_CLASS()
 protected:
+	/**
+	 * \brief 3D-DDA traversal of the cells of a majorant grid
+	 * along a ray segment
+	 */
+	struct MajorantIterator {
+		/// Prepare a traversal of the segment <tt>[mint, maxt]</tt>
+		MajorantIterator(const MajorantGrid *grid, const Ray &ray, 
+				Float mint, Float maxt) : m_grid(grid), m_mint(mint) {
+			const Vector3i &res = grid->getResolution();
+			const Transform &worldToGrid = grid->getWorldToGrid();
+
+			/* Grid-space ray, which is parameterized relative to 'mint'. The
+			   direction is not normalized, hence distances are preserved */
+			const Point o = worldToGrid.transformAffine(ray(mint));
+			const Vector d = worldToGrid(ray.d);
+
+			Float tNear = 0;
+			m_tFar = maxt - mint;
+			for (int i=0; i<3; ++i) {
+				if (d[i] == 0) {
+					if (o[i] < 0 || o[i] > res[i])
+						m_tFar = -1;
+					continue;
+				}
+				Float invD = 1 / d[i],
+					  t0 = -o[i] * invD,
+					  t1 = (res[i] - o[i]) * invD;
+				if (t0 > t1)
+					std::swap(t0, t1);
+				tNear = std::max(tNear, t0);
+				m_tFar = std::min(m_tFar, t1);
+			}
+			m_done = !(tNear < m_tFar);
+			if (m_done)
+				return;
+
+			const Point p = o + d * tNear;
+			for (int i=0; i<3; ++i) {
+				m_cell[i] = std::min(std::max(floorToInt(p[i]), 0), res[i]-1);
+				if (d[i] > 0) {
+					m_step[i] = 1;
+					m_tDelta[i] = 1 / d[i];
+					m_tNext[i] = tNear + (m_cell[i] + 1 - p[i]) * m_tDelta[i];
+				} else if (d[i] < 0) {
+					m_step[i] = -1;
+					m_tDelta[i] = -1 / d[i];
+					m_tNext[i] = tNear + (p[i] - m_cell[i]) * m_tDelta[i];
+				} else {
+					m_step[i] = 0;
+					m_tDelta[i] = m_tNext[i] = std::numeric_limits<Float>::infinity();
+				}
+			}
+			m_t = tNear;
+		}
+
+		/**
+		 * \brief Advance to the next cell
+		 *
+		 * \param start
+		 *    Ray distance at which the cell is entered
+		 * \param end
+		 *    Ray distance at which the cell is left
+		 * \param maximum
+		 *    Upper bound of the density within the cell
+		 * \return \c false when the end of the segment has been reached
+		 */
+		inline bool next(Float &start, Float &end, Float &maximum) {
+			if (m_done)
+				return false;
+
+			const int axis = (m_tNext[0] < m_tNext[1])
+				? (m_tNext[0] < m_tNext[2] ? 0 : 2)
+				: (m_tNext[1] < m_tNext[2] ? 1 : 2);
+			const Float cellEnd = std::min(m_tNext[axis], m_tFar);
+
+			start = m_mint + m_t;
+			end = m_mint + cellEnd;
+			maximum = m_grid->getMaximum(m_grid->getCellIndex(
+				m_cell[0], m_cell[1], m_cell[2]));
+
+			m_t = cellEnd;
+			m_cell[axis] += m_step[axis];
+			m_tNext[axis] += m_tDelta[axis];
+			m_done = cellEnd >= m_tFar || m_cell[axis] < 0 
+				|| m_cell[axis] >= m_grid->getResolution()[axis];
+			return true;
+		}
+
+		const MajorantGrid *m_grid;
+		Float m_mint, m_t, m_tFar;
+		Float m_tNext[3], m_tDelta[3];
+		int m_cell[3], m_step[3];
+		bool m_done;
+	};
+
+	/**
+	 * \brief Delta tracking with local majorants
+	 *
+	 * Traverses the cells of the majorant grid along the ray segment
+	 * <tt>[mint, maxt]</tt> and samples tentative collisions using the
+	 * majorant of the current cell. Since the exponential distribution
+	 * is memoryless, sampling simply restarts at every cell boundary. 
+	 * Empty cells are skipped.
+	 *
+	 * \return \c true if a real collision was found, in which case
+	 * its distance and the density at that point are returned
+	 * in \c t and \c densityAtT.
+	 */
+	bool deltaTracking(const Ray &ray, Float mint, Float maxt, Sampler *sampler,
+			Float &t, Float &densityAtT, size_t &lookups) const {
+		MajorantIterator it(m_majorants, ray, mint, maxt);
+		Float start, end, majorant;
+		#if defined(HETVOL_STATISTICS)
+			size_t lookupsBefore = lookups;
+		#endif
+		bool success = false;
+
+		while (!success && it.next(start, end, majorant)) {
+			majorant *= m_majorantScale;
+			if (majorant <= 0)
+				continue;
+
+			const Float invMajorant = 1 / majorant;
+			t = start;
+			while (true) {
+				t -= std::log(1-sampler->next1D()) * invMajorant;
+				if (t >= end)
+					break;
+
+				densityAtT = lookupDensity(ray(t), ray.d) * m_densityMultiplier;
+				++lookups;
+				#if defined(HETVOL_STATISTICS)
+					++avgRayMarchingStepsSampling;
+					if (densityAtT > majorant)
+						++majorantViolations;
+				#endif
+				if (densityAtT * invMajorant > sampler->next1D()) {
+					success = true;
+					break;
+				}
+			}
+		}
+
+		#if defined(HETVOL_STATISTICS)
+			majorantViolations.incrementBase(lookups - lookupsBefore);
+		#endif
+		return success;
+	}
+
+	/**
+	 * \brief Ratio tracking with local majorants
+	 *
+	 * Returns an unbiased estimate of the transmittance along the ray 
+	 * segment <tt>[mint, maxt]</tt>. Instead of terminating at the first
+	 * tentative collision that turns out to be real, every collision 
+	 * multiplies the estimate by the probability of it being a null 
+	 * collision. Russian roulette terminates paths with a low weight.
+	 */
+	Float ratioTracking(const Ray &ray, Float mint, Float maxt, 
+			Sampler *sampler, size_t &lookups) const {
+		MajorantIterator it(m_majorants, ray, mint, maxt);
+		Float start, end, majorant, weight = 1;
+		#if defined(HETVOL_STATISTICS)
+			size_t lookupsBefore = lookups;
+		#endif
+
+		while (weight > 0 && it.next(start, end, majorant)) {
+			majorant *= m_majorantScale;
+			if (majorant <= 0)
+				continue;
+
+			const Float invMajorant = 1 / majorant;
+			Float t = start;
+			while (true) {
+				t -= std::log(1-sampler->next1D()) * invMajorant;
+				if (t >= end)
+					break;
+
+				Float density = lookupDensity(ray(t), ray.d) * m_densityMultiplier;
+				++lookups;
+				#if defined(HETVOL_STATISTICS)
+					++avgRayMarchingStepsTransmittance;
+					if (density > majorant)
+						++majorantViolations;
+				#endif
+				weight *= 1 - density * invMajorant;
+
+				if (weight < HETVOL_RATIO_RR_THRESHOLD) {
+					if (sampler->next1D() >= 0.5f) {
+						weight = 0;
+						break;
+					}
+					weight *= 2;
+				}
+			}
+		}
+
+		#if defined(HETVOL_STATISTICS)
+			majorantViolations.incrementBase(lookups - lookupsBefore);
+		#endif
+		return weight;
+	}
+
+	/**
+	 * \brief Build a coarse majorant grid over the density volume
+	 *
+	 * The bound of every cell is queried from the density volume (see
+	 * \ref VolumeDataSource::getLocalMaximumFloatValue()), which accounts
+	 * for all voxels that can influence lookups within the cell. For 
+	 * volumes that cannot provide tighter bounds, this is the global 
+	 * maximum, hence the resulting majorants are always conservative.
+	 */
+	ref<MajorantGrid> buildMajorantGrid() const {
+		const Vector extents = m_densityAABB.getExtents();
+		const Float cellSize = extents[m_densityAABB.getLargestAxis()] 
+			/ std::max(m_majorantResolution, 1);
+		Vector3i res;
+		for (int i=0; i<3; ++i)
+			res[i] = std::max(1, (int) std::ceil(extents[i] / cellSize - Epsilon));
+
+		ref<MajorantGrid> grid = new MajorantGrid(res, 
+			Transform::scale(Vector(res.x / extents.x, res.y / extents.y, res.z / extents.z))
+			* Transform::translate(-Vector(m_densityAABB.min)));
+
+		const int cellCount = res.x * res.y * res.z;
+		ref<Timer> timer = new Timer();
+
+		#pragma omp parallel for schedule(dynamic)
+		for (int i=0; i<cellCount; ++i) {
+			const int x = i % res.x, y = (i / res.x) % res.y, z = i / (res.x * res.y);
+			const int pos[3] = { x, y, z };
+			AABB cellAABB;
+			for (int j=0; j<3; ++j) {
+				Float width = extents[j] / res[j];
+				cellAABB.min[j] = m_densityAABB.min[j] + pos[j] * width;
+				cellAABB.max[j] = m_densityAABB.min[j] + (pos[j]+1) * width;
+			}
+			grid->setBounds(i, 0, m_density->getLocalMaximumFloatValue(cellAABB));
+		}
+
+		Log(EInfo, "Built a %ix%ix%i majorant grid in %i ms (%.1f%% of the cells are empty)",
+			res.x, res.y, res.z, timer->getMilliseconds(), grid->getEmptyFraction() * 100);
+		return grid;
+	}
+
 	inline Float lookupDensity(const Point &p, const Vector &d) const {
 		Float density = m_density->lookupFloat(p);
 		if (m_anisotropicMedium && density != 0) {
@@ -609,6 +935,10 @@ protected:
 	AABB m_densityAABB;
 	Float m_maxDensity;
 	Float m_invMaxDensity;
+	const MajorantGrid *m_majorants;
+	ref<MajorantGrid> m_ownMajorants;
+	Float m_majorantScale;
+	int m_majorantResolution;
 };
 
 MTS_IMPLEMENT_CLASS_S(HeterogeneousMedium, false, Medium)
@@ -27,6 +27,7 @@
 #include <mitsuba/core/statistics.h>
 #include <mitsuba/render/renderjob.h>
 #include <mitsuba/render/scenehandler.h>
+#include <mitsuba/render/texcache.h>
 #include <fstream>
 #include <stdexcept>
 
@@ -68,6 +69,8 @@ void help() {
 	cout <<  "   -r sec      Write (partial) output images every 'sec' seconds" << endl << endl;
 	cout <<  "   -b res      Specify the block resolution used to split images into parallel" << endl;
 	cout <<  "               workloads (default: 32). Only applies to some integrators." << endl << endl;
+	cout <<  "   -m MiB      Memory budget of the cache used by out-of-core textures" << endl;
+	cout <<  "               (default: " << MTS_TEXCACHE_DEFAULT_BUDGET << ")" << endl << endl;
 	cout <<  "   -v          Be more verbose" << endl << endl;
 	cout <<  "   -w          Treat warnings as errors" << endl << endl;
 	cout <<  "   -z          Disable progress bars" << endl << endl;
@@ -132,7 +135,7 @@ int ubi_main(int argc, char **argv) {
 
 		optind = 1;
 		/* Parse command-line arguments */
-		while ((optchar = getopt(argc, argv, "a:c:D:s:j:n:o:r:b:p:qhzvtwx")) != -1) {
+		while ((optchar = getopt(argc, argv, "a:c:D:s:j:n:o:r:b:m:p:qhzvtwx")) != -1) {
 			switch (optchar) {
 				case 'a': {
 						std::vector<std::string> paths = tokenize(optarg, ";");
@@ -202,6 +205,14 @@ int ubi_main(int argc, char **argv) {
 					if (blockSize < 2 || blockSize > 64)
 						SLog(EError, "Invalid block size (should be in the range 2-64)");
 					break;
+				case 'm': {
+						long budget = strtol(optarg, &end_ptr, 10);
+						if (*end_ptr != '\0' || budget <= 0)
+							SLog(EError, "Could not parse the texture cache budget!");
+						TextureCache::getInstance()->setMemoryBudget(
+							(size_t) budget * 1024 * 1024);
+					}
+					break;
 				case 'z':
 					progressBars = false;
 					break;
@@ -721,9 +721,8 @@ void PreviewThread::oglRenderNormals(const std::vector<std::pair<const TriMesh *
             normalColor.fromLinearRGB(0.8f, 0.2f, 0.0f);
             m_renderer->setColor(normalColor);
             const Point *vertices = mesh->getVertexPositions();
-            const Normal *normals = mesh->getVertexNormals();
             for (size_t i=0; i<mesh->getVertexCount(); ++i) {
-                    m_renderer->drawLine( vertices[i], vertices[i] + scale * normals[i] );
+                    m_renderer->drawLine( vertices[i], vertices[i] + scale * mesh->getVertexNormal(i) );
             }
         } else {
             normalColor.fromLinearRGB(0.0f, 0.8f, 0.2f);
@@ -17,25 +17,30 @@
 */
 
 #include "hair.h"
+#include "hairfile.h"
 #include <mitsuba/render/bsdf.h>
 #include <mitsuba/render/subsurface.h>
 #include <mitsuba/render/luminaire.h>
 #include <mitsuba/render/sahkdtree3.h>
 #include <mitsuba/render/trimesh.h>
 #include <mitsuba/core/properties.h>
-#include <mitsuba/core/fstream.h>
 #include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/mstream.h>
+#include <mitsuba/core/mmap.h>
+#include <mitsuba/core/timer.h>
 
 #define MTS_HAIR_USE_FANCY_CLIPPING 1
 
+/// Number of fibers that are processed at a time while filtering the vertices
+#define MTS_HAIR_FIBER_BLOCK_SIZE 4096
+
 MTS_NAMESPACE_BEGIN
 
 /**
  * \brief Space-efficient acceleration structure for cylindrical hair
- * segments with miter joints. This class expects an ASCII file containing
- * a list of hairs made from segments. Each line should contain an X,
- * Y and Z coordinate separated by a space. An empty line indicates
- * the start of a new hair.
+ * segments with miter joints. The hairs are either specified using
+ * a uniform radius or using an individual radius per vertex (which is
+ * constant along each strand).
  */
 class HairKDTree : public SAHKDTree3D<HairKDTree> {
 	friend class GenericKDTree<AABB, SurfaceAreaHeuristic, HairKDTree>;
@@ -45,11 +50,12 @@ public:
 	using SAHKDTree3D<HairKDTree>::size_type;
 
 	HairKDTree(std::vector<Point> &vertices, 
-			std::vector<bool> &vertexStartsFiber, Float radius)
-			: m_radius(radius) {
-		/* Take the supplied vertex & start fiber arrays (without copying) */
+			std::vector<bool> &vertexStartsFiber, std::vector<Float> &radii,
+			Float radius, bool parallelBuild = true) : m_radius(radius) {
+		/* Take the supplied vertex, start fiber & radius arrays (without copying) */
 		m_vertices.swap(vertices);
 		m_vertexStartsFiber.swap(vertexStartsFiber);
+		m_radii.swap(radii);
 		m_hairCount = 0;
 
 		/* Compute the index of the first vertex in each segment. */
@@ -72,18 +78,21 @@ public:
 		setStopPrims(0);
 		setTraversalCost(10);
 		setQueryCost(30);
+		setParallelBuild(parallelBuild);
 		buildInternal();
 
 		Log(EDebug, "Total amount of storage (kd-tree & vertex data): %s",
 			memString(m_nodeCount * sizeof(KDNode) 
 			+ m_indexCount * sizeof(index_type)
-			+ vertices.size() * sizeof(Point)
-			+ vertexStartsFiber.size() / 8).c_str());
+			+ m_vertices.size() * sizeof(Point)
+			+ m_radii.size() * sizeof(Float)
+			+ m_vertexStartsFiber.size() / 8).c_str());
 
 		/* Optimization: replace all primitive indices by the
 		   associated vertex indices (this avoids an extra 
 		   indirection during traversal later on) */
-		for (size_type i=0; i<m_indexCount; ++i)
+		#pragma omp parallel for schedule(static)
+		for (int i=0; i<(int) m_indexCount; ++i)
 			m_indices[i] = m_segIndex[m_indices[i]];
 
 		/* Free the segIndex array, it is not needed anymore */
@@ -108,11 +117,24 @@ public:
 		return m_vertexStartsFiber;
 	}
 
-	/// Return the radius of the hairs stored in the kd-tree
+	/// Return the default radius of the hairs stored in the kd-tree
 	inline Float getRadius() const {
 		return m_radius;
 	}
 
+	/// Return the radius of the segment starting at vertex \c iv
+	inline Float getRadius(index_type iv) const {
+		return m_radii.empty() ? m_radius : m_radii[iv];
+	}
+
+	/**
+	 * \brief Return the per-vertex radii of the hairs stored in 
+	 * the kd-tree (empty when all hairs use the default radius)
+	 */
+	inline const std::vector<Float> &getRadii() const {
+		return m_radii;
+	}
+
 	/// Return the total number of segments
 	inline size_t getSegmentCount() const {
 		return m_segmentCount;
@@ -223,7 +245,7 @@ public:
 	 */
 	AABB intersectCylFace(int axis,
 			const Point &min, const Point &max,
-			const Point &cylPt, const Vector &cylD) const {
+			const Point &cylPt, const Vector &cylD, Float radius) const {
 		int axis1 = (axis + 1) % 3;
 		int axis2 = (axis + 2) % 3;
 
@@ -235,7 +257,7 @@ public:
 		Float ellipseLengths[2];
 
 		AABB aabb;
-		if (!intersectCylPlane(min, planeNrml, cylPt, cylD, m_radius, 
+		if (!intersectCylPlane(min, planeNrml, cylPt, cylD, radius, 
 			ellipseCenter, ellipseAxes, ellipseLengths)) {
 			/* Degenerate case -- return an invalid AABB. This is
 			   not a problem, since one of the other faces will provide
@@ -303,7 +325,7 @@ public:
 		Float lengths[2];
 
 		bool success = intersectCylPlane(firstVertex(iv), firstMiterNormal(iv), 
-			firstVertex(iv), tangent(iv), m_radius, center, axes, lengths);
+			firstVertex(iv), tangent(iv), getRadius(iv), center, axes, lengths);
 		Assert(success);
 
 		AABB result;
@@ -315,7 +337,7 @@ public:
 		}
 
 		success = intersectCylPlane(secondVertex(iv), secondMiterNormal(iv), 
-			secondVertex(iv), tangent(iv), m_radius, center, axes, lengths);
+			secondVertex(iv), tangent(iv), getRadius(iv), center, axes, lengths);
 		Assert(success);
 
 		axes[0] *= lengths[0]; axes[1] *= lengths[1];
@@ -336,6 +358,7 @@ public:
 
 		Point cylPt = firstVertex(iv);
 		Vector cylD = tangent(iv);
+		Float radius = getRadius(iv);
 
 		/* Now forget about the cylinder ends and 
 		   intersect an infinite cylinder with each AABB face */
@@ -343,32 +366,32 @@ public:
 		clippedAABB.expandBy(intersectCylFace(0, 
 				Point(base.min.x, base.min.y, base.min.z),
 				Point(base.min.x, base.max.y, base.max.z),
-				cylPt, cylD));
+				cylPt, cylD, radius));
 
 		clippedAABB.expandBy(intersectCylFace(0,
 				Point(base.max.x, base.min.y, base.min.z),
 				Point(base.max.x, base.max.y, base.max.z),
-				cylPt, cylD));
+				cylPt, cylD, radius));
 
 		clippedAABB.expandBy(intersectCylFace(1, 
 				Point(base.min.x, base.min.y, base.min.z),
 				Point(base.max.x, base.min.y, base.max.z),
-				cylPt, cylD));
+				cylPt, cylD, radius));
 
 		clippedAABB.expandBy(intersectCylFace(1,
 				Point(base.min.x, base.max.y, base.min.z),
 				Point(base.max.x, base.max.y, base.max.z),
-				cylPt, cylD));
+				cylPt, cylD, radius));
 
 		clippedAABB.expandBy(intersectCylFace(2, 
 				Point(base.min.x, base.min.y, base.min.z),
 				Point(base.max.x, base.max.y, base.min.z),
-				cylPt, cylD));
+				cylPt, cylD, radius));
 
 		clippedAABB.expandBy(intersectCylFace(2,
 				Point(base.min.x, base.min.y, base.max.z),
 				Point(base.max.x, base.max.y, base.max.z),
-				cylPt, cylD));
+				cylPt, cylD, radius));
 
 		clippedAABB.clip(base);
 		return clippedAABB;
@@ -382,7 +405,7 @@ public:
 		const Float cos0 = dot(firstMiterNormal(iv), tangent(iv));
 		const Float cos1 = dot(secondMiterNormal(iv), tangent(iv));
 		const Float maxInvCos = 1.0 / std::min(cos0, cos1);
-		const Vector expandVec(m_radius * maxInvCos);
+		const Vector expandVec(getRadius(iv) * maxInvCos);
 
 		const Point a = firstVertex(iv);
 		const Point b = secondVertex(iv);
@@ -422,7 +445,8 @@ public:
 		// Quadratic to intersect circle in projection
 		const Float A = projDirection.lengthSquared();
 		const Float B = 2 * dot(projOrigin, projDirection);
-		const Float C = projOrigin.lengthSquared() - m_radius*m_radius;
+		const Float radius = getRadius(iv);
+		const Float C = projOrigin.lengthSquared() - radius*radius;
 
 		if (!solveQuadratic(A, B, C, nearT, farT))
 			return false;
@@ -490,12 +514,157 @@ public:
 protected:
 	std::vector<Point> m_vertices;
 	std::vector<bool> m_vertexStartsFiber;
+	std::vector<Float> m_radii;
 	std::vector<index_type> m_segIndex;
 	size_t m_segmentCount;
 	size_t m_hairCount;
 	Float m_radius;
 };
 
+/// Hair vertices stored in a memory-mapped binary file
+struct BinaryHairSource {
+	const float *positions;
+	const uint32_t *fiberBits;
+	const float *radii;
+	size_t pointCount;
+	bool swapBytes;
+
+	inline size_t getPointCount() const { return pointCount; }
+	inline bool hasRadii() const { return radii != NULL; }
+
+	inline float getValue(const float *ptr) const {
+		return swapBytes ? endianness_swap(*ptr) : *ptr;
+	}
+
+	inline Point getPoint(size_t i) const {
+		const float *ptr = positions + 3*i;
+		return Point(getValue(ptr), getValue(ptr+1), getValue(ptr+2));
+	}
+
+	inline Float getRadius(size_t fiber, size_t) const {
+		return getValue(radii + fiber);
+	}
+};
+
+/// Vertices of a block of fibers after removing degenerate and low-curvature segments
+struct HairBlock {
+	std::vector<Point> vertices;
+	size_t offset, nDegenerate, nSkipped;
+};
+
+/**
+ * Transform the vertices of a fiber into world space, while dropping 
+ * degenerate segments and merging segments whose tangents differ by
+ * less than the given threshold
+ */
+template <typename Source> static void filterFiber(const Source &source,
+		size_t first, size_t last, const Transform &objectToWorld,
+		Float dpThresh, HairBlock &block) {
+	std::vector<Point> &vertices = block.vertices;
+	Point lastP = objectToWorld(source.getPoint(first));
+	Vector tangent(0.0f);
+	vertices.push_back(lastP);
+
+	for (size_t i=first+1; i<last; ++i) {
+		Point p = objectToWorld(source.getPoint(i));
+		if (p == lastP) {
+			block.nDegenerate++;
+			continue;
+		}
+		if (tangent.isZero()) {
+			vertices.push_back(p);
+			tangent = normalize(p - lastP);
+		} else {
+			Vector nextTangent = normalize(p - lastP);
+			if (dot(nextTangent, tangent) > dpThresh) {
+				/* Too small of a difference in the tangent value,
+					just overwrite the previous vertex by the current one */
+				tangent = normalize(p - vertices[vertices.size()-2]);
+				vertices[vertices.size()-1] = p;
+				block.nSkipped++;
+			} else {
+				vertices.push_back(p);
+				tangent = nextTangent;
+			}
+		}
+		lastP = p;
+	}
+}
+
+/**
+ * Filter all fibers in parallel and assemble the vertex, start fiber 
+ * and (optional) per-vertex radius arrays used by \ref HairKDTree
+ */
+template <typename Source> static void filterFibers(const Source &source,
+		const std::vector<size_t> &fiberStarts, const Transform &objectToWorld,
+		Float dpThresh, Float radius, std::vector<Point> &vertices,
+		std::vector<bool> &vertexStartsFiber, std::vector<Float> &radii) {
+	const size_t fiberCount = fiberStarts.size();
+	const int blockCount = (int) ((fiberCount + MTS_HAIR_FIBER_BLOCK_SIZE - 1)
+		/ MTS_HAIR_FIBER_BLOCK_SIZE);
+	std::vector<HairBlock> blocks(blockCount);
+	std::vector<size_t> fiberOffsets(fiberCount);
+
+	#pragma omp parallel for schedule(dynamic)
+	for (int i=0; i<blockCount; ++i) {
+		HairBlock &block = blocks[i];
+		block.nDegenerate = block.nSkipped = 0;
+		size_t start = (size_t) i * MTS_HAIR_FIBER_BLOCK_SIZE,
+			end = std::min(start + MTS_HAIR_FIBER_BLOCK_SIZE, fiberCount);
+		for (size_t j=start; j<end; ++j) {
+			/* Temporarily record the fiber's offset within the block */
+			fiberOffsets[j] = block.vertices.size();
+			filterFiber(source, fiberStarts[j], j+1 < fiberCount ? fiberStarts[j+1]
+				: source.getPointCount(), objectToWorld, dpThresh, block);
+		}
+	}
+
+	size_t vertexCount = 0, nDegenerate = 0, nSkipped = 0;
+	for (int i=0; i<blockCount; ++i) {
+		blocks[i].offset = vertexCount;
+		vertexCount += blocks[i].vertices.size();
+		nDegenerate += blocks[i].nDegenerate;
+		nSkipped += blocks[i].nSkipped;
+	}
+
+	if (nDegenerate > 0)
+		SLog(EInfo, "Encountered " SIZE_T_FMT 
+			" degenerate segments!", nDegenerate);
+	if (nSkipped > 0)
+		SLog(EInfo, "Skipped " SIZE_T_FMT 
+			" low-curvature segments.", nSkipped);
+
+	vertices.resize(vertexCount);
+	if (source.hasRadii())
+		radii.resize(vertexCount);
+
+	#pragma omp parallel for schedule(dynamic)
+	for (int i=0; i<blockCount; ++i) {
+		HairBlock &block = blocks[i];
+		std::copy(block.vertices.begin(), block.vertices.end(),
+			vertices.begin() + block.offset);
+		size_t start = (size_t) i * MTS_HAIR_FIBER_BLOCK_SIZE,
+			end = std::min(start + MTS_HAIR_FIBER_BLOCK_SIZE, fiberCount);
+		for (size_t j=start; j<end; ++j) {
+			fiberOffsets[j] += block.offset;
+			if (!source.hasRadii())
+				continue;
+			size_t fiberEnd = (j+1 < end) ? (block.offset + fiberOffsets[j+1])
+				: (block.offset + block.vertices.size());
+			Float value = source.getRadius(j, fiberStarts[j]);
+			if (!(value > 0))
+				value = radius;
+			std::fill(radii.begin() + fiberOffsets[j], radii.begin() + fiberEnd, value);
+		}
+		std::vector<Point>().swap(block.vertices);
+	}
+
+	vertexStartsFiber.resize(vertexCount + 1);
+	for (size_t j=0; j<fiberCount; ++j)
+		vertexStartsFiber[fiberOffsets[j]] = true;
+	vertexStartsFiber[vertexCount] = true;
+}
+
 HairShape::HairShape(const Properties &props) : Shape(props) {
 	fs::path path = Thread::getThread()->getFileResolver()->resolve(
 		props.getString("filename"));
@@ -504,79 +673,93 @@ HairShape::HairShape(const Properties &props) : Shape(props) {
 		compared to the previous one */
 	Float angleThreshold = degToRad(props.getFloat("angleThreshold", 1.0f));
 	Float dpThresh = std::cos(angleThreshold);
+	/* Build the kd-tree using several threads? */
+	bool parallelBuild = props.getBoolean("kdParallelBuild", true);
 
 	/* Object-space -> World-space transformation */
 	Transform objectToWorld = props.getTransform("toWorld", Transform());
 
 	Log(EInfo, "Loading hair geometry from \"%s\" ..", path.leaf().c_str());
-
-	fs::ifstream is(path);
-	if (is.fail())
+	if (!fs::exists(path))
 		Log(EError, "Could not open \"%s\"!", path.file_string().c_str());
 
-	std::string line;
-	bool newFiber = true;
-	Point p, lastP(0.0f);
+	ref<Timer> timer = new Timer();
+	ref<MemoryMappedFile> mmap;
+	const char *begin = NULL, *end = NULL;
+	if (fs::file_size(path) > 0) {
+		mmap = new MemoryMappedFile(path);
+		begin = static_cast<const char *>(mmap->getData());
+		end = begin + mmap->getSize();
+	}
+
 	std::vector<Point> vertices;
 	std::vector<bool> vertexStartsFiber;
-	Vector tangent(0.0f);
-	size_t nDegenerate = 0, nSkipped = 0;
-
-	while (is.good()) {
-		std::getline(is, line);
-		if (line.length() > 0 && line[0] == '#') {
-			newFiber = true;
-			continue;
-		}
-		std::istringstream iss(line);
-		iss >> p.x >> p.y >> p.z;
-		if (!iss.fail()) {
-			p = objectToWorld(p);
-			if (newFiber) {
-				vertices.push_back(p);
-				vertexStartsFiber.push_back(newFiber);
-				lastP = p;
-				tangent = Vector(0.0f);
-			} else if (p != lastP) {
-				if (tangent.isZero()) {
-					vertices.push_back(p);
-					vertexStartsFiber.push_back(newFiber);
-					tangent = normalize(p - lastP);
-					lastP = p;
-				} else {
-					Vector nextTangent = normalize(p - lastP);
-					if (dot(nextTangent, tangent) > dpThresh) {
-						/* Too small of a difference in the tangent value,
-							just overwrite the previous vertex by the current one */
-						tangent = normalize(p - vertices[vertices.size()-2]);
-						vertices[vertices.size()-1] = p;
-						++nSkipped;
-					} else {
-						vertices.push_back(p);
-						vertexStartsFiber.push_back(newFiber);
-						tangent = nextTangent;
-					}
-					lastP = p;
-				}
-			} else {
-				nDegenerate++;
+	std::vector<Float> radii;
+	std::vector<size_t> fiberStarts;
+	bool binary = HairFileHeader::isBinary(begin, end);
+
+	if (binary) {
+		ref<MemoryStream> mstream = new MemoryStream(const_cast<char *>(begin), end - begin);
+		mstream->setByteOrder(Stream::ELittleEndian);
+		HairFileHeader header;
+		header.read(mstream);
+		uint64_t pointCount = header.pointCount, fiberCount = header.fiberCount,
+			wordCount = header.getFiberWordCount();
+		uint32_t flags = header.flags;
+		if (header.version != MTS_HAIR_BINARY_VERSION)
+			Log(EError, "\"%s\": unsupported binary hair format version %i!",
+				path.leaf().c_str(), header.version);
+		if ((uint64_t) (end - begin) < header.getFileSize())
+			Log(EError, "\"%s\": the binary hair file is truncated!", path.leaf().c_str());
+
+		BinaryHairSource source;
+		source.pointCount = (size_t) pointCount;
+		source.positions = reinterpret_cast<const float *>(begin + MTS_HAIR_BINARY_HEADER_SIZE);
+		source.fiberBits = reinterpret_cast<const uint32_t *>(source.positions + 3*pointCount);
+		source.radii = (flags & MTS_HAIR_BINARY_STRAND_RADII)
+			? reinterpret_cast<const float *>(source.fiberBits + wordCount) : NULL;
+		source.swapBytes = mstream->getHostByteOrder() != Stream::ELittleEndian;
+
+		/* Locate the fiber starts (the first point always starts one) */
+		fiberStarts.reserve((size_t) std::min(fiberCount, pointCount));
+		for (size_t i=0; i<(size_t) wordCount; ++i) {
+			uint32_t word = source.swapBytes ? endianness_swap(source.fiberBits[i])
+				: source.fiberBits[i];
+			if (i == 0)
+				word |= 1;
+			for (int j=0; word != 0; ++j, word >>= 1) {
+				if ((word & 1) && i*32 + j < source.pointCount)
+					fiberStarts.push_back(i*32 + j);
 			}
-			newFiber = false;
-		} else {
-			newFiber = true;
 		}
+		if (source.radii && fiberStarts.size() != fiberCount)
+			Log(EError, "\"%s\": the number of strands does not match the strand radii!",
+				path.leaf().c_str());
+
+		filterFibers(source, fiberStarts, objectToWorld, dpThresh, radius,
+			vertices, vertexStartsFiber, radii);
+	} else {
+		ASCIIHairSource source;
+		parseASCIIHair(begin, end, source);
+		for (size_t i=0; i<source.points.size(); ++i) {
+			if (source.startsFiber[i])
+				fiberStarts.push_back(i);
+		}
+		filterFibers(source, fiberStarts, objectToWorld, dpThresh, radius,
+			vertices, vertexStartsFiber, radii);
 	}
+	mmap = NULL;
 
-	if (nDegenerate > 0)
-		Log(EInfo, "Encountered " SIZE_T_FMT 
-			" degenerate segments!", nDegenerate);
-	if (nSkipped > 0)
-		Log(EInfo, "Skipped " SIZE_T_FMT 
-			" low-curvature segments.", nSkipped);
+	if (vertices.empty())
+		Log(EError, "\"%s\" does not contain any hair vertices!", path.leaf().c_str());
 
-	vertexStartsFiber.push_back(true);
+	Log(EInfo, "Loaded " SIZE_T_FMT " hair vertices (" SIZE_T_FMT " strands) from "
+		"the %s file in %i ms", vertices.size(), fiberStarts.size(),
+		binary ? "binary" : "ASCII", timer->getMilliseconds());
 
-	m_kdtree = new HairKDTree(vertices, vertexStartsFiber, radius);
+	timer->reset();
+	m_kdtree = new HairKDTree(vertices, vertexStartsFiber, radii, radius, parallelBuild);
+	Log(EInfo, "Built the hair kd-tree in %i ms", timer->getMilliseconds());
 }
 
 HairShape::HairShape(Stream *stream, InstanceManager *manager) 
@@ -586,13 +769,19 @@ HairShape::HairShape(Stream *stream, InstanceManager *manager)
 
 	std::vector<Point> vertices(vertexCount);
 	std::vector<bool> vertexStartsFiber(vertexCount+1);
+	std::vector<Float> radii;
 	stream->readFloatArray((Float *) &vertices[0], vertexCount * 3);
 
 	for (size_t i=0; i<vertexCount; ++i) 
 		vertexStartsFiber[i] = stream->readBool();
 	vertexStartsFiber[vertexCount] = true;
 
-	m_kdtree = new HairKDTree(vertices, vertexStartsFiber, radius);
+	if (stream->readBool()) {
+		radii.resize(vertexCount);
+		stream->readFloatArray(&radii[0], vertexCount);
+	}
+
+	m_kdtree = new HairKDTree(vertices, vertexStartsFiber, radii, radius);
 }
 
 void HairShape::serialize(Stream *stream, InstanceManager *manager) const {
@@ -600,12 +789,16 @@ void HairShape::serialize(Stream *stream, InstanceManager *manager) const {
 
 	const std::vector<Point> &vertices = m_kdtree->getVertices();
 	const std::vector<bool> &vertexStartsFiber = m_kdtree->getStartFiber();
+	const std::vector<Float> &radii = m_kdtree->getRadii();
 
 	stream->writeFloat(m_kdtree->getRadius());
 	stream->writeSize(vertices.size());
 	stream->writeFloatArray((Float *) &vertices[0], vertices.size() * 3);
 	for (size_t i=0; i<vertices.size(); ++i)
 		stream->writeBool(vertexStartsFiber[i]);
+	stream->writeBool(!radii.empty());
+	if (!radii.empty())
+		stream->writeFloatArray(&radii[0], radii.size());
 }
 
 bool HairShape::rayIntersect(const Ray &ray, Float mint, 
@@ -657,7 +850,6 @@ ref<TriMesh> HairShape::createTriMesh() {
 	
 	const std::vector<Point> &hairVertices = m_kdtree->getVertices();
 	const std::vector<bool> &vertexStartsFiber = m_kdtree->getStartFiber();
-	const Float radius = m_kdtree->getRadius();
 	Float *cosPhi = new Float[phiSteps];
 	Float *sinPhi = new Float[phiSteps];
 	for (size_t i=0; i<phiSteps; ++i) {
@@ -668,6 +860,7 @@ ref<TriMesh> HairShape::createTriMesh() {
 	uint32_t hairIdx = 0;
 	for (HairKDTree::index_type iv=0; iv<(HairKDTree::index_type) hairVertices.size()-1; iv++) {
 		if (!vertexStartsFiber[iv+1]) {
+			const Float radius = m_kdtree->getRadius(iv);
 			for (uint32_t phi=0; phi<phiSteps; ++phi) {
 				Vector tangent = m_kdtree->tangent(iv);
 				Vector dir = Frame(tangent).toWorld(
@@ -737,7 +930,8 @@ std::string HairShape::toString() const {
 		<< "   numVertices = " << m_kdtree->getVertexCount() << ","
 		<< "   numSegments = " << m_kdtree->getSegmentCount() << ","
 		<< "   numHairs = " << m_kdtree->getHairCount() << ","
-		<< "   radius = " << m_kdtree->getRadius()
+		<< "   radius = " << m_kdtree->getRadius() << ","
+		<< "   perStrandRadii = " << (m_kdtree->getRadii().empty() ? "no" : "yes")
 		<< "]";
 	return oss.str();
 }
@@ -27,10 +27,30 @@ class HairKDTree;
 
 /**
  * \brief Intersection shape structure for cylindrical hair
- * segments with miter joints. This class expects an ASCII file containing
- * a list of hairs made from segments. Each line should contain an X,
- * Y and Z coordinate separated by a space. An empty line indicates
- * the start of a new hair.
+ * segments with miter joints. 
+ *
+ * The hairs are loaded from an ASCII or a binary file. In the ASCII form, 
+ * each line should contain an X, Y and Z coordinate separated by a space. 
+ * An empty line (or one starting with '#') indicates the start of a new 
+ * hair. An optional fourth number on the first line of a hair specifies 
+ * its radius. ASCII files are parsed in parallel.
+ *
+ * The binary form can be created using <tt>mtsutil hairconv</tt> and
+ * is memory-mapped when loading. It consists of a 32 byte header 
+ * followed by the vertex data (all values are in little endian format):
+ * <pre>
+ *    char[8]    "MTS_HAIR"
+ *    uint32     version (currently 1)
+ *    uint32     flags (0x0001 = the file stores per-strand radii)
+ *    uint64     vertex count
+ *    uint64     strand count
+ *    float32    positions[3 * vertex count]
+ *    uint32     fiber start bitset[(vertex count + 31) / 32]
+ *    float32    radii[strand count] (optional)
+ * </pre>
+ * Bit \c i of word <tt>i / 32</tt> in the bitset is set when vertex 
+ * \c i starts a new hair. A non-positive radius in either form falls 
+ * back to the \c radius parameter of the shape.
  */
 class HairShape : public Shape {
 public:
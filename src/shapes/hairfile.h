@@ -0,0 +1,236 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__HAIRFILE_H)
+#define __HAIRFILE_H
+
+#include <mitsuba/core/stream.h>
+
+/// Approximate size of the file chunks that are handed to the ASCII parser threads
+#define MTS_HAIR_CHUNK_SIZE (1024*1024)
+
+/// Identifies the binary hair format (see \ref HairShape)
+#define MTS_HAIR_BINARY_MAGIC "MTS_HAIR"
+#define MTS_HAIR_BINARY_VERSION 1
+#define MTS_HAIR_BINARY_HEADER_SIZE 32
+
+/// Binary hair format flag: the file stores a radius per strand
+#define MTS_HAIR_BINARY_STRAND_RADII 0x0001
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Header of the binary hair format, which is shared by the
+ * \c hair shape plugin and <tt>mtsutil hairconv</tt>
+ *
+ * The file layout is documented in \ref HairShape.
+ */
+struct HairFileHeader {
+	uint32_t version;
+	uint32_t flags;
+	uint64_t pointCount;
+	uint64_t fiberCount;
+
+	inline HairFileHeader() : version(MTS_HAIR_BINARY_VERSION),
+		flags(0), pointCount(0), fiberCount(0) { }
+
+	/// Does a memory region start with the binary hair format identifier?
+	static inline bool isBinary(const char *begin, const char *end) {
+		return (size_t) (end - begin) >= MTS_HAIR_BINARY_HEADER_SIZE
+			&& memcmp(begin, MTS_HAIR_BINARY_MAGIC, 8) == 0;
+	}
+
+	/// Read the header (the stream must use little endian byte order)
+	inline void read(Stream *stream) {
+		char magic[8];
+		stream->read(magic, 8);
+		version = stream->readUInt();
+		flags = stream->readUInt();
+		pointCount = stream->readULong();
+		fiberCount = stream->readULong();
+	}
+
+	/// Write the header (the stream must use little endian byte order)
+	inline void write(Stream *stream) const {
+		stream->write(MTS_HAIR_BINARY_MAGIC, 8);
+		stream->writeUInt(version);
+		stream->writeUInt(flags);
+		stream->writeULong(pointCount);
+		stream->writeULong(fiberCount);
+	}
+
+	/// Return the size of the file described by this header
+	inline uint64_t getFileSize() const {
+		uint64_t size = MTS_HAIR_BINARY_HEADER_SIZE + pointCount * 3 * sizeof(float)
+			+ getFiberWordCount() * sizeof(uint32_t);
+		if (flags & MTS_HAIR_BINARY_STRAND_RADII)
+			size += fiberCount * sizeof(float);
+		return size;
+	}
+
+	/// Return the number of words in the fiber start bitset
+	inline uint64_t getFiberWordCount() const {
+		return (pointCount + 31) / 32;
+	}
+};
+
+/// Hair vertices that were parsed from an ASCII file
+struct ASCIIHairSource {
+	std::vector<Point> points;
+	/// Specifies whether a point starts a new fiber
+	std::vector<uint8_t> startsFiber;
+	/// Radii given by the optional fourth column (sorted by point index)
+	std::vector<std::pair<size_t, Float> > radii;
+
+	inline size_t getPointCount() const { return points.size(); }
+	inline Point getPoint(size_t i) const { return points[i]; }
+	inline bool hasRadii() const { return !radii.empty(); }
+
+	/// Return the radius of a fiber or zero when it does not specify one
+	Float getRadius(size_t fiber, size_t firstPoint) const {
+		std::vector<std::pair<size_t, Float> >::const_iterator it =
+			std::lower_bound(radii.begin(), radii.end(),
+				std::make_pair(firstPoint, -std::numeric_limits<Float>::infinity()));
+		return (it != radii.end() && it->first == firstPoint) ? it->second : 0.0f;
+	}
+};
+
+/// Range of lines that is parsed by a single thread
+struct HairChunk {
+	const char *start, *end;
+	std::vector<Point> points;
+	/// Specifies whether a separator precedes a point within the chunk
+	std::vector<uint8_t> startsFiber;
+	/// Radii given by the optional fourth column (local point index)
+	std::vector<std::pair<size_t, Float> > radii;
+	/// Is there a separator after the last point (or anywhere, if there are no points)?
+	bool trailingSeparator;
+	/// Index of the first point in the concatenated point list
+	size_t offset;
+};
+
+/**
+ * Parse a chunk of an ASCII hair file. Lines starting with '#' and lines
+ * that do not begin with three numbers separate the fibers (this matches
+ * the behavior of reading the coordinates using <tt>operator>></tt>)
+ */
+inline void parseHairChunk(HairChunk &chunk) {
+	const char *ptr = chunk.start;
+	std::string line;
+	bool separator = false;
+	chunk.trailingSeparator = false;
+
+	while (ptr < chunk.end) {
+		const char *eol = static_cast<const char *>(memchr(ptr, '\n', chunk.end - ptr));
+		if (!eol)
+			eol = chunk.end;
+
+		bool success = false;
+		if (ptr == eol || *ptr != '#') {
+			/* The mapped file is not null-terminated -- copy the line */
+			line.assign(ptr, eol);
+			const char *cur = line.c_str();
+			char *next = NULL;
+			Float values[4];
+			int count = 0;
+			for (; count<4; ++count) {
+				values[count] = (Float) strtod(cur, &next);
+				if (next == cur)
+					break;
+				cur = next;
+			}
+			if (count >= 3) {
+				chunk.startsFiber.push_back(separator ? 1 : 0);
+				if (count == 4)
+					chunk.radii.push_back(std::make_pair(chunk.points.size(), values[3]));
+				chunk.points.push_back(Point(values[0], values[1], values[2]));
+				success = true;
+			}
+		}
+		if (success) {
+			separator = false;
+		} else {
+			separator = true;
+			chunk.trailingSeparator = true;
+		}
+		if (!chunk.points.empty())
+			chunk.trailingSeparator = separator;
+		ptr = eol + 1;
+	}
+}
+
+/// Parse an ASCII hair file in parallel
+inline void parseASCIIHair(const char *begin, const char *end, ASCIIHairSource &source) {
+	/* Split the file into chunks that end at line boundaries */
+	size_t size = (size_t) (end - begin),
+		chunkCount = std::max((size_t) 1, size / MTS_HAIR_CHUNK_SIZE);
+	std::vector<HairChunk> chunks(chunkCount);
+	const char *chunkStart = begin;
+	for (size_t i=0; i<chunkCount; ++i) {
+		const char *chunkEnd = end;
+		if (i+1 < chunkCount) {
+			chunkEnd = std::max(chunkStart, begin + (size / chunkCount) * (i+1));
+			const char *eol = static_cast<const char *>(
+				memchr(chunkEnd, '\n', end - chunkEnd));
+			chunkEnd = eol ? eol + 1 : end;
+		}
+		chunks[i].start = chunkStart;
+		chunks[i].end = chunkEnd;
+		chunkStart = chunkEnd;
+	}
+
+	#pragma omp parallel for schedule(dynamic)
+	for (int i=0; i<(int) chunkCount; ++i)
+		parseHairChunk(chunks[i]);
+
+	/* Resolve fiber separators that straddle chunk boundaries */
+	bool separator = true;
+	size_t pointCount = 0;
+	for (size_t i=0; i<chunkCount; ++i) {
+		HairChunk &chunk = chunks[i];
+		chunk.offset = pointCount;
+		pointCount += chunk.points.size();
+		if (!chunk.points.empty()) {
+			if (separator)
+				chunk.startsFiber[0] = 1;
+			separator = chunk.trailingSeparator;
+		} else {
+			separator |= chunk.trailingSeparator;
+		}
+		for (size_t j=0; j<chunk.radii.size(); ++j)
+			source.radii.push_back(std::make_pair(chunk.offset
+				+ chunk.radii[j].first, chunk.radii[j].second));
+	}
+
+	source.points.resize(pointCount);
+	source.startsFiber.resize(pointCount);
+	#pragma omp parallel for schedule(dynamic)
+	for (int i=0; i<(int) chunkCount; ++i) {
+		HairChunk &chunk = chunks[i];
+		std::copy(chunk.points.begin(), chunk.points.end(),
+			source.points.begin() + chunk.offset);
+		std::copy(chunk.startsFiber.begin(), chunk.startsFiber.end(),
+			source.startsFiber.begin() + chunk.offset);
+		std::vector<Point>().swap(chunk.points);
+		std::vector<uint8_t>().swap(chunk.startsFiber);
+	}
+}
+
+MTS_NAMESPACE_END
+
+#endif /* __HAIRFILE_H */
@@ -19,6 +19,8 @@
 #include <mitsuba/render/trimesh.h>
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/mmap.h>
 #include <mitsuba/render/luminaire.h>
 #include <mitsuba/render/bsdf.h>
 #include <mitsuba/render/subsurface.h>
@@ -27,9 +29,37 @@
 #include <boost/foreach.hpp>
 #include <boost/tokenizer.hpp>
 #include <boost/lexical_cast.hpp>
+#include "weld.h"
+
+/// Number of map rows that are triangulated at a time
+#define MTS_HSPAN_BAND_ROWS 16
+
+/// Version of the binary height span map format
+#define MTS_HSPAN_BINARY_VERSION 1
 
 MTS_NAMESPACE_BEGIN
 
+/**
+ * Header of the binary height span map format (extension ".hspanb").
+ * It is followed by the index of the first sample of every cell in
+ * row-major order (width*height+1 entries of type uint32_t) and by
+ * the samples in the layout of \ref HeightSpanMap::HeightSample. All
+ * values are stored in the byte order of the writing machine, hence
+ * the file can be mapped into memory and used as is. (A file written
+ * with the other byte order is rejected due to its version number.)
+ */
+struct HeightSpanFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t sampleSize;
+	int32_t width, height;
+	uint64_t sampleCount;
+	/// Upper three rows of the file-to-object transformation
+	double fileToObject[3][4];
+};
+
+static const char hspanMagic[8] = { 'M', 'T', 'S', '_', 'H', 'S', 'P', '\0' };
+
 /**
  * Height Span Map loader
  */
@@ -38,23 +68,16 @@ public:
 
     /**
      * Represents an height element of within the height span of a cell.
+     * The same layout is used by the binary file format.
      */
     struct HeightSample
     {
-        /* The type of this heigt span element:
-         * Normal = 0, Bridge = 1, Bridge border = 2
-         */
-        int type;
         // Tha base height of this element.
         float h;
         // The snow height on this element, relative to h.
         float dh;
         // North and east offset of snow node. Used for bridges and over hangs
         float dx, dy;
-        //
-        float u, v;
-        // Flags to state in which direction a neighbor exists.
-        unsigned char flags, user_flags;
         // indices of adjacent spans
         short neighbor_slab_indices[4];
         /* Distances to adjacent spans. Indexed after incoming directions.
@@ -62,32 +85,39 @@ public:
          * east of this element, you need to ask for the west distance.
          */
         short neighbor_distances[4];
-
-        int vertex_index, secondary_vertex_index;
+        /* The type of this heigt span element:
+         * Normal = 0, Bridge = 1, Bridge border = 2
+         */
+        uint8_t type;
+        // Flags to state in which direction a neighbor exists.
+        uint8_t flags;
+        uint8_t padding[2];
 
         /**
          * Creates a new height span element. Defaults are at height 0, no
          * span height and no neighbors.
          */
         HeightSample(float _h = 0, float _dh = 0, unsigned char _f = 0)
-            : type(0),h(_h), dh(_dh), dx(0), dy(0), u(0), v(0), flags(_f), user_flags(0), vertex_index(-1), secondary_vertex_index(-1)
+            : h(_h), dh(_dh), dx(0), dy(0), type(0), flags(_f)
         {
             // init neighbor slab indices to -1
             neighbor_slab_indices[0] = neighbor_slab_indices[1] = neighbor_slab_indices[2] = neighbor_slab_indices[3] = -1;
             // init neighbor distances to 1
             neighbor_distances[0] = neighbor_distances[1] = neighbor_distances[2] = neighbor_distances[3] = 1;
+            padding[0] = padding[1] = 0;
         }
 
         /**
          * Creates a new heaght span element. Defaults to neighborless.
          */
         HeightSample(float _h, int _type, float _dh, float _dx, float _dy, unsigned char _f = 0)
-            : type(_type), h(_h), dh(_dh), dx(_dx), dy(_dy), u(0), v(0), flags(_f), user_flags(0), vertex_index(-1), secondary_vertex_index(-1)
+            : h(_h), dh(_dh), dx(_dx), dy(_dy), type((uint8_t) _type), flags(_f)
         {
             // init neighbor slab indices to -1
             neighbor_slab_indices[0] = neighbor_slab_indices[1] = neighbor_slab_indices[2] = neighbor_slab_indices[3] = -1;
             // init neighbor distances to 1
             neighbor_distances[0] = neighbor_distances[1] = neighbor_distances[2] = neighbor_distances[3] = 1;
+            padding[0] = padding[1] = 0;
         }
 
         /**
@@ -132,15 +162,6 @@ public:
             flags |= flag_values[i];
         }
 
-        bool get_user_flag(int i) const {
-            static unsigned char flag_values[] = { 1,2,4,8 };
-            return (user_flags & flag_values[i]) != 0;
-        }
-        void set_user_flag(int i) {
-            static unsigned char flag_values[] = { 1,2,4,8 };
-            user_flags |= flag_values[i];
-        }
-
         /**
          * Get the index of an adjacent element within neighboring
          * cell in direction i. It is therefore the snow slab in this
@@ -160,41 +181,25 @@ public:
         std::string toString() {
             std::stringstream ss;
             ss << "Height sample:" << std::endl
-               << "\ttype: " << type << std::endl
+               << "\ttype: " << (int) type << std::endl
                << "\th: " << h << std::endl
                << "\tdh: " << dh << std::endl
                << "\tdx: " << dx << " dy: " << dy <<  std::endl
-               << "\tu: " << u << " v: " << v << std::endl
                << "\tflag_0: " << get_flag(0) << " flag_1: " << get_flag(1)
                << " flag_2: " << get_flag(2) << " flag_3: " << get_flag(3) << std::endl
                << "\tnsl_0: " << neighbor_slab_indices[0] << " nsl_1: " << neighbor_slab_indices[1]
                << " nsl_2: " << neighbor_slab_indices[2] << " nsl_2: " << neighbor_slab_indices[3] << std::endl
                << "\tnd_0: " << neighbor_distances[1] << " nd_1: " << neighbor_distances[1]
-               << " nd_2: " << neighbor_distances[2] << " nd_3: " << neighbor_distances[3] << std::endl
-               << "\tvertex-idx: " << vertex_index << " sec. vertex-idx: " << secondary_vertex_index << std::endl;
+               << " nd_2: " << neighbor_distances[2] << " nd_3: " << neighbor_distances[3] << std::endl;
 
             return ss.str();
         }
     };
 
-    /**
-     * Data structure for keeping position information on the map.
-     */
-    struct HeightSpanIterator
-    {
-        float x,y;
-        float dx,dy;
-        int i,j,k;
-        HeightSpanIterator(float _dx, float _dy, int _i, int _j, int _k = 0)
-            : x((_i/*+0.5f*/)*_dx), y((_j/*+0.5f*/)*_dy), dx(_dx), dy(_dy), i(_i), j(_j), k(_k) {}
-    };
-
 public:
     /* type definitons */
     typedef boost::char_separator<char> separator;
     typedef boost::tokenizer< separator > tokenizer;
-    // Represent height spans as vector collection of height samples.
-	typedef std::vector<HeightSample> HeightSpanType;
 
 
 	bool fetch_line(std::istream &is, std::string &line) {
@@ -251,15 +256,26 @@ public:
         /* if true, no consistency checking is done and all is added as is */
         m_filterInconsistencies = props.getBoolean("filterInconsistencies", true);
 
+        /* When loading a text file, additionally write the map in the
+           binary format, which loads much faster. The file is placed
+           next to the text file and has the extension ".hspanb" */
+        m_writeBinary = props.getBoolean("writeBinary", false);
 
 		BSDF *currentMaterial = NULL;
 	    bool hasNormals = false;
         bool hasTexcoords = false;
-        
+
+        m_cellOffsets = NULL;
+        m_samples = NULL;
+        m_sampleCount = 0;
+
         /* Read in the data and build up metsuba usable geometry */
         read(path);
         generateGeometry(name, hasNormals, hasTexcoords,
             currentMaterial, objectToWorld);
+
+        /* The height spans are not needed anymore */
+        releaseSamples();
     }
 
     /**
@@ -269,15 +285,22 @@ public:
     void read(fs::path path) {
 		/* Load the geometry */
 		Log(EInfo, "Loading height span map \"%s\" ..", path.leaf().c_str());
+
+        // do a simple extension test to determine version
+        std::string ext = path.extension();
+        boost::to_lower(ext);
+
+        if (ext.compare(".hspanb") == 0) {
+            readBinary(path);
+            check_connectivity();
+            return;
+        }
+
 		fs::ifstream is(path);
 		if (is.bad() || is.fail())
 			Log(EError, "Height span map file '%s' not found!", path.file_string().c_str());
 
 		std::string buf;
-
-        // do a simple extension test to determine version
-        std::string ext = path.extension();
-        boost::to_lower(ext);
         int version;
 
         if (ext.compare(".hspans1") == 0)
@@ -290,9 +313,6 @@ public:
 		std::string name = m_name, line;
         bool dimensionsFound = false;
 
-        // clear the map
-        m_heightSpans.clear();
-
         // eat all leading comments
 		while (is.good() && !is.eof() && fetch_line(is, line)) {
             // skip comments
@@ -301,9 +321,10 @@ public:
 
 			std::istringstream iss(line);
 
-            int w, h;
+            int w = 0, h = 0;
             iss >> w >> h;
-            resize(w, h);
+            m_width = w;
+            m_height = h;
             dimensionsFound = true;
             break;
         }
@@ -313,6 +334,11 @@ public:
             Log(EError, "Encountered an error while loading height span map: Expected dimensions");
         }
 
+        // the sample positions are computed relative to the map size
+        if (m_width < 2 || m_height < 2) {
+            Log(EError, "Encountered an error while loading height span map: Invalid dimensions");
+        }
+
         /* in version 1 and 2 we need to skip 3 lines, 7 in version 3
          *  until the bounding box is found
          */
@@ -358,14 +384,143 @@ public:
         m_fileToObject = Transform(trafo);
 
         // do version specific parsing
+        std::vector<uint32_t> cells;
+        std::vector<HeightSample> samples;
         if (version == 1)
-            readDataV1(is);
+            readDataV1(is, cells, samples);
         else if (version == 2)
-            readDataV2(is);
+            readDataV2(is, cells, samples);
         else
-            readDataV3(is);
+            readDataV3(is, cells, samples);
+        setSamples(cells, samples);
+
+        // do a sanity check
+        check_connectivity();
+
+        if (m_writeBinary) {
+            fs::path binaryPath = path;
+            binaryPath.replace_extension(".hspanb");
+            writeBinary(binaryPath);
+        }
 	}
 
+    /**
+     * Sort the samples of a text file by their cells, while keeping the
+     * order within each cell, and store them in compressed row storage.
+     */
+    void setSamples(const std::vector<uint32_t> &cells,
+            const std::vector<HeightSample> &samples) {
+        if (samples.size() > (size_t) std::numeric_limits<int32_t>::max())
+            Log(EError, "Encountered an error while loading height span map: Too many samples");
+
+        const size_t cellCount = (size_t) m_width * m_height;
+        m_offsetStorage.assign(cellCount + 1, 0);
+        for (size_t i=0; i<cells.size(); ++i)
+            ++m_offsetStorage[cells[i] + 1];
+        for (size_t i=0; i<cellCount; ++i)
+            m_offsetStorage[i+1] += m_offsetStorage[i];
+
+        std::vector<uint32_t> next(m_offsetStorage.begin(), m_offsetStorage.end() - 1);
+        m_sampleStorage.resize(samples.size());
+        for (size_t i=0; i<samples.size(); ++i)
+            m_sampleStorage[next[cells[i]]++] = samples[i];
+
+        m_cellOffsets = &m_offsetStorage[0];
+        m_samples = m_sampleStorage.empty() ? NULL : &m_sampleStorage[0];
+        m_sampleCount = m_sampleStorage.size();
+    }
+
+    /**
+     * Map a file in the binary format into memory. The samples are
+     * used directly from the mapped region.
+     */
+    void readBinary(const fs::path &path) {
+        if (!fs::exists(path))
+			Log(EError, "Height span map file '%s' not found!", path.file_string().c_str());
+
+        m_mappedFile = new MemoryMappedFile(path);
+        const uint8_t *data = static_cast<const uint8_t *>(m_mappedFile->getData());
+        const HeightSpanFileHeader *header = reinterpret_cast<const HeightSpanFileHeader *>(data);
+        size_t size = m_mappedFile->getSize();
+
+        if (size < sizeof(HeightSpanFileHeader)
+                || memcmp(header->magic, hspanMagic, sizeof(hspanMagic)) != 0
+                || header->version != MTS_HSPAN_BINARY_VERSION
+                || header->sampleSize != sizeof(HeightSample))
+            Log(EError, "Encountered an error while loading height span map: "
+                "Unknown file format or version");
+
+        if (header->width < 2 || header->height < 2 || header->sampleCount
+                > (uint64_t) std::numeric_limits<int32_t>::max())
+            Log(EError, "Encountered an error while loading height span map: Invalid dimensions");
+
+        m_width = header->width;
+        m_height = header->height;
+        m_sampleCount = (size_t) header->sampleCount;
+        const size_t cellCount = (size_t) m_width * m_height;
+
+        if (size != sizeof(HeightSpanFileHeader) + (cellCount + 1) * sizeof(uint32_t)
+                + m_sampleCount * sizeof(HeightSample))
+            Log(EError, "Encountered an error while loading height span map: "
+                "Unexpected file size (the file may be truncated)");
+
+        m_cellOffsets = reinterpret_cast<const uint32_t *>(data + sizeof(HeightSpanFileHeader));
+        m_samples = reinterpret_cast<const HeightSample *>(m_cellOffsets + cellCount + 1);
+
+        bool valid = m_cellOffsets[0] == 0 && m_cellOffsets[cellCount] == m_sampleCount;
+        for (size_t i=0; valid && i<cellCount; ++i)
+            valid = m_cellOffsets[i] <= m_cellOffsets[i+1];
+        if (!valid)
+            Log(EError, "Encountered an error while loading height span map: Invalid cell offsets");
+
+        Matrix4x4 trafo;
+        for (int i=0; i<3; ++i)
+            for (int j=0; j<4; ++j)
+                trafo.m[i][j] = (Float) header->fileToObject[i][j];
+        trafo.m[3][0] = trafo.m[3][1] = trafo.m[3][2] = 0;
+        trafo.m[3][3] = 1;
+        m_fileToObject = Transform(trafo);
+    }
+
+    /// Write the map in the binary format, replacing an existing file
+    void writeBinary(const fs::path &path) const {
+        HeightSpanFileHeader header;
+        memset(&header, 0, sizeof(HeightSpanFileHeader));
+        memcpy(header.magic, hspanMagic, sizeof(hspanMagic));
+        header.version = MTS_HSPAN_BINARY_VERSION;
+        header.sampleSize = sizeof(HeightSample);
+        header.width = m_width;
+        header.height = m_height;
+        header.sampleCount = m_sampleCount;
+        const Matrix4x4 &trafo = m_fileToObject.getMatrix();
+        for (int i=0; i<3; ++i)
+            for (int j=0; j<4; ++j)
+                header.fileToObject[i][j] = (double) trafo.m[i][j];
+
+        try {
+            ref<AtomicFileStream> stream = new AtomicFileStream(path);
+            stream->write(&header, sizeof(HeightSpanFileHeader));
+            stream->write(m_cellOffsets, ((size_t) m_width * m_height + 1) * sizeof(uint32_t));
+            if (m_sampleCount > 0)
+                stream->write(m_samples, m_sampleCount * sizeof(HeightSample));
+            stream->commit();
+            Log(EInfo, "Wrote the binary height span map \"%s\"", path.leaf().c_str());
+        } catch (const std::exception &ex) {
+            Log(EWarn, "Unable to write the binary height span map \"%s\": %s",
+                path.file_string().c_str(), ex.what());
+        }
+    }
+
+    /// Release the height spans once the geometry has been generated
+    void releaseSamples() {
+        std::vector<uint32_t>().swap(m_offsetStorage);
+        std::vector<HeightSample>().swap(m_sampleStorage);
+        m_mappedFile = NULL;
+        m_cellOffsets = NULL;
+        m_samples = NULL;
+        m_sampleCount = 0;
+    }
+
     Vector parseLineWithVector(const std::string& line) const
     {
         // create zero vector (0,0,0,1) as default
@@ -410,11 +565,13 @@ public:
         return v;
     }
 
-    void readDataV1(fs::ifstream& is) {
+    void readDataV1(fs::ifstream& is, std::vector<uint32_t> &cells,
+            std::vector<HeightSample> &samples) {
             Log(EError,  "Hspan 1 format not yet implemented!");
     }
 
-    void readDataV2(fs::ifstream& is) {
+    void readDataV2(fs::ifstream& is, std::vector<uint32_t> &cells,
+            std::vector<HeightSample> &samples) {
         separator sep("\t ");
         std::string line;
         // eat all leading comments
@@ -472,8 +629,11 @@ public:
                 continue;
             }
 
-            // gat current heigh span
-            HeightSpanType& hs = at(x,y);
+            // make sure the cell is inside the map
+            if (!isInside(x, y)) {
+                Log(EWarn, "Cell position (%i, %i) is outside of the map", x, y);
+                continue;
+            }
             // iterate over its elements
             for (int i=0; i<nrOfElements; ++i) {
                 float h1, h2;
@@ -496,7 +656,8 @@ public:
                      * it into the collection of height span elements of the current
                      * cell.
                      */
-                    hs.push_back( HeightSample(h1, h2) );
+                    samples.push_back( HeightSample(h1, h2) );
+                    cells.push_back( (uint32_t) (y * m_width + x) );
                     // iterate over neighbor directions
                     for (j = 0; j < 4; ++j) {
                         // index mapping from data format to internal structure
@@ -509,16 +670,16 @@ public:
                              * of internal structure. And remember -1 as slab index
                              * in that direction.
                              */
-                            hs.back().neighbor_distances[k]    = 1;
-                            hs.back().neighbor_slab_indices[k] = -1;
+                            samples.back().neighbor_distances[k]    = 1;
+                            samples.back().neighbor_slab_indices[k] = -1;
                         } else {
                             /* No, flag current direction to state existence of
                              * neigbor. Remember actual distance in that direction
                              * and the index of the adjacent span as well.
                              */
-                            hs.back().set_flag(k);
-                            hs.back().neighbor_distances[k]    = dists[j];
-                            hs.back().neighbor_slab_indices[k] = indices[j];
+                            samples.back().set_flag(k);
+                            samples.back().neighbor_distances[k]    = dists[j];
+                            samples.back().neighbor_slab_indices[k] = indices[j];
                         }
                     }
                 } catch(boost::bad_lexical_cast &) {
@@ -527,12 +688,10 @@ public:
                 }
             }
         }
-
-        // do a sanity check
-        check_connectivity();
     }
 
-    void readDataV3(fs::ifstream& is) {
+    void readDataV3(fs::ifstream& is, std::vector<uint32_t> &cells,
+            std::vector<HeightSample> &samples) {
         separator sep("\t ");
         std::string line;
         // eat all leading comments
@@ -590,8 +749,11 @@ public:
                 continue;
             }
 
-            // gat current heigh span
-            HeightSpanType& hs = at(x,y);
+            // make sure the cell is inside the map
+            if (!isInside(x, y)) {
+                Log(EWarn, "Cell position (%i, %i) is outside of the map", x, y);
+                continue;
+            }
             // iterate over its elements
             for (int i=0; i<nrOfElements; ++i) {
                 double h1, h2, dx, dy;
@@ -619,7 +781,8 @@ public:
                      * it into the collection of height span elements of the current
                      * cell.
                      */
-                    hs.push_back(HeightSample((float)h1,type,(float)h2,(float)dx,(float)dy));
+                    samples.push_back(HeightSample((float)h1,type,(float)h2,(float)dx,(float)dy));
+                    cells.push_back( (uint32_t) (y * m_width + x) );
                     // iterate over neighbor directions
                     for (j = 0; j < 4; ++j) {
                         // index mapping from data format to internal structure
@@ -632,16 +795,16 @@ public:
                              * of internal structure. And remember -1 as slab index
                              * in that direction.
                              */
-                            hs.back().neighbor_distances[k]    = 1;
-                            hs.back().neighbor_slab_indices[k] = -1;
+                            samples.back().neighbor_distances[k]    = 1;
+                            samples.back().neighbor_slab_indices[k] = -1;
                         } else {
                             /* No, flag current direction to state existence of
                              * neigbor. Remember actual distance in that direction
                              * and the index of the adjacent span as well.
                              */
-                            hs.back().set_flag(k);
-                            hs.back().neighbor_distances[k]    = dists[j];
-                            hs.back().neighbor_slab_indices[k] = indices[j];
+                            samples.back().set_flag(k);
+                            samples.back().neighbor_distances[k]    = dists[j];
+                            samples.back().neighbor_slab_indices[k] = indices[j];
                         }
                     }
                 } catch(boost::bad_lexical_cast &) {
@@ -650,12 +813,12 @@ public:
                 }
             }
         }
-
-        // do a sanity check
-        check_connectivity();
     }
 
     HeightSpanMap(Stream *stream, InstanceManager *manager) : Shape(stream, manager) {
+		m_cellOffsets = NULL;
+		m_samples = NULL;
+		m_sampleCount = 0;
 		m_aabb = AABB(stream);
 		m_name = stream->readString();
 		unsigned int meshCount = stream->readUInt();
@@ -748,39 +911,82 @@ public:
 		return sa;
 	}
 
-	struct Vertex {
-		Point p;
-		Normal n;
-		Point2 uv;
-	};
+	/// Provides the keys for merging samples with identical positions
+	struct PositionSource {
+		typedef WeldKey<3> Key;
 
-	/// For using vertices as keys in an associative structure
-	struct vertex_key_order : public 
-		std::binary_function<Vertex, Vertex, bool> {
-	public:
-		bool operator()(const Vertex &v1, const Vertex &v2) const {
-			if (v1.p.x < v2.p.x) return true;
-			else if (v1.p.x > v2.p.x) return false;
-			if (v1.p.y < v2.p.y) return true;
-			else if (v1.p.y > v2.p.y) return false;
-			if (v1.p.z < v2.p.z) return true;
-			else if (v1.p.z > v2.p.z) return false;
-			if (v1.n.x < v2.n.x) return true;
-			else if (v1.n.x > v2.n.x) return false;
-			if (v1.n.y < v2.n.y) return true;
-			else if (v1.n.y > v2.n.y) return false;
-			if (v1.n.z < v2.n.z) return true;
-			else if (v1.n.z > v2.n.z) return false;
-			if (v1.uv.x < v2.uv.x) return true;
-			else if (v1.uv.x > v2.uv.x) return false;
-			if (v1.uv.y < v2.uv.y) return true;
-			else if (v1.uv.y > v2.uv.y) return false;
-			return false;
+		const Point *positions;
+
+		inline void getKey(int32_t sample, Key &key) const {
+			const Point &p = positions[sample];
+			Float coords[3] = { p.x, p.y, p.z };
+			key.set(coords);
 		}
 	};
 
     /**
-     * Initialize the mitsube usable geometry.
+     * Triangulate the samples of the rows [rowStart, rowEnd). Every sample
+     * forms a triangle with its neighbors in each pair of adjacent directions.
+     * When \c vertexIndices is \c NULL, the triangles are only counted and
+     * all samples they reference are marked in \c used. Otherwise, they are
+     * written to \c target, where \c vertexIndices maps samples to vertices.
+     * Returns the number of triangles.
+     */
+    size_t triangulateBand(int rowStart, int rowEnd, uint8_t *used,
+            const int32_t *vertexIndices, Triangle *target, int &ignoredTris) const {
+        size_t triangleCount = 0;
+
+        for (int j=rowStart; j<rowEnd; ++j) {
+            for (int i=0; i<m_width; ++i) {
+                const uint32_t start = getCellStart(i, j), end = getCellEnd(i, j);
+                for (uint32_t s=start; s<end; ++s) {
+                    const HeightSample& hs = m_samples[s];
+                    const int k = (int) (s - start);
+                    // iterate over all four directions
+                    for (int l1=0; l1<4; ++l1) {
+                        // calculate the second point by rotating l1
+                        int l2 = (l1+1)&3;
+                        // check if there actually is a tringle
+                        if (!hs.get_flag(l1) || !hs.get_flag(l2))
+                            continue;
+                        // get the samples ending the current directions
+                        uint32_t s1, s2;
+                        if (!getNeighbor(i, j, hs, l1, s1) || !getNeighbor(i, j, hs, l2, s2)) {
+                            ++ignoredTris;
+                            continue;
+                        }
+                        // do an inverse reference test
+                        const HeightSample& hs1 = m_samples[s1];
+                        const HeightSample& hs2 = m_samples[s2];
+                        const int r1 = getNeighborIndex(l1), r2 = getNeighborIndex(l2);
+                        if (m_filterInconsistencies && (!hs1.get_flag(r1) || !hs2.get_flag(r2)
+                                                        || hs1.get_nbr_slab_idx(r1) != k
+                                                        || hs2.get_nbr_slab_idx(r2) != k)) {
+                            ++ignoredTris;
+                            continue;
+                        }
+
+                        if (vertexIndices) {
+                            Triangle &tri = target[triangleCount];
+                            tri.idx[0] = (uint32_t) vertexIndices[s];
+                            tri.idx[1] = (uint32_t) vertexIndices[s1];
+                            tri.idx[2] = (uint32_t) vertexIndices[s2];
+                        } else {
+                            /* Bands may mark the same sample concurrently,
+                               but they all store the same value */
+                            used[s] = used[s1] = used[s2] = 1;
+                        }
+                        ++triangleCount;
+                    }
+                }
+            }
+        }
+        return triangleCount;
+    }
+
+    /**
+     * Initialize the mitsube usable geometry. The map is processed in
+     * bands of rows, which are handled in parallel.
      */
     void generateGeometry(const std::string &name,
 			bool hasNormals, bool hasTexcoords,
@@ -788,122 +994,168 @@ public:
             const Transform &objectToWorld) {
 		Log(EInfo, "Loading geometry \"%s\"", name.c_str());
 
-		std::map<Vertex, int, vertex_key_order> vertexMap;
-		std::vector<Vertex> vertexBuffer;
-		size_t numMerged = 0;
+        const int bandCount = (m_height + MTS_HSPAN_BAND_ROWS - 1) / MTS_HSPAN_BAND_ROWS;
+        const size_t sampleCount = m_sampleCount;
+
+        /* Compute the position of every sample (still in file space) */
+        std::vector<Point> positions(sampleCount);
+        AABB aabb;
+
+        #pragma omp parallel
+        {
+            AABB localAABB;
+
+            #pragma omp for schedule(dynamic) nowait
+            for (int band=0; band<bandCount; ++band) {
+                int rowEnd = std::min((band + 1) * MTS_HSPAN_BAND_ROWS, m_height);
+                for (int j=band * MTS_HSPAN_BAND_ROWS; j<rowEnd; ++j) {
+                    for (int i=0; i<m_width; ++i) {
+                        for (uint32_t s=getCellStart(i, j); s<getCellEnd(i, j); ++s) {
+                            positions[s] = getSurfacePoint(i, j, m_samples[s]);
+                            localAABB.expandBy(positions[s]);
+                        }
+                    }
+                }
+            }
+
+            #pragma omp critical
+            aabb.expandBy(localAABB);
+        }
+
 		Vector translate(0.0f);
 		Float scale = 0.0f;
-        // index mapping for inverse directions
-        static int idx_trans[4] = { 2, 3, 0, 1 };
-
 		if (m_recenter) {
-			AABB aabb;
-            for (HeightSpanIterator hsi=begin(); !at_end(hsi); next(hsi)) {
-				aabb.expandBy(getSurfaceSample(hsi));
-            }
 			scale = 2/aabb.getExtents()[aabb.getLargestAxis()];
 			translate = -Vector(aabb.getCenter());
 		}
+        const Transform trafo = objectToWorld * m_fileToObject;
 
-        std::vector<Triangle> triangles;
-
-        // make sure no previous user flag is set anymore
-        clearUserFlag();
+        /* Transform the positions and count the triangles of every band */
+        std::vector<uint8_t> used(sampleCount, 0);
+        std::vector<size_t> triangleOffsets(bandCount + 1, 0);
         int ignoredTris = 0;
-		/* Collapse the mesh into a more usable form */
-        // iterate over all height spans/elements
-        for (HeightSpanIterator hsi=begin(); !at_end(hsi); next(hsi)) {
-            // get a reference to the current cell
-            HeightSample& hs = refSample(hsi);
-            // remember this vertex
-            //vertices.push_back( Point() );
-            // iterate over all four directions
-            for (int l1=0; l1<4; ++l1) {
-                // calculate the second point by rotating l1
-                int l2 = (l1+1)&3;
-                /* Check  if there actually is a tringle and if this
-                 * triangle has not been touched already.
-                 */
-                if (hs.get_flag(l1) && hs.get_flag(l2) && !hs.get_user_flag(l1)) {
-                    // alright, use this triangle and note this with a user flag
-                    hs.set_user_flag(l1);
-                    /* Get two new iterators on the points ending the
-                     * current directions.
-                     */
-                    HeightSpanIterator hsi1 = hsi;
-                    move(hsi1, l1);
-                    HeightSpanIterator hsi2 = hsi;
-                    move(hsi2, l2);
-                    // do an inverse reference test
-                    const HeightSample& hs1 = getSample(hsi1);
-                    const HeightSample& hs2 = getSample(hsi2);
-                    if (m_filterInconsistencies && (!hs1.get_flag( idx_trans[l1] ) || !hs2.get_flag( idx_trans[l2])
-                                                    || (hs1.get_nbr_slab_idx( idx_trans[l1] ) != hsi.k)
-                                                    || (hs2.get_nbr_slab_idx( idx_trans[l2] ) != hsi.k))) {
-                        ++ignoredTris;
-                        continue;
-                    }
-                    // calculate the actual positions (still in object space)
-                    std::vector<Point> pts(3);
-                    pts[0] = getSurfaceSample(hsi);
-                    pts[1] = getSurfaceSample(hsi1);
-                    pts[2] = getSurfaceSample(hsi2);
-                    Normal n = cross(pts[2] - pts[0], pts[1] - pts[0]);
-
-                    // create triangle
-                    Triangle tri;
-
-                    for (unsigned int j=0; j<3; ++j) {
-                        int key;        
-                        Vertex vertex;
- 
-                        if (m_recenter)
-                            vertex.p = objectToWorld( m_fileToObject( (pts[j] + translate) * scale ) );
-                        else
-                            vertex.p = objectToWorld( m_fileToObject( pts[j] ) );
-
-                        vertex.n = Normal(0.0f);
-					    vertex.uv = Point2(0.0f);
-
-                        if (vertexMap.find(vertex) != vertexMap.end()) {
-                            key = vertexMap[vertex];
-                            numMerged++;
-                        } else {
-                            key = (int) vertexBuffer.size();
-                            vertexMap[vertex] = (int) key;
-                            vertexBuffer.push_back(vertex);
-                        }
 
-                        tri.idx[j] = key;
-                    }
-                    triangles.push_back(tri);
-                    
-                }
+        #pragma omp parallel for schedule(dynamic) reduction(+:ignoredTris)
+        for (int band=0; band<bandCount; ++band) {
+            int rowStart = band * MTS_HSPAN_BAND_ROWS,
+                rowEnd = std::min(rowStart + MTS_HSPAN_BAND_ROWS, m_height);
+            for (uint32_t s=getCellStart(0, rowStart); s<getCellStart(0, rowEnd); ++s) {
+                if (m_recenter)
+                    positions[s] = trafo((positions[s] + translate) * scale);
+                else
+                    positions[s] = trafo(positions[s]);
             }
+            triangleOffsets[band+1] = triangulateBand(rowStart, rowEnd,
+                &used[0], NULL, NULL, ignoredTris);
         }
 
         if (ignoredTris > 0) {
-            Log(EWarn, "%i triangles have been ignored because of missing inverse connection information", ignoredTris);
+            Log(EWarn, "%i triangles have been ignored because of missing or inconsistent connection information", ignoredTris);
+        }
+
+        /* Merge samples with identical positions using a lock-free hash table.
+           It maps each distinct position to its lowest-numbered sample, hence
+           numbering these samples in order yields the same vertices for any
+           number of threads. The table is never more than half full. */
+        size_t tableSize = roundToPow2(std::max(2 * sampleCount, (size_t) 64));
+        std::vector<int32_t> table(tableSize, -1);
+        const size_t mask = tableSize - 1;
+        PositionSource source;
+        source.positions = &positions[0];
+
+        #pragma omp parallel for schedule(dynamic)
+        for (int band=0; band<bandCount; ++band) {
+            int rowStart = band * MTS_HSPAN_BAND_ROWS,
+                rowEnd = std::min(rowStart + MTS_HSPAN_BAND_ROWS, m_height);
+            volatile int32_t *tablePtr = &table[0];
+            size_t inserted = 0;
+            for (uint32_t s=getCellStart(0, rowStart); s<getCellStart(0, rowEnd); ++s) {
+                if (used[s])
+                    weldInsert(tablePtr, mask, source, (int32_t) s, inserted);
+            }
+        }
+
+        /* Find the representative of every sample. Representatives
+           are marked with the value 2 in 'used' */
+        std::vector<int32_t> vertexIndices(sampleCount, -1);
+        std::vector<size_t> vertexOffsets(bandCount + 1, 0);
+
+        #pragma omp parallel for schedule(dynamic)
+        for (int band=0; band<bandCount; ++band) {
+            int rowStart = band * MTS_HSPAN_BAND_ROWS,
+                rowEnd = std::min(rowStart + MTS_HSPAN_BAND_ROWS, m_height);
+            size_t count = 0;
+            for (uint32_t s=getCellStart(0, rowStart); s<getCellStart(0, rowEnd); ++s) {
+                if (!used[s])
+                    continue;
+                int32_t representative = weldFind(&table[0], mask, source, (int32_t) s);
+                vertexIndices[s] = representative;
+                if (representative == (int32_t) s) {
+                    used[s] = 2;
+                    ++count;
+                }
+            }
+            vertexOffsets[band+1] = count;
         }
-		
+        std::vector<int32_t>().swap(table);
+
+        for (int band=0; band<bandCount; ++band) {
+            triangleOffsets[band+1] += triangleOffsets[band];
+            vertexOffsets[band+1] += vertexOffsets[band];
+        }
+        const size_t triangleCount = triangleOffsets[bandCount],
+                     vertexCount = vertexOffsets[bandCount];
+
         ref<TriMesh> mesh = new TriMesh(name,
-			triangles.size(), vertexBuffer.size(),
+			triangleCount, vertexCount,
 			hasNormals, hasTexcoords, false,
 			m_flipNormals, m_faceNormals);
 
-		std::copy(triangles.begin(), triangles.end(), mesh->getTriangles());
-
+		Triangle *target_triangles = mesh->getTriangles();
 		Point    *target_positions = mesh->getVertexPositions();
 		Normal   *target_normals   = mesh->getVertexNormals();
 		Point2   *target_texcoords = mesh->getVertexTexcoords();
 
-		for (size_t i=0; i<vertexBuffer.size(); i++) {
-			*target_positions++ = vertexBuffer[i].p;
-			if (hasNormals)
-				*target_normals++ = vertexBuffer[i].n;
-			if (hasTexcoords)
-				*target_texcoords++ = vertexBuffer[i].uv;
-		}
+        /* Emit the representatives in sample order */
+        #pragma omp parallel for schedule(dynamic)
+        for (int band=0; band<bandCount; ++band) {
+            int rowStart = band * MTS_HSPAN_BAND_ROWS,
+                rowEnd = std::min(rowStart + MTS_HSPAN_BAND_ROWS, m_height);
+            int32_t key = (int32_t) vertexOffsets[band];
+            for (uint32_t s=getCellStart(0, rowStart); s<getCellStart(0, rowEnd); ++s) {
+                if (used[s] != 2)
+                    continue;
+                vertexIndices[s] = key;
+                target_positions[key] = positions[s];
+                if (hasNormals)
+                    target_normals[key] = Normal(0.0f);
+                if (hasTexcoords)
+                    target_texcoords[key] = Point2(0.0f);
+                ++key;
+            }
+        }
+        std::vector<Point>().swap(positions);
+
+        /* Let the remaining samples refer to their representative's vertex */
+        #pragma omp parallel for schedule(dynamic)
+        for (int band=0; band<bandCount; ++band) {
+            int rowStart = band * MTS_HSPAN_BAND_ROWS,
+                rowEnd = std::min(rowStart + MTS_HSPAN_BAND_ROWS, m_height);
+            for (uint32_t s=getCellStart(0, rowStart); s<getCellStart(0, rowEnd); ++s) {
+                if (used[s] == 1)
+                    vertexIndices[s] = vertexIndices[vertexIndices[s]];
+            }
+        }
+
+        /* Write the triangles of every band to their final location */
+        #pragma omp parallel for schedule(dynamic)
+        for (int band=0; band<bandCount; ++band) {
+            int rowStart = band * MTS_HSPAN_BAND_ROWS,
+                rowEnd = std::min(rowStart + MTS_HSPAN_BAND_ROWS, m_height),
+                unused = 0;
+            triangulateBand(rowStart, rowEnd, NULL, &vertexIndices[0],
+                target_triangles + triangleOffsets[band], unused);
+        }
 
 		mesh->incRef();
 		if (currentMaterial)
@@ -911,7 +1163,7 @@ public:
 		m_meshes.push_back(mesh);
 		Log(EInfo, "%s: Loaded " SIZE_T_FMT " triangles, " SIZE_T_FMT 
 			" vertices (merged " SIZE_T_FMT " vertices).", name.c_str(),
-			triangles.size(), vertexBuffer.size(), numMerged);
+			triangleCount, vertexCount, 3 * triangleCount - vertexCount);
 		mesh->configure();
     }
 	
@@ -926,42 +1178,17 @@ public:
 	}
 
     /**
-     * Remove any user flags that might have been set.
-     */
-    void clearUserFlag()
-    {
-        for (int i=0; i<m_width; ++i)
-            for (int j=0; j<m_height; ++j) {
-                HeightSpanType& hst = at(i,j);
-                if (hst.empty())
-                    continue;
-                for (int k=0; k < (int)hst.size(); ++k)
-                    hst[k].user_flags = 0;
-            }
-    }
-
-    /**
-     * Resize map and set size members
-     */
-	void resize(int w, int h)
-	{
-		m_width = w;
-		m_height = h;
-		m_heightSpans.resize(w * h);
-	}
-
-    /**
-     * Returns height span at position (i,j).
+     * Returns the index of the first element of the height span at position (i,j).
      */
-	HeightSpanType& at(int i, int j) {
-        return m_heightSpans[j * m_width + i];
+	uint32_t getCellStart(int i, int j) const {
+        return m_cellOffsets[j * m_width + i];
     }
 
     /**
-     * Returns const height span at position (i,y).
+     * Returns the index after the last element of the height span at position (i,j).
      */
-    const HeightSpanType& at(int i, int j) const {
-        return m_heightSpans[j * m_width + i];
+	uint32_t getCellEnd(int i, int j) const {
+        return m_cellOffsets[j * m_width + i + 1];
     }
 
     /**
@@ -996,179 +1223,95 @@ public:
 	}
 
     /**
-     * Get a the current element from the current iterator position (i.e. current height span).
-     */
-	const HeightSample& getSample(const HeightSpanIterator& hsi) const {
-         return at(hsi.i, hsi.j)[hsi.k];
-    }
-
-    /**
-     * Get current element of the passed iterator.
+     * Get the 3D position of the top of an element of the height span
+     * at position (i,j).
      */
-	HeightSample& refSample(const HeightSpanIterator& hsi) {
-        return at(hsi.i, hsi.j)[hsi.k];
-    }
-
-    /**
-     * Get the 3D position of the top of the iterators current element.
-     */
-    Point getSurfaceSample(const HeightSpanIterator& hsi) const
+    Point getSurfacePoint(int i, int j, const HeightSample& hs) const
     {
-        const HeightSample& hs = getSample(hsi);
-        return Point( hsi.x + hsi.dx * hs.dx, hsi.y + hsi.dy * hs.dy, hs.get_total_height());
+        const float dx = 1.0f/(m_width-1), dy = 1.0f/(m_height-1);
+        return Point(i * dx + dx * hs.dx, j * dy + dy * hs.dy, hs.get_total_height());
     }
 
     /**
-     * Moves the iterator hsi one step in direction l. Returns true
-     * on success and false otherwise (e.g. on border).
+     * Find the index of the element adjacent to the element hs of the
+     * height span at position (i,j) in direction l. Returns true on
+     * success and false otherwise (e.g. on border or when the reference
+     * is invalid).
      */
-	bool move(HeightSpanIterator& hsi, int l) const {
-        // get current element of iterator
-        const HeightSample& hs = getSample(hsi);
+	bool getNeighbor(int i, int j, const HeightSample& hs, int l, uint32_t &index) const {
         // return unsuccessful if there is no neighbor in in direction l
         if (!hs.get_flag(l))
             return false;
         // get distance of current element to neighbor in direction l
         int dist = hs.get_distance(l);
         // calculate index of neighbor in direction l
-        int n_i = hsi.i + dist * getDeltaX(l);
-        int n_j = hsi.j + dist * getDeltaY(l);
+        int n_i = i + dist * getDeltaX(l);
+        int n_j = j + dist * getDeltaY(l);
         // make sure the neighbor is inside the map
         if (!isInside(n_i,n_j))
             return false;
-        // move the iterator to the neighbor position
-        hsi.i  = n_i;
-        hsi.j  = n_j;
-        hsi.x += hsi.dx * dist * getDeltaX(l);
-        hsi.y += hsi.dy * dist * getDeltaY(l);
-        hsi.k  = hs.get_nbr_slab_idx(l);
+        // make sure the referenced slab exists
+        int k = hs.get_nbr_slab_idx(l);
+        uint32_t start = getCellStart(n_i, n_j);
+        if (k < 0 || start + k >= getCellEnd(n_i, n_j))
+            return false;
+        index = start + k;
         return true;
     }
 
-
-    /**
-     * Move the passed iterato to the next element, potentially in
-     * another cell. Will return true if successful, false otherwise
-     * (i.e. no more elements are on this map after the current one).
-     */
-	bool next(HeightSpanIterator& hsi) const {
-        // get current height span of iterator
-        const HeightSpanType& hst = at(hsi.i, hsi.j);
-        // check if there is a next element in current height span
-        if (hsi.k + 1 < (int)hst.size()) {
-            // yes, so increment offset within span and return successful
-            ++hsi.k;
-            return true;
-        }
-        // no, so start with zero offset and look for next span
-        hsi.k = 0;
-        while (true) {
-            // check if there is next span in height direction
-            if (hsi.j+1 == m_height) {
-                // no, reset height position information in iterator
-                hsi.j = 0;
-                hsi.y = 0; //0.5f*hsi.dy;
-                // increment width position information by span distance
-                hsi.x += hsi.dx;
-                /* Increment and check if there is a next span in width
-                 * direction.
-                 */
-                if (++hsi.i == m_width)
-                    // no, return unsuccessful
-                    return false;
-            } else {
-                // yes, go to next span in height direction
-                ++hsi.j;
-                hsi.y += hsi.dy;
-            }
-            // check if the current (just yet arrived at) span is not empy
-            if (!at(hsi.i, hsi.j).empty())
-                // it is not empty, return unsuccessful
-                return true;
-            // go to next span if not yet returned
-        }
-    }
-
-    /**
-     * Get an iterator positioned at the first element of the first
-     * span of the map.
-     */
-    HeightSpanIterator begin() const {
-        int i,j;
-        bool found = false;
-        /* Walk the map, until the first heigt span with at least
-         * one element is found.
-         */
-        for (i=0; !found && i<m_width; ++i)
-            for (j=0; !found && j<m_height; ++j) {
-                const HeightSpanType& hst = at(i,j);
-                // are some elements in this cell?
-                if (!hst.empty())
-                    // yes, cool, return this cell/height span
-                    return HeightSpanIterator(1.0f/(m_width-1), 1.0f/(m_height-1), i, j);
-            }
-        // no height spans fourd and hence no snow found, complain!
-        Log(EError, "Oops, no height sample found in map");
-        // return dummy iterator
-        return HeightSpanIterator(1.0f/(m_width-1), 1.0f/(m_height-1), -1, -1);
-    }
-
-    /**
-     * Check if the iterator is after the last element, i.e. the end.
-     */
-    bool at_end(const HeightSpanIterator& hsi) const
-    {
-        // we are at the end if the width index is out of range
-        return hsi.i == m_width;
-    }
-
     /**
      *  Does a sanity check for the interconnection of elemennts.
      */
-    void check_connectivity() {
-        /* start with first element of first height span and walk
-         * elementwise through the map.
-         */
-        for (HeightSpanIterator hsi=begin(); !at_end(hsi); next(hsi)) {
-            // get the current element of the current iterator position
-            const HeightSample& hs = getSample(hsi);
-            // iterate over all four neigbor directions
-            for (int l=0; l<4; ++l) {
-                // check if there is a neighbor in the current direction
-                if (hs.get_flag(l)) {
-                    // yes, check for its index
-                    if (hs.get_nbr_slab_idx(l) == -1) {
-                        // inconsistency detected, no valid index found
-                        Log(EWarn, "Inconsistend nbr slab index and flag");
-                        continue;
-                    }
-                    // A distance below one is not allowed to neighbors, check for it
-                    if (hs.get_distance(l) < 1) {
-                        Log(EWarn, "Invalid neighbor distance");
-                        continue;
-                    }
-                    // get indices of current neighbor
-                    int n_i = hsi.i + getDeltaX(l) * hs.get_distance(l);
-                    int n_j = hsi.j + getDeltaY(l) * hs.get_distance(l);
-                    // check if it is inside map index bounds.
-                    if (!isInside(n_i, n_j)) {
-                        // it is not, complain!
-                        Log(EWarn, "reference to neighbor outside of valid range");
-                        continue;
-                    }
-                    // get actual neigboring element
-                    HeightSpanType& n_hst = at(n_i,n_j);
-                    /* Check if our slab reference is larger than number of
-                     * slabs in referenced cell.
-                     */
-                    if (hs.get_nbr_slab_idx(l) >= (int)n_hst.size()) {
-                        // it is larger, complain!
-                        std::stringstream err;
-                        err << "(" << hsi.i << "," << hsi.j << "): reference to (dir: " << l << ") neighbor ("
-                            << n_i << "," << n_j << ") slab " << hs.get_nbr_slab_idx(l)
-                            << " outside of valid range [0," << n_hst.size() << "[";
-                        Log(EWarn, err.str().c_str());
-                        continue;
+    void check_connectivity() const {
+        if (m_sampleCount == 0) {
+            // no height spans fourd and hence no snow found, complain!
+            Log(EError, "Oops, no height sample found in map");
+        }
+        // walk elementwise through the map.
+        for (int j=0; j<m_height; ++j) {
+            for (int i=0; i<m_width; ++i) {
+                for (uint32_t s=getCellStart(i, j); s<getCellEnd(i, j); ++s) {
+                    // get the current element
+                    const HeightSample& hs = m_samples[s];
+                    // iterate over all four neigbor directions
+                    for (int l=0; l<4; ++l) {
+                        // check if there is a neighbor in the current direction
+                        if (hs.get_flag(l)) {
+                            // yes, check for its index
+                            if (hs.get_nbr_slab_idx(l) == -1) {
+                                // inconsistency detected, no valid index found
+                                Log(EWarn, "Inconsistend nbr slab index and flag");
+                                continue;
+                            }
+                            // A distance below one is not allowed to neighbors, check for it
+                            if (hs.get_distance(l) < 1) {
+                                Log(EWarn, "Invalid neighbor distance");
+                                continue;
+                            }
+                            // get indices of current neighbor
+                            int n_i = i + getDeltaX(l) * hs.get_distance(l);
+                            int n_j = j + getDeltaY(l) * hs.get_distance(l);
+                            // check if it is inside map index bounds.
+                            if (!isInside(n_i, n_j)) {
+                                // it is not, complain!
+                                Log(EWarn, "reference to neighbor outside of valid range");
+                                continue;
+                            }
+                            // get the number of elements of the neighboring height span
+                            int n_size = (int) (getCellEnd(n_i, n_j) - getCellStart(n_i, n_j));
+                            /* Check if our slab reference is larger than number of
+                             * slabs in referenced cell.
+                             */
+                            if (hs.get_nbr_slab_idx(l) >= n_size) {
+                                // it is larger, complain!
+                                std::stringstream err;
+                                err << "(" << i << "," << j << "): reference to (dir: " << l << ") neighbor ("
+                                    << n_i << "," << n_j << ") slab " << hs.get_nbr_slab_idx(l)
+                                    << " outside of valid range [0," << n_size << "[";
+                                Log(EWarn, err.str().c_str());
+                                continue;
+                            }
+                        }
                     }
                 }
             }
@@ -1181,12 +1324,23 @@ private:
 	std::vector<TriMesh *> m_meshes;
 	std::map<std::string, BSDF *> m_materials;
 	bool m_flipNormals, m_faceNormals, m_recenter, m_filterInconsistencies;
+	bool m_writeBinary;
 	std::string m_name;
 	AABB m_aabb;
     // dimensions of the map
     int m_width, m_height;
-    // the actual map, saved in a linear collection.
-	std::vector<HeightSpanType> m_heightSpans;
+    /* The height spans in compressed row storage: the elements of the
+     * height span at position (i,j) are m_samples[m_cellOffsets[j*m_width+i]]
+     * up to (excluding) m_samples[m_cellOffsets[j*m_width+i+1]]. The arrays
+     * either refer to the storage vectors or to a memory mapped binary file.
+     * They are only available while the geometry is generated.
+     */
+    const uint32_t *m_cellOffsets;
+    const HeightSample *m_samples;
+    size_t m_sampleCount;
+    std::vector<uint32_t> m_offsetStorage;
+    std::vector<HeightSample> m_sampleStorage;
+    ref<MemoryMappedFile> m_mappedFile;
     /* the transformation used to convert file data
      * to actuel 3d space data.
      */
@@ -20,17 +20,213 @@
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/core/timer.h>
+#include <mitsuba/core/mmap.h>
+#include <mitsuba/core/atomic.h>
 #include <mitsuba/render/luminaire.h>
 #include <mitsuba/render/bsdf.h>
 #include <mitsuba/render/subsurface.h>
 #include <mitsuba/render/medium.h>
-#include <boost/lexical_cast.hpp>
 #include <set>
+#include "weld.h"
+
+/// Approximate size of the file chunks that are handed to the parser threads
+#define MTS_OBJ_CHUNK_SIZE (1024*1024)
+
+/// Number of triangles that are processed at a time while merging vertices
+#define MTS_OBJ_WELD_BLOCK_SIZE 16384
+
+/// Marks a face corner without a normal or texture coordinate
+#define MTS_OBJ_NO_INDEX 0xFFFFFFFFu
 
 MTS_NAMESPACE_BEGIN
 
+/* Whitespace within a line. Backslashes only occur as line
+   continuations and are treated like the line break they escape */
+static inline bool isSpace(char c) {
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\\';
+}
+
+static inline bool isDigit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+static inline void skipSpace(const char *&ptr, const char *end) {
+	while (ptr < end && isSpace(*ptr))
+		++ptr;
+}
+
+/**
+ * Return the end of the line containing \c ptr, while skipping
+ * over line breaks that are escaped with a backslash. \c begin
+ * denotes the start of the file.
+ */
+static const char *findLineEnd(const char *ptr, const char *begin, const char *end) {
+	while (true) {
+		const char *lineBreak = (const char *) memchr(ptr, '\n', end - ptr);
+		if (!lineBreak)
+			return end;
+		const char *last = lineBreak;
+		while (last > begin && (last[-1] == ' ' || last[-1] == '\t' || last[-1] == '\r'))
+			--last;
+		if (last > begin && last[-1] == '\\') {
+			ptr = lineBreak + 1;
+			continue;
+		}
+		return lineBreak;
+	}
+}
+
+/**
+ * Parse a floating point value. Numbers with at most 15 significant
+ * digits and small exponents are converted exactly using a single
+ * multiplication or division, anything else is passed to strtod().
+ * A missing value is interpreted as zero.
+ */
+static bool parseFloat(const char *&ptr, const char *end, Float &result) {
+	static const double powersOfTen[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	skipSpace(ptr, end);
+	if (ptr == end) {
+		result = 0;
+		return true;
+	}
+
+	const char *cur = ptr;
+	bool negative = false, valid = false;
+	if (*cur == '-' || *cur == '+')
+		negative = *cur++ == '-';
+
+	uint64_t mantissa = 0;
+	int digits = 0, exponent = 0;
+	while (cur < end && isDigit(*cur)) {
+		if (digits < 19) {
+			mantissa = mantissa * 10 + (*cur - '0');
+			digits += mantissa != 0 ? 1 : 0;
+		} else {
+			exponent++;
+		}
+		valid = true;
+		++cur;
+	}
+	if (cur < end && *cur == '.') {
+		++cur;
+		while (cur < end && isDigit(*cur)) {
+			if (digits < 19) {
+				mantissa = mantissa * 10 + (*cur - '0');
+				digits += mantissa != 0 ? 1 : 0;
+				exponent--;
+			}
+			valid = true;
+			++cur;
+		}
+	}
+	if (valid && cur < end && (*cur == 'e' || *cur == 'E')) {
+		bool negativeExponent = false;
+		int value = 0;
+		++cur;
+		if (cur < end && (*cur == '-' || *cur == '+'))
+			negativeExponent = *cur++ == '-';
+		if (cur == end || !isDigit(*cur))
+			valid = false;
+		while (cur < end && isDigit(*cur)) {
+			if (value < 10000)
+				value = value * 10 + (*cur - '0');
+			++cur;
+		}
+		exponent += negativeExponent ? -value : value;
+	}
+
+	if (valid && (cur == end || isSpace(*cur)) && mantissa < ((uint64_t) 1 << 53)
+			&& exponent >= -22 && exponent <= 22) {
+		double value = (double) mantissa;
+		if (exponent < 0)
+			value /= powersOfTen[-exponent];
+		else
+			value *= powersOfTen[exponent];
+		result = (Float) (negative ? -value : value);
+		ptr = cur;
+		return true;
+	}
+
+	/* Slow path (the file contents are not null-terminated) */
+	char buf[64];
+	size_t length = 0;
+	while (ptr + length < end && !isSpace(ptr[length]) && length < sizeof(buf) - 1) {
+		buf[length] = ptr[length];
+		++length;
+	}
+	buf[length] = '\0';
+	char *endPtr = NULL;
+	double value = strtod(buf, &endPtr);
+	if (length == 0 || endPtr != buf + length)
+		return false;
+	result = (Float) value;
+	ptr += length;
+	return true;
+}
+
+/**
+ * Parse a one-based (or negative, i.e. relative) OBJ index and
+ * convert it into an array index. \c count specifies how many
+ * elements of the referenced kind have been defined so far.
+ */
+static bool parseIndex(const char *&ptr, const char *end, size_t count, uint32_t &result) {
+	bool negative = false;
+	if (ptr < end && (*ptr == '-' || *ptr == '+'))
+		negative = *ptr++ == '-';
+	if (ptr == end || !isDigit(*ptr))
+		return false;
+	uint64_t value = 0;
+	while (ptr < end && isDigit(*ptr)) {
+		if (value < (uint64_t) MTS_OBJ_NO_INDEX)
+			value = value * 10 + (*ptr - '0');
+		++ptr;
+	}
+	if (value == 0)
+		return false;
+	if (negative) {
+		if (value > count)
+			return false;
+		value = count - value;
+	} else {
+		value -= 1;
+	}
+	if (value >= (uint64_t) MTS_OBJ_NO_INDEX)
+		return false;
+	result = (uint32_t) value;
+	return true;
+}
+
+/// Return the remainder of a line without line continuations and surrounding whitespace
+static std::string lineArgument(const char *ptr, const char *end) {
+	std::string result;
+	result.reserve(end - ptr);
+	for (; ptr < end; ++ptr) {
+		if (*ptr == '\\') {
+			const char *next = ptr + 1;
+			while (next < end && (*next == ' ' || *next == '\t' || *next == '\r'))
+				++next;
+			if (next < end && *next == '\n') {
+				ptr = next;
+				continue;
+			}
+		}
+		result += *ptr;
+	}
+	return trim(result);
+}
+
 /**
  * Wavefront OBJ triangle mesh loader
+ *
+ * The file is memory-mapped and split into chunks at line boundaries,
+ * which are then parsed in parallel. A first pass only counts the
+ * elements in each chunk, which allows the second pass to store them
+ * directly at their final position. Group and material statements
+ * are recorded and processed in file order afterwards.
  */
 class WavefrontOBJ : public Shape {
 public:
@@ -40,35 +236,44 @@ public:
 		unsigned int uv[3];
 	};
 
-	bool fetch_line(std::istream &is, std::string &line) {
-		/// Fetch a line from the stream, while handling line breaks with backslashes
-		if (!std::getline(is, line))
-			return false;
-		if (line == "")
-			return true;
-		int lastCharacter = (int) line.size() - 1;
-		while (lastCharacter >= 0 && 
-				(line[lastCharacter] == '\r' ||
-					line[lastCharacter] == '\n' ||
-					line[lastCharacter] == '\t' ||
-					line[lastCharacter] == ' '))
-			lastCharacter--;
-
-		if (lastCharacter >= 0 && line[lastCharacter] == '\\') {
-			std::string nextLine;
-			fetch_line(is, nextLine);
-			line = line.substr(0, lastCharacter) + nextLine;
-		} else {
-			line.resize(lastCharacter+1);
-		}
-		return true;
-	}
+	enum ELineType {
+		EOther = 0,
+		EVertex,
+		ENormal,
+		ETexcoord,
+		EFace,
+		EGroup,
+		EUseMaterial,
+		EMaterialLibrary
+	};
+
+	/// Group or material statement, which is processed after parsing
+	struct OBJDirective {
+		ELineType type;
+		/// Number of triangles that precede the statement
+		size_t triangle;
+		std::string argument;
+
+		inline OBJDirective(ELineType type, size_t triangle, const std::string &argument)
+			: type(type), triangle(triangle), argument(argument) { }
+	};
+
+	/// Range of lines that is parsed by a single thread
+	struct OBJChunk {
+		const char *start, *end;
+		/// Number of vertices, normals, texture coordinates and triangles
+		size_t counts[4];
+		/// Index of the first vertex, normal, texture coordinate and triangle
+		size_t offsets[4];
+		std::vector<OBJDirective> directives;
+		std::string error;
+	};
 
 	WavefrontOBJ(const Properties &props) : Shape(props) {
 		FileResolver *fResolver = Thread::getThread()->getFileResolver();
 		fs::path path = fResolver->resolve(props.getString("filename"));
 		m_name = path.stem();
-	
+
 		/* By default, any existing normals will be used for
 		   rendering. If no normals are found, Mitsuba will
 		   automatically generate smooth vertex normals. 
@@ -85,124 +290,145 @@ public:
 		/* Causes all normals to be flipped */
 		m_flipNormals = props.getBoolean("flipNormals", false);
 
+		/* Store the vertex attributes in compact form once 
+		   configured (see \ref TriMesh::compactAttributes()) */
+		m_compactAttributes = props.getBoolean("compactAttributes", false);
+
 		/* Object-space -> World-space transformation */
 		Transform objectToWorld = props.getTransform("toWorld", Transform());
 
 		/* Load the geometry */
 		Log(EInfo, "Loading geometry from \"%s\" ..", path.leaf().c_str());
-		fs::ifstream is(path);
-		if (is.bad() || is.fail())
+		if (!fs::exists(path))
 			Log(EError, "Geometry file '%s' not found!", path.file_string().c_str());
 
 		ref<Timer> timer = new Timer();
-		std::string buf;
-		std::vector<Point> vertices;
-		std::vector<Normal> normals;
-		std::vector<Point2> texcoords;
-		std::vector<OBJTriangle> triangles;
-		bool hasNormals = false, hasTexcoords = false;
-		bool firstVertex = true;
+		ref<MemoryMappedFile> mmap;
+		const char *begin = NULL, *end = NULL;
+		if (fs::file_size(path) > 0) {
+			mmap = new MemoryMappedFile(path);
+			begin = static_cast<const char *>(mmap->getData());
+			end = begin + mmap->getSize();
+		}
+
+		/* Split the file into chunks that end at line boundaries */
+		size_t size = (size_t) (end - begin),
+			chunkCount = std::max((size_t) 1, size / MTS_OBJ_CHUNK_SIZE);
+		std::vector<OBJChunk> chunks(chunkCount);
+		const char *chunkStart = begin;
+		for (size_t i=0; i<chunkCount; ++i) {
+			const char *chunkEnd = end;
+			if (i+1 < chunkCount) {
+				chunkEnd = std::max(chunkStart, begin + (size / chunkCount) * (i+1));
+				chunkEnd = findLineEnd(chunkEnd, begin, end);
+				if (chunkEnd < end)
+					++chunkEnd;
+			}
+			chunks[i].start = chunkStart;
+			chunks[i].end = chunkEnd;
+			chunkStart = chunkEnd;
+		}
+
+		/* First pass: count the elements of each chunk */
+		#pragma omp parallel for schedule(dynamic)
+		for (int i=0; i<(int) chunkCount; ++i)
+			countChunk(chunks[i], begin);
+		checkChunks(chunks, path);
+
+		size_t totals[4] = { 0, 0, 0, 0 };
+		for (size_t i=0; i<chunkCount; ++i) {
+			for (int j=0; j<4; ++j) {
+				chunks[i].offsets[j] = totals[j];
+				totals[j] += chunks[i].counts[j];
+			}
+		}
+
+		std::vector<Point> vertices(totals[0]);
+		std::vector<Normal> normals(totals[1]);
+		std::vector<Point2> texcoords(totals[2]);
+		std::vector<OBJTriangle> triangles(totals[3]);
+
+		/* Second pass: parse the chunks directly into the final arrays */
+		#pragma omp parallel for schedule(dynamic)
+		for (int i=0; i<(int) chunkCount; ++i)
+			parseChunk(chunks[i], begin, vertices.empty() ? NULL : &vertices[0],
+				normals.empty() ? NULL : &normals[0],
+				texcoords.empty() ? NULL : &texcoords[0],
+				triangles.empty() ? NULL : &triangles[0]);
+		checkChunks(chunks, path);
+		mmap = NULL;
+
+		unsigned int parseTime = timer->getMilliseconds();
+		Log(EDebug, "Parsed " SIZE_T_FMT " vertices, " SIZE_T_FMT " normals, " SIZE_T_FMT
+			" texture coordinates and " SIZE_T_FMT " triangles in %i ms (" SIZE_T_FMT
+			" chunks, %.1f MiB/s)", totals[0], totals[1], totals[2], totals[3], parseTime,
+			chunkCount, size / (1024.0 * 1024.0) / std::max(parseTime, 1u) * 1000);
+
 		BSDF *currentMaterial = NULL;
-		std::string name = m_name, line;
+		std::string name = m_name;
 		std::set<std::string> geomNames;
 		int geomIdx = 0;
 		bool nameBeforeGeometry = false;
+		size_t groupStart = 0;
 
-		while (is.good() && !is.eof() && fetch_line(is, line)) {
-			std::istringstream iss(line);
-			if (!(iss >> buf))
-				continue;
+		for (size_t i=0; i<chunkCount; ++i) {
+			for (size_t j=0; j<chunks[i].directives.size(); ++j) {
+				const OBJDirective &directive = chunks[i].directives[j];
+				size_t triangle = chunks[i].offsets[3] + directive.triangle;
 
-			if (buf == "v") {
-				/* Parse + transform vertices */
-				Point p;
-				iss >> p.x >> p.y >> p.z;
-				vertices.push_back(p);
-			} else if (buf == "vn") {
-				Normal n;
-				iss >> n.x >> n.y >> n.z;
-				normals.push_back(n);
-				hasNormals = true;
-			} else if (buf == "g") {
-				std::string targetName;
-				std::string newName = trim(line.substr(1, line.length()-1));
-
-				/* There appear to be two different conventions
-				   for specifying object names in OBJ file -- try
-				   to detect which one is being used */
-				if (nameBeforeGeometry)
-					// Save geometry under the previously specified name
-					targetName = name;
-				else
-					targetName = newName;
-
-				if (triangles.size() > 0) {
-					/// make sure that we have unique names
-					if (geomNames.find(targetName) != geomNames.end())
-						name = formatString("%s_%i", targetName.c_str(), geomIdx);
-					generateGeometry(targetName, vertices, normals, texcoords, 
-						triangles, hasNormals, hasTexcoords, currentMaterial,
-						objectToWorld);
-					triangles.clear();
-					geomNames.insert(name);
-					geomIdx++;
-					hasNormals = false;
-					hasTexcoords = false;
-					firstVertex = false;
-				} else {
-					nameBeforeGeometry = true;
-				}
-				name = newName;
-			} else if (buf == "usemtl") {
-				std::string materialName = trim(line.substr(6, line.length()-1));
-				if (m_materials.find(materialName) != m_materials.end()) {
-					currentMaterial = m_materials[materialName];
-				} else {
-					Log(EWarn, "Unable to find material %s", materialName.c_str());
-					currentMaterial = NULL;
-				}
-			} else if (buf == "mtllib") {
-				ref<FileResolver> frClone = fResolver->clone();
-				frClone->addPath(fs::complete(path).parent_path());
-				fs::path mtlName = frClone->resolve(trim(line.substr(6, line.length()-1)));
-				if (fs::exists(mtlName))
-					parseMaterials(mtlName);
-				else
-					Log(EWarn, "Could not find referenced material library '%s'", 
-						mtlName.file_string().c_str());
-			} else if (buf == "vt") {
-				Float u, v, w;
-				iss >> u >> v >> w;
-				texcoords.push_back(Point2(u, v));
-				hasTexcoords = true;
-			} else if (buf == "f") {
-				std::string  tmp;
-				firstVertex = true;
-				OBJTriangle t;
-				iss >> tmp; parse(t, 0, tmp);
-				iss >> tmp; parse(t, 1, tmp);
-				iss >> tmp; parse(t, 2, tmp);
-				triangles.push_back(t);
-				if (iss >> tmp) {
-					parse(t, 1, tmp);
-					std::swap(t.p[0], t.p[1]);
-					std::swap(t.uv[0], t.uv[1]);
-					std::swap(t.n[0], t.n[1]);
-					triangles.push_back(t);
+				if (directive.type == EGroup) {
+					std::string targetName;
+					const std::string &newName = directive.argument;
+
+					/* There appear to be two different conventions
+					   for specifying object names in OBJ file -- try
+					   to detect which one is being used */
+					if (nameBeforeGeometry)
+						// Save geometry under the previously specified name
+						targetName = name;
+					else
+						targetName = newName;
+
+					if (triangle > groupStart) {
+						/// make sure that we have unique names
+						if (geomNames.find(targetName) != geomNames.end())
+							name = formatString("%s_%i", targetName.c_str(), geomIdx);
+						generateGeometry(targetName, vertices, normals, texcoords,
+							triangles, groupStart, triangle, currentMaterial,
+							objectToWorld);
+						groupStart = triangle;
+						geomNames.insert(name);
+						geomIdx++;
+					} else {
+						nameBeforeGeometry = true;
+					}
+					name = newName;
+				} else if (directive.type == EUseMaterial) {
+					const std::string &materialName = directive.argument;
+					if (m_materials.find(materialName) != m_materials.end()) {
+						currentMaterial = m_materials[materialName];
+					} else {
+						Log(EWarn, "Unable to find material %s", materialName.c_str());
+						currentMaterial = NULL;
+					}
+				} else if (directive.type == EMaterialLibrary) {
+					ref<FileResolver> frClone = fResolver->clone();
+					frClone->addPath(fs::complete(path).parent_path());
+					fs::path mtlName = frClone->resolve(directive.argument);
+					if (fs::exists(mtlName))
+						parseMaterials(mtlName);
+					else
+						Log(EWarn, "Could not find referenced material library '%s'",
+							mtlName.file_string().c_str());
 				}
-				if (iss >> tmp)
-					Log(EError, "Encountered an n-gon (with n>4)! Only "
-						"triangles and quads are supported by the OBJ loader.");
-			} else {
-				/* Ignore */
 			}
 		}
 		if (geomNames.find(name) != geomNames.end())
 			/// make sure that we have unique names
 			name = formatString("%s_%i", m_name.c_str(), geomIdx);
 
-		generateGeometry(name, vertices, normals, texcoords, 
-			triangles, hasNormals, hasTexcoords, currentMaterial,
+		generateGeometry(name, vertices, normals, texcoords,
+			triangles, groupStart, triangles.size(), currentMaterial,
 			objectToWorld);
 
 		Log(EInfo, "Done with \"%s\" (took %i ms)", path.leaf().c_str(), timer->getMilliseconds());
@@ -218,6 +444,8 @@ public:
 			m_meshes[i] = static_cast<TriMesh *>(manager->getInstance(stream));
 			m_meshes[i]->incRef();
 		}
+		/* The meshes are transferred in their final representation */
+		m_compactAttributes = false;
 	}
 
 	void serialize(Stream *stream, InstanceManager *manager) const {
@@ -230,24 +458,191 @@ public:
 			manager->serialize(stream, m_meshes[i]);
 	}
 
-	void parse(OBJTriangle &t, int i, const std::string &str) {
-		std::vector<std::string> tokens = tokenize(str, "/");
-		if (tokens.size() == 1) {
-			t.p[i] = boost::lexical_cast<int>(tokens[0].c_str())-1;
-		} else if (tokens.size() == 2) {
-			if (str.find("//") == std::string::npos) {
-				t.p[i]  = boost::lexical_cast<int>(tokens[0].c_str())-1;
-				t.uv[i] = boost::lexical_cast<int>(tokens[1].c_str())-1;
+	/// Determine the type of a line and advance \c ptr past its keyword
+	static ELineType classifyLine(const char *&ptr, const char *end) {
+		skipSpace(ptr, end);
+		const char *keyword = ptr;
+		while (ptr < end && !isSpace(*ptr))
+			++ptr;
+
+		switch (ptr - keyword) {
+			case 1:
+				if (keyword[0] == 'v')
+					return EVertex;
+				else if (keyword[0] == 'f')
+					return EFace;
+				else if (keyword[0] == 'g')
+					return EGroup;
+				break;
+			case 2:
+				if (keyword[0] == 'v' && keyword[1] == 'n')
+					return ENormal;
+				else if (keyword[0] == 'v' && keyword[1] == 't')
+					return ETexcoord;
+				break;
+			case 6:
+				if (strncmp(keyword, "usemtl", 6) == 0)
+					return EUseMaterial;
+				else if (strncmp(keyword, "mtllib", 6) == 0)
+					return EMaterialLibrary;
+				break;
+		}
+		return EOther;
+	}
+
+	/**
+	 * Parse a face corner of the form "p", "p/uv", "p//n" or "p/uv/n".
+	 * The running element counts are required to resolve relative indices.
+	 */
+	static bool parseCorner(const char *&ptr, const char *end,
+			const size_t *counts, uint32_t &p, uint32_t &n, uint32_t &uv) {
+		n = uv = MTS_OBJ_NO_INDEX;
+		if (!parseIndex(ptr, end, counts[0], p))
+			return false;
+		if (ptr < end && *ptr == '/') {
+			++ptr;
+			if (ptr < end && *ptr == '/') {
+				++ptr;
+				if (!parseIndex(ptr, end, counts[1], n))
+					return false;
 			} else {
-				t.p[i] = boost::lexical_cast<int>(tokens[0].c_str())-1;
-				t.n[i] = boost::lexical_cast<int>(tokens[1].c_str())-1;
+				if (!parseIndex(ptr, end, counts[2], uv))
+					return false;
+				if (ptr < end && *ptr == '/') {
+					++ptr;
+					if (ptr < end && !isSpace(*ptr) && !parseIndex(ptr, end, counts[1], n))
+						return false;
+				}
 			}
-		} else if (tokens.size() == 3) {
-			t.p[i] = boost::lexical_cast<int>(tokens[0].c_str())-1;
-			t.uv[i] = boost::lexical_cast<int>(tokens[1].c_str())-1;
-			t.n[i] = boost::lexical_cast<int>(tokens[2].c_str())-1;
-		} else {
-			Log(EError, "Invalid OBJ face format!");
+		}
+		return ptr == end || isSpace(*ptr);
+	}
+
+	/// First pass: count the elements of a chunk and record its directives
+	void countChunk(OBJChunk &chunk, const char *begin) const {
+		memset(chunk.counts, 0, sizeof(chunk.counts));
+		const char *ptr = chunk.start;
+
+		while (ptr < chunk.end) {
+			const char *eol = findLineEnd(ptr, begin, chunk.end), *cur = ptr;
+			ELineType type = classifyLine(cur, eol);
+
+			switch (type) {
+				case EVertex: chunk.counts[0]++; break;
+				case ENormal: chunk.counts[1]++; break;
+				case ETexcoord: chunk.counts[2]++; break;
+				case EFace: {
+						int cornerCount = 0;
+						while (true) {
+							skipSpace(cur, eol);
+							if (cur == eol)
+								break;
+							++cornerCount;
+							while (cur < eol && !isSpace(*cur))
+								++cur;
+						}
+						if (cornerCount > 4) {
+							chunk.error = "Encountered an n-gon (with n>4)! Only "
+								"triangles and quads are supported by the OBJ loader.";
+							return;
+						} else if (cornerCount < 3) {
+							chunk.error = "Invalid OBJ face format!";
+							return;
+						}
+						chunk.counts[3] += cornerCount - 2;
+					}
+					break;
+				case EGroup:
+				case EUseMaterial:
+				case EMaterialLibrary:
+					chunk.directives.push_back(OBJDirective(type,
+						chunk.counts[3], lineArgument(cur, eol)));
+					break;
+				default:
+					/* Ignore */
+					break;
+			}
+			ptr = eol + 1;
+		}
+	}
+
+	/// Second pass: parse a chunk into the final arrays
+	void parseChunk(OBJChunk &chunk, const char *begin, Point *vertices, Normal *normals,
+			Point2 *texcoords, OBJTriangle *triangles) const {
+		size_t counts[4];
+		memcpy(counts, chunk.offsets, sizeof(counts));
+		const char *ptr = chunk.start;
+
+		while (ptr < chunk.end) {
+			const char *eol = findLineEnd(ptr, begin, chunk.end), *cur = ptr;
+			bool success = true;
+
+			switch (classifyLine(cur, eol)) {
+				case EVertex: {
+						Point &p = vertices[counts[0]++];
+						success = parseFloat(cur, eol, p.x) && parseFloat(cur, eol, p.y)
+							&& parseFloat(cur, eol, p.z);
+					}
+					break;
+				case ENormal: {
+						Normal &n = normals[counts[1]++];
+						success = parseFloat(cur, eol, n.x) && parseFloat(cur, eol, n.y)
+							&& parseFloat(cur, eol, n.z);
+					}
+					break;
+				case ETexcoord: {
+						Point2 &uv = texcoords[counts[2]++];
+						success = parseFloat(cur, eol, uv.x) && parseFloat(cur, eol, uv.y);
+					}
+					break;
+				case EFace: {
+						uint32_t p[4], n[4], uv[4];
+						int cornerCount = 0;
+						while (success) {
+							skipSpace(cur, eol);
+							if (cur == eol)
+								break;
+							success = cornerCount < 4 && parseCorner(cur, eol, counts,
+								p[cornerCount], n[cornerCount], uv[cornerCount]);
+							++cornerCount;
+						}
+						if (!success)
+							break;
+
+						OBJTriangle &t = triangles[counts[3]++];
+						for (int i=0; i<3; ++i) {
+							t.p[i] = p[i]; t.n[i] = n[i]; t.uv[i] = uv[i];
+						}
+						if (cornerCount == 4) {
+							/* Split the quad along the diagonal between corners 0 and 2 */
+							const int order[3] = { 3, 0, 2 };
+							OBJTriangle &t2 = triangles[counts[3]++];
+							for (int i=0; i<3; ++i) {
+								t2.p[i] = p[order[i]]; t2.n[i] = n[order[i]];
+								t2.uv[i] = uv[order[i]];
+							}
+						}
+					}
+					break;
+				default:
+					break;
+			}
+
+			if (!success) {
+				chunk.error = formatString("Could not parse the line \"%s\"",
+					lineArgument(ptr, eol).c_str());
+				return;
+			}
+			ptr = eol + 1;
+		}
+	}
+
+	/// Raise an error if any of the chunks could not be parsed
+	void checkChunks(const std::vector<OBJChunk> &chunks, const fs::path &path) const {
+		for (size_t i=0; i<chunks.size(); ++i) {
+			if (!chunks[i].error.empty())
+				Log(EError, "Error while loading \"%s\": %s", path.leaf().c_str(),
+					chunks[i].error.c_str());
 		}
 	}
 
@@ -292,34 +687,36 @@ public:
 		m_materials[name] = bsdf;
 	}
 
-	struct Vertex {
-		Point p;
-		Normal n;
-		Point2 uv;
-	};
+	/// Provides the vertex keys of the face corners in a group
+	struct CornerSource {
+		/// Bit-level representation of a position, normal and texture coordinates
+		typedef WeldKey<8> Key;
 
-	/// For using vertices as keys in an associative structure
-	struct vertex_key_order : public 
-		std::binary_function<Vertex, Vertex, bool> {
-	public:
-		bool operator()(const Vertex &v1, const Vertex &v2) const {
-			if (v1.p.x < v2.p.x) return true;
-			else if (v1.p.x > v2.p.x) return false;
-			if (v1.p.y < v2.p.y) return true;
-			else if (v1.p.y > v2.p.y) return false;
-			if (v1.p.z < v2.p.z) return true;
-			else if (v1.p.z > v2.p.z) return false;
-			if (v1.n.x < v2.n.x) return true;
-			else if (v1.n.x > v2.n.x) return false;
-			if (v1.n.y < v2.n.y) return true;
-			else if (v1.n.y > v2.n.y) return false;
-			if (v1.n.z < v2.n.z) return true;
-			else if (v1.n.z > v2.n.z) return false;
-			if (v1.uv.x < v2.uv.x) return true;
-			else if (v1.uv.x > v2.uv.x) return false;
-			if (v1.uv.y < v2.uv.y) return true;
-			else if (v1.uv.y > v2.uv.y) return false;
-			return false;
+		const OBJTriangle *triangles;
+		const Point *vertices;
+		const Normal *normals;
+		const Point2 *texcoords;
+		bool hasNormals, hasTexcoords;
+
+		inline void getKey(int32_t corner, Key &key) const {
+			const OBJTriangle &tri = triangles[corner / 3];
+			const int i = corner % 3;
+			Float values[8];
+			const Point &p = vertices[tri.p[i]];
+			values[0] = p.x; values[1] = p.y; values[2] = p.z;
+			if (hasNormals && tri.n[i] != MTS_OBJ_NO_INDEX) {
+				const Normal &n = normals[tri.n[i]];
+				values[3] = n.x; values[4] = n.y; values[5] = n.z;
+			} else {
+				values[3] = values[4] = values[5] = 0;
+			}
+			if (hasTexcoords && tri.uv[i] != MTS_OBJ_NO_INDEX) {
+				const Point2 &uv = texcoords[tri.uv[i]];
+				values[6] = uv.x; values[7] = uv.y;
+			} else {
+				values[6] = values[7] = 0;
+			}
+			key.set(values);
 		}
 	};
 
@@ -328,98 +725,211 @@ public:
 			const std::vector<Normal> &normals,
 			const std::vector<Point2> &texcoords,
 			const std::vector<OBJTriangle> &triangles,
-			bool hasNormals, bool hasTexcoords,
+			size_t triangleStart, size_t triangleEnd,
 			BSDF *currentMaterial,
 			const Transform &objectToWorld) {
-		if (triangles.size() == 0)
+		if (triangleEnd == triangleStart)
 			return;
 		Log(EInfo, "Loading mesh \"%s\"", name.c_str());
 
-		std::map<Vertex, int, vertex_key_order> vertexMap;
-		std::vector<Vertex> vertexBuffer;
-		size_t numMerged = 0;
-		Vector translate(0.0f);
-		Float scale = 0.0f;
+		const size_t triangleCount = triangleEnd - triangleStart;
+		if (triangleCount > (size_t) std::numeric_limits<int32_t>::max() / 3)
+			Log(EError, "%s: too many triangles!", name.c_str());
+		const int blockCount = (int) ((triangleCount + MTS_OBJ_WELD_BLOCK_SIZE - 1)
+			/ MTS_OBJ_WELD_BLOCK_SIZE);
+		const OBJTriangle *tris = &triangles[triangleStart];
 
-		if (m_recenter) {
-			AABB aabb;
-			for (unsigned int i=0; i<triangles.size(); i++) {
-				for (unsigned int j=0; j<3; j++) {
-					unsigned int vertexId = triangles[i].p[j];
-					aabb.expandBy(vertices.at(vertexId));
+		/* Validate the indices and find out whether the faces
+		   reference any normals or texture coordinates */
+		bool hasNormals = false, hasTexcoords = false, valid = true;
+		AABB aabb;
+
+		#pragma omp parallel
+		{
+			bool localHasNormals = false, localHasTexcoords = false, localValid = true;
+			AABB localAABB;
+
+			#pragma omp for schedule(static) nowait
+			for (int block=0; block<blockCount; ++block) {
+				size_t start = (size_t) block * MTS_OBJ_WELD_BLOCK_SIZE,
+				       end = std::min(start + MTS_OBJ_WELD_BLOCK_SIZE, triangleCount);
+				for (size_t i=start; i<end; ++i) {
+					for (int j=0; j<3; ++j) {
+						if (tris[i].p[j] >= vertices.size()) {
+							localValid = false;
+							continue;
+						}
+						if (m_recenter)
+							localAABB.expandBy(vertices[tris[i].p[j]]);
+						if (tris[i].n[j] != MTS_OBJ_NO_INDEX) {
+							localHasNormals = true;
+							localValid &= tris[i].n[j] < normals.size();
+						}
+						if (tris[i].uv[j] != MTS_OBJ_NO_INDEX) {
+							localHasTexcoords = true;
+							localValid &= tris[i].uv[j] < texcoords.size();
+						}
+					}
 				}
 			}
+
+			#pragma omp critical
+			{
+				hasNormals |= localHasNormals;
+				hasTexcoords |= localHasTexcoords;
+				valid &= localValid;
+				aabb.expandBy(localAABB);
+			}
+		}
+
+		if (!valid)
+			Log(EError, "%s: a face references a nonexistent vertex, "
+				"normal or texture coordinate!", name.c_str());
+
+		Vector translate(0.0f);
+		Float scale = 0.0f;
+		if (m_recenter) {
 			scale = 2/aabb.getExtents()[aabb.getLargestAxis()];
 			translate = -Vector(aabb.getCenter());
 		}
 
-		/* Collapse the mesh into a more usable form */
-		Triangle *triangleArray = new Triangle[triangles.size()];
-		for (unsigned int i=0; i<triangles.size(); i++) {
-			Triangle tri;
-			for (unsigned int j=0; j<3; j++) {
-				unsigned int vertexId = triangles[i].p[j];
-				unsigned int normalId = triangles[i].n[j];
-				unsigned int uvId = triangles[i].uv[j];
-				int key;
+		CornerSource source;
+		source.triangles = tris;
+		source.vertices = &vertices[0];
+		source.normals = normals.empty() ? NULL : &normals[0];
+		source.texcoords = texcoords.empty() ? NULL : &texcoords[0];
+		source.hasNormals = hasNormals;
+		source.hasTexcoords = hasTexcoords;
 
-				Vertex vertex;
+		/* Merge identical vertices using a lock-free hash table. It maps each
+		   distinct vertex to its lowest-numbered face corner, hence numbering
+		   these corners in order reproduces the vertex order of a sequential
+		   pass. The table is enlarged and rebuilt when it becomes too full. */
+		const size_t cornerCount = 3 * triangleCount;
+		size_t tableSize = roundToPow2(std::max(cornerCount / 2, (size_t) 64));
+		std::vector<int32_t> table;
 
-				if (m_recenter)
-					vertex.p = objectToWorld((vertices.at(vertexId) + translate)*scale);
-				else
-					vertex.p = objectToWorld(vertices.at(vertexId));
-
-				if (hasNormals && normals.at(normalId) != Normal(0.0f))
-					vertex.n = normalize(objectToWorld(normals.at(normalId)));
-				else
-					vertex.n = Normal(0.0f);
+		while (true) {
+			table.assign(tableSize, -1);
+			volatile int32_t *tablePtr = &table[0];
+			volatile int32_t distinctCount = 0;
+			volatile bool full = false;
+			const size_t mask = tableSize - 1, maxDistinct = tableSize / 4 * 3;
 
-				if (hasTexcoords)
-					vertex.uv = texcoords.at(uvId);
-				else
-					vertex.uv = Point2(0.0f);
-
-				if (vertexMap.find(vertex) != vertexMap.end()) {
-					key = vertexMap[vertex];
-					numMerged++;
-				} else {
-					key = (int) vertexBuffer.size();
-					vertexMap[vertex] = (int) key;
-					vertexBuffer.push_back(vertex);
+			#pragma omp parallel for schedule(dynamic)
+			for (int block=0; block<blockCount; ++block) {
+				if (full)
+					continue;
+				size_t start = (size_t) block * MTS_OBJ_WELD_BLOCK_SIZE * 3,
+				       end = std::min(start + MTS_OBJ_WELD_BLOCK_SIZE * 3, cornerCount),
+				       inserted = 0;
+				for (size_t corner=start; corner<end; ++corner) {
+					if (!weldInsert(tablePtr, mask, source, (int32_t) corner, inserted)) {
+						full = true;
+						break;
+					}
 				}
+				if ((size_t) atomicAdd(&distinctCount, (int32_t) inserted) > maxDistinct)
+					full = true;
+			}
+
+			if (!full)
+				break;
+			tableSize *= 2;
+			Log(EDebug, "%s: growing the vertex hash table to " SIZE_T_FMT " entries",
+				name.c_str(), tableSize);
+		}
 
-				tri.idx[j] = key;
+		/* Find the representative corner of every corner */
+		std::vector<int32_t> corners(cornerCount);
+		std::vector<size_t> blockOffsets(blockCount + 1, 0);
+
+		#pragma omp parallel for schedule(dynamic)
+		for (int block=0; block<blockCount; ++block) {
+			size_t start = (size_t) block * MTS_OBJ_WELD_BLOCK_SIZE * 3,
+			       end = std::min(start + MTS_OBJ_WELD_BLOCK_SIZE * 3, cornerCount),
+			       count = 0;
+			for (size_t corner=start; corner<end; ++corner) {
+				int32_t representative = weldFind(&table[0], tableSize - 1,
+					source, (int32_t) corner);
+				corners[corner] = representative;
+				if (representative == (int32_t) corner)
+					++count;
 			}
-			triangleArray[i] = tri;
+			blockOffsets[block+1] = count;
 		}
+		std::vector<int32_t>().swap(table);
+
+		for (int block=0; block<blockCount; ++block)
+			blockOffsets[block+1] += blockOffsets[block];
+		const size_t vertexCount = blockOffsets[blockCount];
 
 		ref<TriMesh> mesh = new TriMesh(name,
-			triangles.size(), vertexBuffer.size(),
+			triangleCount, vertexCount,
 			hasNormals, hasTexcoords, false,
 			m_flipNormals, m_faceNormals);
 
-		std::copy(triangleArray, triangleArray+triangles.size(), mesh->getTriangles());
-
+		Triangle *target_triangles = mesh->getTriangles();
 		Point    *target_positions = mesh->getVertexPositions();
 		Normal   *target_normals   = mesh->getVertexNormals();
 		Point2   *target_texcoords = mesh->getVertexTexcoords();
 
-		for (size_t i=0; i<vertexBuffer.size(); i++) {
-			*target_positions++ = vertexBuffer[i].p;
-			if (hasNormals)
-				*target_normals++ = vertexBuffer[i].n;
-			if (hasTexcoords)
-				*target_texcoords++ = vertexBuffer[i].uv;
+		/* Emit the representatives in corner order */
+		#pragma omp parallel for schedule(dynamic)
+		for (int block=0; block<blockCount; ++block) {
+			size_t start = (size_t) block * MTS_OBJ_WELD_BLOCK_SIZE * 3,
+			       end = std::min(start + MTS_OBJ_WELD_BLOCK_SIZE * 3, cornerCount);
+			uint32_t key = (uint32_t) blockOffsets[block];
+
+			for (size_t corner=start; corner<end; ++corner) {
+				if (corners[corner] != (int32_t) corner)
+					continue;
+				const OBJTriangle &tri = tris[corner / 3];
+				const int i = (int) (corner % 3);
+				target_triangles[corner / 3].idx[i] = key;
+
+				if (m_recenter)
+					target_positions[key] = objectToWorld((vertices[tri.p[i]] + translate)*scale);
+				else
+					target_positions[key] = objectToWorld(vertices[tri.p[i]]);
+
+				if (hasNormals) {
+					if (tri.n[i] != MTS_OBJ_NO_INDEX && normals[tri.n[i]] != Normal(0.0f))
+						target_normals[key] = normalize(objectToWorld(normals[tri.n[i]]));
+					else
+						target_normals[key] = Normal(0.0f);
+				}
+
+				if (hasTexcoords) {
+					if (tri.uv[i] != MTS_OBJ_NO_INDEX)
+						target_texcoords[key] = texcoords[tri.uv[i]];
+					else
+						target_texcoords[key] = Point2(0.0f);
+				}
+				++key;
+			}
+		}
+
+		/* Let the remaining corners refer to their representative's vertex */
+		#pragma omp parallel for schedule(static)
+		for (int block=0; block<blockCount; ++block) {
+			size_t start = (size_t) block * MTS_OBJ_WELD_BLOCK_SIZE * 3,
+			       end = std::min(start + MTS_OBJ_WELD_BLOCK_SIZE * 3, cornerCount);
+			for (size_t corner=start; corner<end; ++corner) {
+				size_t representative = (size_t) corners[corner];
+				if (representative != corner)
+					target_triangles[corner / 3].idx[corner % 3] =
+						target_triangles[representative / 3].idx[representative % 3];
+			}
 		}
 
 		mesh->incRef();
 		if (currentMaterial)
 			mesh->addChild("", currentMaterial);
 		m_meshes.push_back(mesh);
-		Log(EInfo, "%s: Loaded " SIZE_T_FMT " triangles, " SIZE_T_FMT 
+		Log(EInfo, "%s: Loaded " SIZE_T_FMT " triangles, " SIZE_T_FMT
 			" vertices (merged " SIZE_T_FMT " vertices).", name.c_str(),
-			triangles.size(), vertexBuffer.size(), numMerged);
+			triangleCount, vertexCount, cornerCount - vertexCount);
 		mesh->configure();
 	}
 
@@ -438,6 +948,8 @@ public:
 		m_aabb.reset();
 		for (size_t i=0; i<m_meshes.size(); ++i) {
 			m_meshes[i]->configure();
+			if (m_compactAttributes)
+				m_meshes[i]->compactAttributes();
 			m_aabb.expandBy(m_meshes[i]->getAABB());
 		}
 	}
@@ -512,6 +1024,7 @@ private:
 	std::vector<TriMesh *> m_meshes;
 	std::map<std::string, BSDF *> m_materials;
 	bool m_flipNormals, m_faceNormals, m_recenter;
+	bool m_compactAttributes;
 	std::string m_name;
 	AABB m_aabb;
 };
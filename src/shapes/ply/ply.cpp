@@ -21,6 +21,7 @@
 #include <mitsuba/core/properties.h>
 #include <mitsuba/core/fstream.h>
 #include <mitsuba/core/timer.h>
+#include <mitsuba/core/mmap.h>
 #include <ply/ply_parser.hpp>
 
 #if defined(__clang__)
@@ -59,6 +60,10 @@ MTS_NAMESPACE_BEGIN
 /**
  * PLY mesh loader using libply by Ares Lagae
  * (http://people.cs.kuleuven.be/~ares.lagae/libply/)
+ *
+ * Binary files consisting of triangles are memory-mapped and converted
+ * in parallel, since all of their records have the same size. Other
+ * files are handled by libply.
  */
 class PLYLoader : public TriMesh {
 public:
@@ -95,6 +100,14 @@ public:
 
 	void loadPLY(const fs::path &path);
 
+	/**
+	 * Try to load a binary triangle mesh using the parallel code path.
+	 * Returns \c false if the file must be handled by libply instead.
+	 */
+	bool loadBinaryPLY(const fs::path &path);
+
+	void logSummary(unsigned int time);
+
 	void info_callback(const std::string& filename, std::size_t line_number,
 			const std::string& message) {
 		Log(EInfo, "\"%s\" [line %i] info: %s", filename.c_str(), line_number,
@@ -393,6 +406,12 @@ template<> std::tr1::tuple<std::tr1::function<void (ply::uint32)>,
 
 
 void PLYLoader::loadPLY(const fs::path &path) {
+	ref<Timer> timer = new Timer();
+	if (loadBinaryPLY(path)) {
+		logSummary(timer->getMilliseconds());
+		return;
+	}
+
 	ply::ply_parser ply_parser;
 	ply_parser.info_callback(std::tr1::bind(&PLYLoader::info_callback,
 		this, std::tr1::ref(m_name), _1, _2));
@@ -428,9 +447,11 @@ void PLYLoader::loadPLY(const fs::path &path) {
 	ply_parser.scalar_property_definition_callbacks(scalar_property_definition_callbacks);
 	ply_parser.list_property_definition_callbacks(list_property_definition_callbacks);
 
-	ref<Timer> timer = new Timer();
 	ply_parser.parse(path.file_string());
+	logSummary(timer->getMilliseconds());
+}
 
+void PLYLoader::logSummary(unsigned int time) {
 	size_t vertexSize = sizeof(Point);
 	if (m_normals)
 		vertexSize += sizeof(Normal);
@@ -442,7 +463,309 @@ void PLYLoader::loadPLY(const fs::path &path) {
 	Log(EInfo, "\"%s\": Loaded " SIZE_T_FMT " triangles, " SIZE_T_FMT 
 			" vertices (%s in %i ms).", m_name.c_str(), m_triangleCount, m_vertexCount,
 			memString(sizeof(uint32_t) * m_triangleCount * 3 + vertexSize * m_vertexCount).c_str(),
-			timer->getMilliseconds());
+			time);
+}
+
+/// Scalar types that can occur in a PLY file
+enum EPLYType {
+	EPLYInvalid = 0,
+	EPLYInt8, EPLYUInt8, EPLYInt16, EPLYUInt16,
+	EPLYInt32, EPLYUInt32, EPLYFloat32, EPLYFloat64
+};
+
+static EPLYType parsePLYType(const std::string &name) {
+	if (name == "char" || name == "int8")
+		return EPLYInt8;
+	else if (name == "uchar" || name == "uint8")
+		return EPLYUInt8;
+	else if (name == "short" || name == "int16")
+		return EPLYInt16;
+	else if (name == "ushort" || name == "uint16")
+		return EPLYUInt16;
+	else if (name == "int" || name == "int32")
+		return EPLYInt32;
+	else if (name == "uint" || name == "uint32")
+		return EPLYUInt32;
+	else if (name == "float" || name == "float32")
+		return EPLYFloat32;
+	else if (name == "double" || name == "float64")
+		return EPLYFloat64;
+	return EPLYInvalid;
+}
+
+static size_t getPLYTypeSize(EPLYType type) {
+	switch (type) {
+		case EPLYInt8: case EPLYUInt8: return 1;
+		case EPLYInt16: case EPLYUInt16: return 2;
+		case EPLYInt32: case EPLYUInt32: case EPLYFloat32: return 4;
+		case EPLYFloat64: return 8;
+		default: return 0;
+	}
+}
+
+/// Read a scalar value from a binary PLY file
+static inline double readPLYValue(const uint8_t *ptr, EPLYType type, bool swapBytes) {
+	union {
+		uint8_t bytes[8];
+		int8_t i8; uint8_t u8; int16_t i16; uint16_t u16;
+		int32_t i32; uint32_t u32; float f32; double f64;
+	} value;
+	size_t size = getPLYTypeSize(type);
+	if (swapBytes) {
+		for (size_t i=0; i<size; ++i)
+			value.bytes[i] = ptr[size-1-i];
+	} else {
+		memcpy(value.bytes, ptr, size);
+	}
+	switch (type) {
+		case EPLYInt8: return value.i8;
+		case EPLYUInt8: return value.u8;
+		case EPLYInt16: return value.i16;
+		case EPLYUInt16: return value.u16;
+		case EPLYInt32: return value.i32;
+		case EPLYUInt32: return value.u32;
+		case EPLYFloat32: return value.f32;
+		case EPLYFloat64: return value.f64;
+		default: return 0;
+	}
+}
+
+struct PLYProperty {
+	std::string name;
+	EPLYType type, countType;
+	bool isList;
+	size_t offset;
+};
+
+struct PLYElement {
+	std::string name;
+	size_t count;
+	std::vector<PLYProperty> properties;
+};
+
+bool PLYLoader::loadBinaryPLY(const fs::path &path) {
+	if (!fs::exists(path) || fs::file_size(path) == 0)
+		return false;
+	ref<MemoryMappedFile> mmap = new MemoryMappedFile(path);
+	const char *data = static_cast<const char *>(mmap->getData());
+	const size_t size = mmap->getSize();
+
+	/* Parse the header */
+	std::vector<PLYElement> elements;
+	bool swapBytes = false, foundFormat = false;
+	const uint16_t endiannessTest = 1;
+	const bool littleEndianHost = *((const uint8_t *) &endiannessTest) == 1;
+	size_t pos = 0, lineIndex = 0;
+
+	while (true) {
+		const char *lineEnd = (const char *) memchr(data + pos, '\n', size - pos);
+		if (!lineEnd)
+			return false;
+		std::vector<std::string> tokens = tokenize(
+			std::string(data + pos, lineEnd), " \t\r");
+		pos = (size_t) (lineEnd - data) + 1;
+
+		if (lineIndex++ == 0) {
+			if (tokens.size() != 1 || tokens[0] != "ply")
+				return false;
+			continue;
+		} else if (tokens.empty() || tokens[0] == "comment" || tokens[0] == "obj_info") {
+			continue;
+		} else if (tokens[0] == "end_header") {
+			break;
+		} else if (tokens[0] == "format" && tokens.size() == 3) {
+			if (tokens[1] == "binary_little_endian")
+				swapBytes = !littleEndianHost;
+			else if (tokens[1] == "binary_big_endian")
+				swapBytes = littleEndianHost;
+			else
+				return false;
+			foundFormat = true;
+		} else if (tokens[0] == "element" && tokens.size() == 3) {
+			PLYElement element;
+			element.name = tokens[1];
+			element.count = (size_t) strtoull(tokens[2].c_str(), NULL, 10);
+			elements.push_back(element);
+		} else if (tokens[0] == "property" && !elements.empty()) {
+			PLYProperty property;
+			if (tokens.size() == 3) {
+				property.isList = false;
+				property.type = parsePLYType(tokens[1]);
+				property.countType = EPLYInvalid;
+			} else if (tokens.size() == 5 && tokens[1] == "list") {
+				property.isList = true;
+				property.countType = parsePLYType(tokens[2]);
+				property.type = parsePLYType(tokens[3]);
+				if (property.countType == EPLYInvalid || property.countType == EPLYFloat32
+					|| property.countType == EPLYFloat64)
+					return false;
+			} else {
+				return false;
+			}
+			if (property.type == EPLYInvalid)
+				return false;
+			property.name = tokens[tokens.size()-1];
+			elements[elements.size()-1].properties.push_back(property);
+		} else {
+			return false;
+		}
+	}
+	if (!foundFormat)
+		return false;
+
+	/* Locate the vertex and face records. Every element before them
+	   must have a fixed record size, and every face must be a triangle */
+	const PLYElement *vertexElement = NULL, *faceElement = NULL;
+	const uint8_t *vertexData = NULL, *faceData = NULL;
+	size_t vertexStride = 0, faceStride = 0;
+	const PLYProperty *indexProperty = NULL;
+
+	for (size_t i=0; i<elements.size() && !(vertexElement && faceElement); ++i) {
+		PLYElement &element = elements[i];
+		size_t stride = 0;
+		const PLYProperty *listProperty = NULL;
+		for (size_t j=0; j<element.properties.size(); ++j) {
+			PLYProperty &property = element.properties[j];
+			property.offset = stride;
+			if (property.isList) {
+				if (listProperty)
+					return false;
+				listProperty = &property;
+				stride += getPLYTypeSize(property.countType) + 3 * getPLYTypeSize(property.type);
+			} else {
+				stride += getPLYTypeSize(property.type);
+			}
+		}
+		if (element.name == "face") {
+			if (!listProperty || (listProperty->name != "vertex_indices"
+					&& listProperty->name != "vertex_index"))
+				return false;
+		} else if (listProperty) {
+			return false;
+		}
+		if (size - pos < element.count * stride)
+			return false;
+
+		const uint8_t *elementData = reinterpret_cast<const uint8_t *>(data + pos);
+		if (element.name == "vertex") {
+			vertexElement = &element;
+			vertexData = elementData;
+			vertexStride = stride;
+		} else if (element.name == "face") {
+			faceElement = &element;
+			faceData = elementData;
+			faceStride = stride;
+			indexProperty = listProperty;
+
+			/* Check the size of every face, since the record size
+			   was computed under the assumption of triangles */
+			bool onlyTriangles = true;
+			const int count = (int) element.count;
+			#pragma omp parallel for schedule(static)
+			for (int k=0; k<count; ++k) {
+				if (readPLYValue(faceData + (size_t) k * faceStride + indexProperty->offset,
+						indexProperty->countType, swapBytes) != 3)
+					onlyTriangles = false;
+			}
+			if (!onlyTriangles)
+				return false;
+		}
+		pos += element.count * stride;
+	}
+
+	if (!vertexElement || !faceElement || vertexElement->count > (size_t) INT_MAX
+			|| faceElement->count > (size_t) INT_MAX)
+		return false;
+
+	/* Map vertex properties to the components of the following array */
+	enum EComponent {
+		EX = 0, EY, EZ, ENX, ENY, ENZ, EU, EV, ERed, EGreen, EBlue, EComponentCount
+	};
+	const char *componentNames[] = {
+		"x", "y", "z", "nx", "ny", "nz", "u", "v", "red", "green", "blue"
+	};
+	std::vector<std::pair<int, const PLYProperty *> > components;
+	bool hasComponent[EComponentCount];
+	memset(hasComponent, 0, sizeof(hasComponent));
+	for (size_t i=0; i<vertexElement->properties.size(); ++i) {
+		const PLYProperty &property = vertexElement->properties[i];
+		std::string name = property.name;
+		if (name.compare(0, 8, "diffuse_") == 0)
+			name = name.substr(8);
+		for (int j=0; j<EComponentCount; ++j) {
+			if (name == componentNames[j]) {
+				components.push_back(std::make_pair(j, &property));
+				hasComponent[j] = true;
+				break;
+			}
+		}
+	}
+
+	m_vertexCount = vertexElement->count;
+	m_triangleCount = faceElement->count;
+	m_positions = new Point[m_vertexCount];
+	if (hasComponent[ENX])
+		m_normals = new Normal[m_vertexCount];
+	if (hasComponent[EU])
+		m_texcoords = new Point2[m_vertexCount];
+	if (hasComponent[ERed])
+		m_colors = new Spectrum[m_vertexCount];
+	m_triangles = new Triangle[m_triangleCount];
+
+	const int vertexCount = (int) m_vertexCount,
+		triangleCount = (int) m_triangleCount;
+
+	#pragma omp parallel for schedule(static)
+	for (int i=0; i<vertexCount; ++i) {
+		const uint8_t *record = vertexData + (size_t) i * vertexStride;
+		Float values[EComponentCount];
+		memset(values, 0, sizeof(values));
+		for (size_t j=0; j<components.size(); ++j) {
+			const PLYProperty *property = components[j].second;
+			Float value = (Float) readPLYValue(record + property->offset,
+				property->type, swapBytes);
+			if (components[j].first >= ERed && property->type == EPLYUInt8)
+				value /= 255.0f;
+			values[components[j].first] = value;
+		}
+
+		m_positions[i] = m_objectToWorld(Point(values[EX], values[EY], values[EZ]));
+		if (m_normals)
+			m_normals[i] = m_objectToWorld(Normal(values[ENX], values[ENY], values[ENZ]));
+		if (m_texcoords)
+			m_texcoords[i] = Point2(values[EU], values[EV]);
+		if (m_colors) {
+			if (m_sRGB)
+				m_colors[i].fromSRGB(values[ERed], values[EGreen], values[EBlue]);
+			else
+				m_colors[i].fromLinearRGB(values[ERed], values[EGreen], values[EBlue]);
+		}
+	}
+
+	const size_t indexSize = getPLYTypeSize(indexProperty->type),
+		indexOffset = indexProperty->offset + getPLYTypeSize(indexProperty->countType);
+	bool validIndices = true;
+
+	#pragma omp parallel for schedule(static)
+	for (int i=0; i<triangleCount; ++i) {
+		const uint8_t *record = faceData + (size_t) i * faceStride + indexOffset;
+		for (int j=0; j<3; ++j) {
+			double index = readPLYValue(record + j * indexSize,
+				indexProperty->type, swapBytes);
+			if (index < 0 || index >= (double) m_vertexCount) {
+				validIndices = false;
+				index = 0;
+			}
+			m_triangles[i].idx[j] = (uint32_t) index;
+		}
+	}
+
+	if (!validIndices)
+		Log(EError, "\"%s\": a face references a nonexistent vertex!", m_name.c_str());
+
+	m_vertexCtr = m_vertexCount;
+	m_triangleCtr = m_triangleCount;
+	return true;
 }
 
 
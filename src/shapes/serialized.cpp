@@ -18,7 +18,8 @@
 
 #include <mitsuba/render/trimesh.h>
 #include <mitsuba/core/properties.h>
-#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/mstream.h>
+#include <mitsuba/core/mmap.h>
 #include <mitsuba/core/fresolver.h>
 
 MTS_NAMESPACE_BEGIN
@@ -41,40 +42,27 @@ public:
 		m_name = (props.getID() != "unnamed") ? props.getID() 
 			: formatString("%s@%i", filePath.stem().c_str(), shapeIndex); 
 
-		/* Load the geometry */
+		/* Load the geometry. The file is memory-mapped, which allows
+		   the mesh to seek to the requested shape and to decode the
+		   blocks of the newer file format in parallel */
 		Log(EInfo, "Loading shape %i from \"%s\" ..", shapeIndex, filePath.leaf().c_str());
-		ref<FileStream> stream = new FileStream(filePath, FileStream::EReadOnly);
+		if (!fs::exists(filePath) || fs::file_size(filePath) == 0)
+			Log(EError, "The file \"%s\" does not exist or is empty!",
+				filePath.file_string().c_str());
+		ref<MemoryMappedFile> mmap = new MemoryMappedFile(filePath);
+		ref<MemoryStream> stream = new MemoryStream(mmap->getData(), mmap->getSize());
 		stream->setByteOrder(Stream::ELittleEndian);
-		ref<TriMesh> mesh = new TriMesh(stream, shapeIndex);
-		m_triangleCount = mesh->getTriangleCount();
-		m_vertexCount = mesh->getVertexCount();
 
-		m_positions = new Point[m_vertexCount];
-		memcpy(m_positions, mesh->getVertexPositions(), sizeof(Point) * m_vertexCount);
-
-		if (mesh->hasVertexNormals()) {
-			m_normals = new Normal[m_vertexCount];
-			memcpy(m_normals, mesh->getVertexNormals(), sizeof(Normal) * m_vertexCount);
-		}
-
-		if (mesh->hasVertexTexcoords()) {
-			m_texcoords = new Point2[m_vertexCount];
-			memcpy(m_texcoords, mesh->getVertexTexcoords(), sizeof(Point2) * m_vertexCount);
-		}
-
-		if (mesh->hasVertexColors()) {
-			m_colors = new Spectrum[m_vertexCount];
-			memcpy(m_colors, mesh->getVertexColors(), sizeof(Spectrum) * m_vertexCount);
-		}
-
-		m_triangles = new Triangle[m_triangleCount];
-		memcpy(m_triangles, mesh->getTriangles(), sizeof(Triangle) * m_triangleCount);
+		/* Face normals are determined by the scene description */
+		bool faceNormals = m_faceNormals;
+		readSerialized(stream, shapeIndex);
+		m_faceNormals = faceNormals;
 
 		if (!objectToWorld.isIdentity()) {
-			for (size_t i=0; i<m_vertexCount; ++i)
+			#pragma omp parallel for schedule(static)
+			for (int i=0; i<(int) m_vertexCount; ++i) {
 				m_positions[i] = objectToWorld(m_positions[i]);
-			if (m_normals) {
-				for (size_t i=0; i<m_vertexCount; ++i) 
+				if (m_normals)
 					m_normals[i] = objectToWorld(m_normals[i]);
 			}
 		}
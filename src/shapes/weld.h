@@ -0,0 +1,133 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__WELD_H)
+#define __WELD_H
+
+#include <mitsuba/core/atomic.h>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Bit-level representation of \c N floating point values,
+ * which is used to merge vertices with identical attributes.
+ */
+template <int N> struct WeldKey {
+#if defined(SINGLE_PRECISION)
+	typedef uint32_t FloatBits;
+#else
+	typedef uint64_t FloatBits;
+#endif
+
+	FloatBits values[N];
+
+	inline WeldKey() { }
+
+	inline WeldKey(const Float *coords) {
+		set(coords);
+	}
+
+	inline void set(const Float *coords) {
+		memcpy(values, coords, sizeof(values));
+
+		/* Map negative to positive zero (using integer arithmetic,
+		   since the compiler may remove the floating point version) */
+		for (int i=0; i<N; ++i) {
+			if ((FloatBits) (values[i] << 1) == 0)
+				values[i] = 0;
+		}
+	}
+
+	inline bool operator==(const WeldKey &key) const {
+		return memcmp(values, key.values, sizeof(values)) == 0;
+	}
+
+	inline uint64_t hash() const {
+		uint64_t hash = 0;
+		for (int i=0; i<N; ++i) {
+			hash = (hash ^ (uint64_t) values[i]) * 0x9E3779B97F4A7C15ULL;
+			hash ^= hash >> 32;
+		}
+		return hash;
+	}
+};
+
+/**
+ * \brief Insert an element into a lock-free hash table that keeps
+ * the lowest-numbered element of each distinct key.
+ *
+ * The table has a power-of-two size (\c mask + 1), uses linear probing
+ * and must be initialized to -1. \c source defines the key type
+ * <tt>Source::Key</tt> and computes keys using
+ * <tt>source.getKey(index, key)</tt>. Since the outcome does not depend
+ * on the order of insertion, several threads may insert concurrently
+ * and still produce the same table.
+ *
+ * \return \c false when no free slot was found. \c inserted is
+ * incremented when a new key was added.
+ */
+template <typename Source> bool weldInsert(volatile int32_t *table,
+		size_t mask, const Source &source, int32_t index, size_t &inserted) {
+	typename Source::Key key, key2;
+	source.getKey(index, key);
+	size_t slot = (size_t) key.hash() & mask, probes = 0;
+
+	while (probes <= mask) {
+		int32_t entry = table[slot];
+		if (entry == -1) {
+			if (atomicCompareAndExchange(table + slot, index, -1)) {
+				++inserted;
+				return true;
+			}
+			/* Lost the race for this slot -- re-examine it */
+			continue;
+		}
+		source.getKey(entry, key2);
+		if (!(key == key2)) {
+			slot = (slot + 1) & mask;
+			++probes;
+			continue;
+		}
+		if (entry < index)
+			return true;
+		if (atomicCompareAndExchange(table + slot, index, entry))
+			return true;
+		/* Another thread replaced the entry in the meantime. It has
+		   the same key, so re-check whether \c index is still lower */
+	}
+	return false;
+}
+
+/// Look up the lowest-numbered element that has the same key as \c index
+template <typename Source> int32_t weldFind(const int32_t *table,
+		size_t mask, const Source &source, int32_t index) {
+	typename Source::Key key, key2;
+	source.getKey(index, key);
+	size_t slot = (size_t) key.hash() & mask;
+	while (true) {
+		int32_t entry = table[slot];
+		source.getKey(entry, key2);
+		if (key == key2)
+			return entry;
+		slot = (slot + 1) & mask;
+	}
+}
+
+MTS_NAMESPACE_END
+
+#endif /* __WELD_H */
@@ -26,9 +26,9 @@
 #include <mitsuba/core/fresolver.h>
 #include <boost/bind.hpp>
 #include <boost/timer.hpp>
-#include "irrtree.h"
-
-//#define NO_SSE_QUERY
+#include "irrstore.h"
+#include "irrquery.h"
+#include "lutproc.h"
 
 MTS_NAMESPACE_BEGIN
 
@@ -45,94 +45,6 @@ typedef SubsurfaceMaterialManager::LUTType LUTType;
 typedef SubsurfaceMaterialManager::LUTRecord LUTRecord;
 
 
-/**
- * Computes the combined diffuse radiant exitance 
- * caused by a number of dipole sources
- */
-struct IsotropicDipoleQuery {
-#if !defined(MTS_SSE) || (SPECTRUM_SAMPLES != 3) || defined(NO_SSE_QUERY)
-	inline IsotropicDipoleQuery(const Spectrum &zr, const Spectrum &zv, 
-		const Spectrum &sigmaTr, Float Fdt, const Point &p) 
-		: zr(zr), zv(zv), sigmaTr(sigmaTr), result(0.0f), Fdt(Fdt), p(p) {
-			count = 0;
-            Float zrMin = zr.min();
-            zrMinSq = zrMin * zrMin;
-	}
-
-	inline void operator()(const IrradianceSample &sample) {
-        //Float dist = std::max((p - sample.p).lengthSquared(), zrMinSq); 
-        Float dist = (p - sample.p).lengthSquared(); 
-		Spectrum rSqr = Spectrum(dist);
-		/* Distance to the real source */
-		Spectrum dr = (rSqr + zr*zr).sqrt();
-		/* Distance to the image point source */
-		Spectrum dv = (rSqr + zv*zv).sqrt();
-		Spectrum C1 = zr * (sigmaTr + Spectrum(1.0f) / dr);
-		Spectrum C2 = zv * (sigmaTr + Spectrum(1.0f) / dv);
-
-		/* Do not include the reduced albedo - will be canceled out later */
-		Spectrum dMo = Spectrum(0.25f * INV_PI) *
-			 (C1 * ((-sigmaTr * dr).exp()) / (dr * dr)
-			+ C2 * ((-sigmaTr * dv).exp()) / (dv * dv));
-		result += dMo * sample.E * (sample.area * Fdt);
-		count++;
-	}
-
-	inline const Spectrum &getResult() const {
-		return result;
-	}
-
-	Spectrum zr, zv, sigmaTr, result;
-#else
-	inline IsotropicDipoleQuery(const Spectrum &_zr, const Spectrum &_zv, 
-		const Spectrum &_sigmaTr, Float Fdt, const Point &p) : Fdt(Fdt), p(p) {
-		zr = _mm_set_ps(_zr[0], _zr[1], _zr[2], 0);
-		zv = _mm_set_ps(_zv[0], _zv[1], _zv[2], 0);
-		sigmaTr = _mm_set_ps(_sigmaTr[0], _sigmaTr[1], _sigmaTr[2], 0);
-		zrSqr = _mm_mul_ps(zr, zr);
-		zvSqr = _mm_mul_ps(zv, zv);
-		result.ps = _mm_setzero_ps();
-		count = 0;
-        Float zrMin = _zr.min();
-        zrMinSq = zrMin * zrMin;
-	}
-
-	inline void operator()(const IrradianceSample &sample) {
-		/* Distance to the positive point source of the dipole */
-        Float dist = std::max((p - sample.p).lengthSquared(), zrMinSq);
-		const __m128 lengthSquared = _mm_set1_ps(dist),
-			drSqr = _mm_add_ps(zrSqr, lengthSquared), 
-			dvSqr = _mm_add_ps(zvSqr, lengthSquared),
-			dr = _mm_sqrt_ps(drSqr), dv = _mm_sqrt_ps(dvSqr), 
-			one = _mm_set1_ps(1.0f),
-			factor = _mm_mul_ps(_mm_set1_ps(0.25f*INV_PI*sample.area * Fdt),
-				_mm_set_ps(sample.E[0], sample.E[1], sample.E[2], 0)),
-			C1fac = _mm_div_ps(_mm_mul_ps(zr, _mm_add_ps(sigmaTr, _mm_div_ps(one, dr))), drSqr),
-			C2fac = _mm_div_ps(_mm_mul_ps(zv, _mm_add_ps(sigmaTr, _mm_div_ps(one, dv))), dvSqr);
-		SSEVector temp1(_mm_mul_ps(dr, sigmaTr)), temp2(_mm_mul_ps(dv, sigmaTr));
-		const __m128
-			exp1 = _mm_set_ps(expf(-temp1.f[3]), expf(-temp1.f[2]), expf(-temp1.f[1]), 0),
-			exp2 = _mm_set_ps(expf(-temp2.f[3]), expf(-temp2.f[2]), expf(-temp2.f[1]), 0);
-		result.ps = _mm_add_ps(result.ps, _mm_mul_ps(factor, _mm_add_ps(
-			_mm_mul_ps(C1fac, exp1), _mm_mul_ps(C2fac, exp2))));
-	}
-
-	Spectrum getResult() {
-		Spectrum value;
-		for (int i=0; i<3; ++i)
-			value[i] = result.f[3-i];
-		return value;
-	}
-
-	__m128 zr, zv, zrSqr, zvSqr, sigmaTr;
-	SSEVector result;
-#endif
-
-	int count;
-	Float Fdt, zrMinSq;
-	Point p;
-};
-
 /**
  * Computes the combined diffuse radiant exitance 
  * caused by a number of dipole sources. This variant
@@ -161,6 +73,16 @@ struct IsotropicLUTDipoleQuery {
         count++;
 	}
 
+	inline void operator()(const IrradianceOctree::SampleArrays &samples,
+			uint32_t start, uint32_t sampleCount) {
+		for (uint32_t i=start; i<start+sampleCount; ++i) {
+			/* Skip the padding at the end of a leaf */
+			if (samples.area[i] == 0)
+				continue;
+			(*this)(samples.get(i));
+		}
+	}
+
 	inline const Spectrum &getResult() const {
 		return result;
 	}
@@ -379,6 +301,14 @@ public:
 		m_minDelta = props.getFloat("quality", 0.1f);
 		/* Max. depth of the created octree */
 		m_maxDepth = props.getInteger("maxDepth", 40);
+		/* Directory, in which irradiance samples are kept between render
+		   jobs (e.g. for camera-only animations). Disabled by default */
+		if (props.hasProperty("irrCacheDir"))
+			m_irrCacheDir = Thread::getThread()->getFileResolver()->resolveAbsolute(
+				props.getString("irrCacheDir"));
+		/* Only resample shapes, whose geometry has changed since the 
+		   cached samples were taken? */
+		m_irrCacheIncremental = props.getBoolean("irrCacheIncremental", false);
         /* Single scattering term */
         m_singleScattering = props.getBoolean("singleScattering", false);
         /* Should the irrtree be dumped? */
@@ -425,6 +355,8 @@ public:
             m_rMax = props.getFloat("lutRmax");
         }
         m_mcIterations = props.getInteger("mcIterations", 10000);
+        /* Seed for the Monte Carlo integration of the look-up-table */
+        m_lutSeed = (uint64_t) props.getLong("lutSeed", 5489);
         m_hasRoughSurface = props.getBoolean("hasRoughSurface", false);
 		m_roughSurfaceThetaBins = props.getInteger("maxDepth", 30);
 		m_roughSurfacePhiBins = props.getInteger("maxDepth", 2*m_roughSurfaceThetaBins);
@@ -452,6 +384,11 @@ public:
         m_hasRoughSurface = stream->readBool(); 
 		m_roughSurfaceThetaBins = stream->readInt();
 		m_roughSurfacePhiBins = stream->readInt();
+        m_lutSeed = stream->readULong();
+        if (stream->readBool()) {
+            m_rMax = stream->readFloat();
+            m_RdLookUpTable = new LUTType(stream);
+        }
 		m_ready = false;
 		m_octreeResID = -1;
 		configure();
@@ -488,6 +425,12 @@ public:
         stream->writeBool(m_hasRoughSurface);
         stream->writeInt(m_roughSurfaceThetaBins);
         stream->writeInt(m_roughSurfacePhiBins);
+        stream->writeULong(m_lutSeed);
+        stream->writeBool(m_RdLookUpTable.get() != NULL);
+        if (m_RdLookUpTable.get()) {
+            stream->writeFloat(m_rMax);
+            m_RdLookUpTable->serialize(stream);
+        }
 	}
 
 	Spectrum Lo(const Scene *scene, Sampler *sampler,
@@ -500,8 +443,9 @@ public:
             Spectrum zv = m_zvTex->getValue(its);
             Spectrum sigmaTr = m_sigmaTrTex->getValue(its);
 
-            IsotropicDipoleQuery query(zr, zv, sigmaTr, m_Fdt, its.p);
-            m_octree->execute(query);
+            Float zrMin = zr.min();
+            BatchedDipoleQuery query(zr, zv, sigmaTr, m_Fdt, its.p, zrMin * zrMin);
+            m_octree->executeBatched(query);
             // compute multiple scattering term
             Spectrum Mo = query.getResult();
 
@@ -528,12 +472,13 @@ public:
             Spectrum Mo;
             if (m_useRdLookUpTable) {
                 IsotropicLUTDipoleQuery query(m_RdLookUpTable, m_lutResolution, m_Fdt, its.p, m_minMFP);
-                m_octree->execute(query);
+                m_octree->executeBatched(query);
                 // compute multiple scattering term
                 Mo = query.getResult();
             } else {
-                IsotropicDipoleQuery query(m_zr, m_zv, m_sigmaTr, m_Fdt, its.p);
-                m_octree->execute(query);
+                Float zrMin = m_zr.min();
+                BatchedDipoleQuery query(m_zr, m_zv, m_sigmaTr, m_Fdt, its.p, zrMin * zrMin);
+                m_octree->executeBatched(query);
                 // compute multiple scattering term
                 Mo = query.getResult();
             }
@@ -585,7 +530,6 @@ public:
 	}
 
 	void configure() {
-        boost::timer timer;
 		m_sigmaSPrime = m_sigmaS * (1-m_g);
 		m_sigmaTPrime = m_sigmaSPrime + m_sigmaA;
 
@@ -659,88 +603,61 @@ public:
         /* Configure bitmap usage */
         if (m_useTextures)
             configureTexture();
+    }
 
-        /* Configure look-up-table */
-        if (m_useRdLookUpTable) {
-            ref<SubsurfaceMaterialManager> smm = SubsurfaceMaterialManager::getInstance();
-            std::string lutHash = smm->getDipoleLUTHash(m_lutResolution, m_errThreshold,
-                m_sigmaTr, m_alphaPrime, m_zr, m_zv);
-            if (smm->hasLUT(lutHash)) {
-                LUTRecord lutR = smm->getLUT(lutHash);
-                m_RdLookUpTable = lutR.lut;
-                AssertEx(lutR.resolution == m_lutResolution, "Cached LUT does not have requested resolution!");
-            } else {
-                if (!m_rMaxPredefined) {
-                    timer.restart();
-                    const Spectrum invSigmaTr = 1.0f / m_sigmaTr;
-                    const Float inv4Pi = 1.0f / (4 * M_PI);
-                    ref<Random> random = new Random();
-
-                    /* Find Rd for the whole area by monte carlo integration. The
-                     * sampling area is calculated from the max. mean free path.
-                     * A square area around with edge length 2 * maxMFP is used
-                     * for this. Hene, the sampling area is 4 * maxMFP * maxMFP. */
-                    Spectrum Rd_A = Spectrum(0.0f);
-                    int count;
-                    for (count = 0; count < m_mcIterations; ++count) {
-                        /* do importance sampling by choosing samples distributed
-                         * with sigmaTr^2 * e^(-sigmaTr * r). */
-                        Spectrum r = invSigmaTr * -std::log( random->nextFloat() );
-                        Rd_A += getRd(r);
-                    }
-                    Float A = 4 * invSigmaTr.max() * invSigmaTr.max();
-                    Rd_A = A * Rd_A * m_alphaPrime * inv4Pi / (Float)(m_mcIterations - 1);
-                    Log(EDebug, "After %i MC integration iterations, Rd seems to be %s (took %.2fs)",
-                        count, Rd_A.toString().c_str(), timer.elapsed());
-
-                    /* Since we now have Rd integrated over the whole surface we can find a valid rmax
-                     * for the given threshold. */
-                    timer.restart();
-                    Float rMax = 0.0f;
-                    Spectrum err(std::numeric_limits<Float>::max());
-                    Spectrum invRd_A = Spectrum(1.0f) / Rd_A;
-                    while (err.max() > m_errThreshold) {
-                        rMax += m_lutResolution;
-                        /* Again, do MC integration, but with r clamped at rmax. */
-                        Spectrum Rd_APrime(0.0f);
-                        for (int n = 0; n < m_mcIterations; ++n) {
-                            /* do importance sampling by choosing samples distributed
-                             * with sigmaTr^2 * e^(-sigmaTr * r). */
-                            Spectrum r = invSigmaTr * -std::log( random->nextFloat() );
-                            // clamp samples to rMax
-                            for (int s=0; s<SPECTRUM_SAMPLES; ++s) {
-                                r[s] = std::min(rMax, r[s]);
-                            }
-                            Rd_APrime += getRd(r);
-                        }
-                        Float APrime = 4 * rMax * rMax;
-                        Rd_APrime = APrime * Rd_APrime * m_alphaPrime * inv4Pi / (Float)(m_mcIterations - 1);
-                        err = (Rd_A - Rd_APrime) * invRd_A;
-                    }
-                    m_rMax = rMax;
-                    Log(EDebug, "Maximum distance for sampling surface is %f with an error of %f (took %.0fs)",
-                        m_rMax, m_errThreshold, timer.elapsed());
-                }
-
-                /* Create the actual look-up-table */
-                timer.restart();
-                const int numEntries = (int) (m_rMax / m_lutResolution) + 1;
-                m_RdLookUpTable = new LUTType(numEntries);
-                for (int i=0; i<numEntries; ++i) {
-                    m_RdLookUpTable->at(i) = getRd(Spectrum(i * m_lutResolution));
-                    //std::cerr << "r: " << (i * m_lutResolution) << " Rd: " << m_RdLookUpTable->at(i).toString() << std::endl;
-                }
-
-                /* Create new LUTRecord and store this LUT if it was MC integrated */
-                if (!m_rMaxPredefined) {
-                    LUTRecord lutRec(m_RdLookUpTable, m_lutResolution);
-                    smm->addLUT(lutHash, lutRec);
-                    AssertEx(smm->hasLUT(lutHash), "LUT is not available, but it should be!");
-                }
+    /**
+     * Precompute the look-up-table for Rd (if requested), which is
+     * indexed by the distance to the sample. Returns false when the
+     * precomputation was cancelled.
+     */
+    bool configureLookUpTable() {
+        if (!m_useRdLookUpTable || m_RdLookUpTable.get())
+            return true;
+
+        ref<SubsurfaceMaterialManager> smm = SubsurfaceMaterialManager::getInstance();
+        std::string lutHash = smm->getDipoleLUTHash(m_lutResolution, m_errThreshold,
+            m_sigmaTr, m_alphaPrime, m_zr, m_zv);
+        /* The tables may be persisted, hence also include the parameters
+           of the Monte Carlo integration */
+        lutHash += formatString(",mcIterations=%i,lutSeed=%llu",
+            m_mcIterations, (unsigned long long) m_lutSeed);
+        if (smm->hasLUT(lutHash)) {
+            LUTRecord lutR = smm->getLUT(lutHash);
+            m_RdLookUpTable = lutR.lut;
+            m_rMax = (m_RdLookUpTable->size() - 1) * m_lutResolution;
+            AssertEx(lutR.resolution == m_lutResolution, "Cached LUT does not have requested resolution!");
+            return true;
+        }
 
-                Log(EDebug, "Created Rd look-up-table with %i entries (took %.2fs)", numEntries, timer.elapsed());
-            }
+        DiffusionProfile profile;
+        profile.sigmaTr = m_sigmaTr;
+        profile.zr.push_back(m_zr);
+        profile.zv.push_back(m_zv);
+
+        ref<Timer> timer = new Timer();
+        ref<Scheduler> sched = Scheduler::getInstance();
+        ref<RdTableProcess> proc = new RdTableProcess(profile, m_lutResolution,
+            m_rMaxPredefined ? m_rMax : -1, m_errThreshold, m_mcIterations, m_lutSeed);
+        m_proc = proc;
+        sched->schedule(proc);
+        sched->wait(proc);
+        m_proc = NULL;
+        if (proc->getReturnStatus() != ParallelProcess::ESuccess)
+            return false;
+
+        m_RdLookUpTable = proc->getRdTable();
+        m_rMax = proc->getMaxDistance();
+        Log(EInfo, "Created Rd look-up-table with " SIZE_T_FMT " entries "
+            "(rMax = %f, took %i ms)", m_RdLookUpTable->size(), m_rMax,
+            timer->getMilliseconds());
+
+        /* Create new LUTRecord and store this LUT if it was MC integrated */
+        if (!m_rMaxPredefined) {
+            LUTRecord lutRec(m_RdLookUpTable, m_lutResolution);
+            smm->addLUT(lutHash, lutRec);
+            AssertEx(smm->hasLUT(lutHash), "LUT is not available, but it should be!");
         }
+        return true;
     }
 
     /// Functor to evaluate the pdf values in parallel using OpenMP
@@ -1000,30 +917,6 @@ public:
         }
 	}
 
-    /// Calculate Rd based on all dipoles and the requested distance
-    Spectrum getRd(const Spectrum r) {
-        //Float dist = std::max((p - sample.p).lengthSquared(), zrMinSq); 
-		const Spectrum rSqr = r * r;
-        const Spectrum one(1.0f);
-        const Spectrum negSigmaTr = m_sigmaTr * (-1.0f);
-
-        /* Distance to the real source */
-        Spectrum dr = (rSqr + m_zr*m_zr).sqrt();
-        /* Distance to the image point source */
-        Spectrum dv = (rSqr + m_zv*m_zv).sqrt();
-
-        Spectrum C1 = m_zr * (m_sigmaTr + one / dr);
-        Spectrum C2 = m_zv * (m_sigmaTr + one / dv);
-
-        /* Do not include the reduced albedo - will be canceled out later */
-        Spectrum dMo = Spectrum(0.25f * INV_PI) *
-             (C1 * ((negSigmaTr * dr).exp()) / (dr * dr)
-            + C2 * ((negSigmaTr * dv).exp()) / (dv * dv));
-
-        dMo.clampNegative();
-        return dMo;
-    }
-
 	/// Unpolarized fresnel reflection term for dielectric materials
 	Float fresnel(Float cosThetaI) const {
 		Float g = std::sqrt(m_eta*m_eta - 1.0f + cosThetaI * cosThetaI);
@@ -1142,49 +1035,18 @@ public:
 				"a sampling-based surface integrator!");
 		}
 
+		if (!configureLookUpTable())
+			return false;
+
 		m_octree = new IrradianceOctree(m_maxDepth, m_minDelta, 
 			scene->getKDTree()->getAABB());
 
-		Float sa = 0;
-		for (std::vector<Shape *>::iterator it = m_shapes.begin(); 
-			it != m_shapes.end(); ++it) 
-			sa += (*it)->getSurfaceArea();
-		size_t sampleCount = (size_t) std::ceil(sa / (M_PI * m_minMFP * m_minMFP)
-			* m_sampleMultiplier);
-		Log(EInfo, "Generating " SIZE_T_FMT " irradiance samples..", sampleCount);
-
-		ref<Scheduler> sched = Scheduler::getInstance();
-
-		/* This could be a bit more elegant.. - inform the irradiance
-		   sampler about the index of this subsurface integrator */
-		std::vector<Subsurface *> ssIntegrators
-			= scene->getSubsurfaceIntegrators();
-		int index = -1;
-		for (size_t i=0; i<ssIntegrators.size(); ++i) {
-			if (ssIntegrators[i] == this) {
-				index = (int) i;
-				break;
-			}
-		}
-		Assert(index != -1);
-
-		ref<IrradianceSamplingProcess> proc = new IrradianceSamplingProcess(
-			sampleCount, (size_t) std::ceil(sampleCount/100.0f), index, 
-			m_irrSamples, m_irrIndirect, job);
-
-		proc->bindResource("scene", sceneResID);
-		scene->bindUsedResources(proc);
-		m_proc = proc;
-		sched->schedule(proc);
-		sched->wait(proc);
-		m_proc = NULL;
-		if (proc->getReturnStatus() != ParallelProcess::ESuccess)
+		Float sampleDensity = m_sampleMultiplier / (M_PI * m_minMFP * m_minMFP);
+		if (!sampleIrradiance(scene, this, job, sceneResID, sampleDensity,
+				m_irrSamples, m_irrIndirect, m_irrCacheDir, m_irrCacheIncremental,
+				m_proc, m_octree))
 			return false;
 
-		const IrradianceRecordVector &results = *proc->getSamples();
-		for (size_t i=0; i<results.size(); ++i) 
-			m_octree->addSample(results[i]);
-
 		m_octree->preprocess();
 		m_octreeResID = Scheduler::getInstance()->registerResource(m_octree);
 
@@ -1225,6 +1087,8 @@ private:
 	int m_maxDepth;
 	int m_irrSamples;
 	bool m_irrIndirect;
+	fs::path m_irrCacheDir;
+	bool m_irrCacheIncremental;
 	bool m_ready, m_requireSample, m_singleScattering, m_dumpIrrtree;
     std::string m_dumpIrrtreePath;
     mutable ThreadLocal<Random> m_random;
@@ -1253,6 +1117,8 @@ private:
     Float m_errThreshold;
     /* monte carlo integration iterations */
     int m_mcIterations;
+    /* seed of the monte carlo integration */
+    uint64_t m_lutSeed;
     /* resolution of the dMoR LUT */
     Float m_lutResolution;
 };
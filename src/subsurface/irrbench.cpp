@@ -0,0 +1,184 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/core/timer.h>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#endif
+#include "irrquery.h"
+
+MTS_NAMESPACE_BEGIN
+
+class IrradianceOctreeBenchmark : public Utility {
+public:
+	void help() {
+		cout << endl;
+		cout << "Synopsis: Compares the query throughput of the pointer-based irradiance" << endl;
+		cout << "octree with that of the flattened octree, which is used by the dipole" << endl;
+		cout << "integrators. The flattened octree is queried one sample at a time and" << endl;
+		cout << "using the batched (SSE) evaluation of the dipole sum. The irradiance" << endl;
+		cout << "samples are uniformly distributed over a bumpy sphere of radius one." << endl;
+		cout << endl;
+		cout << "Usage: mtsutil irrbench [options]" << endl;
+		cout << "Options/Arguments:" << endl;
+		cout << "   -h             Display this help text" << endl << endl;
+		cout << "   -n count       Number of irradiance samples (default: 200000)" << endl << endl;
+		cout << "   -q count       Number of queries (default: 50000)" << endl << endl;
+		cout << "   -t threshold   Solid angle threshold for using clusters (default: 0.1)" << endl << endl;
+	}
+
+	/// Position on the bumpy sphere for a given direction
+	inline Point surfacePoint(const Vector &d) const {
+		Float bump = 1 + 0.05f * std::sin(12 * d.x) * std::sin(12 * d.y) * std::sin(12 * d.z);
+		return Point(d * bump);
+	}
+
+	/// Time a set of queries and store the results
+	template <typename QueryType> unsigned int query(const IrradianceOctree *octree,
+			const std::vector<Point> &points, std::vector<Spectrum> &results,
+			bool batched) {
+		const Spectrum zr(0.02f), zv(0.07f), sigmaTr(10.0f);
+		const Float Fdt = 0.5f, zrMin = zr.min();
+		ref<Timer> timer = new Timer();
+		for (size_t i=0; i<points.size(); ++i) {
+			QueryType query(zr, zv, sigmaTr, Fdt, points[i], zrMin * zrMin);
+			if (batched)
+				octree->executeBatched(query);
+			else
+				octree->execute(query);
+			results[i] = query.getResult();
+		}
+		return timer->getMilliseconds();
+	}
+
+	/// Return the largest relative difference of two sets of results
+	Float maxRelError(const std::vector<Spectrum> &results,
+			const std::vector<Spectrum> &reference) const {
+		Float error = 0;
+		for (size_t i=0; i<results.size(); ++i) {
+			for (int j=0; j<SPECTRUM_SAMPLES; ++j) {
+				if (reference[i][j] != 0)
+					error = std::max(error, std::abs(results[i][j]
+						- reference[i][j]) / reference[i][j]);
+			}
+		}
+		return error;
+	}
+
+	int run(int argc, char **argv) {
+		char optchar, *end_ptr = NULL;
+		size_t sampleCount = 200000, queryCount = 50000;
+		Float threshold = 0.1f;
+		optind = 1;
+
+		/* Parse command-line arguments */
+		while ((optchar = getopt(argc, argv, "n:q:t:h")) != -1) {
+			switch (optchar) {
+				case 'h': {
+						help();
+						return 0;
+					}
+					break;
+				case 'n': {
+						long value = strtol(optarg, &end_ptr, 10);
+						if (*end_ptr != '\0' || value <= 0)
+							SLog(EError, "Could not parse the sample count!");
+						sampleCount = (size_t) value;
+					}
+					break;
+				case 'q': {
+						long value = strtol(optarg, &end_ptr, 10);
+						if (*end_ptr != '\0' || value <= 0)
+							SLog(EError, "Could not parse the query count!");
+						queryCount = (size_t) value;
+					}
+					break;
+				case 't': {
+						threshold = (Float) strtod(optarg, &end_ptr);
+						if (*end_ptr != '\0' || threshold <= 0)
+							SLog(EError, "Could not parse the threshold!");
+					}
+					break;
+			};
+		}
+
+		if (optind != argc) {
+			help();
+			return 0;
+		}
+
+		ref<Random> random = new Random((uint64_t) 1);
+		AABB aabb(Point(-1.1f), Point(1.1f));
+		ref<IrradianceOctree> pointerTree = new IrradianceOctree(40, threshold, aabb),
+			flatTree = new IrradianceOctree(40, threshold, aabb);
+
+		for (size_t i=0; i<sampleCount; ++i) {
+			Vector d = squareToSphere(Point2(random->nextFloat(), random->nextFloat()));
+			IrradianceSample sample;
+			sample.p = surfacePoint(d);
+			sample.n = Normal(d);
+			for (int j=0; j<SPECTRUM_SAMPLES; ++j)
+				sample.E[j] = 0.5f + random->nextFloat();
+			sample.area = 4 * M_PI / sampleCount;
+			pointerTree->addSample(sample);
+			flatTree->addSample(sample);
+		}
+
+		ref<Timer> timer = new Timer();
+		pointerTree->preprocess(false);
+		unsigned int pointerBuildTime = timer->getMilliseconds();
+		timer->reset();
+		flatTree->preprocess(true);
+		unsigned int flatBuildTime = timer->getMilliseconds();
+
+		std::vector<Point> points(queryCount);
+		for (size_t i=0; i<queryCount; ++i)
+			points[i] = surfacePoint(squareToSphere(
+				Point2(random->nextFloat(), random->nextFloat())));
+
+		Log(EInfo, SIZE_T_FMT " samples, " SIZE_T_FMT " queries, clustering took %i ms "
+			"(pointer-based) and %i ms (flattened)", sampleCount, queryCount,
+			pointerBuildTime, flatBuildTime);
+
+		std::vector<Spectrum> reference(queryCount), results(queryCount);
+		unsigned int pointerTime = query<BatchedDipoleQuery>(pointerTree, points, reference, false);
+		Log(EInfo, "%-20s %10s %14s %10s %14s", "Octree", "Time [ms]",
+			"Queries/s", "Speedup", "Max. rel. diff.");
+		Log(EInfo, "%-20s %10i %14.0f %10.2f %14s", "pointer-based", pointerTime,
+			queryCount * 1000.0f / std::max(pointerTime, 1U), 1.0f, "-");
+
+		unsigned int flatTime = query<BatchedDipoleQuery>(flatTree, points, results, false);
+		Log(EInfo, "%-20s %10i %14.0f %10.2f %14e", "flattened", flatTime,
+			queryCount * 1000.0f / std::max(flatTime, 1U),
+			pointerTime / (Float) std::max(flatTime, 1U),
+			maxRelError(results, reference));
+
+		unsigned int batchedTime = query<BatchedDipoleQuery>(flatTree, points, results, true);
+		Log(EInfo, "%-20s %10i %14.0f %10.2f %14e", "flattened (batched)", batchedTime,
+			queryCount * 1000.0f / std::max(batchedTime, 1U),
+			pointerTime / (Float) std::max(batchedTime, 1U),
+			maxRelError(results, reference));
+		return 0;
+	}
+
+	MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(IrradianceOctreeBenchmark, "Irradiance octree query benchmark")
+MTS_NAMESPACE_END
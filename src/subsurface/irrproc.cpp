@@ -26,9 +26,10 @@ MTS_NAMESPACE_BEGIN
 /* Parallel irradiance sampling implementation (worker) */
 class IrradianceSamplingWorker : public WorkProcessor {
 public:
-	IrradianceSamplingWorker(size_t sampleCount, int ssIndex, int irrSamples, bool irrIndirect) 
+	IrradianceSamplingWorker(size_t sampleCount, int ssIndex, int irrSamples, 
+		bool irrIndirect, const std::vector<uint32_t> &shapes) 
 		: m_sampleCount(sampleCount), m_ssIndex(ssIndex), 
-		m_irrSamples(irrSamples), m_irrIndirect(irrIndirect) {
+		m_irrSamples(irrSamples), m_irrIndirect(irrIndirect), m_shapeIndices(shapes) {
 	}
 
 	IrradianceSamplingWorker(Stream *stream, InstanceManager *manager) {
@@ -36,6 +37,9 @@ public:
 		m_ssIndex = stream->readInt();
 		m_irrSamples = stream->readInt();
 		m_irrIndirect = stream->readBool();
+		m_shapeIndices.resize(stream->readSize());
+		if (m_shapeIndices.size() > 0)
+			stream->readUIntArray(&m_shapeIndices[0], m_shapeIndices.size());
 	}
 
 	void serialize(Stream *stream, InstanceManager *manager) const {
@@ -43,6 +47,9 @@ public:
 		stream->writeInt(m_ssIndex);
 		stream->writeInt(m_irrSamples);
 		stream->writeBool(m_irrIndirect);
+		stream->writeSize(m_shapeIndices.size());
+		if (m_shapeIndices.size() > 0)
+			stream->writeUIntArray(&m_shapeIndices[0], m_shapeIndices.size());
 	}
 
 	ref<WorkUnit> createWorkUnit() const {
@@ -67,8 +74,12 @@ public:
 		m_scene->wakeup(m_resources);
 		const Subsurface *ss = m_scene->getSubsurfaceIntegrators()[m_ssIndex];
 		m_shapes = ss->getShapes();
-		for (size_t i=0; i<m_shapes.size(); ++i)
-			m_areaPDF.put(m_shapes[i]->getSurfaceArea());
+		if (m_shapeIndices.empty()) {
+			for (size_t i=0; i<m_shapes.size(); ++i)
+				m_shapeIndices.push_back((uint32_t) i);
+		}
+		for (size_t i=0; i<m_shapeIndices.size(); ++i)
+			m_areaPDF.put(m_shapes[m_shapeIndices[i]]->getSurfaceArea());
 		m_areaPDF.build();
 	}
 
@@ -85,7 +96,7 @@ public:
 			Point2 sample = m_sampler->next2D();
 
 			Float expSamples;
-			unsigned int index = m_areaPDF.sampleReuse(sample.x, expSamples);
+			uint32_t index = m_shapeIndices[m_areaPDF.sampleReuse(sample.x, expSamples)];
 			expSamples *= m_sampleCount;
 			ShapeSamplingRecord sRec;
 			Float pdf = m_shapes[index]->sampleArea(sRec, sample) * expSamples;
@@ -97,12 +108,13 @@ public:
 					camera->getMedium(), m_independentSampler,
 					m_irrSamples, m_irrIndirect), 1/pdf,
                 sRec.n
-			));
+			), index);
 		}
 	}
 
 	ref<WorkProcessor> clone() const {
-		return new IrradianceSamplingWorker(m_sampleCount, m_ssIndex, m_irrSamples, m_irrIndirect);
+		return new IrradianceSamplingWorker(m_sampleCount, m_ssIndex, 
+			m_irrSamples, m_irrIndirect, m_shapeIndices);
 	}
 
 	MTS_DECLARE_CLASS()
@@ -119,20 +131,26 @@ private:
 	int m_ssIndex;
 	int m_irrSamples;
 	bool m_irrIndirect;
+	std::vector<uint32_t> m_shapeIndices;
 };
 
 void IrradianceRecordVector::load(Stream *stream) {
 	clear();
 	size_t count = stream->readSize();
 	m_samples.resize(count);
+	m_shapeIndices.resize(count);
 	for (size_t i=0; i<count; ++i)
 		m_samples[i] = IrradianceSample(stream);
+	if (count > 0)
+		stream->readUIntArray(&m_shapeIndices[0], count);
 }
 
 void IrradianceRecordVector::save(Stream *stream) const {
 	stream->writeSize(m_samples.size());
 	for (size_t i=0; i<m_samples.size(); ++i)
 		m_samples[i].serialize(stream);
+	if (m_samples.size() > 0)
+		stream->writeUIntArray(&m_shapeIndices[0], m_shapeIndices.size());
 }
 
 std::string IrradianceRecordVector::toString() const {
@@ -144,9 +162,9 @@ std::string IrradianceRecordVector::toString() const {
 
 IrradianceSamplingProcess::IrradianceSamplingProcess(size_t sampleCount, 
 	size_t granularity, int ssIndex, int irrSamples, bool irrIndirect,
-	const void *progressReporterPayload) 
+	const void *progressReporterPayload, const std::vector<uint32_t> &shapes) 
 	: m_sampleCount(sampleCount), m_granularity(granularity), m_ssIndex(ssIndex), 
-	m_irrSamples(irrSamples), m_irrIndirect(irrIndirect) {
+	m_irrSamples(irrSamples), m_irrIndirect(irrIndirect), m_shapes(shapes) {
 	m_resultCount = 0;
 	m_resultMutex = new Mutex();
 	m_samples = new IrradianceRecordVector();
@@ -162,7 +180,7 @@ IrradianceSamplingProcess::~IrradianceSamplingProcess() {
 
 ref<WorkProcessor> IrradianceSamplingProcess::createWorkProcessor() const {
 	return new IrradianceSamplingWorker(m_sampleCount, m_ssIndex, 
-			m_irrSamples, m_irrIndirect);
+			m_irrSamples, m_irrIndirect, m_shapes);
 }
 
 ParallelProcess::EStatus IrradianceSamplingProcess::generateWork(WorkUnit *unit, int worker) {
@@ -182,7 +200,7 @@ void IrradianceSamplingProcess::processResult(const WorkResult *wr, bool cancell
 	const IrradianceRecordVector *result = static_cast<const IrradianceRecordVector *>(wr);
 	m_resultMutex->lock();
 	for (size_t i=0; i<result->size(); ++i)
-		m_samples->put((*result)[i]);
+		m_samples->put((*result)[i], result->getShapeIndex(i));
 	m_resultCount += result->size();
 	m_progress->update(m_resultCount);
 	m_resultMutex->unlock();
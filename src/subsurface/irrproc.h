@@ -73,8 +73,10 @@ class IrradianceRecordVector : public WorkResult {
 public:
 	IrradianceRecordVector() { }
 
-	inline void put(const IrradianceSample &rec) {
+	/// Append a sample taken on the shape with the given index
+	inline void put(const IrradianceSample &rec, uint32_t shapeIndex) {
 		m_samples.push_back(rec);
+		m_shapeIndices.push_back(shapeIndex);
 	}
 
 	inline size_t size() const {
@@ -83,12 +85,18 @@ public:
 
 	inline void clear() {
 		m_samples.clear();
+		m_shapeIndices.clear();
 	}
 
 	inline const IrradianceSample &operator[](size_t index) const {
 		return m_samples[index];
 	}
 
+	/// Return the index of the shape, on which a sample was taken
+	inline uint32_t getShapeIndex(size_t index) const {
+		return m_shapeIndices[index];
+	}
+
 	/* WorkUnit interface */
 	void load(Stream *stream);
 	void save(Stream *stream) const;
@@ -100,6 +108,7 @@ protected:
 	virtual ~IrradianceRecordVector() { }
 private:
 	std::vector<IrradianceSample> m_samples;
+	std::vector<uint32_t> m_shapeIndices;
 };
 
 /**
@@ -107,9 +116,15 @@ private:
  */
 class IrradianceSamplingProcess : public ParallelProcess {
 public:
+	/**
+	 * \param shapes
+	 *    Indices of the shapes of the subsurface integrator, which
+	 *    should be sampled. An empty list selects all shapes.
+	 */
 	IrradianceSamplingProcess(size_t sampleCount, size_t granularity, 
 		int ssIndex, int irrSamples, 
-		bool irrIndirect, const void *progressReporterPayload);
+		bool irrIndirect, const void *progressReporterPayload,
+		const std::vector<uint32_t> &shapes = std::vector<uint32_t>());
 
 	inline const IrradianceRecordVector *getSamples() const {
 		return m_samples.get();
@@ -129,6 +144,7 @@ private:
 	int m_ssIndex;
 	int m_irrSamples;
 	bool m_irrIndirect;
+	std::vector<uint32_t> m_shapes;
 	ref<Mutex> m_resultMutex;
 	ref<IrradianceRecordVector> m_samples;
 	ProgressReporter *m_progress;
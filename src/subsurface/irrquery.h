@@ -0,0 +1,175 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__IRR_QUERY_H)
+#define __IRR_QUERY_H
+
+#include "irrtree.h"
+
+MTS_NAMESPACE_BEGIN
+
+#if defined(MTS_SSE)
+/**
+ * Exponential function of four single precision values. Uses the
+ * polynomial approximation of the Cephes library, whose relative
+ * error is about 2e-7. Arguments below -86.6 are clamped, i.e. the
+ * result never underflows to a denormal.
+ */
+static inline __m128 exp_ps(__m128 x) {
+	const __m128 one = _mm_set1_ps(1.0f);
+	x = _mm_min_ps(x, _mm_set1_ps(88.3762626647949f));
+	x = _mm_max_ps(x, _mm_set1_ps(-86.6f));
+
+	/* exp(x) = 2^n * exp(g), where n = round(x / log(2)) */
+	__m128 fx = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(1.44269504088896341f)),
+		_mm_set1_ps(0.5f));
+	__m128 tmp = _mm_cvtepi32_ps(_mm_cvttps_epi32(fx));
+	fx = _mm_sub_ps(tmp, _mm_and_ps(_mm_cmpgt_ps(tmp, fx), one));
+	x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(0.693359375f)));
+	x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(-2.12194440e-4f)));
+
+	__m128 y = _mm_set1_ps(1.9875691500e-4f);
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.3981999507e-3f));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(8.3334519073e-3f));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(4.1665795894e-2f));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.6666665459e-1f));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(5.0000001201e-1f));
+	y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(y, _mm_mul_ps(x, x)), x), one);
+
+	/* Construct 2^n */
+	__m128i n = _mm_add_epi32(_mm_cvttps_epi32(fx), _mm_set1_epi32(0x7f));
+	return _mm_mul_ps(y, _mm_castsi128_ps(_mm_slli_epi32(n, 23)));
+}
+#endif
+
+/**
+ * Computes the combined diffuse radiant exitance caused by a number of
+ * dipole sources. When used with \ref IrradianceOctree::executeBatched(),
+ * the samples of a leaf are processed four at a time using SSE2.
+ */
+struct BatchedDipoleQuery {
+	/**
+	 * \param zr
+	 *    Distance of the real source below the surface
+	 * \param zv
+	 *    Distance of the image source above the surface
+	 * \param minDistSqr
+	 *    Lower bound on the squared distance to a sample, which
+	 *    avoids the singularity of the dipole model
+	 */
+	inline BatchedDipoleQuery(const Spectrum &zr, const Spectrum &zv,
+		const Spectrum &sigmaTr, Float Fdt, const Point &p, Float minDistSqr = 0)
+		: zr(zr), zv(zv), sigmaTr(sigmaTr), result(0.0f), Fdt(Fdt),
+		  minDistSqr(minDistSqr), p(p) {
+#if defined(MTS_SSE)
+		for (int i=0; i<SPECTRUM_SAMPLES; ++i) {
+			zrSSE[i] = _mm_set1_ps(zr[i]);
+			zvSSE[i] = _mm_set1_ps(zv[i]);
+			zrSqrSSE[i] = _mm_set1_ps(zr[i] * zr[i]);
+			zvSqrSSE[i] = _mm_set1_ps(zv[i] * zv[i]);
+			sigmaTrSSE[i] = _mm_set1_ps(sigmaTr[i]);
+			resultSSE[i] = _mm_setzero_ps();
+		}
+#endif
+	}
+
+	/// Process a single sample or cluster
+	inline void operator()(const IrradianceSample &sample) {
+		Float dist = std::max((p - sample.p).lengthSquared(), minDistSqr);
+		Spectrum rSqr = Spectrum(dist);
+		/* Distance to the real source */
+		Spectrum dr = (rSqr + zr*zr).sqrt();
+		/* Distance to the image point source */
+		Spectrum dv = (rSqr + zv*zv).sqrt();
+		Spectrum C1 = zr * (sigmaTr + Spectrum(1.0f) / dr);
+		Spectrum C2 = zv * (sigmaTr + Spectrum(1.0f) / dv);
+
+		/* Do not include the reduced albedo - will be canceled out later */
+		Spectrum dMo = Spectrum(0.25f * INV_PI) *
+			 (C1 * ((-sigmaTr * dr).exp()) / (dr * dr)
+			+ C2 * ((-sigmaTr * dv).exp()) / (dv * dv));
+		result += dMo * sample.E * (sample.area * Fdt);
+	}
+
+	/// Process the (padded) samples of a leaf
+	inline void operator()(const IrradianceOctree::SampleArrays &samples,
+			uint32_t start, uint32_t count) {
+#if defined(MTS_SSE)
+		const __m128 px = _mm_set1_ps(p.x), py = _mm_set1_ps(p.y),
+			pz = _mm_set1_ps(p.z), one = _mm_set1_ps(1.0f),
+			minDist = _mm_set1_ps(minDistSqr),
+			factor = _mm_set1_ps(0.25f * INV_PI * Fdt);
+
+		for (uint32_t i=start; i<start+count; i += 4) {
+			const __m128
+				dx = _mm_sub_ps(_mm_load_ps(samples.p[0] + i), px),
+				dy = _mm_sub_ps(_mm_load_ps(samples.p[1] + i), py),
+				dz = _mm_sub_ps(_mm_load_ps(samples.p[2] + i), pz),
+				rSqr = _mm_max_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx),
+					_mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)), minDist),
+				weight = _mm_mul_ps(_mm_load_ps(samples.area + i), factor);
+
+			for (int j=0; j<SPECTRUM_SAMPLES; ++j) {
+				const __m128
+					drSqr = _mm_add_ps(rSqr, zrSqrSSE[j]),
+					dvSqr = _mm_add_ps(rSqr, zvSqrSSE[j]),
+					dr = _mm_sqrt_ps(drSqr), dv = _mm_sqrt_ps(dvSqr),
+					C1 = _mm_div_ps(_mm_mul_ps(zrSSE[j], _mm_add_ps(sigmaTrSSE[j],
+						_mm_div_ps(one, dr))), drSqr),
+					C2 = _mm_div_ps(_mm_mul_ps(zvSSE[j], _mm_add_ps(sigmaTrSSE[j],
+						_mm_div_ps(one, dv))), dvSqr),
+					exp1 = exp_ps(_mm_sub_ps(_mm_setzero_ps(), _mm_mul_ps(sigmaTrSSE[j], dr))),
+					exp2 = exp_ps(_mm_sub_ps(_mm_setzero_ps(), _mm_mul_ps(sigmaTrSSE[j], dv))),
+					E = _mm_load_ps(samples.E[j] + i);
+
+				resultSSE[j] = _mm_add_ps(resultSSE[j], _mm_mul_ps(_mm_mul_ps(weight, E),
+					_mm_add_ps(_mm_mul_ps(C1, exp1), _mm_mul_ps(C2, exp2))));
+			}
+		}
+#else
+		for (uint32_t i=start; i<start+count; ++i) {
+			if (samples.area[i] > 0)
+				(*this)(samples.get(i));
+		}
+#endif
+	}
+
+	inline Spectrum getResult() const {
+		Spectrum value = result;
+#if defined(MTS_SSE)
+		for (int i=0; i<SPECTRUM_SAMPLES; ++i) {
+			SSEVector sum(resultSSE[i]);
+			value[i] += (sum.f0 + sum.f1) + (sum.f2 + sum.f3);
+		}
+#endif
+		return value;
+	}
+
+#if defined(MTS_SSE)
+	__m128 zrSSE[SPECTRUM_SAMPLES], zvSSE[SPECTRUM_SAMPLES];
+	__m128 zrSqrSSE[SPECTRUM_SAMPLES], zvSqrSSE[SPECTRUM_SAMPLES];
+	__m128 sigmaTrSSE[SPECTRUM_SAMPLES], resultSSE[SPECTRUM_SAMPLES];
+#endif
+	Spectrum zr, zv, sigmaTr, result;
+	Float Fdt, minDistSqr;
+	Point p;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __IRR_QUERY_H */
@@ -0,0 +1,293 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/timer.h>
+#include <mitsuba/render/trimesh.h>
+#include <mitsuba/render/luminaire.h>
+#include <mitsuba/render/medium.h>
+#include <mitsuba/render/bsdf.h>
+#include <set>
+#include "irrstore.h"
+
+/// Version of the on-disk irradiance sample format
+#define MTS_IRR_CACHE_VERSION 1
+
+MTS_NAMESPACE_BEGIN
+
+static const char irrCacheMagic[8] = { 'M', 'T', 'S', '_', 'I', 'R', 'R', '\0' };
+
+/// Size of a serialized irradiance sample (position, irradiance, area, normal)
+static const size_t irrSampleSize = (3 + SPECTRUM_SAMPLES + 1 + 3) * sizeof(Float);
+
+IrradianceSampleStore::IrradianceSampleStore(uint64_t sceneHash)
+	: m_sceneHash(sceneHash) { }
+
+size_t IrradianceSampleStore::getSampleCount() const {
+	size_t count = 0;
+	for (size_t i=0; i<m_samples.size(); ++i)
+		count += m_samples[i].size();
+	return count;
+}
+
+uint64_t IrradianceSampleStore::getShapeHash(const Shape *shape) {
+	if (shape->getClass()->derivesFrom(MTS_CLASS(TriMesh))) {
+		/* Triangle meshes store world-space positions, hence
+		   this also captures changes of their transformation */
+		const TriMesh *mesh = static_cast<const TriMesh *>(shape);
+		uint64_t hash = hashBuffer(mesh->getVertexPositions(),
+			mesh->getVertexCount() * sizeof(Point), MTS_IRR_CACHE_VERSION);
+		return hashBuffer(mesh->getTriangles(),
+			mesh->getTriangleCount() * sizeof(Triangle), hash);
+	} else {
+		std::string desc = shape->toString();
+		AABB aabb = shape->getAABB();
+		uint64_t hash = hashBuffer(desc.c_str(), desc.length(), MTS_IRR_CACHE_VERSION);
+		return hashBuffer(&aabb, sizeof(AABB), hash);
+	}
+}
+
+static inline uint64_t hashString(const std::string &str, uint64_t seed) {
+	return hashBuffer(str.c_str(), str.length(), seed);
+}
+
+uint64_t IrradianceSampleStore::getSceneHash(const Scene *scene, int ssIndex,
+		Float sampleDensity, int irrSamples, bool irrIndirect) {
+	/* Sampling parameters */
+	uint64_t params[6];
+	params[0] = (uint64_t) ssIndex;
+	params[1] = (uint64_t) union_cast<uint32_t>((float) sampleDensity);
+	params[2] = (uint64_t) irrSamples;
+	params[3] = irrIndirect ? 1 : 0;
+	params[4] = (uint64_t) sizeof(Float);
+	params[5] = (uint64_t) SPECTRUM_SAMPLES;
+	uint64_t hash = hashBuffer(params, sizeof(params), MTS_IRR_CACHE_VERSION);
+
+	/* Lighting and light transport */
+	hash = hashString(scene->getIntegrator()->toString(), hash);
+	const std::vector<Luminaire *> &luminaires = scene->getLuminaires();
+	for (size_t i=0; i<luminaires.size(); ++i)
+		hash = hashString(luminaires[i]->toString(), hash);
+	const std::set<Medium *> &media = scene->getMedia();
+	for (std::set<Medium *>::const_iterator it = media.begin(); it != media.end(); ++it)
+		hash = hashString((*it)->toString(), hash);
+
+	/* Materials of all shapes and the geometry of those,
+	   which are not sampled by this subsurface integrator */
+	const Subsurface *ss = scene->getSubsurfaceIntegrators()[ssIndex];
+	const std::vector<Shape *> &ssShapes = ss->getShapes();
+	std::set<const Shape *> sampled(ssShapes.begin(), ssShapes.end());
+	const std::vector<Shape *> &shapes = scene->getShapes();
+	for (size_t i=0; i<shapes.size(); ++i) {
+		const Shape *shape = shapes[i];
+		if (shape->getBSDF())
+			hash = hashString(shape->getBSDF()->toString(), hash);
+		if (sampled.find(shape) == sampled.end()) {
+			uint64_t shapeHash = getShapeHash(shape);
+			hash = hashBuffer(&shapeHash, sizeof(uint64_t), hash);
+		}
+	}
+	return hash;
+}
+
+ref<IrradianceSampleStore> IrradianceSampleStore::load(const fs::path &filename,
+		uint64_t sceneHash) {
+	if (!fs::exists(filename))
+		return NULL;
+
+	ref<Timer> timer = new Timer();
+	ref<IrradianceSampleStore> store;
+	try {
+		ref<FileStream> fs = new FileStream(filename, FileStream::EReadOnly);
+		fs->setByteOrder(Stream::ELittleEndian);
+		size_t size = fs->getSize();
+
+		char magic[8];
+		if (size < 28)
+			return NULL;
+		fs->read(magic, 8);
+		if (memcmp(magic, irrCacheMagic, 8) != 0
+			|| fs->readUInt() != MTS_IRR_CACHE_VERSION
+			|| fs->readUInt() != (uint32_t) irrSampleSize
+			|| fs->readULong() != sceneHash) {
+			Log(EDebug, "The irradiance cache file \"%s\" is outdated",
+				filename.file_string().c_str());
+			return NULL;
+		}
+
+		store = new IrradianceSampleStore(sceneHash);
+		uint32_t shapeCount = fs->readUInt();
+		for (uint32_t i=0; i<shapeCount; ++i) {
+			bool truncated = fs->getPos() + 16 > size;
+			uint64_t hash = 0, count = 0;
+			if (!truncated) {
+				hash = fs->readULong();
+				count = fs->readULong();
+				truncated = fs->getPos() + count * irrSampleSize > size;
+			}
+			if (truncated) {
+				Log(EWarn, "The irradiance cache file \"%s\" is truncated",
+					filename.file_string().c_str());
+				return NULL;
+			}
+			store->addShape(hash);
+			SampleVector &samples = store->getSamples(i);
+			samples.reserve((size_t) count);
+			for (uint64_t j=0; j<count; ++j)
+				samples.push_back(IrradianceSample(fs));
+		}
+	} catch (const std::exception &ex) {
+		Log(EWarn, "Ignoring the irradiance cache file \"%s\": %s",
+			filename.file_string().c_str(), ex.what());
+		return NULL;
+	}
+
+	Log(EInfo, "Loaded " SIZE_T_FMT " irradiance samples from \"%s\" (took %i ms)",
+		store->getSampleCount(), filename.file_string().c_str(),
+		timer->getMilliseconds());
+	return store;
+}
+
+void IrradianceSampleStore::save(const fs::path &filename) const {
+	try {
+		if (!filename.parent_path().empty() && !fs::exists(filename.parent_path()))
+			fs::create_directories(filename.parent_path());
+
+		ref<AtomicFileStream> fs = new AtomicFileStream(filename);
+		fs->setByteOrder(Stream::ELittleEndian);
+		fs->write(irrCacheMagic, 8);
+		fs->writeUInt(MTS_IRR_CACHE_VERSION);
+		fs->writeUInt((uint32_t) irrSampleSize);
+		fs->writeULong(m_sceneHash);
+		fs->writeUInt((uint32_t) m_shapeHashes.size());
+		for (size_t i=0; i<m_shapeHashes.size(); ++i) {
+			const SampleVector &samples = m_samples[i];
+			fs->writeULong(m_shapeHashes[i]);
+			fs->writeULong((uint64_t) samples.size());
+			for (size_t j=0; j<samples.size(); ++j)
+				samples[j].serialize(fs);
+		}
+		fs->commit();
+	} catch (const std::exception &ex) {
+		Log(EWarn, "Could not write the irradiance cache file \"%s\": %s",
+			filename.file_string().c_str(), ex.what());
+		return;
+	}
+
+	Log(EInfo, "Wrote " SIZE_T_FMT " irradiance samples to \"%s\"",
+		getSampleCount(), filename.file_string().c_str());
+}
+
+bool sampleIrradiance(const Scene *scene, const Subsurface *ss,
+		const void *progressReporterPayload, int sceneResID, Float sampleDensity,
+		int irrSamples, bool irrIndirect, const fs::path &cacheDirectory,
+		bool incremental, ref<ParallelProcess> &proc, IrradianceOctree *octree) {
+	/* This could be a bit more elegant.. - inform the irradiance
+	   sampler about the index of this subsurface integrator */
+	const std::vector<Subsurface *> &ssIntegrators
+		= scene->getSubsurfaceIntegrators();
+	int index = -1;
+	for (size_t i=0; i<ssIntegrators.size(); ++i) {
+		if (ssIntegrators[i] == ss) {
+			index = (int) i;
+			break;
+		}
+	}
+	SAssert(index != -1);
+
+	const std::vector<Shape *> &shapes = ss->getShapes();
+	ref<IrradianceSampleStore> store, cached;
+	fs::path filename;
+	if (!cacheDirectory.empty()) {
+		ref<Timer> timer = new Timer();
+		uint64_t sceneHash = IrradianceSampleStore::getSceneHash(scene, index,
+			sampleDensity, irrSamples, irrIndirect);
+		store = new IrradianceSampleStore(sceneHash);
+		for (size_t i=0; i<shapes.size(); ++i)
+			store->addShape(IrradianceSampleStore::getShapeHash(shapes[i]));
+		SLog(EDebug, "Computed the irradiance cache key (took %i ms)",
+			timer->getMilliseconds());
+		filename = cacheDirectory / formatString("irrtree_%016llx.irc",
+			(unsigned long long) sceneHash);
+		cached = IrradianceSampleStore::load(filename, sceneHash);
+	} else {
+		store = new IrradianceSampleStore(0);
+		for (size_t i=0; i<shapes.size(); ++i)
+			store->addShape(0);
+	}
+
+	/* Without incremental updates, the cached samples can only
+	   be used if none of the shapes have changed */
+	bool reuseAll = cached.get() && cached->getShapeCount() == shapes.size();
+	for (size_t i=0; i<shapes.size() && reuseAll; ++i)
+		reuseAll = cached->getShapeHash(i) == store->getShapeHash(i);
+
+	std::vector<uint32_t> resample;
+	Float area = 0;
+	for (size_t i=0; i<shapes.size(); ++i) {
+		if (reuseAll || (incremental && cached.get() && i < cached->getShapeCount()
+				&& cached->getShapeHash(i) == store->getShapeHash(i))) {
+			store->getSamples(i).swap(cached->getSamples(i));
+		} else {
+			resample.push_back((uint32_t) i);
+			area += shapes[i]->getSurfaceArea();
+		}
+	}
+	cached = NULL;
+
+	size_t sampleCount = (size_t) std::ceil(area * sampleDensity);
+	if (sampleCount > 0) {
+		if (resample.size() == shapes.size())
+			SLog(EInfo, "Generating " SIZE_T_FMT " irradiance samples..", sampleCount);
+		else
+			SLog(EInfo, "Generating " SIZE_T_FMT " irradiance samples for " SIZE_T_FMT
+				" out of " SIZE_T_FMT " shapes..", sampleCount, resample.size(), shapes.size());
+
+		ref<Scheduler> sched = Scheduler::getInstance();
+		ref<IrradianceSamplingProcess> sampler = new IrradianceSamplingProcess(
+			sampleCount, (size_t) std::ceil(sampleCount/100.0f), index,
+			irrSamples, irrIndirect, progressReporterPayload,
+			resample.size() == shapes.size() ? std::vector<uint32_t>() : resample);
+
+		sampler->bindResource("scene", sceneResID);
+		scene->bindUsedResources(sampler);
+		proc = sampler;
+		sched->schedule(sampler);
+		sched->wait(sampler);
+		proc = NULL;
+		if (sampler->getReturnStatus() != ParallelProcess::ESuccess)
+			return false;
+
+		const IrradianceRecordVector &results = *sampler->getSamples();
+		for (size_t i=0; i<results.size(); ++i)
+			store->getSamples(results.getShapeIndex(i)).push_back(results[i]);
+
+		if (!filename.empty())
+			store->save(filename);
+	}
+
+	for (size_t i=0; i<store->getShapeCount(); ++i) {
+		const IrradianceSampleStore::SampleVector &samples = store->getSamples(i);
+		for (size_t j=0; j<samples.size(); ++j)
+			octree->addSample(samples[j]);
+	}
+	return true;
+}
+
+MTS_IMPLEMENT_CLASS(IrradianceSampleStore, false, Object)
+MTS_NAMESPACE_END
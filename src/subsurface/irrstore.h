@@ -0,0 +1,126 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__IRR_STORE_H)
+#define __IRR_STORE_H
+
+#include <mitsuba/render/scene.h>
+#include "irrtree.h"
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * Irradiance samples of a subsurface integrator grouped by the shape,
+ * on which they were taken. Together with a hash of the geometry of
+ * each shape and a hash of the remaining scene (lighting, materials,
+ * other geometry and sampling parameters), this makes it possible to
+ * store the samples on disk and to reuse them in later render jobs.
+ * The octree itself is not stored, since clustering the samples is
+ * cheap compared to computing them.
+ */
+class IrradianceSampleStore : public Object {
+public:
+	typedef std::vector<IrradianceSample> SampleVector;
+
+	/// Create an empty store
+	IrradianceSampleStore(uint64_t sceneHash);
+
+	/**
+	 * Load a store from disk. Returns \c NULL if the file does not
+	 * exist, cannot be read or belongs to a different scene.
+	 */
+	static ref<IrradianceSampleStore> load(const fs::path &filename, uint64_t sceneHash);
+
+	/**
+	 * Write the store to disk. The data is written to a temporary file,
+	 * which then atomically replaces \c filename.
+	 */
+	void save(const fs::path &filename) const;
+
+	/// Append a shape with the given geometry hash and no samples
+	inline void addShape(uint64_t hash) {
+		m_shapeHashes.push_back(hash);
+		m_samples.push_back(SampleVector());
+	}
+
+	/// Return the hash of the remaining scene
+	inline uint64_t getSceneHash() const { return m_sceneHash; }
+
+	/// Return the number of shapes
+	inline size_t getShapeCount() const { return m_shapeHashes.size(); }
+
+	/// Return the geometry hash of a shape
+	inline uint64_t getShapeHash(size_t shape) const { return m_shapeHashes[shape]; }
+
+	/// Return the samples taken on a shape
+	inline SampleVector &getSamples(size_t shape) { return m_samples[shape]; }
+
+	/// Return the samples taken on a shape (const version)
+	inline const SampleVector &getSamples(size_t shape) const { return m_samples[shape]; }
+
+	/// Return the total number of samples
+	size_t getSampleCount() const;
+
+	/// Compute a hash of the (world-space) geometry of a shape
+	static uint64_t getShapeHash(const Shape *shape);
+
+	/**
+	 * Compute a hash of everything besides the geometry of its own shapes,
+	 * which influences the irradiance samples of a subsurface integrator.
+	 * The camera is deliberately left out.
+	 */
+	static uint64_t getSceneHash(const Scene *scene, int ssIndex,
+		Float sampleDensity, int irrSamples, bool irrIndirect);
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Virtual destructor
+	virtual ~IrradianceSampleStore() { }
+private:
+	uint64_t m_sceneHash;
+	std::vector<uint64_t> m_shapeHashes;
+	std::vector<SampleVector> m_samples;
+};
+
+/**
+ * Generate the irradiance samples of a subsurface integrator and add
+ * them to an octree. This is shared by the dipole-type integrators.
+ *
+ * When a cache directory is given, the samples are loaded from there
+ * if neither the scene nor the shapes have changed -- e.g. when only
+ * the camera moves. In incremental mode, the samples of all shapes
+ * with unchanged geometry are reused even if other shapes have been
+ * moved, and only the remaining shapes are sampled again. This ignores
+ * the changed occlusion between the shapes, which is usually acceptable
+ * for animations. Newly computed samples are written back to the cache.
+ *
+ * \param sampleDensity
+ *    Number of samples per unit area
+ * \param proc
+ *    Refers to the sampling process while it is running, so that it
+ *    can be cancelled
+ * \return \c false if the sampling process was cancelled
+ */
+extern bool sampleIrradiance(const Scene *scene, const Subsurface *ss,
+	const void *progressReporterPayload, int sceneResID, Float sampleDensity,
+	int irrSamples, bool irrIndirect, const fs::path &cacheDirectory,
+	bool incremental, ref<ParallelProcess> &proc, IrradianceOctree *octree);
+
+MTS_NAMESPACE_END
+
+#endif /* __IRR_STORE_H */
@@ -22,14 +22,17 @@
 MTS_NAMESPACE_BEGIN
 
 IrradianceOctree::IrradianceOctree(int maxDepth, Float threshold, const AABB &bounds) 
- : m_maxDepth(maxDepth), m_threshold(threshold) {
+ : m_aabb(bounds), m_maxDepth(maxDepth), m_threshold(threshold), m_nodes(NULL),
+   m_nodeCount(0), m_sampleData(NULL), m_sampleCount(0) {
 	m_root = new OctreeNode(bounds);
 	m_numSamples = 0;
 }
 
 IrradianceOctree::IrradianceOctree(Stream *stream, InstanceManager *manager) : 
-		SerializableObject(stream, manager) {
-	m_root = new OctreeNode(AABB(stream));
+		SerializableObject(stream, manager), m_nodes(NULL), m_nodeCount(0),
+		m_sampleData(NULL), m_sampleCount(0) {
+	m_aabb = AABB(stream);
+	m_root = new OctreeNode(m_aabb);
 	m_threshold = stream->readFloat();
 	m_maxDepth = stream->readInt();
 	m_numSamples = 0;
@@ -41,32 +44,63 @@ IrradianceOctree::IrradianceOctree(Stream *stream, InstanceManager *manager) :
 }
 
 IrradianceOctree::~IrradianceOctree() {
-	delete m_root;
+	if (m_root)
+		delete m_root;
+	if (m_nodes)
+		delete[] m_nodes;
+	if (m_sampleData)
+		freeAligned(m_sampleData);
 }
 
 void IrradianceOctree::serialize(Stream *stream, InstanceManager *manager) const {
-	m_root->aabb.serialize(stream);
+	m_aabb.serialize(stream);
 	stream->writeFloat(m_threshold);
 	stream->writeInt(m_maxDepth);
 	stream->writeUInt(m_numSamples);
-	m_root->serialize(stream);
+	if (m_root) {
+		m_root->serialize(stream);
+	} else {
+		/* Write the samples of all leaves without padding */
+		for (uint32_t i=0; i<m_nodeCount; ++i) {
+			const FlatNode &node = m_nodes[i];
+			if (!node.leaf)
+				continue;
+			for (uint32_t j=node.index; j<node.index + node.count; ++j) {
+				if (m_sampleArrays.area[j] > 0)
+					m_sampleArrays.get(j).serialize(stream);
+			}
+		}
+	}
 }
 	
 	
 void IrradianceOctree::addSample(const IrradianceSample &sample) {
 	static StatsCounter numSamples("SSS IrradianceOctree", "Number of samples");
 	++numSamples;
-	++m_numSamples;
-	if (!sample.E.isValid())
+	if (!m_root) {
+		Log(EError, "Samples cannot be added to a flattened octree!");
+	} else if (!sample.E.isValid()) {
 		Log(EWarn, "Invalid sample: %s", sample.E.toString().c_str());
-	else
+	} else {
+		/* Only count stored samples, since this is also the 
+		   number of samples written by serialize() */
+		++m_numSamples;
 		addSample(m_root, sample, 0);
+	}
 }
 
 void IrradianceOctree::dumpOBJ(const std::string &filename) const {
 	std::ofstream os(filename.c_str());
 	os << "o IrrSamples" << endl;
-	m_root->dumpOBJ(os);
+	if (m_root) {
+		m_root->dumpOBJ(os);
+	} else {
+		for (size_t i=0; i<m_sampleCount; ++i) {
+			if (m_sampleArrays.area[i] > 0)
+				os << "v " << m_sampleArrays.p[0][i] << " " << m_sampleArrays.p[1][i]
+				   << " " << m_sampleArrays.p[2][i] << endl;
+		}
+	}
 	/// Need to generate some fake geometry so that blender will import the points
 	for (unsigned int i=3; i<=m_numSamples; i++) 
 		os << "f " << i << " " << i-1 << " " << i-2 << endl;
@@ -103,6 +137,97 @@ void IrradianceOctree::addSample(OctreeNode *node, const IrradianceSample &sampl
 	node->samples.swap(empty);
 }
 
+void IrradianceOctree::preprocess(bool flatten) {
+	if (!m_root)
+		return;
+	Log(EDebug, "Sub-surface integrator - clustering %i samples..", m_numSamples);
+	preprocess(m_root);
+	if (flatten)
+		this->flatten();
+}
+
+void IrradianceOctree::count(const OctreeNode *node, size_t &nodeCount,
+		size_t &sampleCount) const {
+	++nodeCount;
+	if (node->leaf) {
+		sampleCount += (node->samples.size() + 3) & ~(size_t) 3;
+	} else {
+		for (int i=0; i<8; i++)
+			if (node->children[i])
+				count(node->children[i], nodeCount, sampleCount);
+	}
+}
+
+void IrradianceOctree::flatten() {
+	size_t nodeCount = 0, sampleCount = 0;
+	count(m_root, nodeCount, sampleCount);
+	if (nodeCount > 0xFFFFFFFFULL || sampleCount > 0xFFFFFFFFULL)
+		Log(EError, "The irradiance octree is too large to be flattened!");
+
+	const int fields = 3 + 3 + SPECTRUM_SAMPLES + 1;
+	m_nodes = new FlatNode[nodeCount];
+	m_nodeCount = 0;
+	m_sampleCount = 0;
+	if (sampleCount > 0)
+		m_sampleData = static_cast<Float *>(allocAligned(
+			fields * sampleCount * sizeof(Float)));
+	Float *ptr = m_sampleData;
+	for (int i=0; i<3; ++i, ptr += sampleCount)
+		m_sampleArrays.p[i] = ptr;
+	for (int i=0; i<3; ++i, ptr += sampleCount)
+		m_sampleArrays.n[i] = ptr;
+	for (int i=0; i<SPECTRUM_SAMPLES; ++i, ptr += sampleCount)
+		m_sampleArrays.E[i] = ptr;
+	m_sampleArrays.area = ptr;
+
+	flatten(m_root);
+	Assert(m_nodeCount == nodeCount && m_sampleCount == sampleCount);
+	Log(EDebug, "Flattened the irradiance octree (%i nodes, " SIZE_T_FMT 
+		" clusters, %s)", m_nodeCount, m_clusters.size(), memString(
+		nodeCount * sizeof(FlatNode) + fields * sampleCount * sizeof(Float)
+		+ m_clusters.size() * sizeof(IrradianceSample)).c_str());
+
+	delete m_root;
+	m_root = NULL;
+}
+
+void IrradianceOctree::flatten(const OctreeNode *node) {
+	uint32_t index = m_nodeCount++;
+	FlatNode &flatNode = m_nodes[index];
+	flatNode.aabb = node->aabb;
+	flatNode.clusterP = node->cluster.p;
+	flatNode.clusterArea = node->cluster.area;
+	flatNode.leaf = node->leaf;
+
+	if (node->leaf) {
+		size_t count = node->samples.size(),
+			   padded = (count + 3) & ~(size_t) 3;
+		flatNode.index = (uint32_t) m_sampleCount;
+		flatNode.count = (uint32_t) padded;
+		for (size_t i=0; i<padded; ++i) {
+			/* Padding repeats the position of the last sample and has zero area */
+			const IrradianceSample &sample = node->samples[std::min(i, count-1)];
+			size_t target = m_sampleCount + i;
+			for (int j=0; j<3; ++j) {
+				m_sampleArrays.p[j][target] = sample.p[j];
+				m_sampleArrays.n[j][target] = sample.n[j];
+			}
+			for (int j=0; j<SPECTRUM_SAMPLES; ++j)
+				m_sampleArrays.E[j][target] = i < count ? sample.E[j] : 0.0f;
+			m_sampleArrays.area[target] = i < count ? sample.area : 0.0f;
+		}
+		m_sampleCount += padded;
+	} else {
+		flatNode.index = (uint32_t) m_clusters.size();
+		flatNode.count = 0;
+		m_clusters.push_back(node->cluster);
+		for (int i=0; i<8; i++)
+			if (node->children[i])
+				flatten(node->children[i]);
+	}
+	flatNode.next = m_nodeCount;
+}
+
 void IrradianceOctree::preprocess(OctreeNode *node) {
 	/* Initialize the cluster values */
 	node->cluster.E = Spectrum(0.0f);
@@ -71,6 +71,32 @@ private:
 		}
 	};
 public:
+	/**
+	 * Leaf samples of the flattened octree in structure-of-arrays
+	 * layout. The samples of every leaf start at a multiple of four and
+	 * are padded with samples of zero area, hence they can be processed
+	 * in groups of four using aligned SSE loads.
+	 */
+	struct SampleArrays {
+		Float *p[3];
+		Float *n[3];
+		Float *E[SPECTRUM_SAMPLES];
+		Float *area;
+
+		/// Gather a single sample
+		inline IrradianceSample get(uint32_t index) const {
+			IrradianceSample sample;
+			for (int i=0; i<3; ++i) {
+				sample.p[i] = p[i][index];
+				sample.n[i] = n[i][index];
+			}
+			for (int i=0; i<SPECTRUM_SAMPLES; ++i)
+				sample.E[i] = E[i][index];
+			sample.area = area[index];
+			return sample;
+		}
+	};
+
 	/// Construct an empty octree
 	IrradianceOctree(int maxDepth, Float threshold, const AABB &bounds); 
 
@@ -83,19 +109,58 @@ public:
 	/// Add an irradiance sample to the octree
 	void addSample(const IrradianceSample &sample);
 
-	/// Query the octree using a customizable implementation
+	/**
+	 * Query the octree using a customizable implementation, which 
+	 * is invoked for one sample or cluster at a time
+	 */
 	template <typename QueryType> inline void execute(QueryType &query) const {
-		execute(m_root, query);
+		if (m_root) {
+			execute(m_root, query);
+		} else {
+			PerSampleQuery<QueryType> adapter(query);
+			executeBatched(adapter);
+		}
 	}
 
+	/**
+	 * Query the flattened octree using a customizable implementation,
+	 * which processes the samples of a leaf at once. Apart from a
+	 * point \c p, the query must provide the operators
+	 * <tt>()(const IrradianceSample &cluster)</tt> and
+	 * <tt>()(const SampleArrays &samples, uint32_t start, uint32_t count)</tt>,
+	 * where \c count is a multiple of four.
+	 */
+	template <typename QueryType> void executeBatched(QueryType &query) const {
+		const Point p = query.p;
+		uint32_t index = 0;
+		while (index < m_nodeCount) {
+			const FlatNode &node = m_nodes[index];
+			if (node.leaf) {
+				if (node.count > 0)
+					query(m_sampleArrays, node.index, node.count);
+				index = node.next;
+			} else if (!node.aabb.contains(p) && node.clusterArea 
+					/ (p - node.clusterP).lengthSquared() < m_threshold) {
+				query(m_clusters[node.index]);
+				index = node.next;
+			} else {
+				++index;
+			}
+		}
+	}
+
+	/// Has the octree been flattened?
+	inline bool isFlattened() const { return m_root == NULL; }
+
 	/// Write the samples to an OBJ file for debugging
 	void dumpOBJ(const std::string &filename) const;
 
-	/// Pre-process step (clusters the samples)
-	inline void preprocess() { 
-		Log(EDebug, "Sub-surface integrator - clustering %i samples..", m_numSamples);
-		preprocess(m_root);
-	}
+	/**
+	 * Pre-process step (clusters the samples). Afterwards, the tree is
+	 * flattened into contiguous arrays unless requested otherwise, and
+	 * no more samples can be added.
+	 */
+	void preprocess(bool flatten = true);
 
 	MTS_DECLARE_CLASS()
 protected:
@@ -105,7 +170,53 @@ protected:
 	/// Pre-process step (clusters the samples)
 	void preprocess(OctreeNode *node);
 
-	/// Query the octree using a customizable implementation
+	/**
+	 * Node of the flattened octree. The nodes are stored in depth-first
+	 * order, hence the first child of an inner node directly follows it
+	 */
+	struct FlatNode {
+		AABB aabb;
+		/// Cluster position and area (inner nodes)
+		Point clusterP;
+		Float clusterArea;
+		/// Index of the node following the subtree of this node
+		uint32_t next;
+		/// First sample (leaves) or index of the cluster (inner nodes)
+		uint32_t index;
+		/// Padded number of samples (leaves)
+		uint32_t count;
+		bool leaf;
+	};
+
+	/// Adapter for invoking a per-sample query on the flattened tree
+	template <typename QueryType> struct PerSampleQuery {
+		inline PerSampleQuery(QueryType &query) : query(query), p(query.p) { }
+
+		inline void operator()(const IrradianceSample &cluster) {
+			query(cluster);
+		}
+
+		inline void operator()(const SampleArrays &samples, uint32_t start, uint32_t count) {
+			for (uint32_t i=start; i<start+count; ++i) {
+				if (samples.area[i] > 0)
+					query(samples.get(i));
+			}
+		}
+
+		QueryType &query;
+		Point p;
+	};
+
+	/// Count the nodes and padded samples of a subtree
+	void count(const OctreeNode *node, size_t &nodeCount, size_t &sampleCount) const;
+
+	/// Copy a subtree into the flattened representation
+	void flatten(const OctreeNode *node);
+
+	/// Convert the tree into the flattened representation
+	void flatten();
+
+	/// Query the pointer-based octree using a customizable implementation
 	template <typename QueryType> void execute(OctreeNode *node, QueryType &query) const {
 		if (node->leaf) {
 			for (sample_iterator it = node->samples.begin();
@@ -127,9 +238,17 @@ protected:
 	virtual ~IrradianceOctree();
 private:
 	OctreeNode *m_root;
+	AABB m_aabb;
 	int m_maxDepth;
 	unsigned int m_numSamples;
 	Float m_threshold;
+	/* Flattened representation */
+	FlatNode *m_nodes;
+	uint32_t m_nodeCount;
+	std::vector<IrradianceSample> m_clusters;
+	SampleArrays m_sampleArrays;
+	Float *m_sampleData;
+	size_t m_sampleCount;
 };
 
 MTS_NAMESPACE_END
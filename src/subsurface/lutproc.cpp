@@ -0,0 +1,386 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/core/random.h>
+#include <mitsuba/render/range.h>
+#include "lutproc.h"
+
+MTS_NAMESPACE_BEGIN
+
+/* Number of table entries per work unit */
+#define LUT_GRANULARITY 4
+
+DiffusionProfile::DiffusionProfile(Stream *stream) {
+	sigmaTr = Spectrum(stream);
+	size_t count = stream->readSize();
+	zr.resize(count);
+	zv.resize(count);
+	for (size_t i=0; i<count; ++i) {
+		zr[i] = Spectrum(stream);
+		zv[i] = Spectrum(stream);
+	}
+	slabThickness = stream->readFloat();
+	multipole = stream->readBool();
+}
+
+void DiffusionProfile::serialize(Stream *stream) const {
+	sigmaTr.serialize(stream);
+	stream->writeSize(zr.size());
+	for (size_t i=0; i<zr.size(); ++i) {
+		zr[i].serialize(stream);
+		zv[i].serialize(stream);
+	}
+	stream->writeFloat(slabThickness);
+	stream->writeBool(multipole);
+}
+
+Spectrum DiffusionProfile::getRd(const Spectrum &r) const {
+	const Spectrum one(1.0f);
+	const Spectrum negSigmaTr = sigmaTr * (-1.0f);
+	const Spectrum rSqr = r * r;
+
+	if (!multipole) {
+		/* Distance to the real source */
+		Spectrum dr = (rSqr + zr[0]*zr[0]).sqrt();
+		/* Distance to the image point source */
+		Spectrum dv = (rSqr + zv[0]*zv[0]).sqrt();
+
+		Spectrum C1 = zr[0] * (sigmaTr + one / dr);
+		Spectrum C2 = zv[0] * (sigmaTr + one / dv);
+
+		/* Do not include the reduced albedo - will be canceled out later */
+		Spectrum dMo = Spectrum(0.25f * INV_PI) *
+			 (C1 * ((negSigmaTr * dr).exp()) / (dr * dr)
+			+ C2 * ((negSigmaTr * dv).exp()) / (dv * dv));
+
+		dMo.clampNegative();
+		return dMo;
+	}
+
+	Spectrum Rd(0.0f);
+	for (size_t i=0; i<zr.size(); ++i) {
+		const Spectrum &zri = zr[i], &zvi = zv[i];
+		/* Distance to the real source */
+		Spectrum dri = (rSqr + zri*zri).sqrt();
+		/* Distance to the image point source */
+		Spectrum dvi = (rSqr + zvi*zvi).sqrt();
+
+		/* Do not include the reduced albedo - will be canceled out later */
+		Rd += Spectrum(0.25f * INV_PI) *
+			 (zri * (one + sigmaTr * dri) * ((negSigmaTr * dri).exp())
+					/ (dri * dri * dri)
+			- zvi * (one + sigmaTr * dvi) * ((negSigmaTr * dvi).exp())
+					/ (dvi * dvi * dvi));
+	}
+	return Rd;
+}
+
+Spectrum DiffusionProfile::getTd(const Spectrum &r) const {
+	const Spectrum one(1.0f);
+	const Spectrum negSigmaTr = sigmaTr * (-1.0f);
+	const Spectrum rSqr = r * r;
+	const Spectrum d(slabThickness);
+
+	Spectrum Td(0.0f);
+	for (size_t i=0; i<zr.size(); ++i) {
+		const Spectrum &zri = zr[i], &zvi = zv[i];
+		/* Distance to the real source */
+		Spectrum dri = (rSqr + zri*zri).sqrt();
+		/* Distance to the image point source */
+		Spectrum dvi = (rSqr + zvi*zvi).sqrt();
+
+		/* Do not include the reduced albedo - will be canceled out later */
+		Td += (d - zri) * (one + dri * sigmaTr) * ((negSigmaTr * dri).exp())
+					/ (dri * dri * dri)
+			- (d - zvi) * (one + dvi * sigmaTr) * ((negSigmaTr * dvi).exp())
+					/ (dvi * dvi * dvi);
+	}
+	/* Unfortunately, Td can get negative */
+	Td.clampNegative();
+
+	return Spectrum(0.25f * INV_PI) * Td;
+}
+
+/* Look-up table precomputation (worker) */
+class RdTableWorker : public WorkProcessor {
+public:
+	RdTableWorker(const DiffusionProfile &profile, Float resolution,
+		int mcIterations, uint64_t seed) : m_profile(profile),
+		m_resolution(resolution), m_mcIterations(mcIterations), m_seed(seed) {
+	}
+
+	RdTableWorker(Stream *stream, InstanceManager *manager)
+		: m_profile(stream) {
+		m_resolution = stream->readFloat();
+		m_mcIterations = stream->readInt();
+		m_seed = stream->readULong();
+	}
+
+	void serialize(Stream *stream, InstanceManager *manager) const {
+		m_profile.serialize(stream);
+		stream->writeFloat(m_resolution);
+		stream->writeInt(m_mcIterations);
+		stream->writeULong(m_seed);
+	}
+
+	ref<WorkUnit> createWorkUnit() const {
+		return new RangeWorkUnit();
+	}
+
+	ref<WorkResult> createWorkResult() const {
+		return new RdTableResult();
+	}
+
+	void prepare() {
+		m_random = new Random(m_seed);
+	}
+
+	void process(const WorkUnit *workUnit, WorkResult *workResult,
+		const bool &stop) {
+		const RangeWorkUnit *range = static_cast<const RangeWorkUnit *>(workUnit);
+		RdTableResult *result = static_cast<RdTableResult *>(workResult);
+		const Spectrum invSigmaTr = Spectrum(1.0f) / m_profile.sigmaTr;
+
+		result->init(range->getRangeStart(), range->getSize(),
+			m_profile.multipole, m_mcIterations > 0);
+
+		for (size_t i=0; i<result->size(); ++i) {
+			const size_t entry = result->getStart() + i;
+			const Float r = entry * m_resolution;
+
+			result->getRd(i) = m_profile.getRd(Spectrum(r));
+			if (m_profile.multipole)
+				result->getTd(i) = m_profile.getTd(Spectrum(r));
+
+			if (m_mcIterations == 0 || stop)
+				continue;
+
+			/* Every entry uses its own random number stream */
+			uint64_t seed[2] = { m_seed, entry };
+			m_random->seed(seed, 2);
+
+			/* Integrate Rd over the surface by importance sampling distances
+			   distributed according to sigmaTr^2 * e^(-sigmaTr * r). The
+			   first entry integrates the entire surface, all others
+			   clamp the distances to their own distance. */
+			Spectrum sum(0.0f);
+			for (int n = 0; n < m_mcIterations; ++n) {
+				Spectrum rSample = invSigmaTr * -std::log(1 - m_random->nextFloat());
+				if (entry > 0) {
+					for (int s=0; s<SPECTRUM_SAMPLES; ++s)
+						rSample[s] = std::min(r, rSample[s]);
+				}
+				sum += m_profile.getRd(rSample);
+			}
+			result->getEstimate(i) = sum;
+		}
+	}
+
+	ref<WorkProcessor> clone() const {
+		return new RdTableWorker(m_profile, m_resolution, m_mcIterations, m_seed);
+	}
+
+	MTS_DECLARE_CLASS()
+protected:
+	virtual ~RdTableWorker() { }
+private:
+	DiffusionProfile m_profile;
+	Float m_resolution;
+	int m_mcIterations;
+	uint64_t m_seed;
+	ref<Random> m_random;
+};
+
+void RdTableResult::init(size_t start, size_t size, bool transmittance, bool estimates) {
+	m_start = start;
+	m_Rd.resize(size);
+	m_Td.resize(transmittance ? size : 0);
+	m_estimates.resize(estimates ? size : 0);
+}
+
+void RdTableResult::load(Stream *stream) {
+	m_start = stream->readSize();
+	size_t size = stream->readSize();
+	bool transmittance = stream->readBool(), estimates = stream->readBool();
+	init(m_start, size, transmittance, estimates);
+	for (size_t i=0; i<size; ++i) {
+		m_Rd[i] = Spectrum(stream);
+		if (transmittance)
+			m_Td[i] = Spectrum(stream);
+		if (estimates)
+			m_estimates[i] = Spectrum(stream);
+	}
+}
+
+void RdTableResult::save(Stream *stream) const {
+	stream->writeSize(m_start);
+	stream->writeSize(m_Rd.size());
+	stream->writeBool(hasTransmittance());
+	stream->writeBool(hasEstimates());
+	for (size_t i=0; i<m_Rd.size(); ++i) {
+		m_Rd[i].serialize(stream);
+		if (hasTransmittance())
+			m_Td[i].serialize(stream);
+		if (hasEstimates())
+			m_estimates[i].serialize(stream);
+	}
+}
+
+std::string RdTableResult::toString() const {
+	std::ostringstream oss;
+	oss << "RdTableResult[start=" << m_start
+		<< ", size=" << m_Rd.size() << "]";
+	return oss.str();
+}
+
+RdTableProcess::RdTableProcess(const DiffusionProfile &profile, Float resolution,
+	Float rMax, Float errThreshold, int mcIterations, uint64_t seed)
+	: m_profile(profile), m_resolution(resolution), m_rMax(rMax),
+	m_errThreshold(errThreshold), m_mcIterations(mcIterations), m_seed(seed) {
+	m_resultMutex = new Mutex();
+	m_entriesRequested = 0;
+	m_granularity = LUT_GRANULARITY;
+	m_lastEntry = 0;
+
+	if (m_rMax >= 0) {
+		/* The table size is known -- no need for Monte Carlo integration */
+		m_entryCount = (size_t) (m_rMax / m_resolution) + 1;
+		m_mcIterations = 0;
+	} else {
+		if (m_mcIterations < 2)
+			Log(EError, "At least two Monte Carlo iterations are required!");
+		m_entryCount = std::numeric_limits<size_t>::max();
+	}
+}
+
+ref<WorkProcessor> RdTableProcess::createWorkProcessor() const {
+	return new RdTableWorker(m_profile, m_resolution, m_mcIterations, m_seed);
+}
+
+ParallelProcess::EStatus RdTableProcess::generateWork(WorkUnit *unit, int worker) {
+	m_resultMutex->lock();
+	/* Stop as soon as an entry satisfies the error threshold. All entries
+	   before it have already been requested, hence the final table does
+	   not depend on the order in which the results arrive */
+	bool done = m_entriesRequested == m_entryCount || m_lastEntry != 0;
+	m_resultMutex->unlock();
+	if (done)
+		return EFailure;
+
+	size_t workSize = std::min(m_granularity, m_entryCount - m_entriesRequested);
+	RangeWorkUnit *range = static_cast<RangeWorkUnit *>(unit);
+	range->setRange(m_entriesRequested, m_entriesRequested + workSize - 1);
+	m_entriesRequested += workSize;
+
+	return ESuccess;
+}
+
+void RdTableProcess::processResult(const WorkResult *wr, bool cancelled) {
+	if (cancelled)
+		return;
+	const RdTableResult *result = static_cast<const RdTableResult *>(wr);
+	const size_t start = result->getStart(), end = start + result->size();
+
+	m_resultMutex->lock();
+	if (m_Rd.size() < end) {
+		m_Rd.resize(end);
+		m_Td.resize(end);
+		m_estimates.resize(end);
+		m_done.resize(end, false);
+	}
+	for (size_t i=start; i<end; ++i) {
+		m_Rd[i] = result->getRd(i - start);
+		if (result->hasTransmittance())
+			m_Td[i] = result->getTd(i - start);
+		if (result->hasEstimates())
+			m_estimates[i] = result->getEstimate(i - start);
+		m_done[i] = true;
+	}
+
+	/* Check the new entries against the reference integral (or
+	   all entries, if the reference has just arrived) */
+	if (m_mcIterations > 0 && m_done[0]) {
+		const size_t checkStart = (start == 0) ? 1 : start,
+			checkEnd = (start == 0) ? m_done.size() : end;
+		for (size_t i=checkStart; i<checkEnd; ++i) {
+			if (m_done[i] && (m_lastEntry == 0 || i < m_lastEntry)
+					&& getError(i) <= m_errThreshold)
+				m_lastEntry = i;
+		}
+	}
+	m_resultMutex->unlock();
+}
+
+Float RdTableProcess::getError(size_t index) const {
+	/* The constant factors of both estimates cancel out */
+	const Float invSigmaTrMax = (Spectrum(1.0f) / m_profile.sigmaTr).max(),
+		r = index * m_resolution;
+	const Spectrum RdA = m_estimates[0] * (invSigmaTrMax * invSigmaTrMax),
+		RdAPrime = m_estimates[index] * (r * r);
+
+	return ((RdA - RdAPrime) / RdA).max();
+}
+
+void RdTableProcess::finalize() {
+	if (m_RdTable.get())
+		return;
+
+	size_t entryCount = m_entryCount;
+	if (m_mcIterations > 0) {
+		/* Find the first entry satisfying the error threshold. All
+		   entries up to there are guaranteed to be available */
+		for (entryCount = 1; entryCount < m_done.size(); ++entryCount) {
+			if (getError(entryCount) <= m_errThreshold)
+				break;
+		}
+		if (entryCount == m_done.size())
+			Log(EError, "The look-up table precomputation did not finish!");
+		m_rMax = entryCount * m_resolution;
+		++entryCount;
+	}
+
+	m_RdTable = new SubsurfaceMaterialManager::LUTType(entryCount);
+	for (size_t i=0; i<entryCount; ++i)
+		m_RdTable->at(i) = m_Rd[i];
+
+	if (m_profile.multipole) {
+		m_TdTable = new SubsurfaceMaterialManager::LUTType(entryCount);
+		for (size_t i=0; i<entryCount; ++i)
+			m_TdTable->at(i) = m_Td[i];
+	}
+}
+
+Float RdTableProcess::getMaxDistance() {
+	finalize();
+	return m_rMax;
+}
+
+SubsurfaceMaterialManager::LUTType *RdTableProcess::getRdTable() {
+	finalize();
+	return m_RdTable;
+}
+
+SubsurfaceMaterialManager::LUTType *RdTableProcess::getTdTable() {
+	finalize();
+	return m_TdTable;
+}
+
+MTS_IMPLEMENT_CLASS(RdTableResult, false, WorkResult);
+MTS_IMPLEMENT_CLASS_S(RdTableWorker, false, WorkProcessor);
+MTS_IMPLEMENT_CLASS(RdTableProcess, false, ParallelProcess);
+MTS_NAMESPACE_END
@@ -0,0 +1,191 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__LUT_PROC_H)
+#define __LUT_PROC_H
+
+#include <mitsuba/render/subsurface.h>
+#include <mitsuba/core/sched.h>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * Radial diffusion profile of a dipole or a multipole configuration.
+ * This is everything needed to evaluate the diffuse reflectance and
+ * transmittance of a material, which makes it possible to precompute
+ * look-up tables on remote machines.
+ */
+struct DiffusionProfile {
+	/// Effective transport extinction coefficient
+	Spectrum sigmaTr;
+	/// Distances of the real and virtual point sources to the surface
+	std::vector<Spectrum> zr, zv;
+	/// Thickness of the slab (multipoles only)
+	Float slabThickness;
+	/// Use the multipole formulation? Otherwise, \c zr and \c zv contain one dipole
+	bool multipole;
+
+	/// Create an empty profile
+	inline DiffusionProfile() : slabThickness(0), multipole(false) { }
+
+	/// Unserialize a profile from a binary data stream
+	DiffusionProfile(Stream *stream);
+
+	/// Serialize a profile to a binary data stream
+	void serialize(Stream *stream) const;
+
+	/**
+	 * Diffuse reflectance at the distances \c r (one per wavelength),
+	 * without the reduced albedo
+	 */
+	Spectrum getRd(const Spectrum &r) const;
+
+	/**
+	 * Diffuse transmittance at the distances \c r (one per wavelength),
+	 * without the reduced albedo. Only supported by multipoles.
+	 */
+	Spectrum getTd(const Spectrum &r) const;
+};
+
+/**
+ * Stores a range of precomputed look-up table entries, which can
+ * be sent over the wire as needed
+ */
+class RdTableResult : public WorkResult {
+public:
+	RdTableResult() : m_start(0) { }
+
+	/// Prepare for storing the entries <tt>start, .., start+size-1</tt>
+	void init(size_t start, size_t size, bool transmittance, bool estimates);
+
+	inline size_t getStart() const { return m_start; }
+	inline size_t size() const { return m_Rd.size(); }
+	inline bool hasTransmittance() const { return m_Td.size() > 0; }
+	inline bool hasEstimates() const { return m_estimates.size() > 0; }
+
+	/// Diffuse reflectance at the distance of entry \c i
+	inline Spectrum &getRd(size_t i) { return m_Rd[i]; }
+	inline const Spectrum &getRd(size_t i) const { return m_Rd[i]; }
+
+	/// Diffuse transmittance at the distance of entry \c i
+	inline Spectrum &getTd(size_t i) { return m_Td[i]; }
+	inline const Spectrum &getTd(size_t i) const { return m_Td[i]; }
+
+	/**
+	 * Sum of the Monte Carlo samples of the integrated reflectance,
+	 * where the distances were clamped to the distance of entry \c i
+	 * (or not at all for the first entry)
+	 */
+	inline Spectrum &getEstimate(size_t i) { return m_estimates[i]; }
+	inline const Spectrum &getEstimate(size_t i) const { return m_estimates[i]; }
+
+	/* WorkResult interface */
+	void load(Stream *stream);
+	void save(Stream *stream) const;
+	std::string toString() const;
+
+	MTS_DECLARE_CLASS()
+protected:
+	// Virtual destructor
+	virtual ~RdTableResult() { }
+private:
+	size_t m_start;
+	std::vector<Spectrum> m_Rd, m_Td, m_estimates;
+};
+
+/**
+ * Parallel process for precomputing the diffuse reflectance (and
+ * transmittance) look-up tables of the dipole and multipole integrators.
+ *
+ * Entry \c i of the tables stores the profile at the distance
+ * <tt>i*resolution</tt>. Unless the maximum distance is specified, the
+ * process also determines the smallest table size, for which the energy
+ * beyond the last entry falls below a relative error threshold. To do
+ * so, every entry additionally estimates the integrated reflectance
+ * with distances clamped to its own distance using Monte Carlo
+ * integration. The samples of each entry are drawn from a separate
+ * random number stream derived from the seed, hence the results do not
+ * depend on the number of workers or the order of execution.
+ */
+class RdTableProcess : public ParallelProcess {
+public:
+	/**
+	 * \param resolution
+	 *    Distance between two table entries
+	 * \param rMax
+	 *    Maximum distance stored in the table, or a negative value if
+	 *    it should be determined using Monte Carlo integration
+	 * \param errThreshold
+	 *    Permitted relative error of the truncated integrated reflectance
+	 * \param mcIterations
+	 *    Number of Monte Carlo samples per estimate
+	 * \param seed
+	 *    Seed of the random number streams
+	 */
+	RdTableProcess(const DiffusionProfile &profile, Float resolution,
+		Float rMax, Float errThreshold, int mcIterations, uint64_t seed);
+
+	/// Set the number of table entries per work unit (must be called before scheduling)
+	inline void setGranularity(size_t granularity) { m_granularity = granularity; }
+
+	/**
+	 * The following functions may only be called after the
+	 * process has finished successfully
+	 */
+
+	/// Return the maximum distance stored in the tables
+	Float getMaxDistance();
+
+	/// Return the diffuse reflectance table
+	SubsurfaceMaterialManager::LUTType *getRdTable();
+
+	/// Return the diffuse transmittance table (multipoles only)
+	SubsurfaceMaterialManager::LUTType *getTdTable();
+
+	/* ParallelProcess implementation */
+	ref<WorkProcessor> createWorkProcessor() const;
+	void processResult(const WorkResult *wr, bool cancelled);
+	ParallelProcess::EStatus generateWork(WorkUnit *unit, int worker);
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Virtual destructor
+	virtual ~RdTableProcess() { }
+
+	/// Relative error of the reflectance truncated at entry \c index
+	Float getError(size_t index) const;
+
+	/// Create the final tables once all results have arrived
+	void finalize();
+private:
+	DiffusionProfile m_profile;
+	Float m_resolution, m_rMax, m_errThreshold;
+	int m_mcIterations;
+	uint64_t m_seed;
+	size_t m_entriesRequested, m_entryCount, m_granularity;
+	/* Smallest entry known to satisfy the error threshold (or 0) */
+	size_t m_lastEntry;
+	std::vector<Spectrum> m_Rd, m_Td, m_estimates;
+	std::vector<bool> m_done;
+	ref<SubsurfaceMaterialManager::LUTType> m_RdTable, m_TdTable;
+	ref<Mutex> m_resultMutex;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __LUT_PROC_H */
@@ -19,96 +19,16 @@
 #include <mitsuba/render/subsurface.h>
 #include <mitsuba/render/scene.h>
 #include <mitsuba/core/plugin.h>
-#include <boost/timer.hpp>
-#include "irrtree.h"
+#include <mitsuba/core/fresolver.h>
+#include "irrstore.h"
+#include "irrquery.h"
+#include "lutproc.h"
 
 MTS_NAMESPACE_BEGIN
 
 typedef SubsurfaceMaterialManager::LUTType LUTType;
 typedef SubsurfaceMaterialManager::LUTRecord LUTRecord;
 
-/**
- * Computes the combined diffuse radiant exitance 
- * caused by a number of dipole sources
- */
-struct IsotropicDipoleQuery {
-#if !defined(MTS_SSE) || (SPECTRUM_SAMPLES != 3)
-	inline IsotropicDipoleQuery(const Spectrum &zr, const Spectrum &zv, 
-		const Spectrum &sigmaTr, Float Fdt, const Point &p)
-		: zr(zr), zv(zv), sigmaTr(sigmaTr), result(0.0f), Fdt(Fdt), p(p) {
-			count = 0;
-	}
-
-	inline void operator()(const IrradianceSample &sample) {
-		Spectrum rSqr = Spectrum((p - sample.p).lengthSquared());
-		/* Distance to the real source */
-		Spectrum dr = (rSqr + zr*zr).sqrt();
-		/* Distance to the image point source */
-		Spectrum dv = (rSqr + zv*zv).sqrt();
-		Spectrum C1 = zr * (sigmaTr + Spectrum(1.0f) / dr);
-		Spectrum C2 = zv * (sigmaTr + Spectrum(1.0f) / dv);
-
-		/* Do not include the reduced albedo - will be canceled out later */
-		Spectrum dMo = Spectrum(0.25f * INV_PI) *
-			 (C1 * ((-sigmaTr * dr).exp()) / (dr * dr)
-			+ C2 * ((-sigmaTr * dv).exp()) / (dv * dv));
-        
-		result += dMo * sample.E * (sample.area * Fdt);
-		count++;
-	}
-
-	inline const Spectrum &getResult() const {
-		return result;
-	}
-
-	Spectrum zr, zv, sigmaTr, result;
-#else
-	inline IsotropicDipoleQuery(const Spectrum &_zr, const Spectrum &_zv, 
-		const Spectrum &_sigmaTr, Float Fdt, const Point &p) : Fdt(Fdt), p(p) {
-		zr = _mm_set_ps(_zr[0], _zr[1], _zr[2], 0);
-		zv = _mm_set_ps(_zv[0], _zv[1], _zv[2], 0);
-		sigmaTr = _mm_set_ps(_sigmaTr[0], _sigmaTr[1], _sigmaTr[2], 0);
-		zrSqr = _mm_mul_ps(zr, zr);
-		zvSqr = _mm_mul_ps(zv, zv);
-		result.ps = _mm_setzero_ps();
-		count = 0;
-	}
-
-	inline void operator()(const IrradianceSample &sample) {
-		/* Distance to the positive point source of the dipole */
-		const __m128 lengthSquared = _mm_set1_ps((p - sample.p).lengthSquared()),
-			drSqr = _mm_add_ps(zrSqr, lengthSquared), 
-			dvSqr = _mm_add_ps(zvSqr, lengthSquared),
-			dr = _mm_sqrt_ps(drSqr), dv = _mm_sqrt_ps(dvSqr), 
-			one = _mm_set1_ps(1.0f),
-			factor = _mm_mul_ps(_mm_set1_ps(0.25f*INV_PI*sample.area * Fdt),
-				_mm_set_ps(sample.E[0], sample.E[1], sample.E[2], 0)),
-			C1fac = _mm_div_ps(_mm_mul_ps(zr, _mm_add_ps(sigmaTr, _mm_div_ps(one, dr))), drSqr),
-			C2fac = _mm_div_ps(_mm_mul_ps(zr, _mm_add_ps(sigmaTr, _mm_div_ps(one, dv))), dvSqr);
-		SSEVector temp1(_mm_mul_ps(dr, sigmaTr)), temp2(_mm_mul_ps(dv, sigmaTr));
-		const __m128
-			exp1 = _mm_set_ps(expf(-temp1.f[3]), expf(-temp1.f[2]), expf(-temp1.f[1]), 0),
-			exp2 = _mm_set_ps(expf(-temp2.f[3]), expf(-temp2.f[2]), expf(-temp2.f[1]), 0);
-		result.ps = _mm_add_ps(result.ps, _mm_mul_ps(factor, _mm_add_ps(
-			_mm_mul_ps(C1fac, exp1), _mm_mul_ps(C2fac, exp2))));
-	}
-
-	Spectrum getResult() {
-		Spectrum value;
-		for (int i=0; i<3; ++i)
-			value[i] = result.f[3-i];
-		return value;
-	}
-
-	__m128 zr, zv, zrSqr, zvSqr, sigmaTr;
-	SSEVector result;
-#endif
-
-	int count;
-	Float Fdt;
-	Point p;
-};
-
 /**
  * Computes the combined diffuse radiant exitance 
  * caused by a number of dipole sources
@@ -257,6 +177,16 @@ struct IsotropicLUTMultipoleQuery {
 		count++;
 	}
 
+	inline void operator()(const IrradianceOctree::SampleArrays &samples,
+			uint32_t start, uint32_t sampleCount) {
+		for (uint32_t i=start; i<start+sampleCount; ++i) {
+			/* Skip the padding at the end of a leaf */
+			if (samples.area[i] == 0)
+				continue;
+			(*this)(samples.get(i));
+		}
+	}
+
 	inline const Spectrum &getResult() const {
 		return result;
 	}
@@ -312,6 +242,14 @@ public:
 		m_minDelta= props.getFloat("quality", 0.1f);
 		/* Max. depth of the created octree */
 		m_maxDepth = props.getInteger("maxDepth", 40);
+		/* Directory, in which irradiance samples are kept between render
+		   jobs (e.g. for camera-only animations). Disabled by default */
+		if (props.hasProperty("irrCacheDir"))
+			m_irrCacheDir = Thread::getThread()->getFileResolver()->resolveAbsolute(
+				props.getString("irrCacheDir"));
+		/* Only resample shapes, whose geometry has changed since the 
+		   cached samples were taken? */
+		m_irrCacheIncremental = props.getBoolean("irrCacheIncremental", false);
 		/* Multiplicative factor for the subsurface term - can be used to remove
 		   this contribution completely, making it possible to use this integrator
 		   for other interesting things.. */
@@ -332,6 +270,8 @@ public:
             m_rMax = props.getFloat("lutRmax");
         }
         m_mcIterations = props.getInteger("mcIterations", 10000);
+        /* Seed for the Monte Carlo integration of the look-up-table */
+        m_lutSeed = (uint64_t) props.getLong("lutSeed", 5489);
 
         if (m_extraDipoles == 0) {
             Log(EInfo, "Using standard dipole model");
@@ -352,13 +292,19 @@ public:
 		m_sampleMultiplier = stream->readFloat();
 		m_minDelta = stream->readFloat();
 		m_maxDepth = stream->readInt();
-		m_octreeIndex = stream->readInt();
 		m_irrSamples = stream->readInt();
 		m_irrIndirect = stream->readBool();
+		m_octreeIndex = stream->readInt();
         m_useMartelliD = stream->readBool();
         m_useRdLookUpTable = stream->readBool();
         m_errThreshold = stream->readFloat();
         m_lutResolution = stream->readFloat();
+        m_lutSeed = stream->readULong();
+        if (stream->readBool()) {
+            m_rMax = stream->readFloat();
+            m_RdLookUpTable = new LUTType(stream);
+            m_TdLookUpTable = new LUTType(stream);
+        }
 		m_ready = false;
 		m_octreeResID = -1;
 		configure();
@@ -388,6 +334,13 @@ public:
         stream->writeBool(m_useRdLookUpTable);
         stream->writeFloat(m_errThreshold);
         stream->writeFloat(m_lutResolution);
+        stream->writeULong(m_lutSeed);
+        stream->writeBool(m_RdLookUpTable.get() != NULL);
+        if (m_RdLookUpTable.get()) {
+            stream->writeFloat(m_rMax);
+            m_RdLookUpTable->serialize(stream);
+            m_TdLookUpTable->serialize(stream);
+        }
 	}
 
 	Spectrum Lo(const Scene *scene, Sampler *sampler,  const Intersection &its,
@@ -400,14 +353,15 @@ public:
         Spectrum Mo = Spectrum(0.0f);
         /* If there are no extra dipoles, do a srandard dipolo query */
         if (m_extraDipoles == 0) {
-                IsotropicDipoleQuery query(m_zr[0], m_zv[0], m_sigmaTr, m_Fdt, its.p);
-                m_octree->execute(query);
+                /* The image source is stored with a negative sign */
+                BatchedDipoleQuery query(m_zr[0], -m_zv[0], m_sigmaTr, m_Fdt, its.p);
+                m_octree->executeBatched(query);
                 // compute combined radiant exitance
                 Mo = query.getResult();
         } else {
             if (m_useRdLookUpTable) {
                 IsotropicLUTMultipoleQuery query(m_RdLookUpTable, m_TdLookUpTable, m_lutResolution, m_Fdt, its.p, n, m_minMFP);
-                m_octree->execute(query);
+                m_octree->executeBatched(query);
                 Mo = query.getResult();
             } else {
                 // calulate diffuse reflectance and transmittance
@@ -492,157 +446,75 @@ public:
             m_zr.push_back( basicDist + m_mfp );
             m_zv.push_back( basicDist - m_mfp - 2 * zb );
         }
-
-        /* Create look-up-table for dMoR (if requested) that is indexed
-         * by the squared distance to the sample. The Monte Carlo
-         * is currently done with 10k samples. This could be done more
-         * dynamic. */
-        if (m_useRdLookUpTable) {
-            ref<SubsurfaceMaterialManager> smm = SubsurfaceMaterialManager::getInstance();
-            std::string lutHashR = smm->getMultipoleLUTHashR(m_lutResolution, m_errThreshold,
-                m_sigmaTr, m_alphaPrime, m_extraDipoles, m_zr, m_zv);
-            std::string lutHashT = smm->getMultipoleLUTHashT(m_lutResolution, m_errThreshold,
-                m_sigmaTr, m_alphaPrime, m_extraDipoles, m_zr, m_zv, m_slabThickness);
-            if (smm->hasLUT(lutHashR) && smm->hasLUT(lutHashT)) {
-                /* get Rd LUT */
-                LUTRecord lutR = smm->getLUT(lutHashR);
-                m_RdLookUpTable = lutR.lut;
-                AssertEx(lutR.resolution == m_lutResolution, "Cached Rd LUT does not have requested resolution!");
-                /* get Td LUT */
-                LUTRecord lutT = smm->getLUT(lutHashT);
-                m_TdLookUpTable = lutT.lut;
-                AssertEx(lutT.resolution == m_lutResolution, "Cached Td LUT does not have requested resolution!");
-            } else {
-                boost::timer timer;
-                if (!m_rMaxPredefined) {
-                    const Spectrum invSigmaTr = 1.0f / m_sigmaTr;
-                    const Float inv4Pi = 1.0f / (4 * M_PI);
-                    ref<Random> random = new Random();
-
-                    /* Find Rd for the whole area by monte carlo integration. The
-                     * sampling area is calculated from the max. mean free path.
-                     * A square area around with edge length 2 * maxMFP is used
-                     * for this. Hence, the sampling area is 4 * maxMFP * maxMFP. */
-                    const int numSamples = m_mcIterations;
-                    Spectrum Rd_A = Spectrum(0.0f);
-                    for (int n = 0; n < numSamples; ++n) {
-                        /* do importance sampling by choosing samples distributed
-                         * with sigmaTr^2 * e^(-sigmaTr * r). */
-                        Spectrum r = invSigmaTr * -std::log( random->nextFloat() );
-                        Rd_A += getRd(r);
-                    }
-                    Float A = 4 * invSigmaTr.max() * invSigmaTr.max();
-                    Rd_A = A * Rd_A * m_alphaPrime * inv4Pi / (Float)(numSamples - 1);
-                    Log(EDebug, "After %i MC integration iterations, Rd seems to be %s (took %.2fs)",
-                        numSamples, Rd_A.toString().c_str(), timer.elapsed());
-
-                    /* Since we now have Rd integrated over the whole surface we can find a valid rmax
-                     * for the given threshold. */
-                    timer.restart();
-                    const Float step = m_lutResolution;
-                    Float rMax = 0.0f;
-                    Spectrum err(std::numeric_limits<Float>::max());
-                    while (err.max() > m_errThreshold) {
-                        rMax += step;
-                        /* Again, do MC integration, but with r clamped at rmax. */
-                        Spectrum Rd_APrime(0.0f);
-                        for (int n = 0; n < numSamples; ++n) {
-                            /* do importance sampling by choosing samples distributed
-                             * with sigmaTr^2 * e^(-sigmaTr * r). */
-                            Spectrum r = invSigmaTr * -std::log( random->nextFloat() );
-                            // clamp samples to rMax
-                            for (int s=0; s<SPECTRUM_SAMPLES; ++s) {
-                                r[s] = std::min(rMax, r[s]);
-                            }
-                            Rd_APrime += getRd(r);
-                        }
-                        Float APrime = 4 * rMax * rMax;
-                        Rd_APrime = APrime * Rd_APrime * m_alphaPrime * inv4Pi / (Float)(numSamples - 1);
-                        err = (Rd_A - Rd_APrime) / Rd_A;
-                    }
-                    m_rMax = rMax;
-                    Log(EDebug, "Maximum distance for sampling surface is %f with an error of %f (took %.0fs)",
-                        m_rMax, m_errThreshold, timer.elapsed());
-                }
-
-                /* Create the actual look-up-table if it was MC integrated */
-                timer.restart();
-                const int numEntries = (int) (m_rMax / m_lutResolution) + 1;
-                m_RdLookUpTable = new LUTType(numEntries);
-                m_TdLookUpTable = new LUTType(numEntries);
-                for (int i=0; i<numEntries; ++i) {
-                    const Spectrum r(i * m_lutResolution);
-                    m_RdLookUpTable->at(i) = getRd(r);
-                    m_TdLookUpTable->at(i) = getTd(r);
-                    //std::cerr << "r: " << (i * m_lutResolution) << " Rd: " << m_RdLookUpTable->at(i).toString() << "Td: " << m_TdLookUpTable->at(i).toString() << std::endl;
-                }
-
-                /* Create new LUTRecord and store this LUT */
-                LUTRecord lutRecR(m_RdLookUpTable, m_lutResolution);
-                smm->addLUT(lutHashR, lutRecR);
-                LUTRecord lutRecT(m_RdLookUpTable, m_lutResolution);
-                smm->addLUT(lutHashT, lutRecT);
-                AssertEx(smm->hasLUT(lutHashR), "Rd LUT is not available, but it should be!");
-                AssertEx(smm->hasLUT(lutHashT), "Td LUT is not available, but it should be!");
-
-                Log(EDebug, "Created Rd and Td look-up-table with %i entries each (took %.2fs)", numEntries, timer.elapsed());
-            }
-        }
 	}
 
-    Spectrum getRd(const Spectrum r) const {
-        const Spectrum one(1.0f);
-        const Spectrum negSigmaTr = m_sigmaTr * (-1.0f);
-		const Spectrum rSqr = r * r;
-
-        Spectrum Rd(0.0f);
-        for (int i=-m_extraDipoles; i<=m_extraDipoles; ++i) {
-            int idx = i + m_extraDipoles;
-
-            Spectrum zri = m_zr[idx];
-            Spectrum zvi = m_zv[idx];
-            /* Distance to the real source */
-		    Spectrum dri = (rSqr + zri*zri).sqrt();
-            /* Distance to the image point source */
-		    Spectrum dvi = (rSqr + zvi*zvi).sqrt();
-
-            /* Do not include the reduced albedo - will be canceled out later */
-            Rd += Spectrum(0.25f * INV_PI) *
-                 (zri * (one + m_sigmaTr * dri) * ((negSigmaTr * dri).exp())
-                        / (dri * dri * dri)
-                - zvi * (one + m_sigmaTr * dvi) * ((negSigmaTr * dvi).exp())
-                        / (dvi * dvi * dvi));
-        }
-        return Rd;
-    }
-
-    Spectrum getTd(const Spectrum r) const {
-        const Spectrum one(1.0f);
-        const Spectrum negSigmaTr = m_sigmaTr * (-1.0f);
-		const Spectrum rSqr = r * r;
-
-        Spectrum Td(0.0f);
-        for (int i=-m_extraDipoles; i<=m_extraDipoles; ++i) {
-            int idx = i + m_extraDipoles;
-
-            Spectrum zri = m_zr[idx];
-            Spectrum zvi = m_zv[idx];
-
-            /* Distance to the real source */
-		    Spectrum dri = (rSqr + zri*zri).sqrt();
-            /* Distance to the image point source */
-		    Spectrum dvi = (rSqr + zvi*zvi).sqrt();
-            /* Do not include the reduced albedo - will be canceled out later */
-            const Spectrum d = Spectrum(m_slabThickness);
-            Td += (d - zri) * (one + dri * m_sigmaTr) * ((negSigmaTr * dri).exp())
-                        / (dri * dri * dri)
-                - (d - zvi) * (one + dvi * m_sigmaTr) *((negSigmaTr * dvi).exp())
-                        / (dvi * dvi * dvi);
+    /**
+     * Precompute the look-up-tables for Rd and Td (if requested), which
+     * are indexed by the distance to the sample. Returns false when the
+     * precomputation was cancelled.
+     */
+    bool configureLookUpTable() {
+        if (!m_useRdLookUpTable || m_RdLookUpTable.get())
+            return true;
+
+        ref<SubsurfaceMaterialManager> smm = SubsurfaceMaterialManager::getInstance();
+        std::string lutHashR = smm->getMultipoleLUTHashR(m_lutResolution, m_errThreshold,
+            m_sigmaTr, m_alphaPrime, m_extraDipoles, m_zr, m_zv);
+        std::string lutHashT = smm->getMultipoleLUTHashT(m_lutResolution, m_errThreshold,
+            m_sigmaTr, m_alphaPrime, m_extraDipoles, m_zr, m_zv, m_slabThickness);
+        /* The tables may be persisted, hence also include the parameters
+           of the Monte Carlo integration (or the predefined distance) */
+        std::string suffix = m_rMaxPredefined ? formatString(",rMax=%f", m_rMax)
+            : formatString(",mcIterations=%i,lutSeed=%llu",
+                m_mcIterations, (unsigned long long) m_lutSeed);
+        lutHashR += suffix;
+        lutHashT += suffix;
+        if (smm->hasLUT(lutHashR) && smm->hasLUT(lutHashT)) {
+            /* get Rd LUT */
+            LUTRecord lutR = smm->getLUT(lutHashR);
+            m_RdLookUpTable = lutR.lut;
+            AssertEx(lutR.resolution == m_lutResolution, "Cached Rd LUT does not have requested resolution!");
+            /* get Td LUT */
+            LUTRecord lutT = smm->getLUT(lutHashT);
+            m_TdLookUpTable = lutT.lut;
+            AssertEx(lutT.resolution == m_lutResolution, "Cached Td LUT does not have requested resolution!");
+            m_rMax = (m_RdLookUpTable->size() - 1) * m_lutResolution;
+            return true;
         }
-        /* Unfordunately, Td can get negative */
-        Td.clampNegative();
 
-        return Spectrum(0.25f * INV_PI) * Td;
+        DiffusionProfile profile;
+        profile.sigmaTr = m_sigmaTr;
+        profile.zr = m_zr;
+        profile.zv = m_zv;
+        profile.slabThickness = m_slabThickness;
+        profile.multipole = true;
+
+        ref<Timer> timer = new Timer();
+        ref<Scheduler> sched = Scheduler::getInstance();
+        ref<RdTableProcess> proc = new RdTableProcess(profile, m_lutResolution,
+            m_rMaxPredefined ? m_rMax : -1, m_errThreshold, m_mcIterations, m_lutSeed);
+        m_proc = proc;
+        sched->schedule(proc);
+        sched->wait(proc);
+        m_proc = NULL;
+        if (proc->getReturnStatus() != ParallelProcess::ESuccess)
+            return false;
+
+        m_RdLookUpTable = proc->getRdTable();
+        m_TdLookUpTable = proc->getTdTable();
+        m_rMax = proc->getMaxDistance();
+        Log(EInfo, "Created Rd and Td look-up-tables with " SIZE_T_FMT " entries each "
+            "(rMax = %f, took %i ms)", m_RdLookUpTable->size(), m_rMax,
+            timer->getMilliseconds());
+
+        /* Create new LUTRecords and store these LUTs */
+        LUTRecord lutRecR(m_RdLookUpTable, m_lutResolution);
+        smm->addLUT(lutHashR, lutRecR);
+        LUTRecord lutRecT(m_TdLookUpTable, m_lutResolution);
+        smm->addLUT(lutHashT, lutRecT);
+        AssertEx(smm->hasLUT(lutHashR), "Rd LUT is not available, but it should be!");
+        AssertEx(smm->hasLUT(lutHashT), "Td LUT is not available, but it should be!");
+        return true;
     }
 
 	/// Unpolarized fresnel reflection term for dielectric materials
@@ -665,49 +537,18 @@ public:
 				"a sampling-based surface integrator!");
 		}
 
+		if (!configureLookUpTable())
+			return false;
+
 		m_octree = new IrradianceOctree(m_maxDepth, m_minDelta, 
 			scene->getKDTree()->getAABB());
 
-		Float sa = 0;
-		for (std::vector<Shape *>::iterator it = m_shapes.begin(); 
-			it != m_shapes.end(); ++it) 
-			sa += (*it)->getSurfaceArea();
-		size_t sampleCount = (size_t) std::ceil(sa / (M_PI * m_minMFP * m_minMFP)
-			* m_sampleMultiplier);
-		Log(EInfo, "Generating " SIZE_T_FMT " irradiance samples..", sampleCount);
-
-		ref<Scheduler> sched = Scheduler::getInstance();
-
-		/* This could be a bit more elegant.. - inform the irradiance
-		   sampler about the index of this subsurface integrator */
-		std::vector<Subsurface *> ssIntegrators
-			= scene->getSubsurfaceIntegrators();
-		int index = -1;
-		for (size_t i=0; i<ssIntegrators.size(); ++i) {
-			if (ssIntegrators[i] == this) {
-				index = i;
-				break;
-			}
-		}
-		Assert(index != -1);
-
-		ref<IrradianceSamplingProcess> proc = new IrradianceSamplingProcess(
-			sampleCount, (size_t) std::ceil(sampleCount/100.0f), index, 
-			m_irrSamples, m_irrIndirect, job);
-
-		proc->bindResource("scene", sceneResID);
-		scene->bindUsedResources(proc);
-		m_proc = proc;
-		sched->schedule(proc);
-		sched->wait(proc);
-		m_proc = NULL;
-		if (proc->getReturnStatus() != ParallelProcess::ESuccess)
+		Float sampleDensity = m_sampleMultiplier / (M_PI * m_minMFP * m_minMFP);
+		if (!sampleIrradiance(scene, this, job, sceneResID, sampleDensity,
+				m_irrSamples, m_irrIndirect, m_irrCacheDir, m_irrCacheIncremental,
+				m_proc, m_octree))
 			return false;
 
-		const IrradianceRecordVector &results = *proc->getSamples();
-		for (size_t i=0; i<results.size(); ++i) 
-			m_octree->addSample(results[i]);
-
 		m_octree->preprocess();
 		m_octreeResID = Scheduler::getInstance()->registerResource(m_octree);
 
@@ -743,6 +584,8 @@ private:
 	int m_maxDepth;
 	int m_irrSamples;
 	bool m_irrIndirect;
+	fs::path m_irrCacheDir;
+	bool m_irrCacheIncremental;
 	bool m_ready, m_requireSample;
     /* The number of additional dipoles. Specifies the number of
      * dipoles that get added below *and* above the surface. E.g.
@@ -764,6 +607,8 @@ private:
     Float m_errThreshold;
     /* monte carlo integration iterations */
     int m_mcIterations;
+    /* seed of the monte carlo integration */
+    uint64_t m_lutSeed;
     /* resolution of the dMoR LUT */
     Float m_lutResolution;
 };
@@ -0,0 +1,101 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/testcase.h>
+#include "../subsurface/irrquery.h"
+
+MTS_NAMESPACE_BEGIN
+
+/// Permitted relative error of the batched (SSE) dipole evaluation
+#define BATCHED_REL_ERROR 1e-4f
+
+class TestIrradianceOctree : public TestCase {
+public:
+	MTS_BEGIN_TESTCASE()
+	MTS_DECLARE_TEST(test01_flattenedQueries)
+	MTS_END_TESTCASE()
+
+	/// Build two octrees over the same random samples on the unit sphere
+	void createOctrees(size_t sampleCount, ref<IrradianceOctree> &pointerTree,
+			ref<IrradianceOctree> &flatTree, Random *random) {
+		AABB aabb(Point(-1.1f), Point(1.1f));
+		pointerTree = new IrradianceOctree(40, 0.1f, aabb);
+		flatTree = new IrradianceOctree(40, 0.1f, aabb);
+
+		for (size_t i=0; i<sampleCount; ++i) {
+			Vector d = squareToSphere(Point2(random->nextFloat(), random->nextFloat()));
+			IrradianceSample sample;
+			sample.p = Point(d);
+			sample.n = Normal(d);
+			for (int j=0; j<SPECTRUM_SAMPLES; ++j)
+				sample.E[j] = 0.5f + random->nextFloat();
+			sample.area = 4 * M_PI / sampleCount;
+			pointerTree->addSample(sample);
+			flatTree->addSample(sample);
+		}
+
+		pointerTree->preprocess(false);
+		flatTree->preprocess(true);
+		assertFalse(pointerTree->isFlattened());
+		assertTrue(flatTree->isFlattened());
+	}
+
+	template <typename QueryType> Spectrum query(const IrradianceOctree *octree,
+			const Point &p, bool batched) {
+		const Spectrum zr(0.02f), zv(0.07f), sigmaTr(10.0f);
+		QueryType query(zr, zv, sigmaTr, 0.5f, p, zr.min() * zr.min());
+		if (batched)
+			octree->executeBatched(query);
+		else
+			octree->execute(query);
+		return query.getResult();
+	}
+
+	void test01_flattenedQueries() {
+		ref<Random> random = new Random((uint64_t) 1);
+
+		/* The smaller trees consist of a single leaf, whose sample
+		   count is not a multiple of four and thus requires padding */
+		const size_t sampleCounts[] = { 1, 3, 5, 7, 20000 };
+
+		for (int i=0; i<5; ++i) {
+			ref<IrradianceOctree> pointerTree, flatTree;
+			createOctrees(sampleCounts[i], pointerTree, flatTree, random);
+
+			for (int j=0; j<1000; ++j) {
+				Vector d = squareToSphere(Point2(random->nextFloat(), random->nextFloat()));
+				Point p(d * (0.9f + 0.2f * random->nextFloat()));
+
+				/* The flattened tree visits the samples and clusters in
+				   the same order, hence the results must be identical */
+				Spectrum reference = query<BatchedDipoleQuery>(pointerTree, p, false),
+					flattened = query<BatchedDipoleQuery>(flatTree, p, false),
+					batched = query<BatchedDipoleQuery>(flatTree, p, true);
+
+				for (int k=0; k<SPECTRUM_SAMPLES; ++k) {
+					assertEquals(reference[k], flattened[k]);
+					assertEqualsEpsilon(reference[k], batched[k],
+						BATCHED_REL_ERROR * reference[k]);
+				}
+			}
+		}
+	}
+};
+
+MTS_EXPORT_TESTCASE(TestIrradianceOctree, "Testcase for the flattened irradiance octree")
+MTS_NAMESPACE_END
@@ -0,0 +1,106 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/testcase.h>
+#include "../subsurface/lutproc.h"
+
+MTS_NAMESPACE_BEGIN
+
+class TestLUTProcess : public TestCase {
+public:
+	MTS_BEGIN_TESTCASE()
+	MTS_DECLARE_TEST(test01_predefinedDistance)
+	MTS_DECLARE_TEST(test02_monteCarlo)
+	MTS_END_TESTCASE()
+
+	/// Dipole or multipole profile of a material with a colored extinction
+	DiffusionProfile createProfile(bool multipole) {
+		DiffusionProfile profile;
+		for (int i=0; i<SPECTRUM_SAMPLES; ++i)
+			profile.sigmaTr[i] = 2.0f + 3.0f * i;
+		if (!multipole) {
+			profile.zr.push_back(Spectrum(0.05f));
+			profile.zv.push_back(Spectrum(-0.15f));
+		} else {
+			profile.slabThickness = 0.5f;
+			profile.multipole = true;
+			for (int i=-2; i<=2; ++i) {
+				Float offset = 2 * i * (profile.slabThickness + 0.2f);
+				profile.zr.push_back(Spectrum(offset + 0.05f));
+				profile.zv.push_back(Spectrum(offset - 0.45f));
+			}
+		}
+		return profile;
+	}
+
+	ref<RdTableProcess> createTables(const DiffusionProfile &profile,
+			Float rMax, size_t granularity) {
+		ref<Scheduler> sched = Scheduler::getInstance();
+		ref<RdTableProcess> proc = new RdTableProcess(profile, 0.01f,
+			rMax, 0.01f, 1000, 1234);
+		proc->setGranularity(granularity);
+		sched->schedule(proc);
+		sched->wait(proc);
+		assertTrue(proc->getReturnStatus() == ParallelProcess::ESuccess);
+		return proc;
+	}
+
+	/// Verify that two look-up tables are bitwise identical
+	void compareTables(const SubsurfaceMaterialManager::LUTType *expected,
+			const SubsurfaceMaterialManager::LUTType *actual) {
+		assertEquals((int) expected->size(), (int) actual->size());
+		for (size_t i=0; i<expected->size(); ++i)
+			assertTrue(memcmp(&expected->at(i), &actual->at(i), sizeof(Spectrum)) == 0);
+	}
+
+	/**
+	 * Build the tables of a dipole and a multipole profile using work
+	 * units of several sizes, which must produce the same result
+	 */
+	void testDeterminism(Float rMax) {
+		const size_t granularities[] = { 1, 3, 4, 17 };
+
+		for (int multipole=0; multipole<2; ++multipole) {
+			DiffusionProfile profile = createProfile(multipole != 0);
+			ref<RdTableProcess> reference = createTables(profile, rMax, granularities[0]);
+			Float maxDistance = reference->getMaxDistance();
+			assertTrue(maxDistance > 0);
+			if (rMax >= 0)
+				assertEquals(rMax, maxDistance);
+
+			for (int i=1; i<4; ++i) {
+				ref<RdTableProcess> proc = createTables(profile, rMax, granularities[i]);
+				assertEquals(maxDistance, proc->getMaxDistance());
+				compareTables(reference->getRdTable(), proc->getRdTable());
+				if (multipole)
+					compareTables(reference->getTdTable(), proc->getTdTable());
+			}
+		}
+	}
+
+	void test01_predefinedDistance() {
+		testDeterminism(1.0f);
+	}
+
+	void test02_monteCarlo() {
+		testDeterminism(-1.0f);
+	}
+};
+
+MTS_EXPORT_TESTCASE(TestLUTProcess, "Testcase for the subsurface look-up table precomputation")
+MTS_NAMESPACE_END
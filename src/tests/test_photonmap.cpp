@@ -0,0 +1,210 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/testcase.h>
+#include <mitsuba/render/photonmap.h>
+
+MTS_NAMESPACE_BEGIN
+
+class TestPhotonMap : public TestCase {
+public:
+	MTS_BEGIN_TESTCASE()
+	MTS_DECLARE_TEST(test01_balance)
+	MTS_DECLARE_TEST(test02_nnSearch)
+	MTS_END_TESTCASE()
+
+	typedef PhotonMap::search_result search_result;
+
+	struct compareSearchResult {
+		inline bool operator()(const search_result &a, const search_result &b) const {
+			if (a.first != b.first)
+				return a.first < b.first;
+			return a.second < b.second;
+		}
+	};
+
+	/// Fill a photon map with photons that are scattered over a few planes
+	ref<PhotonMap> createPhotonMap(size_t photonCount, uint64_t seed) {
+		ref<Random> random = new Random(seed);
+		ref<PhotonMap> pmap = new PhotonMap(photonCount);
+
+		for (size_t i=0; i<photonCount; ++i) {
+			Point p(random->nextFloat(), random->nextFloat(), random->nextFloat());
+			int plane = (int) (random->nextFloat() * 4);
+			if (plane < 3)
+				p[plane] = (Float) 0;
+			Vector d = squareToSphere(Point2(random->nextFloat(), random->nextFloat()));
+			pmap->storePhoton(p, Normal(d), -d, Spectrum(random->nextFloat()), 1);
+		}
+		return pmap;
+	}
+
+	/**
+	 * Node-by-node nearest-neighbor search, which corresponds to the
+	 * implementation that was used before the blocked leaf layout
+	 */
+	size_t referenceSearch(const PhotonMap *pmap, const Point &p,
+			Float &searchRadiusSquared, size_t maxSize, search_result *results) {
+		const float pos[3] = { (float) p.x, (float) p.y, (float) p.z };
+		size_t stack[MAX_PHOTONMAP_DEPTH];
+		size_t index = 1, stackPos = 1, fill = 0,
+			   lastInnerNode = pmap->getPhotonCount()/2,
+			   lastRChildNode = (pmap->getPhotonCount()-1)/2;
+		bool isPriorityQueue = false;
+		float distSquared = (float) searchRadiusSquared;
+		stack[0] = 0;
+
+		while (index > 0) {
+			const Photon *photon = &pmap->getPhoton(index);
+
+			if (index <= lastInnerNode) {
+				float distToPlane = pos[photon->axis] - photon->pos[photon->axis];
+				bool searchBoth = (distToPlane*distToPlane <= distSquared);
+
+				if (distToPlane > 0) {
+					if (index <= lastRChildNode) {
+						if (searchBoth)
+							stack[stackPos++] = 2*index;
+						index = 2*index+1;
+					} else if (searchBoth) {
+						index = 2*index;
+					} else {
+						index = stack[--stackPos];
+					}
+				} else {
+					if (searchBoth && index <= lastRChildNode)
+						stack[stackPos++] = 2*index+1;
+					index = 2*index;
+				}
+			} else {
+				index = stack[--stackPos];
+			}
+
+			const float photonDistSquared = photon->distSquared(pos);
+			if (photonDistSquared < distSquared) {
+				if (fill < maxSize) {
+					results[fill++] = search_result(photonDistSquared, photon);
+				} else {
+					search_result *begin = results, *end = begin + maxSize + 1;
+					if (!isPriorityQueue) {
+						std::make_heap(begin, begin + maxSize, compareSearchResult());
+						isPriorityQueue = true;
+					}
+					results[fill] = search_result(photonDistSquared, photon);
+					std::push_heap(begin, end, compareSearchResult());
+					std::pop_heap(begin, end, compareSearchResult());
+					distSquared = results[0].first;
+				}
+			}
+		}
+
+		searchRadiusSquared = (Float) distSquared;
+		return fill;
+	}
+
+	void test01_balance() {
+		/* Balance the same set of photons serially and in parallel,
+		   and verify that the resulting trees are identical */
+		size_t photonCount = 2000000;
+		ref<PhotonMap> serial = createPhotonMap(photonCount, 1);
+		ref<PhotonMap> parallel = createPhotonMap(photonCount, 1);
+		ref<Timer> timer = new Timer();
+
+		Log(EInfo, "Balancing a photon map with " SIZE_T_FMT " photons ..", photonCount);
+		serial->balance(false);
+		unsigned int serialTime = timer->getMilliseconds();
+		timer->reset();
+		parallel->balance(true);
+		unsigned int parallelTime = timer->getMilliseconds();
+
+		Log(EInfo, "  Serial balancing: %i ms, parallel balancing: %i ms (speedup: %.2fx)",
+			serialTime, parallelTime, serialTime / (Float) std::max(parallelTime, 1u));
+
+		bool identical = true;
+		for (size_t i=1; i<=photonCount; ++i) {
+			const Photon &p1 = serial->getPhoton(i), &p2 = parallel->getPhoton(i);
+			if (p1.pos[0] != p2.pos[0] || p1.pos[1] != p2.pos[1] ||
+				p1.pos[2] != p2.pos[2] || p1.axis != p2.axis) {
+				identical = false;
+				break;
+			}
+		}
+		assertTrue(identical);
+	}
+
+	void test02_nnSearch() {
+		/* Compare the blocked nearest-neighbor search against the
+		   node-by-node reference implementation */
+		size_t photonCount = 1000000, nQueries = 200000;
+		ref<PhotonMap> pmap = createPhotonMap(photonCount, 2);
+		pmap->balance();
+		ref<Random> random = new Random(3);
+		ref<Timer> timer = new Timer();
+
+		size_t kValues[] = { 1, 10, 50, 200 };
+		for (int k=0; k<4; ++k) {
+			size_t maxSize = kValues[k];
+			Float radius = 0.05f;
+			std::vector<search_result> results(maxSize+1), reference(maxSize+1);
+			std::vector<Point> queries(nQueries);
+			for (size_t i=0; i<nQueries; ++i)
+				queries[i] = Point(random->nextFloat(), random->nextFloat(), random->nextFloat());
+
+			/* Validation */
+			bool identical = true;
+			for (size_t i=0; i<nQueries/10; ++i) {
+				Float r1 = radius*radius, r2 = radius*radius;
+				size_t n1 = pmap->nnSearch(queries[i], r1, maxSize, &results[0]);
+				size_t n2 = referenceSearch(pmap, queries[i], r2, maxSize, &reference[0]);
+				if (n1 != n2 || r1 != r2) {
+					identical = false;
+					break;
+				}
+				std::sort(results.begin(), results.begin() + n1, compareSearchResult());
+				std::sort(reference.begin(), reference.begin() + n2, compareSearchResult());
+				for (size_t j=0; j<n1; ++j)
+					identical &= results[j] == reference[j];
+			}
+			assertTrue(identical);
+
+			/* Timings */
+			size_t found1 = 0, found2 = 0;
+			timer->reset();
+			for (size_t i=0; i<nQueries; ++i) {
+				Float r = radius*radius;
+				found1 += referenceSearch(pmap, queries[i], r, maxSize, &reference[0]);
+			}
+			unsigned int referenceTime = timer->getMilliseconds();
+			timer->reset();
+			for (size_t i=0; i<nQueries; ++i) {
+				Float r = radius*radius;
+				found2 += pmap->nnSearch(queries[i], r, maxSize, &results[0]);
+			}
+			unsigned int blockedTime = timer->getMilliseconds();
+			assertTrue(found1 == found2);
+
+			Log(EInfo, "  " SIZE_T_FMT "-NN queries: reference = %i ms, blocked = %i ms "
+				"(speedup: %.2fx, avg. " SIZE_T_FMT " photons)", maxSize, referenceTime,
+				blockedTime, referenceTime / (Float) std::max(blockedTime, 1u),
+				found2 / nQueries);
+		}
+	}
+};
+
+MTS_EXPORT_TESTCASE(TestPhotonMap, "Testcase for the photon map")
+MTS_NAMESPACE_END
@@ -0,0 +1,154 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/core/plugin.h>
+#include <mitsuba/render/testcase.h>
+#include <mitsuba/render/trimesh.h>
+#include "../integrators/vpl/vpltree.h"
+
+MTS_NAMESPACE_BEGIN
+
+class TestVPLTree : public TestCase {
+public:
+	MTS_BEGIN_TESTCASE()
+	MTS_DECLARE_TEST(test01_fullCut)
+	MTS_END_TESTCASE()
+
+	/// Add a diffuse square to the scene, which optionally emits light
+	void addQuad(Scene *scene, const Point &center, const Vector &normal,
+			Float size, const Spectrum &reflectance, Float intensity = 0) {
+		ref<TriMesh> mesh = new TriMesh("quad", 2, 4, false, false, false);
+		Vector s, t;
+		coordinateSystem(normal, s, t);
+		s *= size / 2; t *= size / 2;
+
+		Point *positions = mesh->getVertexPositions();
+		positions[0] = center - s - t;
+		positions[1] = center + s - t;
+		positions[2] = center + s + t;
+		positions[3] = center - s + t;
+		Triangle *triangles = mesh->getTriangles();
+		triangles[0].idx[0] = 0; triangles[0].idx[1] = 1; triangles[0].idx[2] = 2;
+		triangles[1].idx[0] = 2; triangles[1].idx[1] = 3; triangles[1].idx[2] = 0;
+
+		Properties bsdfProps("lambertian");
+		bsdfProps.setSpectrum("reflectance", reflectance);
+		ref<BSDF> bsdf = static_cast<BSDF *> (PluginManager::getInstance()->
+				createObject(MTS_CLASS(BSDF), bsdfProps));
+		bsdf->configure();
+		mesh->addChild("", bsdf);
+		bsdf->setParent(mesh);
+
+		if (intensity > 0) {
+			Properties lumProps("area");
+			lumProps.setSpectrum("intensity", Spectrum(intensity));
+			ref<Luminaire> luminaire = static_cast<Luminaire *> (PluginManager::getInstance()->
+					createObject(MTS_CLASS(Luminaire), lumProps));
+			mesh->addChild("", luminaire);
+			luminaire->setParent(mesh);
+			luminaire->configure();
+		}
+
+		mesh->configure();
+		scene->addChild("", mesh);
+	}
+
+	/// Sum of the contributions of all VPLs, which are evaluated one by one
+	Spectrum bruteForce(const Scene *scene, const std::deque<VPL> &vpls,
+			const Intersection &its) {
+		const BSDF *bsdf = its.shape->getBSDF();
+		Spectrum result(0.0f);
+
+		for (size_t i=0; i<vpls.size(); ++i) {
+			const VPL &vpl = vpls[i];
+			Vector d = vpl.its.p - its.p;
+			Float dist2 = d.lengthSquared();
+			d /= std::sqrt(dist2);
+
+			Spectrum value = bsdf->fCos(BSDFQueryRecord(its, its.toLocal(d)));
+			if (vpl.type == ESurfaceVPL) {
+				BSDFQueryRecord bRec(vpl.its, vpl.its.toLocal(-d));
+				bRec.quantity = EImportance;
+				value *= vpl.its.shape->getBSDF()->f(bRec);
+			} else {
+				EmissionRecord eRec(vpl.luminaire,
+					ShapeSamplingRecord(vpl.its.p, vpl.its.shFrame.n), -d);
+				eRec.type = EmissionRecord::EPreview;
+				value *= vpl.luminaire->fDirection(eRec);
+			}
+			value *= absDot(vpl.its.shFrame.n, d);
+
+			if (value.isZero() || scene->isOccluded(its.p, vpl.its.p, its.time))
+				continue;
+			result += value * vpl.P / dist2;
+		}
+		return result;
+	}
+
+	void test01_fullCut() {
+		/* Cornell box-like scene with an area light source and a block */
+		ref<Scene> scene = new Scene(Properties());
+		Spectrum white(0.7f), red, green;
+		red.fromLinearRGB(0.7f, 0.1f, 0.1f);
+		green.fromLinearRGB(0.1f, 0.7f, 0.1f);
+		addQuad(scene, Point(0, 0, 0), Vector(0, 1, 0), 2, white);
+		addQuad(scene, Point(0, 2, 0), Vector(0, -1, 0), 2, white);
+		addQuad(scene, Point(0, 1, -1), Vector(0, 0, 1), 2, white);
+		addQuad(scene, Point(-1, 1, 0), Vector(1, 0, 0), 2, red);
+		addQuad(scene, Point(1, 1, 0), Vector(-1, 0, 0), 2, green);
+		addQuad(scene, Point(0.3f, 0.7f, -0.2f), Vector(0, 1, 0), 0.6f, white);
+		addQuad(scene, Point(0, 1.99f, 0), Vector(0, -1, 0), 0.5f, white, 20);
+		scene->initialize();
+
+		ref<Random> random = new Random((uint64_t) 1);
+		std::deque<VPL> vpls;
+		Float normalization = (Float) 1 / generateVPLs(scene, random,
+				0, 300, 5, false, vpls);
+		for (size_t i=0; i<vpls.size(); ++i)
+			vpls[i].P *= normalization;
+
+		ref<VPLTree> tree = new VPLTree(scene, vpls, 0.0f);
+		int vplCount = (int) tree->getVPLCount();
+		assertTrue(vplCount > 0);
+
+		/* Once the cut may contain every VPL and the threshold is zero,
+		   the lightcut estimate must match the sum over all VPLs */
+		int receivers = 0;
+		while (receivers < 100) {
+			Vector d(random->nextFloat() * 2 - 1, random->nextFloat() * 2 - 1, -1);
+			Ray ray(Point(0, 1, 0.95f), normalize(d), 0.0f);
+			Intersection its;
+			if (!scene->rayIntersect(ray, its) || its.isLuminaire())
+				continue;
+			its.wi = its.toLocal(-ray.d);
+
+			int cutSize;
+			Spectrum expected = bruteForce(scene, vpls, its);
+			Spectrum actual = tree->Lo(scene, its, its.shape->getBSDF(),
+				0.0f, vplCount, cutSize);
+			assertTrue(cutSize <= vplCount);
+			for (int i=0; i<SPECTRUM_SAMPLES; ++i)
+				assertEqualsEpsilon(expected[i], actual[i],
+					1e-3f * std::max(expected[i], (Float) 1e-3f));
+			++receivers;
+		}
+	}
+};
+
+MTS_EXPORT_TESTCASE(TestVPLTree, "Testcase for the lightcuts VPL tree")
+MTS_NAMESPACE_END
@@ -37,30 +37,80 @@ public:
 			props.getString("filename"));
 		Log(EInfo, "Loading texture \"%s\"", m_filename.leaf().c_str());
 
+		/* Optionally keep the texels as half-precision RGB values
+		   (the native format of most EXR files) */
+		std::string texelFormat = props.getString("texelFormat", "spectrum");
+		if (texelFormat == "spectrum")
+			m_texelFormat = MIPMap::ESpectrum;
+		else if (texelFormat == "half")
+			m_texelFormat = MIPMap::EHalfRGB;
+		else
+			Log(EError, "Unknown texel format '%s' -- must be "
+				"'spectrum' or 'half'!", texelFormat.c_str());
+
+		/* Store the mip map in a pre-tiled file next to the texture,
+		   whose tiles are loaded on demand through the texture cache */
+		m_cache = props.getBoolean("cache", false);
+		if (m_cache && loadTileFile())
+			return;
+
 		ref<FileStream> fs = new FileStream(m_filename, FileStream::EReadOnly);
 		ref<Bitmap> bitmap = new Bitmap(Bitmap::EEXR, fs);
-		m_mipmap = MIPMap::fromBitmap(bitmap);
-		m_average = m_mipmap->triangle(m_mipmap->getLevels()-1, 0, 0);
-		m_maximum = m_mipmap->getMaximum();
+		initializeFrom(bitmap);
 	}
 
 	EXRTexture(Stream *stream, InstanceManager *manager) 
 	 : Texture2D(stream, manager) {
 		m_filename = stream->readString();
 		Log(EInfo, "Unserializing texture \"%s\"", m_filename.leaf().c_str());
+		m_texelFormat = (MIPMap::EStorageFormat) stream->readUInt();
+		m_cache = stream->readBool();
 		size_t size = stream->readSize();
 		ref<MemoryStream> mStream = new MemoryStream(size);
 		stream->copyTo(mStream, size);
 		mStream->setPos(0);
-		ref<Bitmap> bitmap = new Bitmap(Bitmap::EEXR, mStream);
-		m_mipmap = MIPMap::fromBitmap(bitmap);
+
+		/* Only use the tile file if the texture is also available locally */
+		if (!m_cache || !fs::exists(m_filename) || !loadTileFile()) {
+			ref<Bitmap> bitmap = new Bitmap(Bitmap::EEXR, mStream);
+			initializeFrom(bitmap);
+		}
+	}
+
+	void initializeFrom(Bitmap *bitmap) {
+		m_mipmap = MIPMap::fromBitmap(bitmap, MIPMap::EEWA,
+			MIPMap::ERepeat, 8.0f, m_texelFormat);
+		m_average = m_mipmap->triangle(m_mipmap->getLevels()-1, 0, 0);
+		m_maximum = m_mipmap->getMaximum();
+
+		if (m_cache && m_mipmap->writeTileFile(getTileFilePath(),
+				MIPMap::getSourceKey(m_filename)))
+			loadTileFile(); /* Replaces the in-memory pyramid */
+	}
+
+	/// Return the path of the pre-tiled mip file
+	inline fs::path getTileFilePath() const {
+		return fs::path(m_filename.file_string() + ".mip");
+	}
+
+	/// Try to open an up-to-date pre-tiled mip file of the texture
+	bool loadTileFile() {
+		ref<MIPMap> mipmap = MIPMap::fromTileFile(getTileFilePath(),
+			MIPMap::getSourceKey(m_filename), MIPMap::EEWA,
+			MIPMap::ERepeat, 8.0f, m_texelFormat);
+		if (!mipmap)
+			return false;
+		m_mipmap = mipmap;
 		m_average = m_mipmap->triangle(m_mipmap->getLevels()-1, 0, 0);
 		m_maximum = m_mipmap->getMaximum();
+		return true;
 	}
 
 	void serialize(Stream *stream, InstanceManager *manager) const {
 		Texture2D::serialize(stream, manager);
 		stream->writeString(m_filename.file_string());
+		stream->writeUInt(m_texelFormat);
+		stream->writeBool(m_cache);
 		ref<Stream> is = new FileStream(m_filename, FileStream::EReadOnly);
 		stream->writeSize(is->getSize());
 		is->copyTo(stream);
@@ -106,6 +156,8 @@ protected:
 	ref<MIPMap> m_mipmap;
 	fs::path m_filename;
 	Spectrum m_average, m_maximum;
+	MIPMap::EStorageFormat m_texelFormat;
+	bool m_cache;
 };
 
 MTS_IMPLEMENT_CLASS_S(EXRTexture, false, Texture2D)
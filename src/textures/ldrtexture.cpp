@@ -41,7 +41,6 @@ public:
 		m_gamma = props.getFloat("gamma", -1); /* -1 means sRGB */
 		Log(EInfo, "Loading texture \"%s\"", m_filename.leaf().c_str());
 
-		ref<FileStream> fs = new FileStream(m_filename, FileStream::EReadOnly);
 		std::string extension = boost::to_lower_copy(m_filename.extension());
 
 		std::string filterType = props.getString("filterType", "ewa");
@@ -71,6 +70,25 @@ public:
 	
 		m_maxAnisotropy = props.getFloat("maxAnisotropy", 8);
 
+		/* Optionally keep the texels in a reduced-precision RGB format,
+		   which is converted into spectra during texture lookups */
+		std::string texelFormat = props.getString("texelFormat", "spectrum");
+		if (texelFormat == "spectrum")
+			m_texelFormat = MIPMap::ESpectrum;
+		else if (texelFormat == "half")
+			m_texelFormat = MIPMap::EHalfRGB;
+		else if (texelFormat == "linear8")
+			m_texelFormat = MIPMap::ELinearRGB8;
+		else if (texelFormat == "srgb8")
+			m_texelFormat = MIPMap::ESRGB8;
+		else
+			Log(EError, "Unknown texel format '%s' -- must be "
+				"'spectrum', 'half', 'linear8', or 'srgb8'!", texelFormat.c_str());
+
+		/* Store the mip map in a pre-tiled file next to the texture,
+		   whose tiles are loaded on demand through the texture cache */
+		m_cache = props.getBoolean("cache", false);
+
 		if (extension == ".jpg" || extension == ".jpeg")
 			m_format = Bitmap::EJPEG;
 		else if (extension == ".png")
@@ -82,6 +100,10 @@ public:
 		else
 			Log(EError, "Cannot deduce the file type of '%s'!", m_filename.file_string().c_str());
 
+		if (m_cache && loadTileFile())
+			return;
+
+		ref<FileStream> fs = new FileStream(m_filename, FileStream::EReadOnly);
 		ref<Bitmap> bitmap = new Bitmap(m_format, fs);
 		initializeFrom(bitmap);
 	}
@@ -95,12 +117,18 @@ public:
 		m_filterType = (MIPMap::EFilterType) stream->readInt();
 		m_wrapMode = (MIPMap::EWrapMode) stream->readUInt();
 		m_maxAnisotropy = stream->readFloat();
+		m_texelFormat = (MIPMap::EStorageFormat) stream->readUInt();
+		m_cache = stream->readBool();
 		uint32_t size = stream->readUInt();
 		ref<MemoryStream> mStream = new MemoryStream(size);
 		stream->copyTo(mStream, size);
 		mStream->setPos(0);
-		ref<Bitmap> bitmap = new Bitmap(m_format, mStream);
-		initializeFrom(bitmap);
+
+		/* Only use the tile file if the texture is also available locally */
+		if (!m_cache || !fs::exists(m_filename) || !loadTileFile()) {
+			ref<Bitmap> bitmap = new Bitmap(m_format, mStream);
+			initializeFrom(bitmap);
+		}
 
 		if (Scheduler::getInstance()->hasRemoteWorkers()
 			&& !fs::exists(m_filename)) {
@@ -113,6 +141,24 @@ public:
 		}
 	}
 
+	/// Return the path of the pre-tiled mip file
+	inline fs::path getTileFilePath() const {
+		return fs::path(m_filename.file_string() + ".mip");
+	}
+
+	/// Try to open an up-to-date pre-tiled mip file of the texture
+	bool loadTileFile() {
+		ref<MIPMap> mipmap = MIPMap::fromTileFile(getTileFilePath(),
+			MIPMap::getSourceKey(m_filename, m_gamma), m_filterType,
+			m_wrapMode, m_maxAnisotropy, m_texelFormat);
+		if (!mipmap)
+			return false;
+		m_mipmap = mipmap;
+		m_average = m_mipmap->triangle(m_mipmap->getLevels()-1, 0, 0);
+		m_maximum = m_mipmap->getMaximum();
+		return true;
+	}
+
 	inline Float fromSRGBComponent(Float value) {
 		if (value <= (Float) 0.04045)
 			return value / (Float) 12.92;
@@ -202,9 +248,13 @@ public:
 		}
 
 		m_mipmap = MIPMap::fromBitmap(corrected, m_filterType,
-				m_wrapMode, m_maxAnisotropy);
+				m_wrapMode, m_maxAnisotropy, m_texelFormat);
 		m_average = m_mipmap->triangle(m_mipmap->getLevels()-1, 0, 0);
 		m_maximum = m_mipmap->getMaximum();
+
+		if (m_cache && m_mipmap->writeTileFile(getTileFilePath(),
+				MIPMap::getSourceKey(m_filename, m_gamma)))
+			loadTileFile(); /* Replaces the in-memory pyramid */
 	}
 
 	void serialize(Stream *stream, InstanceManager *manager) const {
@@ -215,6 +265,8 @@ public:
 		stream->writeInt(m_filterType);
 		stream->writeUInt(m_wrapMode);
 		stream->writeFloat(m_maxAnisotropy);
+		stream->writeUInt(m_texelFormat);
+		stream->writeBool(m_cache);
 
 		if (m_stream.get()) {
 			stream->writeUInt((uint32_t) m_stream->getSize());
@@ -260,7 +312,9 @@ public:
 		std::ostringstream oss;
 		oss << "LDRTexture[" << endl
 			<< "  filename = \"" << m_filename << "\"," << endl
-			<< "  gamma = " << m_gamma << endl
+			<< "  gamma = " << m_gamma << "," << endl
+			<< "  texelFormat = " << m_texelFormat << "," << endl
+			<< "  cache = " << m_cache << endl
 			<< "]";
 		return oss.str();
 	}
@@ -278,6 +332,8 @@ protected:
 	Float m_gamma;
 	MIPMap::EWrapMode m_wrapMode;
 	Float m_maxAnisotropy;
+	MIPMap::EStorageFormat m_texelFormat;
+	bool m_cache;
 };
 
 // ================ Hardware shader implementation ================ 
@@ -0,0 +1,256 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/render/mipmap.h>
+#include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/timer.h>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+class EnvMapBenchmark : public Utility {
+public:
+	void help() {
+		cout << endl;
+		cout << "Synopsis: Compares the sampling densities, which can be used to importance" << endl;
+		cout << "sample environment maps: a single CDF over all pixels and the hierarchical" << endl;
+		cout << "warp using different pruning thresholds. Reports the build time, memory" << endl;
+		cout << "usage, sampling and PDF evaluation throughput, and the relative standard" << endl;
+		cout << "deviation when estimating the luminance integral of the full-resolution map." << endl;
+		cout << endl;
+		cout << "Usage: mtsutil envbench [options] [EXR environment map]" << endl;
+		cout << "Options/Arguments:" << endl;
+		cout << "   -h             Display this help text" << endl << endl;
+		cout << "   -l level       Mip map level used to build the density (default: 3)" << endl << endl;
+		cout << "   -n count       Number of samples per measurement (default: 2000000)" << endl << endl;
+		cout << "   -s res         Height of the synthetic sun and sky map, which is used" << endl;
+		cout << "                  when no file is specified (default: 2048)" << endl << endl;
+	}
+
+	/// Create a synthetic environment map with a small and very bright sun
+	ref<Bitmap> createImage(int height) {
+		int width = 2 * height;
+		ref<Bitmap> bitmap = new Bitmap(width, height, 128);
+		float *target = bitmap->getFloatData();
+		for (int y=0; y<height; ++y) {
+			for (int x=0; x<width; ++x) {
+				Float theta = M_PI * (y + 0.5f) / height, phi = 2 * M_PI * (x + 0.5f) / width;
+				Float r, g, b;
+				if (theta > M_PI / 2) {
+					/* Dark ground */
+					r = g = b = 0.02f;
+				} else {
+					Float horizon = std::cos(theta);
+					r = 0.3f + 0.2f * (1 - horizon);
+					g = 0.5f + 0.2f * (1 - horizon);
+					b = 1.0f;
+				}
+				Float dTheta = theta - 0.3f, dPhi = phi - 1.0f;
+				if (dTheta*dTheta + dPhi*dPhi < 0.0004f)
+					r = g = b = 50000.0f;
+				*target++ = r; *target++ = g; *target++ = b; *target++ = 1.0f;
+			}
+		}
+		return bitmap;
+	}
+
+	/// Sampling weights as computed by the environment map luminaire
+	std::vector<Float> computeWeights(const MIPMap *mipmap, int level, Vector2i &res) {
+		res = mipmap->getLevelResolution(level);
+		const Spectrum *image = mipmap->getImageData(level);
+		std::vector<Float> weights(res.x * res.y);
+		for (int y=0; y<res.y; ++y) {
+			Float sinFactor = std::sin(M_PI * (y + .5f) / res.y);
+			for (int x=0; x<res.x; ++x)
+				weights[x + y * res.x] = image[x + y * res.x].getLuminance() * sinFactor;
+		}
+		return weights;
+	}
+
+	/**
+	 * \brief Luminance integrand with respect to the unit square. The
+	 * full-resolution image is treated as piecewise constant, which
+	 * matches how the sampling densities are defined.
+	 */
+	inline Float integrand(const MIPMap *mipmap, Float u, Float v) const {
+		int width = mipmap->getWidth(), height = mipmap->getHeight();
+		int x = std::min((int) (u * width), width - 1),
+			y = std::min((int) (v * height), height - 1);
+		return mipmap->getImageData(0)[x + y * width].getLuminance()
+			* std::sin(M_PI * v);
+	}
+
+	void report(const char *name, unsigned int buildTime, size_t memory,
+			unsigned int sampleTime, unsigned int pdfTime, size_t nSamples,
+			const std::vector<Float> &estimates) {
+		double mean = 0, variance = 0;
+		for (size_t i=0; i<estimates.size(); ++i)
+			mean += estimates[i];
+		mean /= estimates.size();
+		for (size_t i=0; i<estimates.size(); ++i)
+			variance += (estimates[i] - mean) * (estimates[i] - mean);
+		variance /= estimates.size() - 1;
+		Log(EInfo, "%-16s %10i %12s %14.2f %14.2f %12.4f", name, buildTime, memString(memory).c_str(),
+			nSamples / (std::max(sampleTime, 1U) * 1000.0f), nSamples / (std::max(pdfTime, 1U) * 1000.0f),
+			std::sqrt(variance) / mean);
+	}
+
+	int run(int argc, char **argv) {
+		char optchar, *end_ptr = NULL;
+		size_t nSamples = 2000000;
+		int level = 3, res = 2048;
+		optind = 1;
+
+		/* Parse command-line arguments */
+		while ((optchar = getopt(argc, argv, "l:n:s:h")) != -1) {
+			switch (optchar) {
+				case 'h': {
+						help();
+						return 0;
+					}
+					break;
+				case 'l': {
+						level = strtol(optarg, &end_ptr, 10);
+						if (*end_ptr != '\0' || level < 0)
+							SLog(EError, "Could not parse the mip map level!");
+					}
+					break;
+				case 'n': {
+						long value = strtol(optarg, &end_ptr, 10);
+						if (*end_ptr != '\0' || value <= 1)
+							SLog(EError, "Could not parse the number of samples!");
+						nSamples = (size_t) value;
+					}
+					break;
+				case 's': {
+						res = strtol(optarg, &end_ptr, 10);
+						if (*end_ptr != '\0' || res <= 0)
+							SLog(EError, "Could not parse the resolution!");
+					}
+					break;
+			};
+		}
+
+		if (optind+1 < argc) {
+			help();
+			return 0;
+		}
+
+		ref<Bitmap> bitmap;
+		if (optind < argc) {
+			fs::path path = Thread::getThread()->getFileResolver()->resolve(argv[optind]);
+			ref<FileStream> fs = new FileStream(path, FileStream::EReadOnly);
+			bitmap = new Bitmap(Bitmap::EEXR, fs);
+		} else {
+			bitmap = createImage(res);
+		}
+		ref<MIPMap> mipmap = MIPMap::fromBitmap(bitmap);
+		level = std::min(level, mipmap->getLevels() - 1);
+
+		Vector2i pdfRes;
+		std::vector<Float> weights = computeWeights(mipmap, level, pdfRes);
+		Log(EInfo, "Environment map: %ix%i, sampling density: %ix%i, %s samples",
+			mipmap->getWidth(), mipmap->getHeight(), pdfRes.x, pdfRes.y,
+			formatString(SIZE_T_FMT, nSamples).c_str());
+		Log(EInfo, "%-16s %10s %12s %14s %14s %12s", "Method", "Build [ms]", "Memory",
+			"Sample [M/s]", "PDF [M/s]", "Rel. std.dev.");
+
+		std::vector<Point2> samples(nSamples);
+		ref<Random> random = new Random((uint64_t) 1);
+		for (size_t i=0; i<nSamples; ++i)
+			samples[i] = Point2(random->nextFloat(), random->nextFloat());
+		std::vector<Point2> positions(nSamples);
+		std::vector<Float> probs(nSamples), estimates(nSamples);
+		Float pixelCount = (Float) (pdfRes.x * pdfRes.y), checksum = 0;
+
+		/* Flat CDF over all pixels (the previous implementation) */
+		{
+			ref<Timer> timer = new Timer();
+			DiscretePDF pdf(weights.size());
+			for (size_t i=0; i<weights.size(); ++i)
+				pdf[i] = weights[i];
+			pdf.build();
+			unsigned int buildTime = timer->getMilliseconds();
+
+			timer->reset();
+			for (size_t i=0; i<nSamples; ++i) {
+				Point2 sample(samples[i]);
+				int index = pdf.sampleReuse(sample.x, probs[i]);
+				int row = index / pdfRes.x, col = index - row * pdfRes.x;
+				positions[i] = Point2(col + sample.x, row + sample.y);
+			}
+			unsigned int sampleTime = timer->getMilliseconds();
+
+			timer->reset();
+			for (size_t i=0; i<nSamples; ++i) {
+				int x = std::min((int) positions[i].x, pdfRes.x - 1),
+					y = std::min((int) positions[i].y, pdfRes.y - 1);
+				checksum += pdf[x + y * pdfRes.x];
+			}
+			unsigned int pdfTime = timer->getMilliseconds();
+
+			for (size_t i=0; i<nSamples; ++i)
+				estimates[i] = integrand(mipmap, positions[i].x / pdfRes.x,
+					positions[i].y / pdfRes.y) / (probs[i] * pixelCount);
+			report("cdf", buildTime, weights.size() * 2 * sizeof(Float),
+				sampleTime, pdfTime, nSamples, estimates);
+		}
+
+		/* Hierarchical warp using different pruning thresholds */
+		const Float thresholds[] = { 0.0f, 0.01f, 0.1f, 0.5f };
+		for (int j=0; j<4; ++j) {
+			ref<Timer> timer = new Timer();
+			HierarchicalPDF2D pdf;
+			pdf.build(&weights[0], pdfRes.x, pdfRes.y, thresholds[j]);
+			unsigned int buildTime = timer->getMilliseconds();
+
+			timer->reset();
+			for (size_t i=0; i<nSamples; ++i)
+				positions[i] = pdf.sample(samples[i], probs[i]);
+			unsigned int sampleTime = timer->getMilliseconds();
+
+			timer->reset();
+			for (size_t i=0; i<nSamples; ++i) {
+				int x = std::min((int) positions[i].x, pdfRes.x - 1),
+					y = std::min((int) positions[i].y, pdfRes.y - 1);
+				checksum += pdf.pdf(x, y);
+			}
+			unsigned int pdfTime = timer->getMilliseconds();
+
+			for (size_t i=0; i<nSamples; ++i)
+				estimates[i] = integrand(mipmap, positions[i].x / pdfRes.x,
+					positions[i].y / pdfRes.y) / (probs[i] * pixelCount);
+			std::string name = formatString("prune=%g (%.0f%%)", thresholds[j],
+				pdf.getPrunedFraction() * 100);
+			report(name.c_str(), buildTime, pdf.getMemoryUsage(),
+				sampleTime, pdfTime, nSamples, estimates);
+		}
+
+		Log(EDebug, "Checksum: %f", checksum);
+		return 0;
+	}
+
+	MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(EnvMapBenchmark, "Environment map sampling benchmark")
+MTS_NAMESPACE_END
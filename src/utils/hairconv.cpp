@@ -0,0 +1,128 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/timer.h>
+#include <mitsuba/core/mmap.h>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#endif
+#include "../shapes/hairfile.h"
+
+MTS_NAMESPACE_BEGIN
+
+class HairConverter : public Utility {
+public:
+	void help() {
+		cout << endl;
+		cout << "Synopsis: Converts an ASCII hair file into the binary format, which can be" << endl;
+		cout << "memory-mapped by the 'hair' shape plugin." << endl;
+		cout << endl;
+		cout << "Usage: mtsutil hairconv [options] <ASCII hair file> <binary hair file>" << endl;
+		cout << "Options/Arguments:" << endl;
+		cout << "   -h             Display this help text" << endl << endl;
+	}
+
+	int run(int argc, char **argv) {
+		char optchar;
+		optind = 1;
+
+		/* Parse command-line arguments */
+		while ((optchar = getopt(argc, argv, "h")) != -1) {
+			switch (optchar) {
+				case 'h': {
+						help();
+						return 0;
+					}
+					break;
+			};
+		}
+
+		if (argc - optind != 2) {
+			help();
+			return 0;
+		}
+
+		fs::path inputPath = Thread::getThread()->getFileResolver()->resolve(argv[optind]);
+		fs::path outputPath(argv[optind+1]);
+
+		Log(EInfo, "Reading hair geometry from \"%s\" ..", inputPath.leaf().c_str());
+		if (!fs::exists(inputPath))
+			Log(EError, "Could not open \"%s\"!", inputPath.file_string().c_str());
+
+		/* Use the parser of the 'hair' shape plugin */
+		ref<Timer> timer = new Timer();
+		ASCIIHairSource source;
+		if (fs::file_size(inputPath) > 0) {
+			ref<MemoryMappedFile> mmap = new MemoryMappedFile(inputPath);
+			const char *begin = static_cast<const char *>(mmap->getData()),
+				*end = begin + mmap->getSize();
+			if (HairFileHeader::isBinary(begin, end))
+				Log(EError, "\"%s\" already is a binary hair file!",
+					inputPath.leaf().c_str());
+			parseASCIIHair(begin, end, source);
+		}
+
+		const size_t vertexCount = source.getPointCount();
+		if (vertexCount == 0)
+			Log(EError, "\"%s\" does not contain any hair vertices!",
+				inputPath.leaf().c_str());
+
+		std::vector<float> positions(3 * vertexCount), radii;
+		std::vector<uint32_t> fiberBits((vertexCount + 31) / 32, 0);
+		for (size_t i=0; i<vertexCount; ++i) {
+			const Point &p = source.points[i];
+			positions[3*i+0] = (float) p.x;
+			positions[3*i+1] = (float) p.y;
+			positions[3*i+2] = (float) p.z;
+			if (source.startsFiber[i]) {
+				fiberBits[i / 32] |= 1u << (i % 32);
+				radii.push_back((float) source.getRadius(radii.size(), i));
+			}
+		}
+		const size_t strandCount = radii.size();
+
+		Log(EInfo, "Read " SIZE_T_FMT " vertices (" SIZE_T_FMT " strands) in %i ms",
+			vertexCount, strandCount, timer->getMilliseconds());
+
+		HairFileHeader header;
+		header.flags = source.hasRadii() ? MTS_HAIR_BINARY_STRAND_RADII : 0;
+		header.pointCount = (uint64_t) vertexCount;
+		header.fiberCount = (uint64_t) strandCount;
+
+		ref<FileStream> stream = new FileStream(outputPath, FileStream::ETruncReadWrite);
+		stream->setByteOrder(Stream::ELittleEndian);
+		header.write(stream);
+		stream->writeSingleArray(&positions[0], positions.size());
+		stream->writeUIntArray(&fiberBits[0], fiberBits.size());
+		if (source.hasRadii())
+			stream->writeSingleArray(&radii[0], radii.size());
+
+		Log(EInfo, "Wrote \"%s\" (%s)", outputPath.leaf().c_str(),
+			memString(stream->getSize()).c_str());
+		stream->close();
+		return 0;
+	}
+
+	MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(HairConverter, "Convert ASCII hair files into the binary format")
+MTS_NAMESPACE_END
@@ -55,6 +55,8 @@ public:
 		cout << "                  optimization method." << endl << endl;
 		cout << "   -f             Try to empirically find the best SAH cost values by" << endl;
 		cout << "                  fitting the cost model to collected performance data" << endl << endl;
+		cout << "   -s             Measure how the tree construction scales when using" << endl;
+		cout << "                  1, 2, 4, .. up to the number of available cores" << endl << endl;
 		cout << "Examples:" << endl;
 		cout << "  E.g. to build a tree for the Stanford bunny having a low SAH cost, type " << endl << endl;
 		cout << "  $ mtsutil kdbench -e .9 -l1 -d48 -x100000 data/tests/bunny.ply" << endl << endl;
@@ -70,10 +72,11 @@ public:
 		Float intersectionCost = -1, traversalCost = -1, emptySpaceBonus = -1;
 		int stopPrims = -1, maxDepth = -1, exactPrims = -1, minMaxBins = -1;
 		bool clip = true, parallel = true, retract = true, fitParameters = false;
+		bool scaling = false;
 		optind = 1;
 
 		/* Parse command-line arguments */
-		while ((optchar = getopt(argc, argv, "i:t:e:c:p:r:l:x:b:d:hf")) != -1) {
+		while ((optchar = getopt(argc, argv, "i:t:e:c:p:r:l:x:b:d:hfs")) != -1) {
 			switch (optchar) {
 				case 'h': {
 						help();
@@ -83,6 +86,9 @@ public:
 				case 'f': 
 					fitParameters = true;
 					break;
+				case 's': 
+					scaling = true;
+					break;
 				case 'i': 
 					intersectionCost = (Float) strtod(optarg, &end_ptr);
 					if (*end_ptr != '\0')
@@ -208,7 +214,48 @@ public:
 		BSphere bsphere(kdtree->getBSphere());
 		const size_t nRays = 5000000;
 
-		if (!fitParameters) {
+		if (scaling) {
+			/* Rebuild the tree from scratch using an increasing number 
+			   of threads and report the resulting build times */
+			int procCount = getProcessorCount();
+			std::vector<int> threadCounts;
+			for (int i=1; i<procCount; i*=2)
+				threadCounts.push_back(i);
+			threadCounts.push_back(procCount);
+
+			Log(EInfo, "Measuring the scaling of the tree construction (%i cores) ..", procCount);
+			Float baseTime = 0;
+			for (size_t i=0; i<threadCounts.size(); ++i) {
+				ref<ShapeKDTree> tree = new ShapeKDTree();
+				const std::vector<const Shape *> &shapes = kdtree->getShapes();
+				for (size_t j=0; j<shapes.size(); ++j)
+					tree->addShape(shapes[j]);
+				tree->setQueryCost(kdtree->getQueryCost());
+				tree->setTraversalCost(kdtree->getTraversalCost());
+				tree->setEmptySpaceBonus(kdtree->getEmptySpaceBonus());
+				tree->setStopPrims(kdtree->getStopPrims());
+				tree->setExactPrimitiveThreshold(kdtree->getExactPrimitiveThreshold());
+				tree->setMinMaxBins(kdtree->getMinMaxBins());
+				if (maxDepth != -1)
+					tree->setMaxDepth(maxDepth);
+				tree->setClip(clip);
+				tree->setRetract(retract);
+				tree->setParallelBuild(threadCounts[i] > 1);
+				tree->setBuildThreadCount(threadCounts[i]);
+
+				logger->setLogLevel(EWarn);
+				ref<Timer> timer = new Timer();
+				tree->build();
+				Float time = timer->getMilliseconds() / (Float) 1000;
+				logger->setLogLevel(EInfo);
+
+				if (i == 0)
+					baseTime = time;
+				Log(EInfo, "   %3i thread(s) : %.3f s (speedup: %.2fx, efficiency: %.1f%%)",
+					threadCounts[i], time, baseTime / time, 
+					100 * baseTime / (time * threadCounts[i]));
+			}
+		} else if (!fitParameters) {
 			Log(EInfo, "Bounding sphere: %s", bsphere.toString().c_str());
 			Float best = 0;
 			for (int j=0; j<3; ++j) {
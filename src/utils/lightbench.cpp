@@ -0,0 +1,337 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/render/lighttree.h>
+#include <mitsuba/core/plugin.h>
+#include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/timer.h>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+class LightSamplingBenchmark : public Utility {
+public:
+	/// Shading point, at which the direct illumination is estimated
+	struct Receiver {
+		Point p;
+		Normal n;
+	};
+
+	void help() {
+		cout << endl;
+		cout << "Synopsis: Compares the noise and the cost of choosing luminaires for direct" << endl;
+		cout << "illumination independently of the shading point (\"global\") and using the" << endl;
+		cout << "light tree (\"tree\"). For a set of shading points, the irradiance is" << endl;
+		cout << "estimated using shadow rays and compared to a reference solution, which" << endl;
+		cout << "sums over all luminaires. Reports the time, the relative RMS error and the" << endl;
+		cout << "efficiency (inverse of error times time) relative to the global strategy." << endl;
+		cout << endl;
+		cout << "Usage: mtsutil lightbench [options] [scene file]" << endl;
+		cout << "Options/Arguments:" << endl;
+		cout << "   -h             Display this help text" << endl << endl;
+		cout << "   -l count       Number of luminaires in the synthetic city scene, which" << endl;
+		cout << "                  is used when no scene is specified (default: 4000)" << endl << endl;
+		cout << "   -p count       Number of shading points (default: 250)" << endl << endl;
+		cout << "   -s count       Number of samples per shading point (default: 64)" << endl << endl;
+	}
+
+	/// Create a square with the given center, normal and size
+	ref<TriMesh> createQuad(const std::string &name, const Point &center,
+			const Vector &normal, Float size) {
+		ref<TriMesh> mesh = new TriMesh(name, 2, 4, false, false, false);
+		Vector s, t;
+		coordinateSystem(normal, s, t);
+		s *= size / 2; t *= size / 2;
+		Point *positions = mesh->getVertexPositions();
+		positions[0] = center - s - t; positions[1] = center + s - t;
+		positions[2] = center + s + t; positions[3] = center - s + t;
+		Triangle *triangles = mesh->getTriangles();
+		triangles[0].idx[0] = 0; triangles[0].idx[1] = 1; triangles[0].idx[2] = 2;
+		triangles[1].idx[0] = 2; triangles[1].idx[1] = 3; triangles[1].idx[2] = 0;
+		return mesh;
+	}
+
+	/**
+	 * \brief Create a street grid at night: a ground plane with street
+	 * lights (point and spot lights) and lit windows (one-sided area lights)
+	 */
+	ref<Scene> createCity(int luminaireCount, Random *random) {
+		PluginManager *pluginManager = PluginManager::getInstance();
+		ref<Scene> scene = new Scene(Properties());
+		int gridSize = (int) std::ceil(std::sqrt((Float) luminaireCount));
+		Float spacing = 10.0f, extent = gridSize * spacing;
+
+		ref<TriMesh> ground = createQuad("ground", Point(extent / 2, 0, extent / 2),
+			Vector(0, 1, 0), 2 * extent);
+		ground->configure();
+		scene->addChild("ground", ground);
+
+		for (int i=0; i<luminaireCount; ++i) {
+			Point p((i % gridSize + random->nextFloat()) * spacing, 0,
+				(i / gridSize + random->nextFloat()) * spacing);
+			int type = i % 3;
+			Spectrum intensity(10 + 90 * random->nextFloat());
+			ref<Luminaire> luminaire;
+
+			if (type == 0) {
+				Properties props("point");
+				props.setTransform("toWorld", Transform::translate(Vector(p.x, 6, p.z)));
+				props.setSpectrum("intensity", intensity);
+				luminaire = static_cast<Luminaire *> (pluginManager->
+					createObject(MTS_CLASS(Luminaire), props));
+			} else if (type == 1) {
+				Properties props("spot");
+				Point pos(p.x, 8, p.z);
+				props.setTransform("toWorld", Transform::lookAt(pos,
+					pos - Vector(0, 1, 0), Vector(0, 0, 1)));
+				props.setSpectrum("intensity", intensity * 5);
+				props.setFloat("cutoffAngle", 30);
+				luminaire = static_cast<Luminaire *> (pluginManager->
+					createObject(MTS_CLASS(Luminaire), props));
+			} else {
+				Float angle = 2 * M_PI * random->nextFloat();
+				ref<TriMesh> window = createQuad(formatString("window%i", i),
+					Point(p.x, 2 + 10 * random->nextFloat(), p.z),
+					Vector(std::cos(angle), 0, std::sin(angle)), 1.5f);
+				Properties props("area");
+				props.setSpectrum("intensity", intensity / 10);
+				luminaire = static_cast<Luminaire *> (pluginManager->
+					createObject(MTS_CLASS(Luminaire), props));
+				window->addChild("", luminaire);
+				luminaire->setParent(window);
+				luminaire->configure();
+				window->configure();
+				scene->addChild("window", window);
+				continue;
+			}
+			luminaire->configure();
+			scene->addChild("luminaire", luminaire);
+		}
+
+		scene->initialize();
+		return scene;
+	}
+
+	/// Generate shading points by tracing rays from the camera
+	void createReceivers(const Scene *scene, Random *random, size_t count,
+			std::vector<Receiver> &receivers) {
+		const Camera *camera = scene->getCamera();
+		size_t attempts = 0;
+		while (receivers.size() < count && attempts++ < 100 * count) {
+			Ray ray;
+			Vector2i size = camera->getFilm()->getSize();
+			camera->generateRay(Point2(random->nextFloat() * size.x, random->nextFloat() * size.y),
+				Point2(random->nextFloat(), random->nextFloat()), random->nextFloat(), ray);
+			Intersection its;
+			if (!scene->rayIntersect(ray, its) || its.isLuminaire())
+				continue;
+			Receiver receiver;
+			receiver.p = its.p;
+			receiver.n = dot(its.shFrame.n, ray.d) < 0 ? its.shFrame.n : -its.shFrame.n;
+			receivers.push_back(receiver);
+		}
+	}
+
+	/// Irradiance contribution of a luminaire sample (or zero)
+	inline Float contribution(const Scene *scene, const Luminaire *luminaire,
+			const Receiver &receiver, const Point2 &sample) const {
+		LuminaireSamplingRecord lRec;
+		luminaire->sample(receiver.p, lRec, sample);
+		if (lRec.pdf == 0 || dot(receiver.n, lRec.d) >= 0 ||
+			scene->isOccluded(receiver.p, lRec.sRec.p, 0))
+			return 0.0f;
+		return lRec.value.getLuminance() * -dot(receiver.n, lRec.d) / lRec.pdf;
+	}
+
+	/**
+	 * \brief Compute reference irradiance values by summing over all luminaires.
+	 * Luminaires with a degenerate position are evaluated once, while 
+	 * the others are integrated using stratified samples.
+	 */
+	void computeReference(const Scene *scene, const std::vector<Receiver> &receivers,
+			std::vector<Float> &reference) {
+		const std::vector<Luminaire *> &luminaires = scene->getLuminaires();
+		const int strata = 4;
+		ref<Random> random = new Random((uint64_t) 2);
+		for (size_t i=0; i<receivers.size(); ++i) {
+			double sum = 0;
+			for (size_t j=0; j<luminaires.size(); ++j) {
+				const Luminaire *luminaire = luminaires[j];
+				if (luminaire->getType() & Luminaire::EDeltaPosition) {
+					sum += contribution(scene, luminaire, receivers[i], Point2(0.5f));
+					continue;
+				}
+				double lumSum = 0;
+				for (int k=0; k<strata*strata; ++k) {
+					Point2 sample((k % strata + random->nextFloat()) / strata,
+						(k / strata + random->nextFloat()) / strata);
+					lumSum += contribution(scene, luminaire, receivers[i], sample);
+				}
+				sum += lumSum / (strata*strata);
+			}
+			reference[i] = (Float) sum;
+		}
+	}
+
+	/**
+	 * \brief Estimate the irradiance at every shading point and return the
+	 * relative mean squared error with respect to the reference
+	 */
+	Float estimate(const Scene *scene, const LightTree *tree, const DiscretePDF &pdf,
+			const std::vector<Receiver> &receivers, const std::vector<Float> &reference,
+			int sampleCount, unsigned int &time) {
+		const std::vector<Luminaire *> &luminaires = scene->getLuminaires();
+		std::vector<Float> estimates(receivers.size());
+		ref<Random> random = new Random((uint64_t) 1);
+		ref<Timer> timer = new Timer();
+
+		for (size_t i=0; i<receivers.size(); ++i) {
+			const Receiver &receiver = receivers[i];
+			double sum = 0;
+			for (int j=0; j<sampleCount; ++j) {
+				Point2 sample(random->nextFloat(), random->nextFloat());
+				Float lumPdf;
+				const Luminaire *luminaire = tree ? tree->sample(receiver.p, sample.x, lumPdf)
+					: luminaires[pdf.sampleReuse(sample.x, lumPdf)];
+				sum += contribution(scene, luminaire, receiver, sample) / lumPdf;
+			}
+			estimates[i] = (Float) (sum / sampleCount);
+		}
+		time = timer->getMilliseconds();
+
+		double relMSE = 0;
+		size_t count = 0;
+		for (size_t i=0; i<receivers.size(); ++i) {
+			if (reference[i] <= 0)
+				continue;
+			double relError = (estimates[i] - reference[i]) / reference[i];
+			relMSE += relError * relError;
+			count++;
+		}
+		return (Float) (relMSE / std::max(count, (size_t) 1));
+	}
+
+	int run(int argc, char **argv) {
+		char optchar, *end_ptr = NULL;
+		int luminaireCount = 4000, sampleCount = 64;
+		size_t receiverCount = 250;
+		optind = 1;
+
+		/* Parse command-line arguments */
+		while ((optchar = getopt(argc, argv, "l:p:s:h")) != -1) {
+			switch (optchar) {
+				case 'h': {
+						help();
+						return 0;
+					}
+					break;
+				case 'l': {
+						luminaireCount = strtol(optarg, &end_ptr, 10);
+						if (*end_ptr != '\0' || luminaireCount <= 0)
+							SLog(EError, "Could not parse the luminaire count!");
+					}
+					break;
+				case 'p': {
+						long value = strtol(optarg, &end_ptr, 10);
+						if (*end_ptr != '\0' || value <= 0)
+							SLog(EError, "Could not parse the number of shading points!");
+						receiverCount = (size_t) value;
+					}
+					break;
+				case 's': {
+						sampleCount = strtol(optarg, &end_ptr, 10);
+						if (*end_ptr != '\0' || sampleCount <= 1)
+							SLog(EError, "Could not parse the sample count!");
+					}
+					break;
+			};
+		}
+
+		if (optind+1 < argc) {
+			help();
+			return 0;
+		}
+
+		ref<Random> random = new Random((uint64_t) 1);
+		ref<Scene> scene;
+		std::vector<Receiver> receivers;
+		if (optind < argc) {
+			scene = loadScene(argv[optind]);
+			scene->initialize();
+			createReceivers(scene, random, receiverCount, receivers);
+		} else {
+			scene = createCity(luminaireCount, random);
+			/* Place the shading points within the streets (the
+			   ground plane extends beyond them by a factor of two) */
+			Point center = scene->getAABB().getCenter();
+			Float extent = scene->getAABB().getExtents().x / 2;
+			for (size_t i=0; i<receiverCount; ++i) {
+				Receiver receiver;
+				receiver.p = Point(center.x + (random->nextFloat() - 0.5f) * extent,
+					0, center.z + (random->nextFloat() - 0.5f) * extent);
+				receiver.n = Normal(0, 1, 0);
+				receivers.push_back(receiver);
+			}
+		}
+
+		/* Same distribution as the "global" strategy of Scene */
+		const std::vector<Luminaire *> &luminaires = scene->getLuminaires();
+		DiscretePDF pdf(luminaires.size());
+		for (size_t i=0; i<luminaires.size(); ++i)
+			pdf[i] = luminaires[i]->getSamplingWeight();
+		pdf.build();
+
+		ref<Timer> timer = new Timer();
+		ref<LightTree> tree = new LightTree(luminaires, true);
+		unsigned int buildTime = timer->getMilliseconds();
+
+		Log(EInfo, SIZE_T_FMT " luminaires, " SIZE_T_FMT " shading points, %i samples "
+			"per point, light tree built in %i ms", luminaires.size(), receivers.size(),
+			sampleCount, buildTime);
+		timer->reset();
+		std::vector<Float> reference(receivers.size());
+		computeReference(scene, receivers, reference);
+		Log(EInfo, "Computed the reference solution in %i ms", timer->getMilliseconds());
+
+		Log(EInfo, "%-8s %10s %14s %12s %12s", "Method", "Time [ms]",
+			"ns/sample", "Rel. RMSE", "Efficiency");
+		unsigned int globalTime, treeTime;
+		Float globalError = estimate(scene, NULL, pdf, receivers, reference, 
+				sampleCount, globalTime),
+			  treeError = estimate(scene, tree, pdf, receivers, reference,
+				sampleCount, treeTime);
+
+		/* Efficiency: inverse of the product of the error and the time */
+		size_t totalSamples = receivers.size() * sampleCount;
+		Float globalCost = globalError * std::max(globalTime, 1U),
+			  treeCost = treeError * std::max(treeTime, 1U);
+		Log(EInfo, "%-8s %10i %14.1f %12.4f %12.2f", "global", globalTime,
+			globalTime * 1e6 / totalSamples, std::sqrt(globalError), 1.0f);
+		Log(EInfo, "%-8s %10i %14.1f %12.4f %12.2f", "tree", treeTime,
+			treeTime * 1e6 / totalSamples, std::sqrt(treeError), globalCost / treeCost);
+		return 0;
+	}
+
+	MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(LightSamplingBenchmark, "Many-light sampling benchmark")
+MTS_NAMESPACE_END
@@ -0,0 +1,229 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/render/skdtree.h>
+#include <mitsuba/core/timer.h>
+#include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/plugin.h>
+#include <boost/algorithm/string.hpp>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+/// Number of rays, whose intersection records are compared
+#define MTS_MESHATTR_COMPARE_RAYS 100000
+
+class MeshAttributes : public Utility {
+public:
+	void help() {
+		cout << endl;
+		cout << "Synopsis: Compares the full and compact vertex attribute storage of triangle" << endl;
+		cout << "meshes. Reports the memory saved by the compact representation, the resulting" << endl;
+		cout << "overhead when intersecting rays, and the error of the decoded attributes." << endl;
+		cout << endl;
+		cout << "Usage: mtsutil meshattr [options] <OBJ, PLY or serialized file>" << endl;
+		cout << "Options/Arguments:" << endl;
+		cout << "   -h             Display this help text" << endl << endl;
+		cout << "   -n count       Number of rays traced per measurement (default: 2000000)" << endl << endl;
+	}
+
+	/// Attribute memory of a mesh in bytes
+	static size_t getAttributeMemory(const TriMesh *mesh) {
+		size_t perVertex = 0;
+		if (mesh->hasCompactAttributes()) {
+			perVertex = sizeof(uint32_t) * ((mesh->hasVertexNormals() ? 1 : 0)
+				+ (mesh->hasVertexTexcoords() ? 1 : 0)
+				+ (mesh->hasVertexColors() ? 1 : 0));
+		} else {
+			if (mesh->hasVertexNormals())
+				perVertex += sizeof(Normal);
+			if (mesh->hasVertexTexcoords())
+				perVertex += sizeof(Point2);
+			if (mesh->hasVertexColors())
+				perVertex += sizeof(Spectrum);
+		}
+		return perVertex * mesh->getVertexCount();
+	}
+
+	/// Generate a ray through the bounding sphere of the scene
+	static Ray sampleRay(Random *random, const BSphere &bsphere) {
+		Point2 sample1(random->nextFloat(), random->nextFloat()),
+			sample2(random->nextFloat(), random->nextFloat());
+		Point p1 = bsphere.center + squareToSphere(sample1) * bsphere.radius;
+		Point p2 = bsphere.center + squareToSphere(sample2) * bsphere.radius;
+		return Ray(p1, normalize(p2-p1), 0.0f);
+	}
+
+	/// Trace rays and return the achieved number of MRays/s (best of three)
+	Float benchmark(const ShapeKDTree *kdtree, size_t nRays) {
+		BSphere bsphere(kdtree->getBSphere());
+		Float best = 0;
+		for (int j=0; j<3; ++j) {
+			ref<Random> random = new Random((uint64_t) 1);
+			ref<Timer> timer = new Timer();
+			for (size_t i=0; i<nRays; ++i) {
+				Intersection its;
+				kdtree->rayIntersect(sampleRay(random, bsphere), its);
+			}
+			Float mrays = nRays / (std::max(timer->getMilliseconds(), 1U) * (Float) 1000);
+			best = std::max(best, mrays);
+		}
+		return best;
+	}
+
+	int run(int argc, char **argv) {
+		char optchar, *end_ptr = NULL;
+		size_t nRays = 2000000;
+		optind = 1;
+
+		/* Parse command-line arguments */
+		while ((optchar = getopt(argc, argv, "n:h")) != -1) {
+			switch (optchar) {
+				case 'h': {
+						help();
+						return 0;
+					}
+					break;
+				case 'n': {
+						long value = strtol(optarg, &end_ptr, 10);
+						if (*end_ptr != '\0' || value <= 0)
+							SLog(EError, "Could not parse the number of rays!");
+						nRays = (size_t) value;
+					}
+					break;
+			};
+		}
+
+		if (optind == argc || optind+1 < argc) {
+			help();
+			return 0;
+		}
+
+		fs::path filename = Thread::getThread()->getFileResolver()->resolve(argv[optind]);
+		std::string lowercase = boost::to_lower_copy(filename.file_string());
+		std::string pluginName;
+		if (boost::ends_with(lowercase, ".obj"))
+			pluginName = "obj";
+		else if (boost::ends_with(lowercase, ".ply"))
+			pluginName = "ply";
+		else if (boost::ends_with(lowercase, ".serialized"))
+			pluginName = "serialized";
+		else
+			Log(EError, "The supplied filename must end in OBJ, PLY or SERIALIZED!");
+
+		Properties props(pluginName);
+		props.setString("filename", filename.file_string());
+		ref<Shape> shape = static_cast<Shape *> (PluginManager::getInstance()->
+				createObject(MTS_CLASS(Shape), props));
+
+		std::vector<TriMesh *> meshes;
+		if (shape->isCompound()) {
+			for (int i=0; ; ++i) {
+				Shape *element = shape->getElement(i);
+				if (!element)
+					break;
+				if (element->getClass()->derivesFrom(MTS_CLASS(TriMesh)))
+					meshes.push_back(static_cast<TriMesh *>(element));
+			}
+		} else if (shape->getClass()->derivesFrom(MTS_CLASS(TriMesh))) {
+			meshes.push_back(static_cast<TriMesh *>(shape.get()));
+		}
+		if (meshes.empty())
+			Log(EError, "The file \"%s\" does not contain any triangle meshes!",
+				filename.file_string().c_str());
+
+		ref<ShapeKDTree> kdtree = new ShapeKDTree();
+		size_t memoryBefore = 0;
+		for (size_t i=0; i<meshes.size(); ++i) {
+			meshes[i]->configure();
+			memoryBefore += getAttributeMemory(meshes[i]);
+			kdtree->addShape(meshes[i]);
+		}
+
+		Logger *logger = Thread::getThread()->getLogger();
+		logger->setLogLevel(EWarn);
+		kdtree->build();
+		logger->setLogLevel(EInfo);
+
+		/* Record intersections with the full-precision attributes */
+		BSphere bsphere(kdtree->getBSphere());
+		size_t nCompare = std::min(nRays, (size_t) MTS_MESHATTR_COMPARE_RAYS);
+		std::vector<Intersection> reference(nCompare);
+		std::vector<bool> hit(nCompare);
+		ref<Random> random = new Random((uint64_t) 2);
+		for (size_t i=0; i<nCompare; ++i)
+			hit[i] = kdtree->rayIntersect(sampleRay(random, bsphere), reference[i]);
+
+		Log(EInfo, "Tracing " SIZE_T_FMT " rays using the full vertex attributes ..", nRays);
+		Float before = benchmark(kdtree, nRays);
+
+		size_t memoryAfter = 0;
+		for (size_t i=0; i<meshes.size(); ++i) {
+			meshes[i]->compactAttributes();
+			memoryAfter += getAttributeMemory(meshes[i]);
+		}
+
+		Log(EInfo, "Tracing " SIZE_T_FMT " rays using the compact vertex attributes ..", nRays);
+		Float after = benchmark(kdtree, nRays);
+
+		/* Compare the intersection records */
+		Float maxNormalError = 0, avgNormalError = 0, maxUVError = 0, maxColorError = 0;
+		size_t nHits = 0;
+		random = new Random((uint64_t) 2);
+		for (size_t i=0; i<nCompare; ++i) {
+			Intersection its;
+			if (!kdtree->rayIntersect(sampleRay(random, bsphere), its) || !hit[i])
+				continue;
+			const Intersection &expected = reference[i];
+			Float normalError = radToDeg(unitAngle(expected.shFrame.n, its.shFrame.n));
+			if (normalError == normalError) {
+				maxNormalError = std::max(maxNormalError, normalError);
+				avgNormalError += normalError;
+			}
+			maxUVError = std::max(maxUVError, std::max(
+				std::abs(expected.uv.x - its.uv.x), std::abs(expected.uv.y - its.uv.y)));
+			const TriMesh *mesh = static_cast<const TriMesh *>(its.shape);
+			if (mesh->hasVertexColors() && !expected.color.isZero()) {
+				for (int j=0; j<SPECTRUM_SAMPLES; ++j)
+					maxColorError = std::max(maxColorError, std::abs(expected.color[j]
+						- its.color[j]) / expected.color.max());
+			}
+			++nHits;
+		}
+		if (nHits > 0)
+			avgNormalError /= nHits;
+
+		Log(EInfo, "Attribute memory : %s -> %s (saved %s)", memString(memoryBefore).c_str(),
+			memString(memoryAfter).c_str(), memString(memoryBefore - memoryAfter).c_str());
+		Log(EInfo, "Intersection     : %.3f -> %.3f MRays/s (overhead: %.1f%%)", before, after,
+			100 * (before / after - 1));
+		Log(EInfo, "Normal error     : %.4f degrees on average, %.4f degrees at most",
+			avgNormalError, maxNormalError);
+		Log(EInfo, "Texture coord.   : %g maximum absolute error", maxUVError);
+		Log(EInfo, "Vertex color     : %g maximum relative error", maxColorError);
+		return 0;
+	}
+
+	MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(MeshAttributes, "Compact vertex attribute benchmark")
+MTS_NAMESPACE_END
@@ -0,0 +1,188 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/render/trimesh.h>
+#include <mitsuba/core/timer.h>
+#include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/plugin.h>
+#include <boost/algorithm/string.hpp>
+#include <omp.h>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+class MeshBench : public Utility {
+public:
+	void help() {
+		cout << endl;
+		cout << "Synopsis: Mesh loader benchmark. Repeatedly loads an OBJ, PLY or serialized" << endl;
+		cout << "mesh file and reports the achieved throughput as well as the peak resident" << endl;
+		cout << "memory usage of the process." << endl;
+		cout << endl;
+		cout << "Usage: mtsutil meshbench [options] <OBJ, PLY or serialized file>" << endl;
+		cout << "Options/Arguments:" << endl;
+		cout << "   -h             Display this help text" << endl << endl;
+		cout << "   -n count       Number of times the file is loaded (default: 3)" << endl << endl;
+		cout << "   -s             Measure how the loader scales when using" << endl;
+		cout << "                  1, 2, 4, .. up to the number of available cores" << endl << endl;
+	}
+
+	/// Return the peak resident set size of this process in bytes
+	static size_t getPeakMemoryUsage() {
+#if defined(WIN32)
+		PROCESS_MEMORY_COUNTERS counters;
+		if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+			return 0;
+		return (size_t) counters.PeakWorkingSetSize;
+#else
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) != 0)
+			return 0;
+#if defined(__OSX__)
+		return (size_t) usage.ru_maxrss;
+#else
+		return (size_t) usage.ru_maxrss * 1024;
+#endif
+#endif
+	}
+
+	/// Load a mesh and return the number of triangles and vertices
+	void load(const Properties &props, size_t &triangleCount, size_t &vertexCount) {
+		ref<Shape> shape = static_cast<Shape *> (PluginManager::getInstance()->
+				createObject(MTS_CLASS(Shape), props));
+		triangleCount = vertexCount = 0;
+
+		std::vector<Shape *> shapes;
+		if (shape->isCompound()) {
+			for (int i=0; ; ++i) {
+				Shape *element = shape->getElement(i);
+				if (!element)
+					break;
+				shapes.push_back(element);
+			}
+		} else {
+			shapes.push_back(shape);
+		}
+
+		for (size_t i=0; i<shapes.size(); ++i) {
+			if (!shapes[i]->getClass()->derivesFrom(MTS_CLASS(TriMesh)))
+				continue;
+			const TriMesh *mesh = static_cast<const TriMesh *>(shapes[i]);
+			triangleCount += mesh->getTriangleCount();
+			vertexCount += mesh->getVertexCount();
+		}
+	}
+
+	int run(int argc, char **argv) {
+		char optchar, *end_ptr = NULL;
+		int runs = 3;
+		bool scaling = false;
+		optind = 1;
+
+		/* Parse command-line arguments */
+		while ((optchar = getopt(argc, argv, "n:hs")) != -1) {
+			switch (optchar) {
+				case 'h': {
+						help();
+						return 0;
+					}
+					break;
+				case 's':
+					scaling = true;
+					break;
+				case 'n':
+					runs = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || runs <= 0)
+						SLog(EError, "Could not parse the number of runs!");
+					break;
+			};
+		}
+
+		if (optind == argc || optind+1 < argc) {
+			help();
+			return 0;
+		}
+
+		fs::path filename = Thread::getThread()->getFileResolver()->resolve(argv[optind]);
+		if (!fs::exists(filename))
+			Log(EError, "The file \"%s\" does not exist!", filename.file_string().c_str());
+
+		std::string lowercase = boost::to_lower_copy(filename.file_string());
+		std::string pluginName;
+		if (boost::ends_with(lowercase, ".obj"))
+			pluginName = "obj";
+		else if (boost::ends_with(lowercase, ".ply"))
+			pluginName = "ply";
+		else if (boost::ends_with(lowercase, ".serialized"))
+			pluginName = "serialized";
+		else
+			Log(EError, "The supplied filename must end in OBJ, PLY or SERIALIZED!");
+
+		Properties props(pluginName);
+		props.setString("filename", filename.file_string());
+		Float fileSize = (Float) fs::file_size(filename) / (1024 * 1024);
+
+		std::vector<int> threadCounts;
+		int procCount = getProcessorCount();
+		if (scaling) {
+			for (int i=1; i<procCount; i*=2)
+				threadCounts.push_back(i);
+		}
+		threadCounts.push_back(procCount);
+
+		Logger *logger = Thread::getThread()->getLogger();
+		Log(EInfo, "Benchmarking the \"%s\" loader on \"%s\" (%.1f MiB, peak RSS before "
+			"loading: %s) ..", pluginName.c_str(), filename.leaf().c_str(), fileSize,
+			memString(getPeakMemoryUsage()).c_str());
+
+		for (size_t i=0; i<threadCounts.size(); ++i) {
+			omp_set_num_threads(threadCounts[i]);
+			Float best = std::numeric_limits<Float>::infinity();
+			size_t triangleCount = 0, vertexCount = 0;
+
+			for (int j=0; j<runs; ++j) {
+				logger->setLogLevel(EWarn);
+				ref<Timer> timer = new Timer();
+				load(props, triangleCount, vertexCount);
+				Float time = timer->getMilliseconds() / (Float) 1000;
+				logger->setLogLevel(EInfo);
+				best = std::min(best, time);
+			}
+
+			Log(EInfo, "   %3i thread(s) : " SIZE_T_FMT " triangles, " SIZE_T_FMT
+				" vertices in %.3f s (%.1f MiB/s, peak RSS: %s)", threadCounts[i],
+				triangleCount, vertexCount, best, fileSize / std::max(best, (Float) 1e-3f),
+				memString(getPeakMemoryUsage()).c_str());
+		}
+		omp_set_num_threads(procCount);
+
+		return 0;
+	}
+
+	MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(MeshBench, "Mesh loader benchmark")
+MTS_NAMESPACE_END
@@ -0,0 +1,212 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/render/mipmap.h>
+#include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/timer.h>
+#include <boost/algorithm/string.hpp>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+class MIPMapBenchmark : public Utility {
+public:
+	/// Differential texture lookup, which is replayed for every storage format
+	struct Query {
+		Float u, v, dudx, dudy, dvdx, dvdy;
+	};
+
+	void help() {
+		cout << endl;
+		cout << "Synopsis: Compares the memory footprint, lookup throughput and accuracy" << endl;
+		cout << "of the texel storage formats supported by the mip map implementation." << endl;
+		cout << endl;
+		cout << "Usage: mtsutil mipbench [options] [PNG, JPEG or EXR image]" << endl;
+		cout << "Options/Arguments:" << endl;
+		cout << "   -h             Display this help text" << endl << endl;
+		cout << "   -n count       Number of lookups per measurement (default: 1000000)" << endl << endl;
+		cout << "   -s res         Resolution of the synthetic test image, which is used" << endl;
+		cout << "                  when no image is specified (default: 2048)" << endl << endl;
+	}
+
+	/// Load an image and convert it into a linear floating point bitmap
+	ref<Bitmap> loadImage(const fs::path &path) {
+		std::string lowercase = boost::to_lower_copy(path.file_string());
+		Bitmap::EFileFormat format;
+		if (boost::ends_with(lowercase, ".exr"))
+			format = Bitmap::EEXR;
+		else if (boost::ends_with(lowercase, ".png"))
+			format = Bitmap::EPNG;
+		else if (boost::ends_with(lowercase, ".jpg") || boost::ends_with(lowercase, ".jpeg"))
+			format = Bitmap::EJPEG;
+		else
+			Log(EError, "The supplied filename must end in PNG, JPEG or EXR!");
+
+		ref<FileStream> fs = new FileStream(path, FileStream::EReadOnly);
+		ref<Bitmap> bitmap = new Bitmap(format, fs);
+		if (bitmap->getBitsPerPixel() == 128)
+			return bitmap;
+
+		int channels = bitmap->getBitsPerPixel() / 8;
+		if (channels != 3 && channels != 4)
+			Log(EError, "%i bpp images are not supported!", bitmap->getBitsPerPixel());
+		ref<Bitmap> converted = new Bitmap(bitmap->getWidth(), bitmap->getHeight(), 128);
+		const uint8_t *data = bitmap->getData();
+		float *target = converted->getFloatData();
+		for (int i=0; i<bitmap->getWidth()*bitmap->getHeight(); ++i) {
+			Spectrum value;
+			value.fromSRGB(data[0] / 255.0f, data[1] / 255.0f, data[2] / 255.0f);
+			Float r, g, b;
+			value.toLinearRGB(r, g, b);
+			*target++ = r; *target++ = g; *target++ = b; *target++ = 1.0f;
+			data += channels;
+		}
+		return converted;
+	}
+
+	/// Create a smooth synthetic test image with some high-frequency detail
+	ref<Bitmap> createImage(int res) {
+		ref<Bitmap> bitmap = new Bitmap(res, res, 128);
+		float *target = bitmap->getFloatData();
+		for (int y=0; y<res; ++y) {
+			for (int x=0; x<res; ++x) {
+				Float u = x / (Float) res, v = y / (Float) res;
+				*target++ = 0.5f + 0.5f * std::sin(2 * M_PI * 3 * u) * std::cos(2 * M_PI * 5 * v);
+				*target++ = u * v;
+				*target++ = ((x / 8 + y / 8) % 2) ? 0.8f : 0.05f;
+				*target++ = 1.0f;
+			}
+		}
+		return bitmap;
+	}
+
+	int run(int argc, char **argv) {
+		char optchar, *end_ptr = NULL;
+		size_t nLookups = 1000000;
+		int res = 2048;
+		optind = 1;
+
+		/* Parse command-line arguments */
+		while ((optchar = getopt(argc, argv, "n:s:h")) != -1) {
+			switch (optchar) {
+				case 'h': {
+						help();
+						return 0;
+					}
+					break;
+				case 'n': {
+						long value = strtol(optarg, &end_ptr, 10);
+						if (*end_ptr != '\0' || value <= 0)
+							SLog(EError, "Could not parse the number of lookups!");
+						nLookups = (size_t) value;
+					}
+					break;
+				case 's': {
+						res = strtol(optarg, &end_ptr, 10);
+						if (*end_ptr != '\0' || res <= 0)
+							SLog(EError, "Could not parse the image resolution!");
+					}
+					break;
+			};
+		}
+
+		if (optind+1 < argc) {
+			help();
+			return 0;
+		}
+
+		ref<Bitmap> bitmap;
+		if (optind < argc) {
+			fs::path path = Thread::getThread()->getFileResolver()->resolve(argv[optind]);
+			bitmap = loadImage(path);
+		} else {
+			bitmap = createImage(res);
+		}
+
+		/* Generate random lookups with anisotropic footprints of varying size */
+		std::vector<Query> queries(nLookups);
+		ref<Random> random = new Random((uint64_t) 1);
+		for (size_t i=0; i<nLookups; ++i) {
+			Query &q = queries[i];
+			Float angle = random->nextFloat() * 2 * M_PI,
+				  minor = std::pow((Float) 10, -4 + 2 * random->nextFloat()),
+				  major = minor * (1 + 7 * random->nextFloat());
+			q.u = random->nextFloat();
+			q.v = random->nextFloat();
+			q.dudx = major * std::cos(angle); q.dvdx = major * std::sin(angle);
+			q.dudy = -minor * std::sin(angle); q.dvdy = minor * std::cos(angle);
+		}
+
+		const char *names[] = { "spectrum", "half", "linear8", "srgb8" };
+		std::vector<Spectrum> reference(nLookups);
+		Log(EInfo, "Image resolution: %ix%i, %s lookups per measurement", bitmap->getWidth(),
+			bitmap->getHeight(), formatString(SIZE_T_FMT, nLookups).c_str());
+		Log(EInfo, "%-10s %12s %16s %16s %12s %12s", "Format", "Memory",
+			"triangle() [M/s]", "EWA [M/s]", "Max. error", "Avg. error");
+
+		for (int format=MIPMap::ESpectrum; format<=MIPMap::ESRGB8; ++format) {
+			ref<MIPMap> mipmap = MIPMap::fromBitmap(bitmap, MIPMap::EEWA,
+				MIPMap::ERepeat, 8.0f, (MIPMap::EStorageFormat) format);
+
+			/* Accumulate the results so that the lookups cannot be optimized away */
+			Spectrum sum(0.0f);
+			ref<Timer> timer = new Timer();
+			for (size_t i=0; i<nLookups; ++i)
+				sum += mipmap->triangle(0, queries[i].u, queries[i].v);
+			Float triangleRate = nLookups / (std::max(timer->getMilliseconds(), 1U) * (Float) 1000);
+
+			timer->reset();
+			for (size_t i=0; i<nLookups; ++i) {
+				const Query &q = queries[i];
+				sum += mipmap->getValue(q.u, q.v, q.dudx, q.dudy, q.dvdx, q.dvdy);
+			}
+			Float ewaRate = nLookups / (std::max(timer->getMilliseconds(), 1U) * (Float) 1000);
+
+			/* Compare against the full-precision spectra */
+			Float maxError = 0, avgError = 0;
+			for (size_t i=0; i<nLookups; ++i) {
+				const Query &q = queries[i];
+				Spectrum value = mipmap->getValue(q.u, q.v, q.dudx, q.dudy, q.dvdx, q.dvdy);
+				if (format == MIPMap::ESpectrum) {
+					reference[i] = value;
+					continue;
+				}
+				for (int j=0; j<SPECTRUM_SAMPLES; ++j) {
+					Float error = std::abs(value[j] - reference[i][j]);
+					maxError = std::max(maxError, error);
+					avgError += error;
+				}
+			}
+			avgError /= nLookups * SPECTRUM_SAMPLES;
+
+			Log(EDebug, "Checksum: %s", sum.toString().c_str());
+			Log(EInfo, "%-10s %12s %16.3f %16.3f %12g %12g", names[format],
+				memString(mipmap->getMemoryUsage()).c_str(), triangleRate, ewaRate,
+				maxError, avgError);
+		}
+		return 0;
+	}
+
+	MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(MIPMapBenchmark, "Mip map texel storage format benchmark")
+MTS_NAMESPACE_END
@@ -557,6 +557,41 @@ public:
 		return 1.0f;
 	}
 
+	Float getLocalMaximumFloatValue(const AABB &aabb) const {
+		if (m_channels != 1 || (m_volumeType != EFloat32 && m_volumeType != EUInt8))
+			return getMaximumFloatValue();
+
+		/* Lookups interpolate between a voxel and its upper neighbors. An
+		   additional voxel on each side accounts for roundoff errors */
+		AABB gridAABB;
+		for (int i=0; i<8; ++i)
+			gridAABB.expandBy(m_worldToGrid(aabb.getCorner(i)));
+		int start[3], end[3];
+		for (int i=0; i<3; ++i) {
+			start[i] = std::max(0, floorToInt(gridAABB.min[i]) - 1);
+			end[i] = std::min(m_res[i] - 1, floorToInt(gridAABB.max[i]) + 2);
+			if (start[i] > end[i])
+				return 0.0f;
+		}
+
+		Float maxValue = 0;
+		for (int z=start[2]; z<=end[2]; ++z) {
+			for (int y=start[1]; y<=end[1]; ++y) {
+				size_t offset = ((size_t) z*m_res.y + y)*m_res.x;
+				if (m_volumeType == EFloat32) {
+					const float *floatData = (float *) m_data + offset;
+					for (int x=start[0]; x<=end[0]; ++x)
+						maxValue = std::max(maxValue, (Float) floatData[x]);
+				} else {
+					const uint8_t *data = m_data + offset;
+					for (int x=start[0]; x<=end[0]; ++x)
+						maxValue = std::max(maxValue, m_densityMap[data[x]]);
+				}
+			}
+		}
+		return maxValue;
+	}
+
 	MTS_DECLARE_CLASS()
 protected: 
 	FINLINE Vector lookupQuantizedDirection(size_t index) const {
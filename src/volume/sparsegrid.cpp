@@ -0,0 +1,438 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2011 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/volume.h>
+#include <mitsuba/core/mstream.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/properties.h>
+#include <mitsuba/core/mmap.h>
+#include <mitsuba/core/timer.h>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Sparse grid data source, which only stores the occupied
+ * bricks of a scalar density volume.
+ *
+ * The volume is split into cubic bricks of \c brickSize^3 voxels, and
+ * bricks where all voxels are zero are not stored at all. In addition,
+ * the implementation keeps track of the minimum and maximum density
+ * within every brick, which is exposed as a \ref MajorantGrid. The
+ * heterogeneous medium uses this information to skip empty space
+ * during Woodcock tracking and to work with local majorants.
+ *
+ * Lookups are identical to the ones performed by \c gridvolume. The
+ * data can either be loaded from a dense single-channel \c gridvolume
+ * file (float32 or uint8), which is converted into bricks when the scene
+ * is loaded, or from a sparse file using the following little endian
+ * format:
+ *
+ * Bytes 1-3   :  ASCII Bytes 'S', 'V', and 'L'
+ * Byte  4     :  Version identifier (currently 1)
+ * Bytes 5-8   :  Brick size in voxels (double word, must be a power of two)
+ * Bytes 9-12  :  Number of cells along the X axis (double word)
+ * Bytes 13-16 :  Number of cells along the Y axis (double word)
+ * Bytes 17-20 :  Number of cells along the Z axis (double word)
+ * Bytes 21-44 :  Axis-aligned bounding box of the data stored in single
+ *                precision (order: xmin, ymin, zmin, xmax, ymax, zmax)
+ * Bytes 45-48 :  Number of stored bricks (double word)
+ * Bytes 49-*  :  For every stored brick: its integer brick coordinates
+ *                (3 double words) followed by brickSize^3 float32 values
+ *                ordered as "data[(zpos*brickSize + ypos)*brickSize + xpos]".
+ *
+ * When the 'sparseFilename' parameter is specified, a converted dense
+ * volume is also written to disk using this format.
+ */
+class SparseGridDataSource : public VolumeDataSource {
+public:
+	enum EVolumeType {
+		EFloat32 = 1,
+		EUInt8 = 3
+	};
+
+	SparseGridDataSource(const Properties &props)
+		: VolumeDataSource(props) {
+		m_volumeToWorld = props.getTransform("toWorld", Transform());
+
+		/* Brick size used when converting a dense volume */
+		m_brickSize = props.getInteger("brickSize", 8);
+		if (!isPow2(m_brickSize))
+			Log(EError, "Brick size must be a power of two!");
+
+		loadFromFile(props.getString("filename"));
+
+		if (props.hasProperty("sparseFilename"))
+			saveToFile(props.getString("sparseFilename"));
+	}
+
+	SparseGridDataSource(Stream *stream, InstanceManager *manager)
+			: VolumeDataSource(stream, manager) {
+		m_volumeToWorld = Transform(stream);
+		m_dataAABB = AABB(stream);
+		m_brickSize = stream->readInt();
+		m_res = Vector3i(stream);
+		initializeBricks();
+		stream->readIntArray(&m_brickIndex[0], m_brickIndex.size());
+		m_brickData.resize(stream->readSize());
+		stream->readSingleArray(&m_brickData[0], m_brickData.size());
+		configure();
+	}
+
+	virtual ~SparseGridDataSource() {
+	}
+
+	void serialize(Stream *stream, InstanceManager *manager) const {
+		VolumeDataSource::serialize(stream, manager);
+
+		m_volumeToWorld.serialize(stream);
+		m_dataAABB.serialize(stream);
+		stream->writeInt(m_brickSize);
+		m_res.serialize(stream);
+		stream->writeIntArray(&m_brickIndex[0], m_brickIndex.size());
+		stream->writeSize(m_brickData.size());
+		stream->writeSingleArray(&m_brickData[0], m_brickData.size());
+	}
+
+	void configure() {
+		Vector extents(m_dataAABB.getExtents());
+		m_worldToVolume = m_volumeToWorld.inverse();
+		m_worldToGrid = Transform::scale(Vector(
+				(m_res[0] - 1) / extents[0],
+				(m_res[1] - 1) / extents[1],
+				(m_res[2] - 1) / extents[2])
+			) * Transform::translate(-Vector(m_dataAABB.min)) * m_worldToVolume;
+		m_stepSize = std::numeric_limits<Float>::infinity();
+		for (int i=0; i<3; ++i)
+			m_stepSize = 0.5f * std::min(m_stepSize, extents[i] / (Float) (m_res[i]-1));
+		m_aabb.reset();
+		for (int i=0; i<8; ++i)
+			m_aabb.expandBy(m_volumeToWorld(m_dataAABB.getCorner(i)));
+
+		computeBounds();
+	}
+
+	/// Compute the brick grid layout for the current resolution and brick size
+	void initializeBricks() {
+		m_brickShift = log2i((uint32_t) m_brickSize);
+		m_voxelMask = m_brickSize - 1;
+		m_brickVoxels = (size_t) m_brickSize * m_brickSize * m_brickSize;
+		for (int i=0; i<3; ++i)
+			m_brickRes[i] = (m_res[i] + m_brickSize - 1) / m_brickSize;
+		m_brickIndex.clear();
+		m_brickIndex.resize((size_t) m_brickRes.x * m_brickRes.y * m_brickRes.z, -1);
+	}
+
+	void loadFromFile(const fs::path &filename) {
+		ref<Timer> timer = new Timer();
+		fs::path resolved = Thread::getThread()->getFileResolver()->resolve(filename);
+		ref<MemoryMappedFile> mmap = new MemoryMappedFile(resolved);
+		ref<MemoryStream> stream = new MemoryStream(mmap->getData(), mmap->getSize());
+		stream->setByteOrder(Stream::ELittleEndian);
+
+		char header[3];
+		stream->read(header, 3);
+		uint8_t version;
+		stream->read(&version, 1);
+
+		if (header[0] == 'S' && header[1] == 'V' && header[2] == 'L') {
+			if (version != 1)
+				Log(EError, "Encountered an invalid sparse volume data file "
+					"(incorrect file version)");
+			m_brickSize = stream->readInt();
+			if (!isPow2(m_brickSize))
+				Log(EError, "Encountered an invalid sparse volume data file "
+					"(the brick size must be a power of two)");
+			m_res = Vector3i(stream);
+			readAABB(stream);
+			initializeBricks();
+
+			int brickCount = stream->readInt();
+			m_brickData.resize((size_t) brickCount * m_brickVoxels);
+			for (int i=0; i<brickCount; ++i) {
+				int x = stream->readInt(), y = stream->readInt(), z = stream->readInt();
+				if (x < 0 || y < 0 || z < 0 || x >= m_brickRes.x
+						|| y >= m_brickRes.y || z >= m_brickRes.z)
+					Log(EError, "Encountered an invalid sparse volume data file "
+						"(brick coordinates out of range)");
+				m_brickIndex[getBrickIndex(x, y, z)] = i;
+				stream->readSingleArray(&m_brickData[i * m_brickVoxels], m_brickVoxels);
+			}
+		} else if (header[0] == 'V' && header[1] == 'O' && header[2] == 'L') {
+			if (version != 3)
+				Log(EError, "Encountered an invalid volume data file "
+					"(incorrect file version)");
+			int type = stream->readInt();
+			m_res = Vector3i(stream);
+			int channels = stream->readInt();
+			if ((type != EFloat32 && type != EUInt8) || channels != 1)
+				Log(EError, "The sparse grid data source can only convert "
+					"single-channel float32 or uint8 volumes!");
+			readAABB(stream);
+			initializeBricks();
+			convertDense((const uint8_t *) mmap->getData() + 48, (EVolumeType) type);
+		} else {
+			Log(EError, "Encountered an invalid volume data file "
+				"(incorrect header identifier)");
+		}
+
+		size_t denseSize = (size_t) m_res.x * m_res.y * m_res.z * sizeof(float);
+		Log(EInfo, "Loaded \"%s\": %ix%ix%i, " SIZE_T_FMT "/" SIZE_T_FMT " bricks "
+			"of %i^3 voxels occupied, %s (dense: %s, took %i ms)",
+			resolved.filename().c_str(), m_res.x, m_res.y, m_res.z,
+			getBrickCount(), m_brickIndex.size(), m_brickSize,
+			memString(m_brickData.size() * sizeof(float)).c_str(),
+			memString(denseSize).c_str(), timer->getMilliseconds());
+		m_filename = filename;
+	}
+
+	void saveToFile(const fs::path &filename) const {
+		Log(EInfo, "Writing sparse volume to \"%s\"", filename.file_string().c_str());
+		ref<FileStream> stream = new FileStream(filename, FileStream::ETruncReadWrite);
+		stream->setByteOrder(Stream::ELittleEndian);
+		stream->write("SVL", 3);
+		stream->writeUChar(1);
+		stream->writeInt(m_brickSize);
+		m_res.serialize(stream);
+		for (int i=0; i<3; ++i)
+			stream->writeSingle((float) m_dataAABB.min[i]);
+		for (int i=0; i<3; ++i)
+			stream->writeSingle((float) m_dataAABB.max[i]);
+		stream->writeInt((int) getBrickCount());
+		for (int z=0; z<m_brickRes.z; ++z) {
+			for (int y=0; y<m_brickRes.y; ++y) {
+				for (int x=0; x<m_brickRes.x; ++x) {
+					int32_t index = m_brickIndex[getBrickIndex(x, y, z)];
+					if (index < 0)
+						continue;
+					stream->writeInt(x); stream->writeInt(y); stream->writeInt(z);
+					stream->writeSingleArray(&m_brickData[index * m_brickVoxels], m_brickVoxels);
+				}
+			}
+		}
+		stream->close();
+	}
+
+	Float lookupFloat(const Point &_p) const {
+		const Point p = m_worldToGrid.transformAffine(_p);
+		const int x1 = floorToInt(p.x),
+			  y1 = floorToInt(p.y),
+			  z1 = floorToInt(p.z),
+			  x2 = x1+1, y2 = y1+1, z2 = z1+1;
+
+		if (x1 < 0 || y1 < 0 || z1 < 0 || x2 >= m_res.x ||
+		    y2 >= m_res.y || z2 >= m_res.z)
+			return 0;
+
+		const Float fx = p.x - x1, fy = p.y - y1, fz = p.z - z1,
+				_fx = 1.0f - fx, _fy = 1.0f - fy, _fz = 1.0f - fz;
+
+		Float d000, d001, d010, d011, d100, d101, d110, d111;
+		const int bx = x1 & m_voxelMask, by = y1 & m_voxelMask, bz = z1 & m_voxelMask;
+
+		if (bx != m_voxelMask && by != m_voxelMask && bz != m_voxelMask) {
+			/* Fast path: all lookups are in the same brick */
+			int32_t index = m_brickIndex[getBrickIndex(x1 >> m_brickShift,
+				y1 >> m_brickShift, z1 >> m_brickShift)];
+			if (index < 0)
+				return 0;
+
+			const float *data = &m_brickData[index * m_brickVoxels];
+			const int s = m_brickSize, base = (bz*s + by)*s + bx;
+			d000 = data[base];         d001 = data[base + 1];
+			d010 = data[base + s];     d011 = data[base + s + 1];
+			d100 = data[base + s*s];   d101 = data[base + s*s + 1];
+			d110 = data[base + s*s+s]; d111 = data[base + s*s + s + 1];
+		} else {
+			d000 = voxel(x1, y1, z1); d001 = voxel(x2, y1, z1);
+			d010 = voxel(x1, y2, z1); d011 = voxel(x2, y2, z1);
+			d100 = voxel(x1, y1, z2); d101 = voxel(x2, y1, z2);
+			d110 = voxel(x1, y2, z2); d111 = voxel(x2, y2, z2);
+		}
+
+		return ((d000*_fx + d001*fx)*_fy +
+				(d010*_fx + d011*fx)*fy)*_fz +
+			   ((d100*_fx + d101*fx)*_fy +
+				(d110*_fx + d111*fx)*fy)*fz;
+	}
+
+	bool supportsFloatLookups() const { return true; }
+	Float getStepSize() const { return m_stepSize; }
+
+	Float getMaximumFloatValue() const {
+		return m_majorants->getMaximum();
+	}
+
+	const MajorantGrid *getMajorantGrid() const {
+		return m_majorants.get();
+	}
+
+	MTS_DECLARE_CLASS()
+protected:
+	inline size_t getBrickIndex(int x, int y, int z) const {
+		return ((size_t) z * m_brickRes.y + y) * m_brickRes.x + x;
+	}
+
+	inline float voxel(int x, int y, int z) const {
+		int32_t index = m_brickIndex[getBrickIndex(x >> m_brickShift,
+			y >> m_brickShift, z >> m_brickShift)];
+		if (index < 0)
+			return 0.0f;
+		return m_brickData[index * m_brickVoxels +
+			((((z & m_voxelMask) << m_brickShift) + (y & m_voxelMask))
+			 << m_brickShift) + (x & m_voxelMask)];
+	}
+
+	inline size_t getBrickCount() const {
+		return m_brickData.size() / m_brickVoxels;
+	}
+
+	void readAABB(Stream *stream) {
+		Float xmin = stream->readSingle(),
+			  ymin = stream->readSingle(),
+			  zmin = stream->readSingle();
+		Float xmax = stream->readSingle(),
+			  ymax = stream->readSingle(),
+			  zmax = stream->readSingle();
+		m_dataAABB = AABB(Point(xmin, ymin, zmin), Point(xmax, ymax, zmax));
+	}
+
+	/// Convert a dense volume into bricks, skipping ones that are completely empty
+	void convertDense(const uint8_t *data, EVolumeType type) {
+		const float *floatData = (const float *) data;
+		const int brickCount = (int) m_brickIndex.size();
+		std::vector<uint8_t> occupied(brickCount);
+
+		/* Pass 1: determine the occupied bricks */
+		#pragma omp parallel for schedule(dynamic)
+		for (int i=0; i<brickCount; ++i) {
+			const int bx = i % m_brickRes.x, by = (i / m_brickRes.x) % m_brickRes.y,
+				bz = i / (m_brickRes.x * m_brickRes.y);
+			bool nonempty = false;
+			for (int z=bz*m_brickSize; z<std::min((bz+1)*m_brickSize, m_res.z) && !nonempty; ++z) {
+				for (int y=by*m_brickSize; y<std::min((by+1)*m_brickSize, m_res.y) && !nonempty; ++y) {
+					size_t offset = ((size_t) z * m_res.y + y) * m_res.x;
+					for (int x=bx*m_brickSize; x<std::min((bx+1)*m_brickSize, m_res.x); ++x) {
+						if (type == EFloat32 ? floatData[offset+x] != 0 : data[offset+x] != 0) {
+							nonempty = true;
+							break;
+						}
+					}
+				}
+			}
+			occupied[i] = nonempty ? 1 : 0;
+		}
+
+		int32_t storedBricks = 0;
+		for (int i=0; i<brickCount; ++i)
+			m_brickIndex[i] = occupied[i] ? storedBricks++ : -1;
+		m_brickData.clear();
+		m_brickData.resize(storedBricks * m_brickVoxels, 0.0f);
+
+		/* Pass 2: copy the voxels of all occupied bricks */
+		#pragma omp parallel for schedule(dynamic)
+		for (int i=0; i<brickCount; ++i) {
+			if (m_brickIndex[i] < 0)
+				continue;
+			const int bx = i % m_brickRes.x, by = (i / m_brickRes.x) % m_brickRes.y,
+				bz = i / (m_brickRes.x * m_brickRes.y);
+			float *target = &m_brickData[m_brickIndex[i] * m_brickVoxels];
+			for (int z=0; z<m_brickSize && bz*m_brickSize+z < m_res.z; ++z) {
+				for (int y=0; y<m_brickSize && by*m_brickSize+y < m_res.y; ++y) {
+					size_t offset = ((size_t) (bz*m_brickSize+z) * m_res.y
+						+ by*m_brickSize+y) * m_res.x + bx*m_brickSize;
+					float *row = target + (z*m_brickSize + y) * m_brickSize;
+					for (int x=0; x<m_brickSize && bx*m_brickSize+x < m_res.x; ++x)
+						row[x] = type == EFloat32 ? floatData[offset+x]
+							: data[offset+x] * (1.0f / 255.0f);
+				}
+			}
+		}
+	}
+
+	/**
+	 * \brief Compute the value bounds of every brick.
+	 *
+	 * Since lookups interpolate between neighboring voxels, the region
+	 * covered by a brick also depends on the first voxel layer of the
+	 * adjacent bricks, which must be taken into account here.
+	 */
+	void computeBounds() {
+		m_majorants = new MajorantGrid(m_brickRes,
+			Transform::scale(Vector(1.0f / m_brickSize)) * m_worldToGrid);
+		const int brickCount = (int) m_brickIndex.size();
+
+		#pragma omp parallel for schedule(dynamic)
+		for (int i=0; i<brickCount; ++i) {
+			const int bx = i % m_brickRes.x, by = (i / m_brickRes.x) % m_brickRes.y,
+				bz = i / (m_brickRes.x * m_brickRes.y);
+
+			/* Quick check: this brick and all bricks overlapping
+			   its region via interpolation are empty */
+			bool empty = true;
+			for (int k=0; k<8 && empty; ++k) {
+				int nx = bx + (k & 1), ny = by + ((k & 2) >> 1), nz = bz + ((k & 4) >> 2);
+				if (nx < m_brickRes.x && ny < m_brickRes.y && nz < m_brickRes.z)
+					empty = m_brickIndex[getBrickIndex(nx, ny, nz)] < 0;
+			}
+			if (empty)
+				continue;
+
+			float minValue = std::numeric_limits<float>::infinity(), maxValue = 0;
+			const int x0 = bx*m_brickSize, y0 = by*m_brickSize, z0 = bz*m_brickSize;
+			const int x1 = std::min(x0 + m_brickSize, m_res.x - 1),
+			          y1 = std::min(y0 + m_brickSize, m_res.y - 1),
+			          z1 = std::min(z0 + m_brickSize, m_res.z - 1);
+			for (int z=z0; z<=z1; ++z) {
+				for (int y=y0; y<=y1; ++y) {
+					for (int x=x0; x<=x1; ++x) {
+						float value = voxel(x, y, z);
+						minValue = std::min(minValue, value);
+						maxValue = std::max(maxValue, value);
+					}
+				}
+			}
+
+			/* Lookups return zero close to the boundary of the grid */
+			if (x0 + m_brickSize >= m_res.x - 1 || y0 + m_brickSize >= m_res.y - 1
+					|| z0 + m_brickSize >= m_res.z - 1)
+				minValue = std::min(minValue, 0.0f);
+
+			/* Leave some room for round-off errors in the interpolation */
+			m_majorants->setBounds(i, minValue * (1 - 1e-5f), maxValue * (1 + 1e-5f));
+		}
+	}
+
+protected:
+	fs::path m_filename;
+	Vector3i m_res, m_brickRes;
+	int m_brickSize, m_brickShift, m_voxelMask;
+	size_t m_brickVoxels;
+	std::vector<int32_t> m_brickIndex;
+	std::vector<float> m_brickData;
+	ref<MajorantGrid> m_majorants;
+	Transform m_worldToGrid;
+	Transform m_worldToVolume;
+	Transform m_volumeToWorld;
+	Float m_stepSize;
+	AABB m_dataAABB;
+};
+
+MTS_IMPLEMENT_CLASS_S(SparseGridDataSource, false, VolumeDataSource);
+MTS_EXPORT_PLUGIN(SparseGridDataSource, "Sparse grid data source");
+MTS_NAMESPACE_END
@@ -18,9 +18,10 @@
 
 #include <mitsuba/render/volume.h>
 #include <mitsuba/core/properties.h>
-#include <mitsuba/core/lrucache.h>
+#include <mitsuba/core/lock.h>
 #include <mitsuba/core/statistics.h>
-#include <mitsuba/core/sched.h>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
 #include <fstream>
 
 MTS_NAMESPACE_BEGIN
@@ -30,30 +31,228 @@ static StatsCounter statsCreate("Volume cache", "Block creations");
 static StatsCounter statsDestruct("Volume cache", "Block destructions");
 static StatsCounter statsEmpty("Volume cache", "Empty blocks", EPercentage);
 
-/* Lexicographic ordering for Vector3i */
-struct Vector3iKeyOrder : public std::binary_function<Vector3i, Vector3i, bool> {
-	inline bool operator()(const Vector3i &v1, const Vector3i &v2) const {
-		if (v1.x < v2.x) return true;
-		else if (v1.x > v2.x) return false;
-		if (v1.y < v2.y) return true;
-		else if (v1.y > v2.y) return false;
-		if (v1.z < v2.z) return true;
-		else if (v1.z > v2.z) return false;
-		return false;
+/// Maximum number of independently locked parts of the brick cache
+#define MTS_VOLCACHE_MAX_SHARDS 64
+
+/// Minimum number of bricks that are stored in every shard
+#define MTS_VOLCACHE_MIN_SHARD_SIZE 8
+
+/**
+ * \brief Concurrent brick cache that is shared by all rendering threads
+ *
+ * The cache is split into a power-of-two number of shards, each of which
+ * has its own lock, a fixed number of brick slots and a chained hash index.
+ * The shard of a brick is determined by its hash, hence threads only 
+ * contend when they access the same part of the cache. Full shards evict
+ * bricks using the CLOCK algorithm, which approximates LRU using a single
+ * reference bit per brick.
+ *
+ * Brick evaluation happens outside of the locks. When two threads miss
+ * on the same brick at the same time, the brick computed last is 
+ * discarded.
+ */
+class BrickCache {
+public:
+	typedef boost::function<float * (uint64_t)> create_functor_type;
+	typedef boost::function<void (float *)> destroy_functor_type;
+
+	BrickCache(size_t capacity, const create_functor_type &createFunctor,
+			const destroy_functor_type &destroyFunctor) 
+		: m_createFunctor(createFunctor), m_destroyFunctor(destroyFunctor) {
+		capacity = std::max(capacity, (size_t) MTS_VOLCACHE_MIN_SHARD_SIZE);
+		int shardCount = 1;
+		while (shardCount < MTS_VOLCACHE_MAX_SHARDS && 
+			(size_t) shardCount * 2 * MTS_VOLCACHE_MIN_SHARD_SIZE <= capacity)
+			shardCount *= 2;
+		m_shardMask = shardCount - 1;
+		m_shardSize = capacity / shardCount;
+		m_bucketCount = roundToPow2((uint32_t) m_shardSize);
+
+		m_shards = new Shard[shardCount];
+		for (int i=0; i<shardCount; ++i) {
+			Shard &shard = m_shards[i];
+			shard.mutex = new Mutex();
+			shard.bricks.resize(m_shardSize);
+			shard.buckets.resize(m_bucketCount, -1);
+			shard.size = shard.hand = 0;
+		}
+	}
+
+	~BrickCache() {
+		for (int i=0; i<=m_shardMask; ++i) {
+			Shard &shard = m_shards[i];
+			for (size_t j=0; j<shard.size; ++j) {
+				if (shard.bricks[j].data)
+					m_destroyFunctor(shard.bricks[j].data);
+			}
+		}
+		delete[] m_shards;
+	}
+
+	/**
+	 * \brief Copy a set of values from a cached brick
+	 *
+	 * The brick is created if it is not yet part of the cache.
+	 *
+	 * \param key
+	 *    Brick identifier
+	 * \param indices
+	 *    Offsets of the \c count values within the brick
+	 * \param values
+	 *    Target array for the requested values
+	 * \param hit
+	 *    Set to \c true if the brick was already in the cache
+	 * \return 
+	 *    \c false if the brick was empty, in which case
+	 *    \c values is left unchanged
+	 */
+	bool get(uint64_t key, const int *indices, int count, 
+			float *values, bool &hit) {
+		const uint64_t h = hash(key);
+		Shard &shard = m_shards[h & m_shardMask];
+		const uint32_t bucket = (uint32_t) (h >> 32) & (m_bucketCount - 1);
+
+		shard.mutex->lock();
+		int32_t index = find(shard, bucket, key);
+		hit = index >= 0;
+		if (EXPECT_NOT_TAKEN(!hit)) {
+			shard.mutex->unlock();
+			float *data = m_createFunctor(key);
+			shard.mutex->lock();
+
+			index = find(shard, bucket, key);
+			if (index >= 0) {
+				/* Another thread was faster */
+				if (data)
+					m_destroyFunctor(data);
+			} else {
+				index = insert(shard, bucket, key, data);
+			}
+		}
+
+		Brick &brick = shard.bricks[index];
+		brick.referenced = true;
+		const float *data = brick.data;
+		if (data) {
+			for (int i=0; i<count; ++i)
+				values[i] = data[indices[i]];
+		}
+		shard.mutex->unlock();
+		return data != NULL;
+	}
+
+	/// Return the total number of brick slots
+	inline size_t getCapacity() const { return m_shardSize * (m_shardMask+1); }
+
+	/// Return the number of shards
+	inline int getShardCount() const { return m_shardMask + 1; }
+
+	/// Check whether all shards are full (not thread-safe)
+	bool isFull() const {
+		for (int i=0; i<=m_shardMask; ++i) {
+			if (m_shards[i].size < m_shardSize)
+				return false;
+		}
+		return true;
+	}
+
+	/// Return the keys of all cached bricks (not thread-safe)
+	template <typename OutputIterator> void getKeys(OutputIterator it) const {
+		for (int i=0; i<=m_shardMask; ++i) {
+			const Shard &shard = m_shards[i];
+			for (size_t j=0; j<shard.size; ++j)
+				*it++ = shard.bricks[j].key;
+		}
 	}
+protected:
+	struct Brick {
+		uint64_t key;
+		float *data;
+		/// Next brick in the same hash bucket (or -1)
+		int32_t next;
+		/// CLOCK reference bit
+		bool referenced;
+	};
+
+	struct Shard {
+		ref<Mutex> mutex;
+		std::vector<Brick> bricks;
+		std::vector<int32_t> buckets;
+		size_t size, hand;
+	};
+
+	inline static uint64_t hash(uint64_t key) {
+		key ^= key >> 33;
+		key *= 0xff51afd7ed558ccdULL;
+		key ^= key >> 33;
+		key *= 0xc4ceb9fe1a85ec53ULL;
+		key ^= key >> 33;
+		return key;
+	}
+
+	inline int32_t find(const Shard &shard, uint32_t bucket, uint64_t key) const {
+		int32_t index = shard.buckets[bucket];
+		while (index >= 0 && shard.bricks[index].key != key)
+			index = shard.bricks[index].next;
+		return index;
+	}
+
+	int32_t insert(Shard &shard, uint32_t bucket, uint64_t key, float *data) {
+		int32_t index;
+		if (shard.size < m_shardSize) {
+			index = (int32_t) shard.size++;
+		} else {
+			/* Advance the clock hand until a brick without
+			   a reference bit is found */
+			while (true) {
+				Brick &brick = shard.bricks[shard.hand];
+				if (!brick.referenced)
+					break;
+				brick.referenced = false;
+				shard.hand = (shard.hand + 1) % m_shardSize;
+			}
+			index = (int32_t) shard.hand;
+			shard.hand = (shard.hand + 1) % m_shardSize;
+
+			/* Unlink the victim from its hash bucket */
+			Brick &victim = shard.bricks[index];
+			int32_t *link = &shard.buckets[(uint32_t) (hash(victim.key) >> 32) 
+				& (m_bucketCount - 1)];
+			while (*link != index)
+				link = &shard.bricks[*link].next;
+			*link = victim.next;
+			if (victim.data)
+				m_destroyFunctor(victim.data);
+		}
+
+		Brick &brick = shard.bricks[index];
+		brick.key = key;
+		brick.data = data;
+		brick.next = shard.buckets[bucket];
+		brick.referenced = false;
+		shard.buckets[bucket] = index;
+		return index;
+	}
+private:
+	Shard *m_shards;
+	int m_shardMask;
+	size_t m_shardSize;
+	uint32_t m_bucketCount;
+	create_functor_type m_createFunctor;
+	destroy_functor_type m_destroyFunctor;
 };
 
 /**
  * This class sits in between the renderer and another data source, for which 
- * it caches all data lookups using a LRU scheme. This is useful if the nested 
- * volume data source is expensive to evaluate.
+ * it caches all data lookups in bricks of voxels. This is useful if the nested 
+ * volume data source is expensive to evaluate. The brick cache is shared by
+ * all rendering threads and evicts bricks using the CLOCK algorithm once 
+ * the memory limit has been reached.
  */
 class CachingDataSource : public VolumeDataSource {
 public:
-	typedef LRUCache<Vector3i, Vector3iKeyOrder, float *> BlockCache;
-
 	CachingDataSource(const Properties &props) 
-		: VolumeDataSource(props) {
+		: VolumeDataSource(props), m_cache(NULL) {
 		/// Size of an individual block (must be a power of 2)
 		m_blockSize = props.getInteger("blockSize", 4);
 
@@ -73,12 +272,14 @@ public:
 	}
 
 	CachingDataSource(Stream *stream, InstanceManager *manager) 
-	: VolumeDataSource(stream, manager) {
+	: VolumeDataSource(stream, manager), m_cache(NULL) {
 		m_nested = static_cast<VolumeDataSource *>(manager->getInstance(stream));
 		configure();
 	}
 
 	virtual ~CachingDataSource() {
+		if (m_cache)
+			delete m_cache;
 	}
 
 	void serialize(Stream *stream, InstanceManager *manager) const {
@@ -96,9 +297,6 @@ public:
 		if (m_voxelWidth == -1)
 			m_voxelWidth = m_nested->getStepSize();
 
-		size_t memoryLimitPerCore = m_memoryLimit 
-			/ std::max((size_t) 1, Scheduler::getInstance()->getLocalWorkerCount());
-
 		Vector totalCells  = m_aabb.getExtents() / m_voxelWidth;
 		for (int i=0; i<3; ++i)
 			m_cellCount[i] = (int) std::ceil(totalCells[i]);
@@ -114,7 +312,12 @@ public:
 
 		m_blockRes = m_blockSize+1;
 		int blockMemoryUsage = (int) std::pow((Float) m_blockRes, 3) * m_channels * sizeof(float);
-		m_blocksPerCore = memoryLimitPerCore / blockMemoryUsage;
+		m_blockCount = m_memoryLimit / blockMemoryUsage;
+		if (m_cache)
+			delete m_cache;
+		m_cache = new BrickCache(m_blockCount,
+			boost::bind(&CachingDataSource::renderBlock, this, _1),
+			boost::bind(&CachingDataSource::destroyBlock, this, _1));
 
 		m_worldToVolume = m_volumeToWorld.inverse();
 		m_worldToGrid = Transform::scale(Vector(1/m_voxelWidth))
@@ -128,8 +331,8 @@ public:
 		Log(EInfo, "   Voxel width               = %f", m_voxelWidth);
 		Log(EInfo, "   Memory usage of one block = %s", memString(blockMemoryUsage).c_str());
 		Log(EInfo, "   Memory limit              = %s", memString(m_memoryLimit).c_str());
-		Log(EInfo, "   Memory limit per core     = %s", memString(memoryLimitPerCore).c_str());
-		Log(EInfo, "   Max. blocks per core      = %i", m_blocksPerCore);
+		Log(EInfo, "   Max. blocks               = " SIZE_T_FMT, m_cache->getCapacity());
+		Log(EInfo, "   Cache shards              = %i", m_cache->getShardCount());
 		Log(EInfo, "   Effective resolution      = %s", totalCells.toString().c_str());
 		Log(EInfo, "   Effective storage         = %s", memString((size_t)
 			(totalCells[0]*totalCells[1]*totalCells[2]*sizeof(float)*m_channels)).c_str());
@@ -145,25 +348,17 @@ public:
 			z < 0 || z >= m_cellCount.z)) 
 			return 0.0f;
 
-		BlockCache *cache = m_cache.get();
-		if (EXPECT_NOT_TAKEN(cache == NULL)) {
-			cache = new BlockCache(m_blocksPerCore,
-				boost::bind(&CachingDataSource::renderBlock, this, _1),
-				boost::bind(&CachingDataSource::destroyBlock, this, _1));
-			m_cache.set(cache);
-		}
-
 #if defined(VOLCACHE_DEBUG)
-		if (cache->isFull()) {
+		if (m_cache->isFull()) {
 			/* For debugging: when the cache is full, dump locations 
 			   of all cache records into an OBJ file and exit */
-			std::vector<Vector3i> keys;
-			cache->get_keys(std::back_inserter(keys));
+			std::vector<uint64_t> keys;
+			m_cache->getKeys(std::back_inserter(keys));
 	
 			std::ofstream os("keys.obj");
 			os << "o Keys" << endl;
 			for (size_t i=0; i<keys.size(); i++) {
-				Vector3i key = keys[i];
+				Vector3i key = unpackKey(keys[i]);
 				key = key * m_blockSize + Vector3i(m_blockSize/2);
 
 				Point p(key.x * m_voxelWidth + m_aabb.min.x,
@@ -181,39 +376,43 @@ public:
 		}
 #endif
 
+		const int x1 = x & m_voxelMask, y1 = y & m_voxelMask, z1 = z & m_voxelMask,
+				x2 = x1 + 1, y2 = y1 + 1, z2 = z1 + 1;
+
+		const int indices[8] = {
+			(z1*m_blockRes + y1)*m_blockRes + x1,
+			(z1*m_blockRes + y1)*m_blockRes + x2,
+			(z1*m_blockRes + y2)*m_blockRes + x1,
+			(z1*m_blockRes + y2)*m_blockRes + x2,
+			(z2*m_blockRes + y1)*m_blockRes + x1,
+			(z2*m_blockRes + y1)*m_blockRes + x2,
+			(z2*m_blockRes + y2)*m_blockRes + x1,
+			(z2*m_blockRes + y2)*m_blockRes + x2
+		};
+
+		/* The brick may be evicted by another thread as soon as the
+		   cache lock is released, hence the voxel values are copied */
 		bool hit = false;
-		float *blockData = cache->get(Vector3i(
+		float d[8];
+		bool nonempty = m_cache->get(packKey(
 			(x & m_blockMask) >> m_blockShift,
 			(y & m_blockMask) >> m_blockShift,
-			(z & m_blockMask) >> m_blockShift), hit);
+			(z & m_blockMask) >> m_blockShift), indices, 8, d, hit);
 
 		statsHitRate.incrementBase();
 		if (hit) 
 			++statsHitRate;
 		
-		if (blockData == NULL)
+		if (!nonempty)
 			return 0.0f;
 
-		const int x1 = x & m_voxelMask, y1 = y & m_voxelMask, z1 = z & m_voxelMask,
-				x2 = x1 + 1, y2 = y1 + 1, z2 = z1 + 1;
-
 		const Float fx = p.x - x, fy = p.y - y, fz = p.z - z,
 				_fx = 1.0f - fx, _fy = 1.0f - fy, _fz = 1.0f - fz;
 
-		const float
-			&d000 = blockData[(z1*m_blockRes + y1)*m_blockRes + x1],
-			&d001 = blockData[(z1*m_blockRes + y1)*m_blockRes + x2],
-			&d010 = blockData[(z1*m_blockRes + y2)*m_blockRes + x1],
-			&d011 = blockData[(z1*m_blockRes + y2)*m_blockRes + x2],
-			&d100 = blockData[(z2*m_blockRes + y1)*m_blockRes + x1],
-			&d101 = blockData[(z2*m_blockRes + y1)*m_blockRes + x2],
-			&d110 = blockData[(z2*m_blockRes + y2)*m_blockRes + x1],
-			&d111 = blockData[(z2*m_blockRes + y2)*m_blockRes + x2];
-
-		float result = ((d000*_fx + d001*fx)*_fy +
-				(d010*_fx + d011*fx)*fy)*_fz +
-				((d100*_fx + d101*fx)*_fy +
-				(d110*_fx + d111*fx)*fy)*fz;
+		float result = ((d[0]*_fx + d[1]*fx)*_fy +
+				(d[2]*_fx + d[3]*fx)*fy)*_fz +
+				((d[4]*_fx + d[5]*fx)*_fy +
+				(d[6]*_fx + d[7]*fx)*fy)*fz;
 
 		return result;
 	}
@@ -251,7 +450,20 @@ public:
 		}
 	}
 			
-	float *renderBlock(const Vector3i &blockIdx) const {
+	/// Pack brick coordinates into a 64-bit cache key
+	inline static uint64_t packKey(int x, int y, int z) {
+		return (uint64_t) x | ((uint64_t) y << 21) | ((uint64_t) z << 42);
+	}
+
+	/// Inverse of \ref packKey()
+	inline static Vector3i unpackKey(uint64_t key) {
+		const uint64_t mask = (1ULL << 21) - 1;
+		return Vector3i((int) (key & mask), 
+			(int) ((key >> 21) & mask), (int) (key >> 42));
+	}
+			
+	float *renderBlock(uint64_t key) const {
+		const Vector3i blockIdx = unpackKey(key);
 		float *result = new float[m_blockRes*m_blockRes*m_blockRes];
 		Point offset = m_aabb.min + Vector(
 			blockIdx.x * m_blockSize * m_voxelWidth,
@@ -301,12 +513,12 @@ protected:
 	Float m_voxelWidth;
 	Float m_stepSizeMultiplier;
 	size_t m_memoryLimit;
-	size_t m_blocksPerCore;
+	size_t m_blockCount;
 	int m_channels;
 	int m_blockSize, m_blockRes;
 	int m_blockMask, m_voxelMask, m_blockShift;
 	Vector3i m_cellCount;
-	mutable ThreadLocal<BlockCache> m_cache;
+	mutable BrickCache *m_cache;
 };
 
 MTS_IMPLEMENT_CLASS_S(CachingDataSource, false, VolumeDataSource);